@@ -0,0 +1,132 @@
+/**
+ * @file bench-cpu.c
+ * @brief Micro-benchmark of the CPU interpreters: runs the same number of
+ *        instructions of a ROM with cpu_dispatch (without and with the
+ *        decode cache) and with the threaded interpreter
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include "gameboy.h"
+#include "bootrom.h"
+#include "cpu-decode.h"
+#include "cpu-threaded.h"
+#include "cpu-alu.h"
+#include "util.h"  // for zero_init_var()
+#include "error.h"
+#include "tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+
+#define DEFAULT_NB_INSTR 50000000ULL
+
+typedef int (*step_t)(cpu_t*);
+
+typedef struct {
+    const char* name;
+    step_t step;
+    int cached;
+} backend_t;
+
+static const backend_t backends[] = {
+    { "switch",        cpu_step_switch,   0 },
+    { "switch+cache",  cpu_step_switch,   1 },
+    { "threaded",      cpu_step_threaded, 0 }
+};
+
+#define NB_BACKENDS (sizeof(backends) / sizeof(backends[0]))
+
+// Printed with the errors, see tool_error
+#define USAGE "input_file [instructions]"
+static const char* const examples[] = { "rom.gb 10000000", "game.gb", NULL };
+
+// ======================================================================
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Runs nb_instr instructions of the cartridge (from 0x100, boot ROM
+ *        skipped). Only the CPU is simulated: the other components do not
+ *        cycle, interrupts are not served, HALT and idle time are ignored.
+ *
+ * @param gb a freshly created gameboy
+ * @param b backend to use
+ * @param nb_instr number of instructions to run
+ * @param seconds set to the time spent in the interpreter
+ * @return error code
+ */
+static int run(gameboy_t* gb, const backend_t* b, uint64_t nb_instr, double* seconds)
+{
+    *bus_lookup(NULL, &gb->pages, REG_BOOT_ROM_DISABLE) = 1;
+    M_EXIT_IF_ERR(bootrom_bus_listener(gb, REG_BOOT_ROM_DISABLE));
+    if (!b->cached) {
+        decode_cache_free(&gb->cpu.decode_cache);
+    }
+
+    cpu_t* cpu = &gb->cpu;
+    cpu->PC = 0x100;
+    cpu->SP = 0xFFFE;
+
+    const double start = now();
+    for (uint64_t i = 0; i < nb_instr; ++i) {
+        cpu->HALT = 0;
+        cpu->idle_time = 0;
+        M_EXIT_IF_ERR(b->step(cpu));
+    }
+    *seconds = now() - start;
+    cpu_flags_sync(cpu);
+
+    return ERR_NONE;
+}
+
+// ======================================================================
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        tool_error(argv[0], "please provide input_file", USAGE, examples);
+        return 1;
+    }
+
+    const char* const filename = argv[1];
+    const uint64_t nb_instr = argc > 2 ? (uint64_t) atoll(argv[2]) : DEFAULT_NB_INSTR;
+
+    uint16_t ref_pc = 0;
+    uint16_t ref_af = 0;
+
+    for (size_t i = 0; i < NB_BACKENDS; ++i) {
+        gameboy_t gb;
+        zero_init_var(gb);
+        int err = gameboy_create(&gb, filename);
+        double seconds = 0.0;
+        if (err == ERR_NONE) {
+            err = run(&gb, &backends[i], nb_instr, &seconds);
+        }
+        if (err != ERR_NONE) {
+            fprintf(stderr, "%s: %s\n", backends[i].name, ERR_MESSAGES[err - ERR_NONE]);
+            gameboy_free(&gb);
+            return err;
+        }
+
+        // all the backends must end up in the same state
+        if (i == 0) {
+            ref_pc = gb.cpu.PC;
+            ref_af = gb.cpu.AF;
+        }
+        printf("%-14s %" PRIu64 " instructions in %.3f s: %.2f MIPS%s\n",
+               backends[i].name, nb_instr, seconds,
+               seconds > 0.0 ? (double)nb_instr / seconds * 1e-6 : 0.0,
+               gb.cpu.PC == ref_pc && gb.cpu.AF == ref_af ? "" : " (state differs!)");
+
+        gameboy_free(&gb);
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file bench-gameboy.c
+ * @brief Benchmark of the whole emulation: runs a ROM with gameboy_run_until
+ *        for a number of cycles and reports the emulated cycles per host
+ *        second, with the block translator and with cpu_cycle only
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include "gameboy.h"
+#include "cpu-block.h"
+#include "util.h"  // for zero_init_var()
+#include "error.h"
+#include "tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <inttypes.h>
+
+// 16 seconds of emulated time
+#define DEFAULT_NB_CYCLES (16 * GB_CYCLES_PER_S)
+
+// Printed with the errors, see tool_error
+#define USAGE "input_file [cycles]"
+static const char* const examples[] = { "\"tests/data/blargg_roms/09-op r,r.gb\" 15000000", "game.gb", NULL };
+
+// ======================================================================
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+// The serial output of the ROM is not part of the benchmark
+static int serial_ignore(void* arg, data_t byte)
+{
+    (void)arg;
+    (void)byte;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Runs a freshly created gameboy for nb_cycles cycles
+ *
+ * @param gb gameboy to run
+ * @param with_blocks whether whole blocks of instructions are run (see cpu-block.h)
+ * @param nb_cycles number of cycles to run
+ * @param seconds set to the time spent in gameboy_run_until
+ * @return error code
+ */
+static int run(gameboy_t* gb, bool with_blocks, uint64_t nb_cycles, double* seconds)
+{
+    M_EXIT_IF_ERR(gameboy_set_serial(gb, serial_ignore, NULL));
+    if (!with_blocks) {
+        block_cache_free(&gb->blocks);
+    }
+
+    const double start = now();
+    M_EXIT_IF_ERR(gameboy_run_until(gb, nb_cycles));
+    *seconds = now() - start;
+
+    return ERR_NONE;
+}
+
+// ======================================================================
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        tool_error(argv[0], "please provide input_file", USAGE, examples);
+        return 1;
+    }
+
+    const char* const filename = argv[1];
+    const uint64_t nb_cycles = argc > 2 ? (uint64_t) atoll(argv[2]) : DEFAULT_NB_CYCLES;
+
+    for (int with_blocks = 1; with_blocks >= 0; --with_blocks) {
+        const char* const name = with_blocks ? "blocks" : "cpu_cycle";
+        gameboy_t gb;
+        zero_init_var(gb);
+        int err = gameboy_create(&gb, filename);
+        double seconds = 0.0;
+        if (err == ERR_NONE) {
+            err = run(&gb, with_blocks, nb_cycles, &seconds);
+        }
+        if (err != ERR_NONE) {
+            fprintf(stderr, "%s: %s\n", name, ERR_MESSAGES[err - ERR_NONE]);
+            gameboy_free(&gb);
+            return err;
+        }
+
+        const double rate = seconds > 0.0 ? (double)nb_cycles / seconds : 0.0;
+        printf("%-10s %" PRIu64 " cycles in %.3f s: %.2f M cycles/s (%.1f times real time)\n",
+               name, nb_cycles, seconds, rate * 1e-6, rate / (double)GB_CYCLES_PER_S);
+
+        gameboy_free(&gb);
+    }
+
+    return 0;
+}
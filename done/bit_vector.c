@@ -13,6 +13,9 @@
 #include <stdlib.h> // for allocs
 #include <string.h> // for memset
 #include <stdio.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "bit_vector.h"
 
@@ -211,6 +214,18 @@ bit_vector_t *bit_vector_cpy(const bit_vector_t *pbv)
     return copy;
 }
 
+// ==== see bit_vector.h ========================================
+bit_vector_t *bit_vector_cpy_to(bit_vector_t *copy, const bit_vector_t *pbv)
+{
+    if (copy == NULL || pbv == NULL || copy->size != pbv->size)
+    {
+        return NULL;
+    }
+
+    memmove(copy->content, pbv->content, (pbv->size + FOUR_BYTES_SIZE - 1) / FOUR_BYTES_SIZE * sizeof(uint32_t));
+    return copy;
+}
+
 // ==== see bit_vector.h ========================================
 bit_t bit_vector_get(const bit_vector_t *pbv, size_t index)
 {
@@ -340,6 +355,112 @@ bit_vector_t *bit_vector_xor(bit_vector_t *pbv1, const bit_vector_t *pbv2)
     return pbv1;
 }
 
+/**
+ * @brief Gets a word of a bit vector, with its bits past the size of the
+ *  vector cleared
+ *
+ * @param pbv The pointer to the bit vector
+ * @param w The index of the word, 0 if it is not in the vector
+ * @return uint32_t The word
+ */
+static inline uint32_t bit_vector_word(const bit_vector_t *pbv, int64_t w)
+{
+    const size_t num_words = (pbv->size + FOUR_BYTES_SIZE - 1) / FOUR_BYTES_SIZE;
+    if (w < 0 || (size_t)w >= num_words)
+    {
+        return 0;
+    }
+
+    const size_t rest = pbv->size % FOUR_BYTES_SIZE;
+    if ((size_t)w == num_words - 1 && rest != 0)
+    {
+        return pbv->content[w] & (UINT32_MAX >> (FOUR_BYTES_SIZE - rest));
+    }
+    return pbv->content[w];
+}
+
+/**
+ * @brief Funnel shift: the 32 bits starting at bit s of the 64-bit word hi:lo
+ *
+ * @param lo The least significant word
+ * @param hi The most significant word
+ * @param s The index of the first bit, from 0 to 31
+ * @return uint32_t The extracted word
+ */
+static inline uint32_t funnel_shift(uint32_t lo, uint32_t hi, unsigned s)
+{
+    return (uint32_t)((((uint64_t)hi << FOUR_BYTES_SIZE) | lo) >> s);
+}
+
+/**
+ * @brief Funnel shifts n consecutive words of an array: out[k] gets the 32
+ *  bits starting at bit s of src[k + 1]:src[k] (so src must have n + 1 words)
+ *
+ * @param out The array to write the n words to
+ * @param src The array to read the n + 1 words from
+ * @param n The number of words to write
+ * @param s The index of the first bit, from 0 to 31
+ */
+static void funnel_shift_words(uint32_t *out, const uint32_t *src, size_t n, unsigned s)
+{
+    size_t k = 0;
+#if defined(__AVX2__)
+    const __m128i right = _mm_cvtsi32_si128((int)s);
+    const __m128i left = _mm_cvtsi32_si128((int)(FOUR_BYTES_SIZE - s)); // 32 clears everything
+    for (; k + 8 <= n; k += 8)
+    {
+        const __m256i lo = _mm256_loadu_si256((const __m256i *)(src + k));
+        const __m256i hi = _mm256_loadu_si256((const __m256i *)(src + k + 1));
+        _mm256_storeu_si256((__m256i *)(out + k),
+                            _mm256_or_si256(_mm256_srl_epi32(lo, right), _mm256_sll_epi32(hi, left)));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i right4 = _mm_cvtsi32_si128((int)s);
+    const __m128i left4 = _mm_cvtsi32_si128((int)(FOUR_BYTES_SIZE - s));
+    for (; k + 4 <= n; k += 4)
+    {
+        const __m128i lo = _mm_loadu_si128((const __m128i *)(src + k));
+        const __m128i hi = _mm_loadu_si128((const __m128i *)(src + k + 1));
+        _mm_storeu_si128((__m128i *)(out + k),
+                         _mm_or_si128(_mm_srl_epi32(lo, right4), _mm_sll_epi32(hi, left4)));
+    }
+#endif
+    for (; k < n; ++k)
+    {
+        out[k] = funnel_shift(src[k], src[k + 1], s);
+    }
+}
+
+/**
+ * @brief Clears the bits of the last word of a bit vector past its size
+ *
+ * @param pbv The pointer to the bit vector
+ */
+static inline void bit_vector_clear_padding(bit_vector_t *pbv)
+{
+    const size_t rest = pbv->size % FOUR_BYTES_SIZE;
+    if (rest != 0)
+    {
+        pbv->content[pbv->size / FOUR_BYTES_SIZE] &= UINT32_MAX >> (FOUR_BYTES_SIZE - rest);
+    }
+}
+
+/**
+ * @brief Splits a bit index into the index of its word (rounded down, even
+ *  for negative indexes) and its index in that word
+ *
+ * @param index The bit index
+ * @param shift Set to the index of the bit in its word, from 0 to 31
+ * @return int64_t The index of the word
+ */
+static inline int64_t split_index(int64_t index, unsigned *shift)
+{
+    const int64_t w = (index >= 0 ? index : index - (FOUR_BYTES_SIZE - 1)) / FOUR_BYTES_SIZE;
+    *shift = (unsigned)(index - w * FOUR_BYTES_SIZE);
+    return w;
+}
+
 // ==== see bit_vector.h ========================================
 bit_vector_t *bit_vector_extract_zero_ext(const bit_vector_t *pbv, int64_t index, size_t size)
 {
@@ -348,29 +469,81 @@ bit_vector_t *bit_vector_extract_zero_ext(const bit_vector_t *pbv, int64_t index
         return NULL;
     }
 
-    if (pbv == NULL)
-    {
-        return bit_vector_create(size, 0);
-    }
     // Initialize the resulting vector as an empty one
     bit_vector_t *result = bit_vector_create(size, 0);
+    if (pbv == NULL || result == NULL)
+    {
+        return result;
+    }
+    return bit_vector_extract_zero_ext_to(result, pbv, index);
+}
 
-    // Go through pbv bit by bit and set the equivalent bit in result as such:
-    // 1- We compute the new bit index (i + index)
-    // 2- If index is within the range of pbv, take the bit to set from pbv,
-    // 3- Else the bit is 0
-    for (size_t i = 0; i < size; ++i)
+// ==== see bit_vector.h ========================================
+bit_vector_t *bit_vector_extract_zero_ext_to(bit_vector_t *result, const bit_vector_t *pbv, int64_t index)
+{
+    if (result == NULL || pbv == NULL || result == pbv)
     {
-        bit_t value = 0;
-        if (i + index < pbv->size)
+        return NULL;
+    }
+    const size_t size = result->size;
+
+    // Word j of the result is made of words w + j and w + j + 1 of pbv (zero outside of it).
+    // Where both are full words of pbv, the funnel shifts are done on whole runs of words.
+    unsigned s = 0;
+    const int64_t w = split_index(index, &s);
+    const int64_t out_words = (int64_t)((size + FOUR_BYTES_SIZE - 1) / FOUR_BYTES_SIZE);
+    const int64_t full_words = (int64_t)(pbv->size / FOUR_BYTES_SIZE);
+
+    int64_t run_start = w < 0 ? -w : 0;
+    int64_t run_end = full_words - 1 - w;
+    run_start = run_start < out_words ? run_start : out_words;
+    run_end = run_end < out_words ? run_end : out_words;
+
+    for (int64_t j = 0; j < out_words; ++j)
+    {
+        if (j == run_start && run_start < run_end)
         {
-            value = bit_vector_get(pbv, i + index);
+            funnel_shift_words(result->content + j, pbv->content + w + j, (size_t)(run_end - run_start), s);
+            j = run_end - 1;
+            continue;
         }
-        result = bit_vector_set(result, i, value);
+        result->content[j] = funnel_shift(bit_vector_word(pbv, w + j), bit_vector_word(pbv, w + j + 1), s);
     }
+
+    bit_vector_clear_padding(result);
     return result;
 }
 
+/**
+ * @brief Reads the 32 bits of a bit vector starting at a given bit, wrapping
+ *  around at the end of the vector (for sizes which are not multiples of 32)
+ *
+ * @param pbv The pointer to the bit vector
+ * @param pos The index of the first bit, less than the size of the vector
+ * @return uint32_t The word read
+ */
+static uint32_t bit_vector_read_wrap(const bit_vector_t *pbv, size_t pos)
+{
+    uint32_t word = 0;
+    size_t done = 0;
+    while (done < FOUR_BYTES_SIZE)
+    {
+        // Up to the end of the vector or of the word, whichever comes first
+        const size_t left = pbv->size - pos;
+        const size_t n = left < FOUR_BYTES_SIZE - done ? left : FOUR_BYTES_SIZE - done;
+
+        unsigned s = 0;
+        const int64_t w = split_index((int64_t)pos, &s);
+        const uint32_t bits = funnel_shift(bit_vector_word(pbv, w), bit_vector_word(pbv, w + 1), s)
+                              & (UINT32_MAX >> (FOUR_BYTES_SIZE - n));
+        word |= bits << done;
+
+        done += n;
+        pos = (pos + n) % pbv->size;
+    }
+    return word;
+}
+
 // ==== see bit_vector.h ========================================
 bit_vector_t *bit_vector_extract_wrap_ext(const bit_vector_t *pbv, int64_t index, size_t size)
 {
@@ -381,24 +554,62 @@ bit_vector_t *bit_vector_extract_wrap_ext(const bit_vector_t *pbv, int64_t index
 
     // Initialize the resulting vector as an empty one
     bit_vector_t *result = bit_vector_create(size, 0);
+    if (result == NULL)
+    {
+        return NULL;
+    }
+    return bit_vector_extract_wrap_ext_to(result, pbv, index);
+}
 
-    // Go through pbv bit by bit and set the equivalent bit in result as such:
-    // 1- We compute the new bit index (i + index)
-    // 2- If index is within the range of pbv, take the bit to set from pbv,
-    // 3- Else compute a new index (old index % size of pbv) and take the bit from pbv
-    for (size_t i = 0; i < size; ++i)
+// ==== see bit_vector.h ========================================
+bit_vector_t *bit_vector_extract_wrap_ext_to(bit_vector_t *result, const bit_vector_t *pbv, int64_t index)
+{
+    if (result == NULL || pbv == NULL || result == pbv)
     {
-        bit_t value = 0;
-        if (i + index < pbv->size)
+        return NULL;
+    }
+    const size_t size = result->size;
+
+    // Index of the first bit, within pbv
+    const int64_t period = (int64_t)pbv->size;
+    const size_t first = (size_t)(((index % period) + period) % period);
+    const size_t out_words = (size + FOUR_BYTES_SIZE - 1) / FOUR_BYTES_SIZE;
+
+    if (pbv->size % FOUR_BYTES_SIZE != 0)
+    {
+        for (size_t j = 0; j < out_words; ++j)
         {
-            value = bit_vector_get(pbv, i + index);
+            result->content[j] = bit_vector_read_wrap(pbv, (first + j * FOUR_BYTES_SIZE) % pbv->size);
         }
-        else
+    }
+    else
+    {
+        // pbv repeats itself word by word: word j of the result is made of words
+        // w + j and w + j + 1 of pbv (modulo its number of words), so the funnel
+        // shifts are done on whole runs of words until the last word of pbv
+        const size_t num_words = pbv->size / FOUR_BYTES_SIZE;
+        unsigned s = 0;
+        size_t w = (size_t)split_index((int64_t)first, &s);
+
+        size_t j = 0;
+        while (j < out_words)
         {
-            value = bit_vector_get(pbv, (i + index) % pbv->size);
+            size_t run = num_words - 1 - w;
+            run = run < out_words - j ? run : out_words - j;
+            funnel_shift_words(result->content + j, pbv->content + w, run, s);
+            j += run;
+            w += run;
+
+            if (j < out_words)
+            {
+                result->content[j] = funnel_shift(pbv->content[num_words - 1], pbv->content[0], s);
+                ++j;
+                w = 0;
+            }
         }
-        result = bit_vector_set(result, i, value);
     }
+
+    bit_vector_clear_padding(result);
     return result;
 }
 
@@ -413,38 +624,50 @@ bit_vector_t *bit_vector_shift(const bit_vector_t *pbv, int64_t shift)
     return bit_vector_extract_zero_ext(pbv, -shift, pbv->size);
 }
 
+// ==== see bit_vector.h ========================================
+bit_vector_t *bit_vector_shift_to(bit_vector_t *result, const bit_vector_t *pbv, int64_t shift)
+{
+    if (result == NULL || pbv == NULL || result->size != pbv->size)
+    {
+        return NULL;
+    }
+
+    return bit_vector_extract_zero_ext_to(result, pbv, -shift);
+}
+
 // ==== see bit_vector.h ========================================
 bit_vector_t *bit_vector_join(const bit_vector_t *pbv1, const bit_vector_t *pbv2, int64_t shift)
 {
-    if (pbv1 == NULL || pbv2 == NULL || pbv1->size != pbv2->size || shift < 0 || shift > pbv1->size)
+    if (pbv1 == NULL || pbv2 == NULL || pbv1->size != pbv2->size || shift < 0 || (uint64_t)shift > pbv1->size)
     {
         return NULL;
     }
-    // bit_vector_t *pbv1_cpy = bit_vector_cpy(pbv1);
-    // bit_vector_t *pbv2_cpy = bit_vector_cpy(pbv2);
-    bit_vector_t pbv1_cpy = *pbv1;
-    bit_vector_t pbv2_cpy = *pbv2;
-
-    // bit_vector_t *pbv_m = bit_vector_create(pbv1->size, 1);
-    bit_vector_t *pbv_m = bit_vector_create(pbv1->size, 1);
-
-    bit_vector_t *pbv_mask = bit_vector_extract_zero_ext(pbv_m, -shift, pbv1->size);
-    // const bit_vector_t *pbv2_shift = bit_vector_and(pbv2_cpy, pbv_mask);
-    // bit_vector_t *pbv1_shift = bit_vector_and(pbv1_cpy, bit_vector_not(pbv_mask));
-
-    // bit_vector_t *result = bit_vector_or(pbv1_shift, pbv2_shift);
-    bit_vector_t *result =
-        bit_vector_or(
-            bit_vector_and(&pbv1_cpy, bit_vector_not(pbv_mask)),
-            bit_vector_and(&pbv2_cpy, pbv_mask));
-    result = bit_vector_cpy(result);
-    bit_vector_free(&pbv_m);
-    bit_vector_free(&pbv_mask);
-    // free(pbv_m->content);
-    // free(pbv_mask->content);
-    // bit_vector_free(pbv1_cpy);
-    // bit_vector_free(pbv2_cpy);
 
+    return bit_vector_join_to(bit_vector_create(pbv1->size, 0), pbv1, pbv2, shift);
+}
+
+// ==== see bit_vector.h ========================================
+bit_vector_t *bit_vector_join_to(bit_vector_t *result, const bit_vector_t *pbv1, const bit_vector_t *pbv2, int64_t shift)
+{
+    if (result == NULL || pbv1 == NULL || pbv2 == NULL || pbv1->size != pbv2->size
+        || result->size != pbv1->size || shift < 0 || (uint64_t)shift > pbv1->size)
+    {
+        return NULL;
+    }
+
+    // The words before the one containing bit shift come from pbv1, the ones after it from pbv2
+    const size_t num_words = (pbv1->size + FOUR_BYTES_SIZE - 1) / FOUR_BYTES_SIZE;
+    const size_t w = (size_t)shift / FOUR_BYTES_SIZE;
+    // (memmove as result may be one of the inputs)
+    memmove(result->content, pbv1->content, w * sizeof(uint32_t));
+    if (w < num_words)
+    {
+        const uint32_t mask = UINT32_MAX << ((size_t)shift % FOUR_BYTES_SIZE);
+        result->content[w] = (pbv1->content[w] & ~mask) | (pbv2->content[w] & mask);
+        memmove(result->content + w + 1, pbv2->content + w + 1, (num_words - w - 1) * sizeof(uint32_t));
+    }
+
+    bit_vector_clear_padding(result);
     return result;
 }
 
@@ -501,3 +724,129 @@ void bit_vector_free(bit_vector_t **pbv)
     free(*pbv);
     pbv = NULL;
 }
+
+/**
+ * @brief Chunk of memory of an arena, in 8-byte units to keep everything aligned
+ */
+struct bit_vector_arena_chunk_
+{
+    bit_vector_arena_chunk_t *next;
+    size_t capacity;
+    size_t used;
+    uint64_t data[];
+};
+
+#define ARENA_UNIT sizeof(uint64_t)
+#define ARENA_UNITS(bytes) (((bytes) + ARENA_UNIT - 1) / ARENA_UNIT)
+#define ARENA_DEFAULT_UNITS 1024
+
+/**
+ * @brief Adds a chunk in front of the chunks of an arena
+ *
+ * @param arena The pointer to the arena
+ * @param units The capacity of the chunk, in 8-byte units
+ * @return bit_vector_arena_chunk_t* The new chunk, NULL on error
+ */
+static bit_vector_arena_chunk_t *arena_add_chunk(bit_vector_arena_t *arena, size_t units)
+{
+    bit_vector_arena_chunk_t *chunk = malloc(sizeof(bit_vector_arena_chunk_t) + units * ARENA_UNIT);
+    if (chunk != NULL)
+    {
+        ++arena->allocations;
+        chunk->next = arena->chunks;
+        chunk->capacity = units;
+        chunk->used = 0;
+        arena->chunks = chunk;
+    }
+    return chunk;
+}
+
+// ==== see bit_vector.h ========================================
+bit_vector_arena_t *bit_vector_arena_init(bit_vector_arena_t *arena, size_t bytes)
+{
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+
+    arena->chunks = NULL;
+    arena->allocations = 0;
+    const size_t units = ARENA_UNITS(bytes);
+    return arena_add_chunk(arena, units > 0 ? units : ARENA_DEFAULT_UNITS) == NULL ? NULL : arena;
+}
+
+// ==== see bit_vector.h ========================================
+bit_vector_t *bit_vector_arena_create(bit_vector_arena_t *arena, size_t size, bit_t value)
+{
+    if (arena == NULL || size == 0 || size > (size_t)(-FOUR_BYTES_SIZE))
+    {
+        return NULL;
+    }
+
+    // One word more than needed, as bit_vector_create does
+    const size_t num_words = (size + FOUR_BYTES_SIZE - 1) / FOUR_BYTES_SIZE;
+    const size_t vector_units = ARENA_UNITS(sizeof(bit_vector_t));
+    const size_t units = vector_units + ARENA_UNITS((num_words + 1) * sizeof(uint32_t));
+
+    bit_vector_arena_chunk_t *chunk = arena->chunks;
+    if (chunk == NULL || chunk->capacity - chunk->used < units)
+    {
+        const size_t grown = chunk == NULL ? ARENA_DEFAULT_UNITS : 2 * chunk->capacity;
+        chunk = arena_add_chunk(arena, grown > units ? grown : units);
+        if (chunk == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    bit_vector_t *vect = (bit_vector_t *)(chunk->data + chunk->used);
+    vect->content = (uint32_t *)(chunk->data + chunk->used + vector_units);
+    vect->size = size;
+    vect->allocated = num_words * FOUR_BYTES_SIZE;
+    chunk->used += units;
+
+    memset(vect->content, value ? FULL_BYTE : 0, (num_words + 1) * sizeof(uint32_t));
+    vect->content[num_words] = 0;
+    bit_vector_clear_padding(vect);
+    return vect;
+}
+
+// ==== see bit_vector.h ========================================
+void bit_vector_arena_reset(bit_vector_arena_t *arena)
+{
+    if (arena == NULL || arena->chunks == NULL)
+    {
+        return;
+    }
+
+    if (arena->chunks->next == NULL)
+    {
+        arena->chunks->used = 0;
+        return;
+    }
+
+    // Replace the chunks by one as large as all of them together
+    size_t units = 0;
+    for (const bit_vector_arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+    {
+        units += chunk->capacity;
+    }
+    bit_vector_arena_free(arena);
+    arena_add_chunk(arena, units);
+}
+
+// ==== see bit_vector.h ========================================
+void bit_vector_arena_free(bit_vector_arena_t *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+
+    while (arena->chunks != NULL)
+    {
+        bit_vector_arena_chunk_t *next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+}
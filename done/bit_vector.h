@@ -46,6 +46,15 @@ bit_vector_t* bit_vector_create(size_t size, bit_t value);
  */
 bit_vector_t* bit_vector_cpy(const bit_vector_t* pbv);
 
+//=========================================================================
+/**
+ * @brief Copy a bit vector into another one of the same size
+ * @param copy pointer to the bit vector to copy into
+ * @param pbv pointer to the bit vector to copy
+ * @return pointer to copy, NULL if the sizes differ
+ */
+bit_vector_t* bit_vector_cpy_to(bit_vector_t* copy, const bit_vector_t* pbv);
+
 //=========================================================================
 /**
  * @brief Get the value of a given bit in a bit vector
@@ -100,6 +109,16 @@ bit_vector_t* bit_vector_xor(bit_vector_t* pbv1, const bit_vector_t* pbv2);
  */
 bit_vector_t* bit_vector_extract_zero_ext(const bit_vector_t* pbv, int64_t index, size_t size);
 
+//=========================================================================
+/**
+ * @brief Extract from a bit vector into another one (zero extended)
+ * @param result pointer to the bit vector to write to (its size is the size extracted), not pbv
+ * @param pbv pointer to bit vector
+ * @param index index from where to start extraction
+ * @return pointer to result
+ */
+bit_vector_t* bit_vector_extract_zero_ext_to(bit_vector_t* result, const bit_vector_t* pbv, int64_t index);
+
 //=========================================================================
 /**
  * @brief Create a new bit vector extracted from another bit vector (wrap extended)
@@ -110,6 +129,16 @@ bit_vector_t* bit_vector_extract_zero_ext(const bit_vector_t* pbv, int64_t index
  */
 bit_vector_t* bit_vector_extract_wrap_ext(const bit_vector_t* pbv, int64_t index, size_t size);
 
+//=========================================================================
+/**
+ * @brief Extract from a bit vector into another one (wrap extended)
+ * @param result pointer to the bit vector to write to (its size is the size extracted), not pbv
+ * @param pbv pointer to bit vector
+ * @param index index from where to start extraction
+ * @return pointer to result
+ */
+bit_vector_t* bit_vector_extract_wrap_ext_to(bit_vector_t* result, const bit_vector_t* pbv, int64_t index);
+
 //=========================================================================
 /**
  * @brief Create a new bit vector shifted from another bit vector
@@ -119,6 +148,16 @@ bit_vector_t* bit_vector_extract_wrap_ext(const bit_vector_t* pbv, int64_t index
  */
 bit_vector_t* bit_vector_shift(const bit_vector_t* pbv, int64_t shift);
 
+//=========================================================================
+/**
+ * @brief Shift a bit vector into another one of the same size
+ * @param result pointer to the bit vector to write to, not pbv
+ * @param pbv pointer to bit vector
+ * @param shift bit shift count
+ * @return pointer to result
+ */
+bit_vector_t* bit_vector_shift_to(bit_vector_t* result, const bit_vector_t* pbv, int64_t shift);
+
 //=========================================================================
 /**
  * @brief Join two bit vectors into a new bit vector
@@ -129,6 +168,17 @@ bit_vector_t* bit_vector_shift(const bit_vector_t* pbv, int64_t shift);
  */
 bit_vector_t* bit_vector_join(const bit_vector_t* pbv1, const bit_vector_t* pbv2, int64_t shift);
 
+//=========================================================================
+/**
+ * @brief Join two bit vectors into a third one of the same size
+ * @param result pointer to the bit vector to write to (may be pbv1 or pbv2)
+ * @param pbv1 pointer to first bit vector
+ * @param pbv2 pointer to second bit vector
+ * @param shift bit shift count
+ * @return pointer to result
+ */
+bit_vector_t* bit_vector_join_to(bit_vector_t* result, const bit_vector_t* pbv1, const bit_vector_t* pbv2, int64_t shift);
+
 //=========================================================================
 /**
  * @brief Print bit vector values
@@ -153,6 +203,53 @@ int bit_vector_println(const char* prefix, const bit_vector_t* pbv);
  */
 void bit_vector_free(bit_vector_t** pbv);
 
+//=========================================================================
+/**
+ * @brief Arena to allocate bit vectors from, all released at once
+ *        (e.g. once per frame, at VBLANK)
+ */
+typedef struct bit_vector_arena_chunk_ bit_vector_arena_chunk_t;
+
+typedef struct {
+    bit_vector_arena_chunk_t* chunks; // the chunk allocated from first
+    size_t allocations;               // number of heap allocations made so far
+} bit_vector_arena_t;
+
+//=========================================================================
+/**
+ * @brief Initialize an arena
+ * @param arena pointer to the arena
+ * @param bytes initial capacity in bytes (it grows as needed)
+ * @return pointer to the arena, NULL on error
+ */
+bit_vector_arena_t* bit_vector_arena_init(bit_vector_arena_t* arena, size_t bytes);
+
+//=========================================================================
+/**
+ * @brief Create a bit vector in an arena (see bit_vector_create). It must not be
+ *        freed with bit_vector_free: it is valid until the arena is reset or freed
+ * @param arena pointer to the arena
+ * @param size, size in bits of the vector
+ * @param value, bit value
+ * @return pointer to created bit vector
+ */
+bit_vector_t* bit_vector_arena_create(bit_vector_arena_t* arena, size_t size, bit_t value);
+
+//=========================================================================
+/**
+ * @brief Release all the bit vectors of an arena. If it had to grow, its memory is
+ *        merged into one chunk, so that the same use of it does not allocate again
+ * @param arena pointer to the arena
+ */
+void bit_vector_arena_reset(bit_vector_arena_t* arena);
+
+//=========================================================================
+/**
+ * @brief Free an arena (and all its bit vectors)
+ * @param arena pointer to the arena
+ */
+void bit_vector_arena_free(bit_vector_arena_t* arena);
+
 #ifdef __cplusplus
 }
 #endif
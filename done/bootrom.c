@@ -12,25 +12,47 @@
 
 #include "bootrom.h"
 
+static const data_t bootrom_content[MEM_SIZE(BOOT_ROM)] = GAMEBOY_BOOT_ROM_CONTENT;
+static const data_t bootrom_blank_content[MEM_SIZE(BOOT_ROM)] = {0};
+
+// Shared by all the gameboys: the bus only reads them
+static const memory_t bootrom_mem = {MEM_SIZE(BOOT_ROM), (data_t *)bootrom_content};
+static const memory_t bootrom_blank_mem = {MEM_SIZE(BOOT_ROM), (data_t *)bootrom_blank_content};
+
 // ==== see bootrom.h ========================================
 int bootrom_init(component_t *c)
 {
     M_REQUIRE_NON_NULL(c);
-    M_REQUIRE_NON_NULL(c->mem);
-    M_REQUIRE_NON_NULL(c->mem->memory);
 
-    component_t bootROM;
-    memset(&bootROM, 0, sizeof(component_t));
-
-    M_EXIT_IF_ERR(component_create(&bootROM, MEM_SIZE(BOOT_ROM)));
+    c->mem = (memory_t *)&bootrom_mem;
+    c->start = 0;
+    c->end = 0;
+    return ERR_NONE;
+}
 
-    uint8_t instructions[MEM_SIZE(BOOT_ROM)] = GAMEBOY_BOOT_ROM_CONTENT;
-    memcpy(&bootROM.mem->memory, instructions, sizeof(instructions));
+// ==== see bootrom.h ========================================
+int bootrom_init_blank(component_t *c)
+{
+    M_REQUIRE_NON_NULL(c);
 
-    *c = bootROM;
+    c->mem = (memory_t *)&bootrom_blank_mem;
+    c->start = 0;
+    c->end = 0;
     return ERR_NONE;
 }
 
+// ==== see bootrom.h ========================================
+void bootrom_free(component_t *c)
+{
+    if (c != NULL)
+    {
+        // The memory is static, only the component is reset
+        c->mem = NULL;
+        c->start = 0;
+        c->end = 0;
+    }
+}
+
 // ==== see bootrom.h ========================================
 int bootrom_bus_listener(gameboy_t *gameboy, addr_t addr)
 {
@@ -38,10 +60,10 @@ int bootrom_bus_listener(gameboy_t *gameboy, addr_t addr)
 
     if (addr == REG_BOOT_ROM_DISABLE && gameboy->boot != 0)
     {
-        // Deactivates the bootrom
-        M_EXIT_IF_ERR(bus_unplug(gameboy->bus, &gameboy->bootrom));
-        // Maps the component to the corresponding part of the bus
-        M_EXIT_IF_ERR(cartridge_plug(&gameboy->cartridge, gameboy->bus));
+        // Deactivates the bootrom: the first bank of the cartridge is seen again
+        M_EXIT_IF_ERR(bus_pages_remap(&gameboy->pages, &gameboy->cartridge.rom0, 0));
+        // Instructions decoded from the bootrom are not on the bus anymore
+        decode_cache_flush(gameboy->cpu.decode_cache);
         // Set boot bit to 0 to mark end of boot
         gameboy->boot = 0;
     }
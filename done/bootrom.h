@@ -57,14 +57,36 @@ extern "C" {
 
 
 /**
- * @brief Writes bootrom content to a component
+ * @brief Makes a component show the bootrom content. The content is a
+ *        single read-only image shared by all the components (the writes
+ *        to the ROM are trapped by the page table of the cpu): nothing is
+ *        allocated, the component is released with bootrom_free.
  *
- * @param c component to write the bootrom content to
+ * @param c component to show the bootrom content with
  * @return error code
  */
 int bootrom_init(component_t* c);
 
 
+/**
+ * @brief Same as bootrom_init, with a blank (all NOP) boot ROM: the cpu
+ *        slides to the entry point of the cartridge (0x0100) without
+ *        running the boot sequence. This is the one plugged by gameboy_create.
+ *
+ * @param c component to show the blank boot ROM with
+ * @return error code
+ */
+int bootrom_init_blank(component_t* c);
+
+
+/**
+ * @brief Releases a component initiated by bootrom_init or bootrom_init_blank
+ *
+ * @param c component to release
+ */
+void bootrom_free(component_t* c);
+
+
 /**
  * @brief Macro to plug bootrom onto the bus
  */
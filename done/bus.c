@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "memory.h" // addr_t and data_t
 #include "component.h"
@@ -195,3 +196,213 @@ int bus_write16(bus_t bus, addr_t address, addr_t data16)
 
     return ERR_NONE;
 }
+
+// ==== see bus.h ========================================
+int bus_pages_update(bus_pages_t *pages, const bus_t bus, addr_t start, addr_t end)
+{
+    M_REQUIRE_NON_NULL(pages);
+    M_REQUIRE_NON_NULL(bus);
+    M_REQUIRE(start <= end, ERR_ADDRESS, "start %u is after end %u", start, end);
+
+    for (size_t page = start >> BUS_PAGE_BITS; page <= (size_t)(end >> BUS_PAGE_BITS); ++page)
+    {
+        const unsigned first = page << BUS_PAGE_BITS;
+        const uintptr_t base = (uintptr_t)bus[first] - first;
+
+        // Direct only if the whole page is made of consecutive bytes
+        bool direct = bus[first] != NULL;
+        for (unsigned i = 1; direct && i < BUS_PAGE_SIZE; ++i)
+        {
+            direct = (uintptr_t)bus[first + i] == base + first + i;
+        }
+
+        pages->base[page] = direct ? base : 0;
+        pages->rows[page] = NULL;
+        if (pages->stale[page])
+        {
+            // the bus_t table has just been written
+            pages->stale[page] = 0;
+            --pages->nb_stale;
+        }
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_pages_remap(bus_pages_t *pages, component_t *c, addr_t offset)
+{
+    M_REQUIRE_NON_NULL(pages);
+    M_REQUIRE_NON_NULL(c);
+    M_REQUIRE_NON_NULL(c->mem);
+    M_REQUIRE_NON_NULL(c->mem->memory);
+
+    const addr_t start = c->start;
+    const addr_t end = c->end;
+
+    // Same checks as bus_remap, and the component must cover whole pages
+    if ((size_t)(end - start) + offset >= c->mem->size || start > end ||
+        start % BUS_PAGE_SIZE != 0 || (end + 1) % BUS_PAGE_SIZE != 0)
+    {
+        return ERR_ADDRESS;
+    }
+
+    const uintptr_t base = (uintptr_t)&c->mem->memory[offset] - start;
+    for (size_t page = start >> BUS_PAGE_BITS; page <= (size_t)(end >> BUS_PAGE_BITS); ++page)
+    {
+        pages->base[page] = base;
+        if (!pages->stale[page])
+        {
+            pages->stale[page] = 1;
+            ++pages->nb_stale;
+        }
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_pages_sync(bus_pages_t *pages, bus_t bus)
+{
+    M_REQUIRE_NON_NULL(pages);
+    M_REQUIRE_NON_NULL(bus);
+
+    for (unsigned page = 0; pages->nb_stale > 0 && page < BUS_NB_PAGES; ++page)
+    {
+        if (pages->stale[page])
+        {
+            const unsigned first = page << BUS_PAGE_BITS;
+            for (unsigned i = 0; i < BUS_PAGE_SIZE; ++i)
+            {
+                bus[first + i] = (data_t *)(pages->base[page] + first + i);
+            }
+            pages->stale[page] = 0;
+            --pages->nb_stale;
+        }
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_pages_detach(bus_pages_t *pages, const bus_t bus, data_t *(*rows)[BUS_PAGE_SIZE], size_t nb_rows)
+{
+    M_REQUIRE_NON_NULL(pages);
+    M_REQUIRE_NON_NULL(bus);
+    M_REQUIRE_NON_NULL(rows);
+
+    size_t used = 0;
+    for (unsigned page = 0; page < BUS_NB_PAGES; ++page)
+    {
+        const unsigned first = page << BUS_PAGE_BITS;
+        bool empty = true;
+        for (unsigned i = 0; empty && i < BUS_PAGE_SIZE; ++i)
+        {
+            empty = bus[first + i] == NULL;
+        }
+        if (pages->base[page] != 0 || empty)
+        {
+            continue;
+        }
+
+        M_REQUIRE(used < nb_rows, ERR_MEM, "more than %zu pages are not direct", nb_rows);
+        memcpy(rows[used], &bus[first], sizeof(rows[used]));
+        pages->rows[page] = rows[used];
+        ++used;
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_pages_protect(bus_pages_t *pages, addr_t start, addr_t end, bool readonly)
+{
+    M_REQUIRE_NON_NULL(pages);
+    M_REQUIRE(start <= end && start % BUS_PAGE_SIZE == 0 && (end + 1) % BUS_PAGE_SIZE == 0,
+              ERR_ADDRESS, "[%u, %u] is not a range of pages", start, end);
+
+    for (size_t page = start >> BUS_PAGE_BITS; page <= (size_t)(end >> BUS_PAGE_BITS); ++page)
+    {
+        pages->readonly[page] = readonly ? 1 : 0;
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_watch_add(bus_watch_t *watch, addr_t start, addr_t end, bus_watch_fn fn, void *owner)
+{
+    M_REQUIRE_NON_NULL(watch);
+    M_REQUIRE_NON_NULL(fn);
+    M_REQUIRE(start <= end, ERR_ADDRESS, "start %u is after end %u", start, end);
+    M_REQUIRE(watch->nb_watches < BUS_WATCH_MAX, ERR_MEM, "more than %d watches", BUS_WATCH_MAX);
+
+    watch->watches[watch->nb_watches].start = start;
+    watch->watches[watch->nb_watches].end = end;
+    watch->watches[watch->nb_watches].fn = fn;
+    watch->watches[watch->nb_watches].owner = owner;
+    ++watch->nb_watches;
+
+    for (unsigned addr = start; addr <= end; ++addr)
+    {
+        watch->bits[addr >> 6] |= (uint64_t)1 << (addr & 63);
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_watch_dispatch(bus_watch_t *watch)
+{
+    M_REQUIRE_NON_NULL(watch);
+
+    // The watchers may write too: only the writes queued so far are dispatched
+    const uint8_t nb_written = watch->nb_written;
+    for (uint8_t i = 0; i < nb_written; ++i)
+    {
+        const addr_t addr = watch->written[i];
+        for (uint8_t w = 0; w < watch->nb_watches; ++w)
+        {
+            if (addr >= watch->watches[w].start && addr <= watch->watches[w].end)
+            {
+                M_EXIT_IF_ERR(watch->watches[w].fn(watch->watches[w].owner, addr));
+            }
+        }
+    }
+    watch->nb_written = 0;
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_watch_lazy(bus_watch_t *watch, addr_t start, addr_t end, bus_watch_fn fn, void *owner)
+{
+    M_REQUIRE_NON_NULL(watch);
+    M_REQUIRE_NON_NULL(fn);
+    M_REQUIRE(start <= end, ERR_ADDRESS, "start %u is after end %u", start, end);
+    M_REQUIRE(watch->lazy.fn == NULL, ERR_MEM, "range %u-%u is already lazy", watch->lazy.start, watch->lazy.end);
+
+    watch->lazy.start = start;
+    watch->lazy.end = end;
+    watch->lazy.fn = fn;
+    watch->lazy.owner = owner;
+
+    return ERR_NONE;
+}
+
+// ==== see bus.h ========================================
+int bus_watch_dirty(bus_watch_t *watch, addr_t start, addr_t end, unsigned shift, uint64_t *bits)
+{
+    M_REQUIRE_NON_NULL(watch);
+    M_REQUIRE_NON_NULL(bits);
+    M_REQUIRE(start <= end, ERR_ADDRESS, "start %u is after end %u", start, end);
+    M_REQUIRE(shift < 16, ERR_BAD_PARAMETER, "blocks of 2^%u bytes", shift);
+    M_REQUIRE(watch->dirty.bits == NULL, ERR_MEM, "range %u-%u is already tracked", watch->dirty.start, watch->dirty.end);
+
+    watch->dirty.start = start;
+    watch->dirty.end = end;
+    watch->dirty.shift = shift;
+    watch->dirty.bits = bits;
+
+    return ERR_NONE;
+}
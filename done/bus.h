@@ -21,11 +21,263 @@ extern "C" {
 
 #define BUS_SIZE 65536
 
+#define BUS_PAGE_BITS 8
+#define BUS_PAGE_SIZE (1 << BUS_PAGE_BITS)
+#define BUS_NB_PAGES (BUS_SIZE >> BUS_PAGE_BITS)
+
 /**
  * @brief Bus Type, a table of memory pointer pointing to the various component memories
  */
 typedef data_t* bus_t[BUS_SIZE];
 
+/**
+ * @brief Page table of a bus, one descriptor per page of BUS_PAGE_SIZE addresses.
+ *        A page mapped to consecutive bytes of memory is "direct": its
+ *        descriptor is the host address of its first byte minus the bus
+ *        address of that byte, so that accessing it takes a shift, a load
+ *        and an add (see bus_page_ptr). Other pages (not or partly plugged,
+ *        or mixing several memories such as the I/O page) have a 0
+ *        descriptor and are accessed through their row of entries, if
+ *        any, or through the bus_t table.
+ *
+ *        The bus_t table stays the reference for bus_read and bus_write:
+ *        pages changed by bus_pages_remap are only copied back to it by
+ *        bus_pages_sync. Once the rows of the pages which are not direct
+ *        are copied out of it (see bus_pages_detach), the table is not
+ *        needed anymore: a Game Boy only uses one while it is plugged.
+ *
+ *        Writes to a read-only page (see bus_pages_protect) are not done
+ *        by the cpu but recorded in trap, for the component owning the
+ *        page (e.g. the registers of a cartridge's memory bank controller).
+ */
+typedef struct {
+    uintptr_t base[BUS_NB_PAGES];
+    data_t* const* rows[BUS_NB_PAGES]; // entries of the page, NULL to use the bus_t table
+    uint8_t stale[BUS_NB_PAGES]; // 1 if the bus_t entries of the page are out of date
+    uint8_t readonly[BUS_NB_PAGES]; // 1 if the writes to the page are trapped
+    uint16_t nb_stale;
+    struct {
+        bit_t pending; // 1 if a write has been trapped and not handled yet
+        data_t data;
+        addr_t addr;
+    } trap;
+} bus_pages_t;
+
+#define BUS_WATCH_MAX   8 // components watching a bus
+#define BUS_WATCH_QUEUE 8 // watched writes recorded between two dispatches
+
+/**
+ * @brief Function called for a watched write (see bus_watch_add)
+ *
+ * @param owner component which watches the address
+ * @param addr address written
+ * @return error code
+ */
+typedef int (*bus_watch_fn)(void* owner, addr_t addr);
+
+/**
+ * @brief Components watching writes to ranges of a bus.
+ *        The bitmap tells whether an address is watched at all, so that an
+ *        unwatched write costs one bit test; watched writes are queued
+ *        (bus_watch_record) until bus_watch_dispatch calls their watchers.
+ */
+typedef struct {
+    uint64_t bits[BUS_SIZE / 64];
+    struct {
+        addr_t start;
+        addr_t end;
+        bus_watch_fn fn;
+        void* owner;
+    } watches[BUS_WATCH_MAX];
+    uint8_t nb_watches;
+    uint8_t nb_written;
+    addr_t written[BUS_WATCH_QUEUE];
+    struct {
+        addr_t start;
+        addr_t end;
+        bus_watch_fn fn; // NULL if no registers are computed lazily
+        void* owner;
+    } lazy;
+    struct {
+        addr_t start;
+        addr_t end;
+        unsigned shift;  // one bit per block of 2^shift bytes
+        uint64_t* bits;  // NULL if no range is tracked
+    } dirty;
+} bus_watch_t;
+
+/**
+ * @brief Tells whether writes to an address are watched
+ *
+ * @param watch watches of the bus, may be NULL
+ * @param address address to test
+ * @return true if a component watches address
+ */
+static inline bool bus_watched(const bus_watch_t* watch, addr_t address)
+{
+    return watch != NULL && ((watch->bits[address >> 6] >> (address & 63)) & 1);
+}
+
+/**
+ * @brief Marks the block of an address as written if it is in the range
+ *        tracked by bus_watch_dirty
+ *
+ * @param watch watches of the bus, may be NULL
+ * @param address address written
+ */
+static inline void bus_watch_mark(bus_watch_t* watch, addr_t address)
+{
+    if (watch != NULL && watch->dirty.bits != NULL
+        && address >= watch->dirty.start && address <= watch->dirty.end) {
+        const unsigned block = (unsigned)(address - watch->dirty.start) >> watch->dirty.shift;
+        watch->dirty.bits[block >> 6] |= (uint64_t)1 << (block & 63);
+    }
+}
+
+/**
+ * @brief Records a write: marks it (see bus_watch_mark) and queues it for
+ *        bus_watch_dispatch if its address is watched (the writes beyond
+ *        BUS_WATCH_QUEUE are not dispatched)
+ *
+ * @param watch watches of the bus, may be NULL
+ * @param address address written
+ */
+static inline void bus_watch_record(bus_watch_t* watch, addr_t address)
+{
+    bus_watch_mark(watch, address);
+    if (bus_watched(watch, address) && watch->nb_written < BUS_WATCH_QUEUE) {
+        watch->written[watch->nb_written++] = address;
+    }
+}
+
+/**
+ * @brief Forgets the queued writes
+ *
+ * @param watch watches of the bus, may be NULL
+ */
+static inline void bus_watch_clear(bus_watch_t* watch)
+{
+    if (watch != NULL) {
+        watch->nb_written = 0;
+    }
+}
+
+/**
+ * @brief Brings the lazily computed registers up to date before the cpu
+ *        accesses one of them (see bus_watch_lazy)
+ *
+ * @param watch watches of the bus, may be NULL
+ * @param address address about to be read or written
+ */
+static inline void bus_watch_sync(bus_watch_t* watch, addr_t address)
+{
+    if (watch != NULL && watch->lazy.fn != NULL
+        && address >= watch->lazy.start && address <= watch->lazy.end) {
+        (void)watch->lazy.fn(watch->lazy.owner, address);
+    }
+}
+
+/**
+ * @brief Gets the host address of a bus address on a direct page
+ *
+ * @param pages page table
+ * @param address address to look up
+ * @return pointer to the data, NULL if the page is not direct
+ */
+static inline data_t* bus_page_ptr(const bus_pages_t* pages, addr_t address)
+{
+    const uintptr_t base = pages->base[address >> BUS_PAGE_BITS];
+    return base == 0 ? NULL : (data_t*)(base + address);
+}
+
+/**
+ * @brief Records a write to a read-only page instead of doing it
+ *
+ * @param pages page table of the bus, may be NULL
+ * @param address address written to
+ * @param data data written
+ * @return true if the write has been trapped, false if it has to be done
+ */
+static inline bool bus_pages_trap(bus_pages_t* pages, addr_t address, data_t data)
+{
+    if (pages == NULL || !pages->readonly[address >> BUS_PAGE_BITS]) {
+        return false;
+    }
+    pages->trap.pending = 1;
+    pages->trap.data = data;
+    pages->trap.addr = address;
+    return true;
+}
+
+/**
+ * @brief Gets the entry of a bus address on a page which is not direct:
+ *        in the row of the page if it has one, else in the bus_t table.
+ *        The entries of the following addresses of the page follow it.
+ *
+ * @param bus bus to look into, may be NULL once detached (see bus_pages_detach)
+ * @param pages page table of the bus, may be NULL
+ * @param address address to look up
+ * @return pointer to the entry, NULL if there is none
+ */
+static inline data_t* const* bus_row_entry(const bus_t bus, const bus_pages_t* pages, addr_t address)
+{
+    data_t* const* row = pages != NULL ? pages->rows[address >> BUS_PAGE_BITS] : NULL;
+    if (row != NULL) {
+        return &row[address & (BUS_PAGE_SIZE - 1)];
+    }
+    return bus != NULL ? &bus[address] : NULL;
+}
+
+/**
+ * @brief Gets the host address of a bus address on a page which is not
+ *        direct (see bus_row_entry)
+ *
+ * @param bus bus to look into, may be NULL once detached (see bus_pages_detach)
+ * @param pages page table of the bus, may be NULL
+ * @param address address to look up
+ * @return pointer to the data, NULL if nothing is plugged there
+ */
+static inline data_t* bus_row_ptr(const bus_t bus, const bus_pages_t* pages, addr_t address)
+{
+    data_t* const* entry = bus_row_entry(bus, pages, address);
+    return entry != NULL ? *entry : NULL;
+}
+
+/**
+ * @brief Gets the host address of a bus address, through the page table if any
+ *
+ * @param bus bus to look into, may be NULL once detached (see bus_pages_detach)
+ * @param pages page table of the bus, may be NULL
+ * @param address address to look up
+ * @return pointer to the data, NULL if nothing is plugged there
+ */
+static inline data_t* bus_lookup(const bus_t bus, const bus_pages_t* pages, addr_t address)
+{
+    data_t* p = pages != NULL ? bus_page_ptr(pages, address) : NULL;
+    return p != NULL ? p : bus_row_ptr(bus, pages, address);
+}
+
+/**
+ * @brief Same as bus_lookup for an access of the cpu: the lazily computed
+ *        registers are brought up to date first. Those are never on a
+ *        direct page, so that direct accesses are not slowed down.
+ *
+ * @param bus bus to look into, may be NULL once detached (see bus_pages_detach)
+ * @param pages page table of the bus, may be NULL
+ * @param watch watches of the bus, may be NULL
+ * @param address address to look up
+ * @return pointer to the data, NULL if nothing is plugged there
+ */
+static inline data_t* bus_lookup_sync(const bus_t bus, const bus_pages_t* pages, bus_watch_t* watch, addr_t address)
+{
+    data_t* p = pages != NULL ? bus_page_ptr(pages, address) : NULL;
+    if (p != NULL) {
+        return p;
+    }
+    bus_watch_sync(watch, address);
+    return bus_row_ptr(bus, pages, address);
+}
+
 /**
  * @brief Plug a component into the bus
  *
@@ -114,6 +366,131 @@ int bus_read16(const bus_t bus, addr_t address, addr_t* data16);
  */
 int bus_write16(bus_t bus, addr_t address, addr_t data16);
 
+
+/**
+ * @brief Computes the descriptors of the pages overlapping an address range
+ *        from the bus_t table (their rows are dropped, see bus_pages_detach);
+ *        to be called after plugging or unplugging
+ *
+ * @param pages page table to update
+ * @param bus bus the table describes
+ * @param start first address of the range (included)
+ * @param end last address of the range (included)
+ * @return error code
+ */
+int bus_pages_update(bus_pages_t* pages, const bus_t bus, addr_t start, addr_t end);
+
+
+/**
+ * @brief Remaps the memory of a component like bus_remap, one descriptor
+ *        per page (64 for a 16 KiB ROM bank) instead of one pointer per
+ *        address: the bus_t entries are left to bus_pages_sync.
+ *        The component must start and end on page boundaries.
+ *
+ * @param pages page table to update
+ * @param c component to remap
+ * @param offset new offset to use
+ * @return error code
+ */
+int bus_pages_remap(bus_pages_t* pages, component_t* c, addr_t offset);
+
+
+/**
+ * @brief Brings the bus_t entries of the pages changed by bus_pages_remap
+ *        up to date
+ *
+ * @param pages page table
+ * @param bus bus to update
+ * @return error code
+ */
+int bus_pages_sync(bus_pages_t* pages, bus_t bus);
+
+
+/**
+ * @brief Copies the entries of the pages which are neither direct nor
+ *        empty out of the bus_t table, one row of BUS_PAGE_SIZE entries
+ *        per page, so that bus_lookup does not need the table anymore.
+ *        The rows only change with bus_pages_update.
+ *
+ * @param pages page table, up to date (see bus_pages_update)
+ * @param bus bus the table describes
+ * @param rows rows to copy the entries to
+ * @param nb_rows number of rows
+ * @return error code (ERR_MEM if more than nb_rows pages need a row)
+ */
+int bus_pages_detach(bus_pages_t* pages, const bus_t bus, data_t* (*rows)[BUS_PAGE_SIZE], size_t nb_rows);
+
+
+/**
+ * @brief Makes the writes to a range of pages trapped (see bus_pages_trap)
+ *        or done again
+ *
+ * @param pages page table to update
+ * @param start first address of the range (included), on a page boundary
+ * @param end last address of the range (included), at the end of a page
+ * @param readonly true to trap the writes, false to let them be done
+ * @return error code
+ */
+int bus_pages_protect(bus_pages_t* pages, addr_t start, addr_t end, bool readonly);
+
+
+
+/**
+ * @brief Makes a component watch the writes to a range of the bus
+ *
+ * @param watch watches of the bus
+ * @param start first address of the range (included)
+ * @param end last address of the range (included)
+ * @param fn function called for each write to the range, after the write
+ * @param owner component given to fn
+ * @return error code
+ */
+int bus_watch_add(bus_watch_t* watch, addr_t start, addr_t end, bus_watch_fn fn, void* owner);
+
+
+/**
+ * @brief Calls the watchers of the queued writes, in the order of the
+ *        writes then of bus_watch_add, and empties the queue (writes
+ *        done by the watchers included)
+ *
+ * @param watch watches of the bus
+ * @return error code
+ */
+int bus_watch_dispatch(bus_watch_t* watch);
+
+
+/**
+ * @brief Makes the registers of a range computed lazily by a component:
+ *        fn is called before each access of the cpu to the range (see
+ *        bus_lookup_sync), so that the component only has to compute them
+ *        on demand. Only one range can be lazy.
+ *
+ * @param watch watches of the bus
+ * @param start first address of the range (included)
+ * @param end last address of the range (included)
+ * @param fn function bringing the registers up to date
+ * @param owner component given to fn
+ * @return error code
+ */
+int bus_watch_lazy(bus_watch_t* watch, addr_t start, addr_t end, bus_watch_fn fn, void* owner);
+
+
+/**
+ * @brief Makes the writes to a range of the bus set bits in a bitmap of
+ *        a component, one bit per block of 2^shift bytes, which the
+ *        component clears when it is done with the block. Unlike the
+ *        watched writes, nothing is queued or called: the writes to the
+ *        range cost the setting of a bit. Only one range can be tracked.
+ *
+ * @param watch watches of the bus
+ * @param start first address of the range (included)
+ * @param end last address of the range (included)
+ * @param shift log2 of the size of the blocks
+ * @param bits bitmap of the component, of at least one bit per block
+ * @return error code
+ */
+int bus_watch_dirty(bus_watch_t* watch, addr_t start, addr_t end, unsigned shift, uint64_t* bits);
+
 #ifdef __cplusplus
 }
 #endif
@@ -8,60 +8,555 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "component.h"
 #include "bus.h"
+#include "cpu-decode.h"
 
 #include "cartridge.h"
+#include "gameboy.h" // GB_CYCLES_PER_S
+
+#define SAVE_EXTENSION ".sav"
+
+// Windows of the cartridge on the bus, in ct->banks
+#define WINDOW_ROM0 0
+#define WINDOW_ROM1 1
+#define WINDOW_RAM  2
+
+#define RTC_DAY     (24 * 60 * 60)
+#define RTC_NB_DAYS 512
+
+/**
+ * @brief What the type byte of the header tells about a cartridge
+ */
+typedef struct {
+    data_t type;
+    mbc_kind_t mbc;
+    bit_t ram;
+    bit_t battery;
+    bit_t clock;
+} cartridge_kind_t;
+
+static const cartridge_kind_t cartridge_kinds[] = {
+    {0x00, MBC_NONE, 0, 0, 0},
+    {0x01, MBC_1, 0, 0, 0}, {0x02, MBC_1, 1, 0, 0}, {0x03, MBC_1, 1, 1, 0},
+    {0x08, MBC_NONE, 1, 0, 0}, {0x09, MBC_NONE, 1, 1, 0},
+    {0x0F, MBC_3, 0, 1, 1}, {0x10, MBC_3, 1, 1, 1},
+    {0x11, MBC_3, 0, 0, 0}, {0x12, MBC_3, 1, 0, 0}, {0x13, MBC_3, 1, 1, 0},
+    {0x19, MBC_5, 0, 0, 0}, {0x1A, MBC_5, 1, 0, 0}, {0x1B, MBC_5, 1, 1, 0},
+    {0x1C, MBC_5, 0, 0, 0}, {0x1D, MBC_5, 1, 0, 0}, {0x1E, MBC_5, 1, 1, 0} // with rumble
+};
+
+// Indexed by the RAM size byte of the header
+static const size_t cartridge_ram_sizes[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+
+// ======================================================================
+// Real time clock (MBC3)
+
+static int64_t rtc_clock(const cartridge_rtc_t *rtc, int64_t now)
+{
+    const int64_t clock = rtc->halt ? rtc->stopped : now - rtc->base;
+    return clock < 0 ? 0 : clock; // the host clock may have been set back
+}
+
+static void rtc_set_clock(cartridge_rtc_t *rtc, int64_t clock, int64_t now)
+{
+    if (rtc->halt)
+    {
+        rtc->stopped = clock;
+    }
+    else
+    {
+        rtc->base = now - clock;
+    }
+}
+
+/**
+ * @brief Computes the current values of the clock registers
+ */
+static void rtc_get(cartridge_rtc_t *rtc, int64_t now, uint8_t regs[RTC_NB_REGS])
+{
+    int64_t clock = rtc_clock(rtc, now);
+    if (clock >= (int64_t)RTC_NB_DAYS * RTC_DAY)
+    {
+        // The day counter overflows: it restarts from 0 and sets the carry
+        clock %= (int64_t)RTC_NB_DAYS * RTC_DAY;
+        rtc_set_clock(rtc, clock, now);
+        rtc->carry = 1;
+    }
+    const int64_t days = clock / RTC_DAY;
+
+    regs[RTC_S] = (uint8_t)(clock % 60);
+    regs[RTC_M] = (uint8_t)(clock / 60 % 60);
+    regs[RTC_H] = (uint8_t)(clock / (60 * 60) % 24);
+    regs[RTC_DL] = (uint8_t)(days & 0xFF);
+    regs[RTC_DH] = (uint8_t)(((days >> 8) & RTC_DH_DAY_MSB) | (rtc->halt ? RTC_DH_HALT : 0) |
+                             (rtc->carry ? RTC_DH_CARRY : 0));
+}
+
+/**
+ * @brief Writes a clock register (and its latched value)
+ */
+static void rtc_set(cartridge_rtc_t *rtc, rtc_reg_t reg, data_t data, int64_t now)
+{
+    uint8_t regs[RTC_NB_REGS];
+    rtc_get(rtc, now, regs);
+    regs[reg] = data;
+
+    const int64_t days = regs[RTC_DL] | (int64_t)(regs[RTC_DH] & RTC_DH_DAY_MSB) << 8;
+    const int64_t clock = ((days * 24 + regs[RTC_H]) * 60 + regs[RTC_M]) * 60 + regs[RTC_S];
+    if (reg == RTC_DH)
+    {
+        rtc->halt = (data & RTC_DH_HALT) ? 1 : 0;
+        rtc->carry = (data & RTC_DH_CARRY) ? 1 : 0;
+    }
+    rtc_set_clock(rtc, clock, now);
+    rtc->latched[reg] = data;
+}
+
+// ======================================================================
+// Files
+
+/**
+ * @brief Gets the name of the save file of a ROM: its extension (if any) is replaced by .sav
+ */
+static int cartridge_save_path(const char *filename, char *path, size_t size)
+{
+    const char *slash = strrchr(filename, '/');
+    const char *dot = strrchr(filename, '.');
+    const size_t len = (dot != NULL && (slash == NULL || dot > slash)) ? (size_t)(dot - filename) : strlen(filename);
+
+    M_REQUIRE(len + sizeof(SAVE_EXTENSION) <= size, ERR_BAD_PARAMETER, "path of %s is too long", filename);
+    snprintf(path, size, "%.*s%s", (int)len, filename, SAVE_EXTENSION);
+    return ERR_NONE;
+}
+
+/**
+ * @brief Maps the save file read-write, growing it to size bytes if needed,
+ *        so that every write to the external RAM goes to the file
+ */
+static int cartridge_map_save(memory_t *mem, const char *filename, size_t size)
+{
+    char path[FILENAME_MAX];
+    M_EXIT_IF_ERR(cartridge_save_path(filename, path, sizeof(path)));
+
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return ERR_IO;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || ((size_t)st.st_size < size && ftruncate(fd, (off_t)size) != 0))
+    {
+        close(fd);
+        return ERR_IO;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED)
+    {
+        return ERR_IO;
+    }
+
+    mem->memory = map;
+    mem->size = size;
+    return ERR_NONE;
+}
+
+// ======================================================================
+// ROM images, shared by all the cartridges running the same ROM
+
+#define FNV_OFFSET UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME  UINT64_C(0x100000001b3)
+
+/**
+ * @brief Read-only mapping of a ROM, registered by the hash of its content
+ */
+typedef struct rom_image {
+    memory_t mem;
+    uint64_t hash;
+    size_t refs;            // number of components showing it
+    struct rom_image *next;
+} rom_image_t;
+
+// The gameboys of a process may be created and freed by several threads
+static rom_image_t *rom_images = NULL;
+static pthread_mutex_t rom_images_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t rom_hash(const data_t *data, size_t size)
+{
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * @brief Gets the registered image with the content of map (whose reference
+ *        is then taken over) or registers map as a new one
+ */
+static int rom_image_get(data_t *map, size_t size, memory_t **mem)
+{
+    const uint64_t hash = rom_hash(map, size);
+
+    pthread_mutex_lock(&rom_images_lock);
+    rom_image_t *image = rom_images;
+    while (image != NULL && (image->hash != hash || image->mem.size != size || memcmp(image->mem.memory, map, size) != 0))
+    {
+        image = image->next;
+    }
+    if (image != NULL)
+    {
+        ++image->refs;
+        munmap(map, size);
+    }
+    else
+    {
+        image = calloc(1, sizeof(rom_image_t));
+        if (image == NULL)
+        {
+            pthread_mutex_unlock(&rom_images_lock);
+            munmap(map, size);
+            return ERR_MEM;
+        }
+        image->mem.memory = map;
+        image->mem.size = size;
+        image->hash = hash;
+        image->refs = 1;
+        image->next = rom_images;
+        rom_images = image;
+    }
+    pthread_mutex_unlock(&rom_images_lock);
+
+    *mem = &image->mem;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Takes another reference to a registered image
+ */
+static void rom_image_take(memory_t *mem)
+{
+    pthread_mutex_lock(&rom_images_lock);
+    rom_image_t *image = rom_images;
+    while (image != NULL && &image->mem != mem)
+    {
+        image = image->next;
+    }
+    if (image != NULL)
+    {
+        ++image->refs;
+    }
+    pthread_mutex_unlock(&rom_images_lock);
+}
+
+/**
+ * @brief Gets the hash of the whole content of an image, computed when it
+ *        was registered (or now if it is not a registered one)
+ */
+static uint64_t rom_image_hash(const memory_t *mem)
+{
+    pthread_mutex_lock(&rom_images_lock);
+    const rom_image_t *image = rom_images;
+    while (image != NULL && &image->mem != mem)
+    {
+        image = image->next;
+    }
+    const uint64_t hash = image != NULL ? image->hash : rom_hash(mem->memory, mem->size);
+    pthread_mutex_unlock(&rom_images_lock);
+    return hash;
+}
+
+/**
+ * @brief Drops a reference to a registered image, unmapped with the last one
+ */
+static void rom_image_put(memory_t *mem)
+{
+    pthread_mutex_lock(&rom_images_lock);
+    rom_image_t **link = &rom_images;
+    while (*link != NULL && &(*link)->mem != mem)
+    {
+        link = &(*link)->next;
+    }
+    rom_image_t *image = *link;
+    if (image != NULL && --image->refs == 0)
+    {
+        *link = image->next;
+        munmap(image->mem.memory, image->mem.size);
+        free(image);
+    }
+    pthread_mutex_unlock(&rom_images_lock);
+}
 
 // ==== see cartridge.h ========================================
 int cartridge_init_from_file(component_t *c, const char *filename)
 {
     M_REQUIRE_NON_NULL(c);
     M_REQUIRE_NON_NULL(filename);
-    M_REQUIRE_NON_NULL(c->mem);
-    M_REQUIRE_NON_NULL(c->mem->memory);
+    M_REQUIRE(c->mem == NULL, ERR_BAD_PARAMETER, "component %s already has memory", "c");
 
-    FILE *input = NULL;
-    input = fopen(filename, "rb");
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return ERR_IO;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < BANK_ROM_SIZE)
+    {
+        close(fd);
+        return ERR_IO;
+    }
 
-    if (input == NULL)
+    // Read-only and shared: every process running this ROM uses the same pages
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (map == MAP_FAILED)
     {
-        component_free(c);
         return ERR_IO;
     }
-    else
+
+    // and every cartridge of this process the same mapping, even if it is another copy of the file
+    M_EXIT_IF_ERR(rom_image_get(map, (size_t)st.st_size, &c->mem));
+    c->start = 0;
+    c->end = 0;
+
+    return ERR_NONE;
+}
+
+// ==== see cartridge.h ========================================
+void cartridge_free_from_file(component_t *c)
+{
+    if (c != NULL && c->mem != NULL)
+    {
+        rom_image_put(c->mem);
+        c->mem = NULL;
+        c->start = 0;
+        c->end = 0;
+    }
+}
+
+// ======================================================================
+// Banks
+
+static size_t cartridge_nb_rom_banks(const cartridge_t *ct)
+{
+    return ct->c.mem->size / BANK_ROM0_SIZE;
+}
+
+static size_t cartridge_rom0_bank(const cartridge_t *ct)
+{
+    // In its second mode, the MBC1 also switches the first bank (large ROMs only)
+    return ct->mbc == MBC_1 && ct->mode ? ((size_t)(ct->ram_bank & 0x03) << 5) % cartridge_nb_rom_banks(ct) : 0;
+}
+
+static size_t cartridge_rom1_bank(const cartridge_t *ct)
+{
+    size_t bank = 1;
+    switch (ct->mbc)
+    {
+    case MBC_1:
+        bank = (size_t)(ct->ram_bank & 0x03) << 5 | (ct->rom_bank & 0x1F);
+        bank += (ct->rom_bank & 0x1F) == 0; // bank 0 is replaced by bank 1
+        break;
+
+    case MBC_3:
+        bank = (size_t)(ct->rom_bank & 0x7F);
+        bank += bank == 0;
+        break;
+
+    case MBC_5:
+        bank = (size_t)(ct->rom_bank & 0x1FF);
+        break;
+
+    default:
+        break;
+    }
+    return bank % cartridge_nb_rom_banks(ct);
+}
+
+static bool cartridge_clock_selected(const cartridge_t *ct)
+{
+    return ct->rtc != NULL && ct->ram_bank >= RTC_REG_FIRST && ct->ram_bank < RTC_REG_FIRST + RTC_NB_REGS;
+}
+
+static size_t cartridge_ram_bank(const cartridge_t *ct)
+{
+    size_t bank = 0;
+    switch (ct->mbc)
+    {
+    case MBC_1:
+        bank = ct->mode ? (ct->ram_bank & 0x03) : 0;
+        break;
+
+    case MBC_3:
+        bank = ct->ram_bank & 0x03;
+        break;
+
+    case MBC_5:
+        bank = ct->ram_bank & 0x0F;
+        break;
+
+    default:
+        break;
+    }
+    return ct->ram_size == 0 ? 0 : bank % (ct->ram_size / BANK_RAM_SIZE);
+}
+
+/**
+ * @brief Points each window to the bank selected by the registers
+ */
+static void cartridge_select_banks(cartridge_t *ct)
+{
+    data_t *rom = ct->c.mem->memory;
+    ct->banks[WINDOW_ROM0].memory = rom + cartridge_rom0_bank(ct) * BANK_ROM0_SIZE;
+    ct->banks[WINDOW_ROM1].memory = rom + cartridge_rom1_bank(ct) * BANK_ROM1_SIZE;
+
+    if (cartridge_clock_selected(ct))
+    {
+        // The whole window shows the latched value of the register
+        memset(ct->clock.memory, ct->rtc->latched[ct->ram_bank - RTC_REG_FIRST], ct->clock.size);
+        ct->banks[WINDOW_RAM].memory = ct->clock.memory;
+    }
+    else if (ct->ram_size > 0)
+    {
+        ct->banks[WINDOW_RAM].memory = ct->save.memory + cartridge_ram_bank(ct) * BANK_RAM_SIZE;
+    }
+}
+
+/**
+ * @brief Initiates a cartridge, its battery backed external RAM mapped from
+ *        the save file if with_save, private otherwise
+ */
+static int cartridge_init_save(cartridge_t *cartridge, const char *filename, bit_t with_save)
+{
+    M_REQUIRE_NON_NULL(cartridge);
+    M_REQUIRE_NON_NULL(filename);
+
+    memset(cartridge, 0, sizeof(cartridge_t));
+    M_EXIT_IF_ERR(cartridge_init_from_file(&cartridge->c, filename));
+
+    // Find the memory bank controller in the header
+    const data_t type = cartridge->c.mem->memory[CARTRIDGE_TYPE_ADDR];
+    const cartridge_kind_t *kind = NULL;
+    for (size_t i = 0; i < sizeof(cartridge_kinds) / sizeof(cartridge_kinds[0]); ++i)
+    {
+        if (cartridge_kinds[i].type == type)
+        {
+            kind = &cartridge_kinds[i];
+        }
+    }
+    const data_t ram_code = cartridge->c.mem->memory[CARTRIDGE_RAM_SIZE_ADDR];
+    if (kind == NULL || (kind->ram && ram_code >= sizeof(cartridge_ram_sizes) / sizeof(cartridge_ram_sizes[0])))
+    {
+        cartridge_free(cartridge);
+        return ERR_NOT_IMPLEMENTED;
+    }
+
+    cartridge->mbc = kind->mbc;
+    cartridge->battery = kind->battery && with_save;
+    cartridge->ram_enabled = kind->mbc == MBC_NONE; // no register to enable it
+    if (kind->ram && cartridge_ram_sizes[ram_code] > 0)
+    {
+        // The window always shows a whole bank, even of a 2 KiB RAM
+        cartridge->ram_size = cartridge_ram_sizes[ram_code] < BANK_RAM_SIZE ? BANK_RAM_SIZE : cartridge_ram_sizes[ram_code];
+    }
+
+    // External RAM, followed by the clock
+    const size_t save_size = cartridge->ram_size + (kind->clock ? sizeof(cartridge_rtc_t) : 0);
+    if (save_size > 0)
     {
-        // Check if number of read elements is correct
-        if (fread(c->mem->memory, sizeof(uint8_t), BANK_ROM_SIZE, input) != BANK_ROM_SIZE)
+        if (cartridge->battery)
         {
-            component_free(c);
-            fclose(input); // Close stream in case of error
-            return ERR_IO;
+            M_EXIT_IF_ERR_DO_SOMETHING(cartridge_map_save(&cartridge->save, filename, save_size),
+                                       cartridge_free(cartridge));
         }
-        c->mem->size = BANK_ROM_SIZE;
-        // Check if type of cartridge is correct
-        if (c->mem->memory[CARTRIDGE_TYPE_ADDR] != 0)
+        else
         {
-            component_free(c);
-            fclose(input); // Close stream in case of error
-            return ERR_NOT_IMPLEMENTED;
+            M_EXIT_IF_ERR_DO_SOMETHING(mem_create(&cartridge->save, save_size), cartridge_free(cartridge));
         }
-        fclose(input); // Close stream after success
     }
+    if (kind->clock)
+    {
+        M_EXIT_IF_ERR_DO_SOMETHING(mem_create(&cartridge->clock, BANK_RAM_SIZE), cartridge_free(cartridge));
+        cartridge->rtc = (cartridge_rtc_t *)(cartridge->save.memory + cartridge->ram_size);
+        if (cartridge->rtc->base == 0 && cartridge->rtc->stopped == 0)
+        {
+            // New save file: the clock starts now
+            cartridge->rtc->base = (int64_t)time(NULL);
+        }
+    }
+
+    // Windows
+    cartridge->banks[WINDOW_ROM0].size = BANK_ROM0_SIZE;
+    cartridge->banks[WINDOW_ROM1].size = BANK_ROM1_SIZE;
+    cartridge->banks[WINDOW_RAM].size = BANK_RAM_SIZE;
+    cartridge->rom0.mem = &cartridge->banks[WINDOW_ROM0];
+    cartridge->rom1.mem = &cartridge->banks[WINDOW_ROM1];
+    cartridge->ram.mem = save_size > 0 ? &cartridge->banks[WINDOW_RAM] : NULL;
+    cartridge_select_banks(cartridge);
+
     return ERR_NONE;
 }
 
 // ==== see cartridge.h ========================================
 int cartridge_init(cartridge_t *cartridge, const char *filename)
 {
-    M_REQUIRE_NON_NULL(cartridge);
-    M_REQUIRE_NON_NULL(filename);
+    return cartridge_init_save(cartridge, filename, 0);
+}
 
-    memset(cartridge, 0, sizeof(cartridge_t));
-    M_EXIT_IF_ERR(component_create(&cartridge->c, BANK_ROM_SIZE));
+// ==== see cartridge.h ========================================
+int cartridge_init_with_save(cartridge_t *cartridge, const char *filename)
+{
+    return cartridge_init_save(cartridge, filename, 1);
+}
+
+// ==== see cartridge.h ========================================
+int cartridge_clone(cartridge_t *ct, const cartridge_t *model, bus_pages_t *pages)
+{
+    M_REQUIRE_NON_NULL(ct);
+    M_REQUIRE_NON_NULL(model);
+    M_REQUIRE_NON_NULL(model->c.mem);
 
-    return cartridge_init_from_file(&cartridge->c, filename);
+    *ct = *model;
+    rom_image_take(ct->c.mem);
+    ct->rom0.mem = &ct->banks[WINDOW_ROM0];
+    ct->rom1.mem = &ct->banks[WINDOW_ROM1];
+    ct->ram.mem = model->ram.mem != NULL ? &ct->banks[WINDOW_RAM] : NULL;
+
+    // The external RAM (and the clock after it) is copied, even from a save file
+    memset(&ct->save, 0, sizeof(ct->save));
+    memset(&ct->clock, 0, sizeof(ct->clock));
+    ct->rtc = NULL;
+    ct->battery = 0;
+    if (model->save.memory != NULL)
+    {
+        M_EXIT_IF_ERR_DO_SOMETHING(mem_create(&ct->save, model->save.size), cartridge_free(ct));
+        memcpy(ct->save.memory, model->save.memory, model->save.size);
+    }
+    if (model->clock.memory != NULL)
+    {
+        M_EXIT_IF_ERR_DO_SOMETHING(mem_create(&ct->clock, model->clock.size), cartridge_free(ct));
+        memcpy(ct->clock.memory, model->clock.memory, model->clock.size);
+        ct->rtc = (cartridge_rtc_t *)(ct->save.memory + ct->ram_size);
+    }
+    cartridge_select_banks(ct);
+
+    if (pages != NULL && ct->ram.mem != NULL && ct->banks[WINDOW_RAM].memory != NULL)
+    {
+        M_EXIT_IF_ERR_DO_SOMETHING(bus_pages_remap(pages, &ct->ram, 0), cartridge_free(ct));
+    }
+    return ERR_NONE;
 }
 
 // ==== see cartridge.h ========================================
@@ -69,16 +564,289 @@ int cartridge_plug(cartridge_t *ct, bus_t bus)
 {
     M_REQUIRE_NON_NULL(ct);
     M_REQUIRE_NON_NULL(bus);
+    M_REQUIRE_NON_NULL(ct->c.mem);
+
+    // Plugs the windows of the cartridge to the bus
+    cartridge_select_banks(ct);
+    M_EXIT_IF_ERR(bus_forced_plug(bus, &ct->rom0, BANK_ROM0_START, BANK_ROM0_END, 0));
+    M_EXIT_IF_ERR(bus_forced_plug(bus, &ct->rom1, BANK_ROM1_START, BANK_ROM1_END, 0));
+    if (ct->ram.mem != NULL && ct->banks[WINDOW_RAM].memory != NULL)
+    {
+        M_EXIT_IF_ERR(bus_forced_plug(bus, &ct->ram, BANK_RAM_START, BANK_RAM_END, 0));
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Traps the writes to the RAM window while they must not reach the RAM
+ */
+static int cartridge_protect_ram(const cartridge_t *ct, bus_pages_t *pages)
+{
+    if (ct->ram.mem == NULL)
+    {
+        return ERR_NONE; // the RAM window is not ours
+    }
+    return bus_pages_protect(pages, BANK_RAM_START, BANK_RAM_END, !ct->ram_enabled || cartridge_clock_selected(ct));
+}
 
-    // Plugs the cartridge to the bus
-    return bus_forced_plug(bus, &ct->c, BANK_ROM0_START, BANK_ROM1_END, 0);
+// ==== see cartridge.h ========================================
+int cartridge_protect(const cartridge_t *ct, bus_pages_t *pages)
+{
+    M_REQUIRE_NON_NULL(ct);
+    M_REQUIRE_NON_NULL(pages);
+    M_REQUIRE_NON_NULL(ct->c.mem);
+
+    M_EXIT_IF_ERR(bus_pages_protect(pages, BANK_ROM0_START, BANK_ROM1_END, true));
+    return cartridge_protect_ram(ct, pages);
+}
+
+/**
+ * @brief Time of the clock of a cartridge, in s
+ */
+static int64_t cartridge_now(const cartridge_t *ct)
+{
+    return ct->cycles != NULL ? (int64_t)(*ct->cycles / GB_CYCLES_PER_S) : (int64_t)time(NULL);
 }
 
+// ==== see cartridge.h ========================================
+void cartridge_count_cycles(cartridge_t *ct, const uint64_t *cycles)
+{
+    if (ct == NULL || cycles == NULL || ct->battery)
+    {
+        return;
+    }
+    ct->cycles = cycles;
+    if (ct->rtc != NULL)
+    {
+        memset(ct->rtc, 0, sizeof(cartridge_rtc_t));
+        ct->rtc->base = cartridge_now(ct);
+    }
+}
+
+/**
+ * @brief Sets the register of the memory bank controller written at addr
+ */
+static void cartridge_mbc_write(cartridge_t *ct, addr_t addr, data_t data)
+{
+    if (addr <= MBC_RAM_ENABLE_END)
+    {
+        ct->ram_enabled = (data & 0x0F) == MBC_RAM_ENABLE_VALUE;
+    }
+    else if (addr <= MBC_ROM_BANK_END)
+    {
+        if (ct->mbc != MBC_5)
+        {
+            ct->rom_bank = data;
+        }
+        else if (addr <= MBC5_ROM_BANK_LO_END)
+        {
+            ct->rom_bank = (uint16_t)((ct->rom_bank & 0x100) | data);
+        }
+        else
+        {
+            ct->rom_bank = (uint16_t)((ct->rom_bank & 0xFF) | (data & 0x01) << 8);
+        }
+    }
+    else if (addr <= MBC_RAM_BANK_END)
+    {
+        ct->ram_bank = data;
+    }
+    else if (ct->mbc == MBC_1)
+    {
+        ct->mode = data & 0x01;
+    }
+    else if (ct->mbc == MBC_3 && ct->rtc != NULL)
+    {
+        // Writing 0 then 1 latches the clock
+        if (ct->rtc->latch == 0 && data == 1)
+        {
+            rtc_get(ct->rtc, cartridge_now(ct), ct->rtc->latched);
+        }
+        ct->rtc->latch = data;
+    }
+}
+
+/**
+ * @brief Points a window to its (new) bank, through the page table if any
+ */
+static int cartridge_remap(component_t *window, cpu_t *cpu)
+{
+    if (cpu->pages != NULL)
+    {
+        // The bus_t entries are synced later, see bus_pages_sync
+        return bus_pages_remap(cpu->pages, window, 0);
+    }
+    return bus_remap(*cpu->bus, window, 0);
+}
+
+/**
+ * @brief Points the windows to the banks selected by the registers, and
+ *        remaps those which have changed
+ */
+static int cartridge_switch_banks(cartridge_t *ct, cpu_t *cpu)
+{
+    const data_t *before[] = {ct->banks[WINDOW_ROM0].memory, ct->banks[WINDOW_ROM1].memory,
+                              ct->banks[WINDOW_RAM].memory};
+    cartridge_select_banks(ct);
+
+    if (ct->banks[WINDOW_ROM0].memory != before[WINDOW_ROM0])
+    {
+        M_EXIT_IF_ERR(cartridge_remap(&ct->rom0, cpu));
+        decode_cache_invalidate_range(cpu->decode_cache, BANK_ROM0_START, BANK_ROM0_END);
+    }
+    if (ct->banks[WINDOW_ROM1].memory != before[WINDOW_ROM1])
+    {
+        M_EXIT_IF_ERR(cartridge_remap(&ct->rom1, cpu));
+        // Instructions are decoded once per bank
+        decode_cache_set_bank(cpu->decode_cache, (uint16_t)cartridge_rom1_bank(ct));
+    }
+    if (ct->ram.mem != NULL && ct->banks[WINDOW_RAM].memory != before[WINDOW_RAM])
+    {
+        M_EXIT_IF_ERR(cartridge_remap(&ct->ram, cpu));
+        decode_cache_invalidate_range(cpu->decode_cache, BANK_RAM_START, BANK_RAM_END);
+    }
+    return cartridge_protect_ram(ct, cpu->pages);
+}
+
+// ==== see cartridge.h ========================================
+int cartridge_bus_listener(cartridge_t *ct, cpu_t *cpu)
+{
+    M_REQUIRE_NON_NULL(ct);
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
+
+    bus_pages_t *pages = cpu->pages;
+    if (pages == NULL || !pages->trap.pending || ct->c.mem == NULL)
+    {
+        return ERR_NONE;
+    }
+    const addr_t addr = pages->trap.addr;
+    const data_t data = pages->trap.data;
+    if (addr <= BANK_ROM1_END)
+    {
+        if (ct->mbc == MBC_NONE)
+        {
+            pages->trap.pending = 0;
+            return ERR_NONE; // a ROM cannot be written
+        }
+        cartridge_mbc_write(ct, addr, data);
+    }
+    else if (addr >= BANK_RAM_START && addr <= BANK_RAM_END && ct->ram.mem != NULL)
+    {
+        // Clock registers, or disabled RAM
+        if (ct->ram_enabled && cartridge_clock_selected(ct))
+        {
+            rtc_set(ct->rtc, (rtc_reg_t)(ct->ram_bank - RTC_REG_FIRST), data, cartridge_now(ct));
+        }
+    }
+    else
+    {
+        return ERR_NONE; // not for the cartridge
+    }
+    pages->trap.pending = 0;
+
+    return cartridge_switch_banks(ct, cpu);
+}
+
+// The state of a cartridge is followed by its external RAM (and clock)
+typedef struct
+{
+    uint64_t rom;      // see cartridge_rom_id
+    uint32_t save_size;
+    uint16_t rom_bank;
+    uint8_t ram_bank;
+    uint8_t mode;
+    uint8_t ram_enabled;
+} cartridge_state_t;
+
+// ==== see cartridge.h ========================================
+uint64_t cartridge_rom_id(const cartridge_t *ct)
+{
+    if (ct == NULL || ct->c.mem == NULL)
+    {
+        return 0;
+    }
+    return rom_image_hash(ct->c.mem);
+}
+
+// ==== see cartridge.h ========================================
+size_t cartridge_state_size(const cartridge_t *ct)
+{
+    return ct == NULL ? 0 : sizeof(cartridge_state_t) + ct->save.size;
+}
+
+// ==== see cartridge.h ========================================
+int cartridge_save_state(const cartridge_t *ct, uint8_t *state)
+{
+    M_REQUIRE_NON_NULL(ct);
+    M_REQUIRE_NON_NULL(ct->c.mem);
+    M_REQUIRE_NON_NULL(state);
+
+    // Same bytes for the same state, padding included
+    cartridge_state_t regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.rom = cartridge_rom_id(ct);
+    regs.save_size = (uint32_t)ct->save.size;
+    regs.rom_bank = ct->rom_bank;
+    regs.ram_bank = ct->ram_bank;
+    regs.mode = ct->mode;
+    regs.ram_enabled = ct->ram_enabled;
+    memcpy(state, &regs, sizeof(regs));
+    if (ct->save.size > 0)
+    {
+        memcpy(state + sizeof(regs), ct->save.memory, ct->save.size);
+    }
+    return ERR_NONE;
+}
+
+// ==== see cartridge.h ========================================
+int cartridge_load_state(cartridge_t *ct, cpu_t *cpu, const uint8_t *state)
+{
+    M_REQUIRE_NON_NULL(ct);
+    M_REQUIRE_NON_NULL(ct->c.mem);
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE_NON_NULL(cpu->pages);
+    M_REQUIRE_NON_NULL(state);
+
+    cartridge_state_t regs;
+    memcpy(&regs, state, sizeof(regs));
+    M_REQUIRE(regs.rom == cartridge_rom_id(ct) && regs.save_size == ct->save.size, ERR_BAD_PARAMETER,
+              "state of another ROM (%zu bytes of RAM)", (size_t)regs.save_size);
+
+    // Only a RAM which has changed may hold stale decoded instructions
+    const data_t *save = state + sizeof(regs);
+    if (ct->save.size > 0 && memcmp(ct->save.memory, save, ct->save.size) != 0)
+    {
+        memcpy(ct->save.memory, save, ct->save.size);
+        decode_cache_invalidate_range(cpu->decode_cache, BANK_RAM_START, BANK_RAM_END);
+    }
+    ct->rom_bank = regs.rom_bank;
+    ct->ram_bank = regs.ram_bank;
+    ct->mode = regs.mode;
+    ct->ram_enabled = regs.ram_enabled;
+
+    return cartridge_switch_banks(ct, cpu);
+}
+
+
 // ==== see cartridge.h ========================================
 void cartridge_free(cartridge_t *ct)
 {
     if (ct != NULL)
     {
-        component_free(&ct->c);
+        cartridge_free_from_file(&ct->c);
+
+        if (ct->battery && ct->save.memory != NULL)
+        {
+            munmap(ct->save.memory, ct->save.size);
+        }
+        else
+        {
+            mem_free(&ct->save);
+        }
+        mem_free(&ct->clock);
+
+        // The windows only point into the memories freed above
+        memset(ct, 0, sizeof(cartridge_t));
     }
 }
@@ -12,6 +12,7 @@
 
 #include "component.h"
 #include "bus.h"
+#include "cpu.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,29 +28,115 @@ extern "C" {
 
 #define BANK_ROM_SIZE    (BANK_ROM0_SIZE + BANK_ROM1_SIZE)
 
+#define BANK_RAM_START   0xA000
+#define BANK_RAM_END     0xBFFF
+#define BANK_RAM_SIZE    ((BANK_RAM_END - BANK_RAM_START) + 1)
+
 #define CARTRIDGE_GAME_TITLE_START 0x0134
 #define CARTRIDGE_GAME_TITLE_END   0x0143
 #define CARTRIDGE_TYPE_ADDR        0x0147
+#define CARTRIDGE_RAM_SIZE_ADDR    0x0149
+
+// Memory bank controller registers (written through the ROM)
+#define MBC_RAM_ENABLE_END   0x1FFF
+#define MBC_ROM_BANK_END     0x3FFF
+#define MBC5_ROM_BANK_LO_END 0x2FFF
+#define MBC_RAM_BANK_END     0x5FFF
+#define MBC_MODE_END         0x7FFF
+
+#define MBC_RAM_ENABLE_VALUE 0x0A
+
+// MBC3 real time clock registers, selected as RAM banks 0x08 to 0x0C
+#define RTC_REG_FIRST  0x08
+#define RTC_NB_REGS    5
+
+/**
+ * @brief Memory bank controller of a cartridge
+ */
+typedef enum {
+    MBC_NONE, MBC_1, MBC_3, MBC_5
+} mbc_kind_t;
 
 /**
- * @brief Cartridge type
+ * @brief Index of the MBC3 clock registers
+ */
+typedef enum {
+    RTC_S, RTC_M, RTC_H, RTC_DL, RTC_DH
+} rtc_reg_t;
+
+#define RTC_DH_DAY_MSB 0x01
+#define RTC_DH_HALT    0x40
+#define RTC_DH_CARRY   0x80
+
+/**
+ * @brief MBC3 real time clock, kept after the external RAM in the save
+ *        file so that it goes on counting while the emulator is not running
+ */
+typedef struct {
+    int64_t base;    // host time (in s) at which the running clock was at 0
+    int64_t stopped; // clock value (in s) while it is halted
+    uint8_t latched[RTC_NB_REGS]; // values seen by the game
+    uint8_t halt;
+    uint8_t carry;   // the day counter has overflowed
+    uint8_t latch;   // last value written to the latch register
+} cartridge_rtc_t;
+
+/**
+ * @brief Cartridge type.
+ *        The ROM and the external RAM are never copied: c shows the ROM,
+ *        mapped read-only from its file (and thus shared by all the
+ *        processes and cartridges running it, see cartridge_init_from_file),
+ *        save owns the external RAM, mapped from the save file for
+ *        battery backed cartridges opened by cartridge_init_with_save,
+ *        private otherwise. The bus sees them
+ *        through three windows (ROM bank 0, switchable ROM bank, RAM bank)
+ *        which are repointed when the memory bank controller switches banks.
  */
 typedef struct {
-    component_t c;
+    component_t c;         // whole ROM
+    component_t rom0;      // BANK_ROM0 window
+    component_t rom1;      // BANK_ROM1 window
+    component_t ram;       // BANK_RAM window, unused if the cartridge has neither RAM nor clock
+    memory_t banks[3];     // part of the ROM (or RAM) seen through each window
+    memory_t save;         // external RAM, followed by the clock if any
+    memory_t clock;        // what the RAM window shows when a clock register is selected
+    cartridge_rtc_t* rtc;  // NULL if the cartridge has no clock
+    const uint64_t* cycles; // emulated time of the clock, host time if NULL (see cartridge_count_cycles)
+    size_t ram_size;       // size of the external RAM in save
+    mbc_kind_t mbc;
+    bit_t battery;         // 1 if save is mapped from a file
+    bit_t ram_enabled;
+    uint8_t mode;          // MBC1 banking mode
+    uint16_t rom_bank;     // MBC register (low bits only for MBC1)
+    uint8_t ram_bank;      // MBC register (also the high bits of the ROM bank for MBC1)
 } cartridge_t;
 
 /**
- * @brief Reads a file into the memory of a component
+ * @brief Maps a file read-only into the memory of a component. The ROM
+ *        images are registered by the hash of their content: the
+ *        components showing the same ROM (even read from different files)
+ *        share a single mapping, released with the last of them.
  *
- * @param c component to write to
- * @param filename file to read from
+ * @param c component to map to, with no memory yet
+ * @param filename file to map
  * @return error code
  */
 int cartridge_init_from_file(component_t* c, const char* filename);
 
 
 /**
- * @brief Initiates a cartridge given a filename
+ * @brief Releases a component initiated by cartridge_init_from_file
+ *
+ * @param c component to release
+ */
+void cartridge_free_from_file(component_t* c);
+
+
+/**
+ * @brief Initiates a cartridge given a filename. The external RAM is
+ *        private, even for a battery backed cartridge: nothing is written
+ *        next to the ROM, and cartridges running the same ROM never share
+ *        their RAM.
  *
  * @param ct cartridge to initiate
  * @param filename file to read from
@@ -59,7 +146,47 @@ int cartridge_init(cartridge_t* ct, const char* filename);
 
 
 /**
- * @brief Plugs a cartridge to the bus
+ * @brief Initiates a cartridge given a filename, like cartridge_init, but
+ *        battery backed external RAM is mapped from filename with the
+ *        extension replaced by .sav, created if needed, so that it is kept
+ *        from one run to the next.
+ *
+ * @param ct cartridge to initiate
+ * @param filename file to read from
+ * @return error code
+ */
+int cartridge_init_with_save(cartridge_t* ct, const char* filename);
+
+
+/**
+ * @brief Drives the clock of a cartridge (if any) by the emulated time
+ *        instead of the host time: it restarts at 0 and counts a second
+ *        every GB_CYCLES_PER_S cycles, so that a run is reproduced exactly,
+ *        on any host and at any time (see movie.h). A clock kept in a save
+ *        file goes on following the host time.
+ *
+ * @param ct cartridge
+ * @param cycles cycles run by the gameboy of the cartridge
+ */
+void cartridge_count_cycles(cartridge_t* ct, const uint64_t* cycles);
+
+
+/**
+ * @brief Initiates a cartridge as a copy of another one, in the same
+ *        state. The ROM is shared with the model, the external RAM is
+ *        copied: the copy never writes to the save file of the model.
+ *
+ * @param ct cartridge to initiate
+ * @param model cartridge to copy
+ * @param pages page table showing the windows of ct, copied from the one of
+ *        model: its RAM window is moved to the copy of the RAM (may be NULL)
+ * @return error code
+ */
+int cartridge_clone(cartridge_t* ct, const cartridge_t* model, bus_pages_t* pages);
+
+
+/**
+ * @brief Plugs a cartridge to the bus, with its current banks
  *
  * @param ct cartridge to plug
  * @param bus bus to plug into
@@ -68,6 +195,74 @@ int cartridge_init(cartridge_t* ct, const char* filename);
 int cartridge_plug(cartridge_t* ct, bus_t bus);
 
 
+/**
+ * @brief Makes the writes to the cartridge trapped by the page table of
+ *        the bus, for cartridge_bus_listener. To be called once the page
+ *        table is up to date.
+ *
+ * @param ct cartridge plugged into the bus
+ * @param pages page table of the bus
+ * @return error code
+ */
+int cartridge_protect(const cartridge_t* ct, bus_pages_t* pages);
+
+
+/**
+ * @brief Handles a write trapped by the page table of the cpu (see
+ *        cartridge_protect): sets the registers of the memory bank
+ *        controller and switches banks accordingly
+ *
+ * @param ct cartridge plugged into the bus of cpu
+ * @param cpu cpu that has written
+ * @return error code
+ */
+int cartridge_bus_listener(cartridge_t* ct, cpu_t* cpu);
+
+
+/**
+ * @brief Identifies the ROM of a cartridge by a hash of its whole content
+ *        (see cartridge_init_from_file), which does not depend on the
+ *        host: revisions or patched versions of a game sharing its header
+ *        differ
+ *
+ * @param ct cartridge
+ * @return the id, 0 if ct is NULL or has no ROM
+ */
+uint64_t cartridge_rom_id(const cartridge_t* ct);
+
+
+/**
+ * @brief Gets the size of the state of a cartridge (see cartridge_save_state)
+ *
+ * @param ct cartridge
+ * @return size in bytes, 0 if ct is NULL
+ */
+size_t cartridge_state_size(const cartridge_t* ct);
+
+
+/**
+ * @brief Saves the state of a cartridge: the registers of its memory bank
+ *        controller and its external RAM (with its clock, if any)
+ *
+ * @param ct cartridge to save
+ * @param state buffer of cartridge_state_size(ct) bytes
+ * @return error code
+ */
+int cartridge_save_state(const cartridge_t* ct, uint8_t* state);
+
+
+/**
+ * @brief Restores a state saved by cartridge_save_state from the same
+ *        ROM, and switches banks accordingly
+ *
+ * @param ct cartridge plugged into the bus of cpu
+ * @param cpu cpu using the page table of the bus
+ * @param state state to restore
+ * @return error code (ERR_BAD_PARAMETER if the state is of another ROM)
+ */
+int cartridge_load_state(cartridge_t* ct, cpu_t* cpu, const uint8_t* state);
+
+
 /**
  * @brief Frees a cartridge
  *
@@ -32,7 +32,7 @@ int component_create(component_t *c, size_t mem_size)
     }
 
     // Allocate memory space to the component
-    component.mem = calloc(mem_size, sizeof(memory_t));
+    component.mem = calloc(1, sizeof(memory_t));
     M_EXIT_IF_NULL(component.mem, sizeof(memory_t));
 
     // Call mem_create and get potential errors
@@ -70,6 +70,7 @@ int cpu_combine_alu_flags(cpu_t *cpu,
     CHECK_FLAG_SRC(N);
     CHECK_FLAG_SRC(H);
     CHECK_FLAG_SRC(C);
+    cpu_flags_sync(cpu);
 
     flags_t res_f = 0;
 
@@ -90,6 +91,192 @@ int cpu_combine_alu_flags(cpu_t *cpu,
     return ERR_NONE;
 }
 
+// ==== see cpu-alu.h ========================================
+flags_t cpu_flags_get(const cpu_t *cpu)
+{
+    if (cpu == NULL || cpu->lazy.op == LAZY_NONE)
+    {
+        return cpu == NULL ? 0 : cpu->F;
+    }
+
+    flags_t f = cpu->F & FLAG_C;
+    if (cpu->lazy.res == 0)
+        set_Z(&f);
+
+    switch (cpu->lazy.op)
+    {
+    case LAZY_SUB:
+        set_N(&f);
+    // fallthrough
+    case LAZY_ADD:
+        // carry out of bit 3, with or without carry in
+        if ((cpu->lazy.x ^ cpu->lazy.y ^ cpu->lazy.res) & 0x10)
+            set_H(&f);
+        break;
+
+    case LAZY_AND:
+        set_H(&f);
+        break;
+
+    default:
+        break;
+    }
+
+    return f;
+}
+
+// ==== see cpu-alu.h ========================================
+void cpu_flags_sync(cpu_t *cpu)
+{
+    if (cpu != NULL && cpu->lazy.op != LAZY_NONE)
+    {
+        cpu->F = cpu_flags_get(cpu);
+        cpu->lazy.op = LAZY_NONE;
+    }
+}
+
+/**
+ * @brief Records a pending flags computation and sets the C flag
+ *        (left unchanged by INC and DEC)
+ */
+static void lazy_record(cpu_t *cpu, lazy_op_t op, data_t x, data_t y, data_t res, int carry)
+{
+    cpu->lazy.op = (uint8_t)op;
+    cpu->lazy.x = x;
+    cpu->lazy.y = y;
+    cpu->lazy.res = res;
+    if (carry >= 0)
+    {
+        cpu->F = carry ? FLAG_C : 0;
+    }
+}
+
+/**
+ * @brief Executes the 8-bit arithmetic and logic instructions in lazy flags
+ *        mode (see cpu_enable_lazy_flags). Other instructions are left to
+ *        cpu_dispatch_alu.
+ *
+ * @param lu instruction
+ * @param cpu the CPU which shall execute
+ * @param done set to true if the instruction has been executed
+ * @return error code
+ */
+static int cpu_dispatch_alu_lazy(const instruction_t *lu, cpu_t *cpu, bool *done)
+{
+    data_t y = 0;
+    *done = true;
+
+    switch (lu->family)
+    {
+    case INC_R8:
+    case DEC_R8:
+    {
+        const reg_kind reg = extract_reg(lu->opcode, 3);
+        const data_t x = cpu_reg_get(cpu, reg);
+        const data_t res = (data_t)(lu->family == INC_R8 ? x + 1 : x - 1);
+        cpu_reg_set(cpu, reg, res);
+        lazy_record(cpu, lu->family == INC_R8 ? LAZY_ADD : LAZY_SUB, x, 1, res, -1);
+        return ERR_NONE;
+    }
+
+    case INC_HLR:
+    case DEC_HLR:
+    {
+        const data_t x = cpu_read_at_HL(cpu);
+        const data_t res = (data_t)(lu->family == INC_HLR ? x + 1 : x - 1);
+        M_EXIT_IF_ERR(cpu_write_at_HL(cpu, res));
+        lazy_record(cpu, lu->family == INC_HLR ? LAZY_ADD : LAZY_SUB, x, 1, res, -1);
+        return ERR_NONE;
+    }
+
+    case ADD_A_R8:
+    case SUB_A_R8:
+    case AND_A_R8:
+    case OR_A_R8:
+    case XOR_A_R8:
+    case CP_A_R8:
+        y = cpu_reg_get(cpu, extract_reg(lu->opcode, 0));
+        break;
+
+    case ADD_A_HLR:
+    case SUB_A_HLR:
+    case AND_A_HLR:
+    case OR_A_HLR:
+    case XOR_A_HLR:
+    case CP_A_HLR:
+        y = cpu_read_at_HL(cpu);
+        break;
+
+    case ADD_A_N8:
+    case SUB_A_N8:
+    case AND_A_N8:
+    case OR_A_N8:
+    case XOR_A_N8:
+    case CP_A_N8:
+        y = cpu_read_data_after_opcode(cpu);
+        break;
+
+    default:
+        *done = false;
+        return ERR_NONE;
+    }
+
+    const data_t x = cpu->A;
+
+    switch (lu->family)
+    {
+    case ADD_A_R8:
+    case ADD_A_HLR:
+    case ADD_A_N8:
+    {
+        const unsigned sum = (unsigned)x + y + extract_carry(cpu, lu->opcode);
+        cpu->A = (data_t)sum;
+        lazy_record(cpu, LAZY_ADD, x, y, cpu->A, sum > 0xFF);
+    }
+    break;
+
+    case SUB_A_R8:
+    case SUB_A_HLR:
+    case SUB_A_N8:
+    case CP_A_R8:
+    case CP_A_HLR:
+    case CP_A_N8:
+    {
+        // CP never uses the carry (its opcodes have the same bit set as SBC)
+        const unsigned sub = lu->family == CP_A_R8 || lu->family == CP_A_HLR || lu->family == CP_A_N8 ?
+                             y : (unsigned)y + extract_carry(cpu, lu->opcode);
+        const data_t res = (data_t)(x - sub);
+        lazy_record(cpu, LAZY_SUB, x, y, res, x < sub);
+        if (lu->family != CP_A_R8 && lu->family != CP_A_HLR && lu->family != CP_A_N8)
+        {
+            cpu->A = res;
+        }
+    }
+    break;
+
+    case AND_A_R8:
+    case AND_A_HLR:
+    case AND_A_N8:
+        cpu->A = x & y;
+        lazy_record(cpu, LAZY_AND, x, y, cpu->A, 0);
+        break;
+
+    case OR_A_R8:
+    case OR_A_HLR:
+    case OR_A_N8:
+        cpu->A = x | y;
+        lazy_record(cpu, LAZY_OR, x, y, cpu->A, 0);
+        break;
+
+    default: // XOR
+        cpu->A = x ^ y;
+        lazy_record(cpu, LAZY_OR, x, y, cpu->A, 0);
+        break;
+    }
+
+    return ERR_NONE;
+}
+
 // ======================================================================
 /**
 * @brief Tool function usefull for CHG_U3_R8:
@@ -121,6 +308,17 @@ int cpu_dispatch_alu(const instruction_t *lu, cpu_t *cpu)
 {
     M_REQUIRE_NON_NULL(cpu);
 
+    if (cpu->lazy_flags)
+    {
+        bool done = false;
+        M_EXIT_IF_ERR(cpu_dispatch_alu_lazy(lu, cpu, &done));
+        if (done)
+        {
+            cpu->PC += lu->bytes;
+            return ERR_NONE;
+        }
+    }
+
     switch (lu->family)
     {
 
@@ -245,6 +443,7 @@ int cpu_dispatch_alu(const instruction_t *lu, cpu_t *cpu)
     // All the others are handled elsewhere by provided library
     default:
         // uncomment this line if you have the cs212gbcpuext library
+        cpu_flags_sync(cpu); // the library reads F directly
         M_EXIT_IF_ERR(cpu_dispatch_alu_ext(lu, cpu));
         break;
     } // switch
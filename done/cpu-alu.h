@@ -101,6 +101,23 @@ int cpu_dispatch_alu(const instruction_t* lu, cpu_t* cpu);
 int cpu_combine_alu_flags(cpu_t* cpu,
                           flag_src_t Z, flag_src_t N, flag_src_t H, flag_src_t C);
 
+/**
+ * @brief Computes the value F would have with its pending flags
+ *        (see cpu_enable_lazy_flags), without modifying the cpu
+ *
+ * @param cpu cpu to look at
+ * @return the flags
+ */
+flags_t cpu_flags_get(const cpu_t* cpu);
+
+/**
+ * @brief Writes the pending flags of the cpu, if any, to F.
+ *        Must be called before F is read or written directly.
+ *
+ * @param cpu cpu to update
+ */
+void cpu_flags_sync(cpu_t* cpu);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1671 @@
+/**
+ * @file cpu-block.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Translation of basic blocks to micro-operations, and their execution
+ * @date 2020
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h> // memset
+#include <stddef.h> // offsetof
+#include <stdbool.h>
+
+#include "alu.h"
+#include "bus.h"
+#include "cpu.h"
+#include "error.h"
+#include "opcode.h"
+#include "cpu-decode.h"
+#include "cpu-ops.h"
+#include "cpu-block.h"
+#include "gameboy.h" // REGISTERS_START
+
+#define FLAGS_ALL (FLAG_Z | FLAG_N | FLAG_H | FLAG_C)
+#define INTERRUPTS_MASK 0x1F
+
+// ======================================================================
+// Micro-operations
+
+/**
+ * @brief Kinds of micro-operations.
+ *        Registers are given by their offset in cpu_t (see R8 and R16).
+ */
+typedef enum {
+    // Moves and constants
+    UOP_LD8,      // R8(dst) = R8(src)
+    UOP_LD8_I,    // R8(dst) = imm
+    UOP_LD16,     // R16(dst) = R16(src)
+    UOP_LD16_I,   // R16(dst) = imm
+    UOP_SET_F,    // F = (F & src) | imm
+
+    // 8-bit arithmetic and logic
+    UOP_ALU,      // A = A <dst> R8(src)
+    UOP_ALU_I,    // A = A <dst> imm
+    UOP_INC8,     // ++R8(dst)
+    UOP_DEC8,     // --R8(dst)
+    UOP_ROT,      // R8(dst) = <src>(R8(dst))
+    UOP_ROTA,     // A = <src>(A), Z cleared
+    UOP_BIT,      // test bit imm of R8(src)
+    UOP_RES,      // R8(dst) &= imm
+    UOP_SET,      // R8(dst) |= imm
+    UOP_CPL,
+    UOP_CCF,
+    UOP_DAA,
+
+    // 16-bit arithmetic
+    UOP_INC16,    // ++R16(dst)
+    UOP_DEC16,    // --R16(dst)
+    UOP_ADD_HL,   // HL += R16(src)
+    UOP_ADD_SP,   // SP += (int8_t)imm
+    UOP_LD_HL_SP, // HL = SP + (int8_t)imm
+
+    // Memory accesses, the address is given by an addressing mode
+    UOP_LOAD,     // R8(dst) = [src]
+    UOP_STORE,    // [dst] = R8(src), or imm if src is NO_REG
+    UOP_STORE_SP, // [imm] = SP
+    UOP_ALU_M,    // A = A <dst> [HL]
+    UOP_INC_M,
+    UOP_DEC_M,
+    UOP_ROT_M,    // [HL] = <src>([HL])
+    UOP_BIT_M,    // test bit imm of [HL]
+    UOP_RES_M,    // [HL] &= imm
+    UOP_SET_M,    // [HL] |= imm
+    UOP_PUSH,     // push R16(src)
+    UOP_POP,      // R16(dst) = pop
+
+    // End of block
+    UOP_JP,       // PC = imm
+    UOP_JP_CC,    // PC = imm if condition dst holds
+    UOP_JP_HL,
+    UOP_CALL,     // push PC of the next instruction, PC = imm
+    UOP_CALL_CC,
+    UOP_RET,
+    UOP_RET_CC,
+    UOP_EXIT      // PC = pc, the next instruction is not part of the block
+} uop_kind_t;
+
+typedef enum {
+    AM_BC, AM_DE, AM_HL, AM_HLI, AM_HLD, AM_IMM
+} uop_addr_mode_t;
+
+// In the same order as in the opcodes
+typedef enum {
+    ALU_ADD, ALU_ADC, ALU_SUB, ALU_SBC, ALU_AND, ALU_XOR, ALU_OR, ALU_CP
+} uop_alu_t;
+
+typedef enum {
+    ROT_RLC, ROT_RRC, ROT_RL, ROT_RR, ROT_SLA, ROT_SRA, ROT_SWAP, ROT_SRL
+} uop_rot_t;
+
+typedef enum {
+    CC_NZ, CC_Z, CC_NC, CC_C
+} uop_cc_t;
+
+/**
+ * @brief A micro-operation, and the instruction it comes from.
+ *        Fused micro-operations are given the timing of their last instruction.
+ */
+typedef struct {
+    uint8_t kind;
+    uint8_t dst;
+    uint8_t src;
+    uint8_t live;   // whether the flags written have to be computed
+    uint16_t imm;
+    uint16_t pc;    // address of the instruction
+    uint16_t at;    // cycles between the start of the block and the instruction
+    uint8_t bytes;
+    uint8_t cycles;
+    uint8_t xtra;   // additional cycles of a taken branch
+    uint8_t prev;   // cycles of the previous instruction (0 if none)
+} block_uop_t;
+
+struct block_ {
+    uint16_t addr;      // address of its first instruction, as several share a set
+    uint16_t size;      // in the code ring, in bytes
+    uint16_t last;      // address of the last byte of its code
+    uint16_t bank;      // ROM bank the block was translated from
+    uint16_t span;      // start of its last instruction (in cycles from the start)
+    uint16_t line[2];   // lines of the decode cache covered by its code
+    uint32_t gen[2];    // and their generations at translation time
+    uint8_t nb_instr;
+    uint8_t nb_uops;
+    block_uop_t uops[];
+};
+
+#define NO_REG 0xFF
+
+#define R8(cpu, off) (((uint8_t *)(cpu))[off])
+#define R16(cpu, off) (*(uint16_t *)((uint8_t *)(cpu) + (off)))
+
+#define OFF_A offsetof(cpu_t, A)
+#define OFF_F offsetof(cpu_t, F)
+#define OFF_H offsetof(cpu_t, H)
+#define OFF_L offsetof(cpu_t, L)
+#define OFF_AF offsetof(cpu_t, AF)
+#define OFF_HL offsetof(cpu_t, HL)
+#define OFF_SP offsetof(cpu_t, SP)
+
+// 8-bit registers and pairs other than SP share the first 8 bytes of cpu_t
+_Static_assert(offsetof(cpu_t, AF) == 0 && offsetof(cpu_t, BC) == 2 &&
+               offsetof(cpu_t, DE) == 4 && offsetof(cpu_t, HL) == 6,
+               "block translation expects the register pairs at the start of cpu_t");
+
+// Registers as encoded in the opcodes (see reg_kind)
+static const uint8_t reg_offset[8] = {
+    offsetof(cpu_t, B), offsetof(cpu_t, C), offsetof(cpu_t, D), offsetof(cpu_t, E),
+    offsetof(cpu_t, H), offsetof(cpu_t, L), NO_REG, offsetof(cpu_t, A)
+};
+
+// Register pairs of LD rr, n16, INC rr, DEC rr and ADD HL, rr
+static const uint8_t pair_sp_offset[4] = {
+    offsetof(cpu_t, BC), offsetof(cpu_t, DE), offsetof(cpu_t, HL), offsetof(cpu_t, SP)
+};
+
+// Register pairs of PUSH and POP
+static const uint8_t pair_af_offset[4] = {
+    offsetof(cpu_t, BC), offsetof(cpu_t, DE), offsetof(cpu_t, HL), offsetof(cpu_t, AF)
+};
+
+// ======================================================================
+// Plain memory: the addresses a block may access without another component noticing
+
+static inline bool block_io(addr_t addr)
+{
+    return (addr >= REGISTERS_START && addr <= REGISTERS_END) || addr == REG_IE;
+}
+
+static inline bool block_readable(addr_t addr)
+{
+    return !block_io(addr);
+}
+
+static inline bool block_readable16(addr_t addr)
+{
+    return addr != 0xFFFF && block_readable(addr) && block_readable((addr_t)(addr + 1));
+}
+
+// Writes to the ROM (and to other read-only pages) are kept for the cartridge,
+// watched writes for their watchers
+static inline bool block_writable(const cpu_t *cpu, addr_t addr)
+{
+    return addr >= VIDEO_RAM_START && !block_io(addr) && bus_lookup(cpu_bus(cpu), cpu->pages, addr) != NULL
+           && (cpu->pages == NULL || !cpu->pages->readonly[addr >> BUS_PAGE_BITS]) && !bus_watched(cpu->watch, addr);
+}
+
+static inline bool block_writable16(const cpu_t *cpu, addr_t addr)
+{
+    return addr != 0xFFFF && block_writable(cpu, addr) && block_writable(cpu, (addr_t)(addr + 1));
+}
+
+// ======================================================================
+// Flags read and written by each micro-operation, for the liveness analysis
+
+static uint8_t uop_flags_read(const block_uop_t *u)
+{
+    switch (u->kind)
+    {
+    case UOP_ALU:
+    case UOP_ALU_I:
+    case UOP_ALU_M:
+        return u->dst == ALU_ADC || u->dst == ALU_SBC ? FLAG_C : 0;
+
+    case UOP_ROT:
+    case UOP_ROTA:
+    case UOP_ROT_M:
+        return u->src == ROT_RL || u->src == ROT_RR ? FLAG_C : 0;
+
+    case UOP_CCF:
+        return FLAG_C;
+
+    case UOP_DAA:
+        return FLAG_N | FLAG_H | FLAG_C;
+
+    case UOP_PUSH:
+        return u->src == OFF_AF ? FLAGS_ALL : 0;
+
+    default:
+        return 0;
+    }
+}
+
+static uint8_t uop_flags_written(const block_uop_t *u)
+{
+    switch (u->kind)
+    {
+    case UOP_SET_F:
+        return (uint8_t)(~u->src & FLAGS_ALL);
+
+    case UOP_ALU:
+    case UOP_ALU_I:
+    case UOP_ALU_M:
+    case UOP_ROT:
+    case UOP_ROTA:
+    case UOP_ROT_M:
+    case UOP_ADD_SP:
+    case UOP_LD_HL_SP:
+        return FLAGS_ALL;
+
+    case UOP_INC8:
+    case UOP_DEC8:
+    case UOP_INC_M:
+    case UOP_DEC_M:
+    case UOP_BIT:
+    case UOP_BIT_M:
+        return FLAG_Z | FLAG_N | FLAG_H;
+
+    case UOP_CPL:
+        return FLAG_N | FLAG_H;
+
+    case UOP_CCF:
+    case UOP_ADD_HL:
+        return FLAG_N | FLAG_H | FLAG_C;
+
+    case UOP_DAA:
+        return FLAG_Z | FLAG_H | FLAG_C;
+
+    case UOP_POP:
+        return u->dst == OFF_AF ? FLAGS_ALL : 0;
+
+    default:
+        return 0;
+    }
+}
+
+// Micro-operations which may leave the block before running (the state
+// has then to be exact, flags included)
+static bool uop_may_exit_before(const block_uop_t *u)
+{
+    return u->kind >= UOP_LOAD;
+}
+
+// Micro-operations which may leave the block after running (when they
+// have written to the block's code)
+static bool uop_may_exit_after(const block_uop_t *u)
+{
+    switch (u->kind)
+    {
+    case UOP_STORE:
+    case UOP_STORE_SP:
+    case UOP_INC_M:
+    case UOP_DEC_M:
+    case UOP_ROT_M:
+    case UOP_RES_M:
+    case UOP_SET_M:
+    case UOP_PUSH:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Micro-operations without any effect but on the flags
+static bool uop_flags_only(const block_uop_t *u)
+{
+    switch (u->kind)
+    {
+    case UOP_SET_F:
+    case UOP_BIT:
+    case UOP_BIT_M:
+    case UOP_CCF:
+        return true;
+
+    case UOP_ALU:
+    case UOP_ALU_I:
+    case UOP_ALU_M:
+        return u->dst == ALU_CP;
+
+    default:
+        return false;
+    }
+}
+
+static bool uop_ends_block(const block_uop_t *u)
+{
+    return u->kind >= UOP_JP;
+}
+
+// ======================================================================
+// Translation
+
+/**
+ * @brief Values of the registers and flags known at translation time
+ */
+typedef struct {
+    uint8_t known;  // bit i is set if the register at offset i is known
+    uint8_t val[8];
+    uint8_t fknown; // mask of the known flags
+    uint8_t fval;
+} block_consts_t;
+
+#define is_known(c, off) (((c)->known >> (off)) & 1)
+
+static inline void consts_set(block_consts_t *c, uint8_t off, uint8_t v)
+{
+    c->known = (uint8_t)(c->known | (1 << off));
+    c->val[off] = v;
+}
+
+static inline void consts_clobber(block_consts_t *c, uint8_t off)
+{
+    if (off < 8)
+    {
+        c->known = (uint8_t)(c->known & ~(1 << off));
+    }
+}
+
+static inline void consts_clobber16(block_consts_t *c, uint8_t off)
+{
+    consts_clobber(c, off);
+    consts_clobber(c, (uint8_t)(off + 1));
+}
+
+static inline void consts_set_flags(block_consts_t *c, uint8_t keep, uint8_t v)
+{
+    c->fval = (uint8_t)((c->fval & keep) | v);
+    c->fknown = (uint8_t)(c->fknown | (~keep & FLAGS_ALL));
+}
+
+/**
+ * @brief Translation in progress
+ */
+typedef struct {
+    const cpu_t *cpu;
+    block_uop_t uops[2 * BLOCK_MAX_INSTR + 1];
+    size_t nb_uops;
+    block_uop_t instr; // instruction being translated (timing and address)
+    block_consts_t consts;
+} block_tr_t;
+
+static void emit(block_tr_t *tr, uint8_t kind, uint8_t dst, uint8_t src, uint16_t imm)
+{
+    block_uop_t *u = &tr->uops[tr->nb_uops++];
+    *u = tr->instr;
+    u->kind = kind;
+    u->dst = dst;
+    u->src = src;
+    u->imm = imm;
+    u->live = 1;
+}
+
+/**
+ * @brief Computes an 8-bit ALU operation on constants, with the same
+ *        helpers as at run time
+ *
+ * @return the result, the flags are written to *f
+ */
+static data_t fold_alu(uint8_t op, data_t a, data_t v, uint8_t *f)
+{
+    cpu_t tmp;
+    tmp.F = *f;
+    data_t r = a;
+    switch (op)
+    {
+    case ALU_ADD: r = add8(&tmp, a, v, 0); break;
+    case ALU_ADC: r = add8(&tmp, a, v, CARRY(&tmp)); break;
+    case ALU_SUB: r = sub8(&tmp, a, v, 0); break;
+    case ALU_SBC: r = sub8(&tmp, a, v, CARRY(&tmp)); break;
+    case ALU_AND: r = and8(&tmp, a, v); break;
+    case ALU_XOR: r = xor8(&tmp, a, v); break;
+    case ALU_OR:  r = or8(&tmp, a, v); break;
+    default:      (void)sub8(&tmp, a, v, 0); break;
+    }
+    *f = tmp.F;
+    return r;
+}
+
+/**
+ * @brief Translates A = A op v, v being a constant if known is set
+ */
+static void tr_alu(block_tr_t *tr, uint8_t op, uint8_t src, bool known, data_t v)
+{
+    block_consts_t *c = &tr->consts;
+
+    // XOR A, SUB A and CP A do not depend on A
+    if (src == OFF_A && (op == ALU_XOR || op == ALU_SUB || op == ALU_CP))
+    {
+        const uint8_t f = op == ALU_XOR ? FLAG_Z : FLAG_Z | FLAG_N;
+        if (op != ALU_CP)
+        {
+            emit(tr, UOP_LD8_I, OFF_A, 0, 0);
+            consts_set(c, OFF_A, 0);
+        }
+        emit(tr, UOP_SET_F, OFF_F, 0, f);
+        consts_set_flags(c, 0, f);
+        return;
+    }
+
+    const bool with_carry = op == ALU_ADC || op == ALU_SBC;
+    if (known && is_known(c, OFF_A) && (!with_carry || (c->fknown & FLAG_C)))
+    {
+        uint8_t f = c->fval;
+        data_t r = fold_alu(op, c->val[OFF_A], v, &f);
+        if (op != ALU_CP)
+        {
+            emit(tr, UOP_LD8_I, OFF_A, 0, r);
+            consts_set(c, OFF_A, r);
+        }
+        emit(tr, UOP_SET_F, OFF_F, 0, f);
+        consts_set_flags(c, 0, f);
+        return;
+    }
+
+    if (known)
+    {
+        emit(tr, UOP_ALU_I, op, 0, v);
+    }
+    else
+    {
+        emit(tr, UOP_ALU, op, src, 0);
+    }
+    if (op != ALU_CP)
+    {
+        consts_clobber(c, OFF_A);
+    }
+    c->fknown = 0;
+}
+
+/**
+ * @brief Translates INC r and DEC r
+ */
+static void tr_inc_dec(block_tr_t *tr, bool inc, uint8_t reg)
+{
+    block_consts_t *c = &tr->consts;
+    if (is_known(c, reg))
+    {
+        cpu_t tmp;
+        tmp.F = c->fval;
+        data_t r = inc ? inc8(&tmp, c->val[reg]) : dec8(&tmp, c->val[reg]);
+        emit(tr, UOP_LD8_I, reg, 0, r);
+        emit(tr, UOP_SET_F, OFF_F, FLAG_C, tmp.F & (FLAG_Z | FLAG_N | FLAG_H));
+        consts_set(c, reg, r);
+        consts_set_flags(c, FLAG_C, tmp.F & (FLAG_Z | FLAG_N | FLAG_H));
+        return;
+    }
+    emit(tr, inc ? UOP_INC8 : UOP_DEC8, reg, 0, 0);
+    c->fknown &= FLAG_C;
+}
+
+/**
+ * @brief Tells whether a condition is known at translation time
+ *
+ * @param holds set to the value of the condition, if known
+ */
+static bool cc_known(const block_consts_t *c, uint8_t cc, bool *holds)
+{
+    const uint8_t flag = cc <= CC_Z ? FLAG_Z : FLAG_C;
+    if (!(c->fknown & flag))
+    {
+        return false;
+    }
+    const bool set = (c->fval & flag) != 0;
+    *holds = (cc == CC_Z || cc == CC_C) ? set : !set;
+    return true;
+}
+
+/**
+ * @brief Translates a conditional branch
+ *
+ * @return false if it is known not to be taken (the block goes on)
+ */
+static bool tr_cond(block_tr_t *tr, uint8_t kind, uint8_t always_kind, uint8_t cc, uint16_t target)
+{
+    bool holds = false;
+    if (!cc_known(&tr->consts, cc, &holds))
+    {
+        emit(tr, kind, cc, 0, target);
+        return true;
+    }
+    if (holds)
+    {
+        tr->instr.cycles = (uint8_t)(tr->instr.cycles + tr->instr.xtra);
+        tr->instr.xtra = 0;
+        emit(tr, always_kind, 0, 0, target);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Translates one instruction
+ *
+ * @param tr translation in progress (tr->instr gives its address and timing)
+ * @param lu instruction to translate
+ * @param op its opcode
+ * @return 0 if the instruction cannot be part of a block, 1 if it has been
+ *         translated, 2 if it ends the block
+ */
+static int tr_instr(block_tr_t *tr, const instruction_t *lu, opcode_t op)
+{
+    const cpu_t *cpu = tr->cpu;
+    block_consts_t *c = &tr->consts;
+    const addr_t pc = tr->instr.pc;
+    const data_t n8 = rd(cpu, (addr_t)(pc + 1));
+    const addr_t n16 = rd16(cpu, (addr_t)(pc + 1));
+    const uint8_t r3 = reg_offset[extract_reg(op, 3)];
+    const uint8_t r0 = reg_offset[extract_reg(op, 0)];
+    const uint8_t pair = (uint8_t)extract_reg_pair(op);
+    const uint8_t alu_op = (uint8_t)extract_n3(op);
+    const uint8_t cc = (uint8_t)((op >> 3) & 0x3);
+    const addr_t next = (addr_t)(pc + lu->bytes);
+
+    switch (lu->family)
+    {
+    case NOP:
+        break;
+
+    // ---- loads ----
+    case LD_A_BCR:
+    case LD_A_DER:
+        emit(tr, UOP_LOAD, OFF_A, lu->family == LD_A_BCR ? AM_BC : AM_DE, 0);
+        consts_clobber(c, OFF_A);
+        break;
+
+    case LD_A_HLRU:
+        emit(tr, UOP_LOAD, OFF_A, op == 0x2A ? AM_HLI : AM_HLD, 0);
+        consts_clobber(c, OFF_A);
+        consts_clobber16(c, OFF_HL);
+        break;
+
+    case LD_A_N16R:
+    case LD_A_N8R:
+    {
+        const addr_t addr = lu->family == LD_A_N16R ? n16 : (addr_t)(REGISTERS_START + n8);
+        if (!block_readable(addr)) return 0;
+        emit(tr, UOP_LOAD, OFF_A, AM_IMM, addr);
+        consts_clobber(c, OFF_A);
+    }
+    break;
+
+    case LD_R8_HLR:
+        emit(tr, UOP_LOAD, r3, AM_HL, 0);
+        consts_clobber(c, r3);
+        break;
+
+    case LD_R16SP_N16:
+        emit(tr, UOP_LD16_I, pair_sp_offset[pair], 0, n16);
+        if (pair_sp_offset[pair] != OFF_SP)
+        {
+            consts_set(c, pair_sp_offset[pair], lsb8(n16));
+            consts_set(c, (uint8_t)(pair_sp_offset[pair] + 1), msb8(n16));
+        }
+        break;
+
+    case LD_R8_N8:
+        emit(tr, UOP_LD8_I, r3, 0, n8);
+        consts_set(c, r3, n8);
+        break;
+
+    case POP_R16:
+        emit(tr, UOP_POP, pair_af_offset[pair], 0, 0);
+        consts_clobber16(c, pair_af_offset[pair]);
+        if (pair_af_offset[pair] == OFF_AF) c->fknown = 0;
+        break;
+
+    // ---- stores ----
+    case LD_BCR_A:
+    case LD_DER_A:
+        emit(tr, UOP_STORE, lu->family == LD_BCR_A ? AM_BC : AM_DE, OFF_A, 0);
+        break;
+
+    case LD_HLRU_A:
+        emit(tr, UOP_STORE, op == 0x22 ? AM_HLI : AM_HLD, OFF_A, 0);
+        consts_clobber16(c, OFF_HL);
+        break;
+
+    case LD_HLR_N8:
+        emit(tr, UOP_STORE, AM_HL, NO_REG, n8);
+        break;
+
+    case LD_HLR_R8:
+        emit(tr, UOP_STORE, AM_HL, r0, 0);
+        break;
+
+    case LD_N16R_A:
+    case LD_N8R_A:
+    {
+        const addr_t addr = lu->family == LD_N16R_A ? n16 : (addr_t)(REGISTERS_START + n8);
+        if (!block_writable(cpu, addr)) return 0;
+        emit(tr, UOP_STORE, AM_IMM, OFF_A, addr);
+    }
+    break;
+
+    case LD_N16R_SP:
+        if (!block_writable16(cpu, n16)) return 0;
+        emit(tr, UOP_STORE_SP, 0, 0, n16);
+        break;
+
+    case PUSH_R16:
+        emit(tr, UOP_PUSH, 0, pair_af_offset[pair], 0);
+        break;
+
+    // ---- moves ----
+    case LD_R8_R8:
+        if (is_known(c, r0))
+        {
+            emit(tr, UOP_LD8_I, r3, 0, c->val[r0]);
+            consts_set(c, r3, c->val[r0]);
+        }
+        else
+        {
+            emit(tr, UOP_LD8, r3, r0, 0);
+            consts_clobber(c, r3);
+        }
+        break;
+
+    case LD_SP_HL:
+        emit(tr, UOP_LD16, OFF_SP, OFF_HL, 0);
+        break;
+
+    // ---- 8-bit arithmetic and logic ----
+    case ADD_A_R8:
+    case SUB_A_R8:
+    case AND_A_R8:
+    case OR_A_R8:
+    case XOR_A_R8:
+    case CP_A_R8:
+        tr_alu(tr, alu_op, r0, is_known(c, r0), c->val[r0]);
+        break;
+
+    case ADD_A_N8:
+    case SUB_A_N8:
+    case AND_A_N8:
+    case OR_A_N8:
+    case XOR_A_N8:
+    case CP_A_N8:
+        tr_alu(tr, alu_op, NO_REG, true, n8);
+        break;
+
+    case ADD_A_HLR:
+    case SUB_A_HLR:
+    case AND_A_HLR:
+    case OR_A_HLR:
+    case XOR_A_HLR:
+    case CP_A_HLR:
+        emit(tr, UOP_ALU_M, alu_op, 0, 0);
+        if (alu_op != ALU_CP) consts_clobber(c, OFF_A);
+        c->fknown = 0;
+        break;
+
+    case INC_R8:
+    case DEC_R8:
+        tr_inc_dec(tr, lu->family == INC_R8, r3);
+        break;
+
+    case INC_HLR:
+    case DEC_HLR:
+        emit(tr, lu->family == INC_HLR ? UOP_INC_M : UOP_DEC_M, 0, 0, 0);
+        c->fknown &= FLAG_C;
+        break;
+
+    case ROTA:
+    case ROTCA:
+        emit(tr, UOP_ROTA, OFF_A, (uint8_t)((op >> 3) & 0x3), 0);
+        consts_clobber(c, OFF_A);
+        c->fknown = 0;
+        break;
+
+    case ROTC_R8:
+    case ROT_R8:
+    case SWAP_R8:
+    case SLA_R8:
+    case SRA_R8:
+    case SRL_R8:
+        emit(tr, UOP_ROT, r0, alu_op, 0);
+        consts_clobber(c, r0);
+        c->fknown = 0;
+        break;
+
+    case ROTC_HLR:
+    case ROT_HLR:
+    case SWAP_HLR:
+    case SLA_HLR:
+    case SRA_HLR:
+    case SRL_HLR:
+        emit(tr, UOP_ROT_M, 0, alu_op, 0);
+        c->fknown = 0;
+        break;
+
+    case BIT_U3_R8:
+        emit(tr, UOP_BIT, 0, r0, (uint16_t)extract_n3(op));
+        c->fknown &= FLAG_C;
+        break;
+
+    case BIT_U3_HLR:
+        emit(tr, UOP_BIT_M, 0, 0, (uint16_t)extract_n3(op));
+        c->fknown &= FLAG_C;
+        break;
+
+    case CHG_U3_R8:
+    {
+        const data_t mask = (data_t)(1 << extract_n3(op));
+        const bool set = op >= 0xC0;
+        if (is_known(c, r0))
+        {
+            const data_t v = set ? (data_t)(c->val[r0] | mask) : (data_t)(c->val[r0] & ~mask);
+            emit(tr, UOP_LD8_I, r0, 0, v);
+            consts_set(c, r0, v);
+        }
+        else
+        {
+            emit(tr, set ? UOP_SET : UOP_RES, r0, 0, set ? mask : (data_t)~mask);
+        }
+    }
+    break;
+
+    case CHG_U3_HLR:
+    {
+        const data_t mask = (data_t)(1 << extract_n3(op));
+        const bool set = op >= 0xC0;
+        emit(tr, set ? UOP_SET_M : UOP_RES_M, 0, 0, set ? mask : (data_t)~mask);
+    }
+    break;
+
+    case CPL:
+        if (is_known(c, OFF_A))
+        {
+            const data_t v = (data_t)~c->val[OFF_A];
+            emit(tr, UOP_LD8_I, OFF_A, 0, v);
+            consts_set(c, OFF_A, v);
+            emit(tr, UOP_SET_F, OFF_F, FLAG_Z | FLAG_C, FLAG_N | FLAG_H);
+        }
+        else
+        {
+            emit(tr, UOP_CPL, 0, 0, 0);
+        }
+        consts_set_flags(c, FLAG_Z | FLAG_C, FLAG_N | FLAG_H);
+        break;
+
+    case DAA:
+        emit(tr, UOP_DAA, 0, 0, 0);
+        consts_clobber(c, OFF_A);
+        c->fknown &= FLAG_N;
+        break;
+
+    case SCCF:
+        if (op == 0x37)
+        {
+            emit(tr, UOP_SET_F, OFF_F, FLAG_Z, FLAG_C);
+            consts_set_flags(c, FLAG_Z, FLAG_C);
+        }
+        else if (c->fknown & FLAG_C)
+        {
+            const uint8_t f = (uint8_t)(~c->fval & FLAG_C);
+            emit(tr, UOP_SET_F, OFF_F, FLAG_Z, f);
+            consts_set_flags(c, FLAG_Z, f);
+        }
+        else
+        {
+            emit(tr, UOP_CCF, 0, 0, 0);
+            consts_set_flags(c, FLAG_Z | FLAG_C, 0);
+            c->fknown &= (uint8_t)~FLAG_C;
+        }
+        break;
+
+    // ---- 16-bit arithmetic ----
+    case INC_R16SP:
+    case DEC_R16SP:
+        emit(tr, lu->family == INC_R16SP ? UOP_INC16 : UOP_DEC16, pair_sp_offset[pair], 0, 0);
+        consts_clobber16(c, pair_sp_offset[pair]);
+        break;
+
+    case ADD_HL_R16SP:
+        emit(tr, UOP_ADD_HL, OFF_HL, pair_sp_offset[pair], 0);
+        consts_clobber16(c, OFF_HL);
+        c->fknown &= FLAG_Z;
+        break;
+
+    case LD_HLSP_S8:
+        emit(tr, op == 0xE8 ? UOP_ADD_SP : UOP_LD_HL_SP, 0, 0, n8);
+        if (op != 0xE8) consts_clobber16(c, OFF_HL);
+        c->fknown = 0;
+        break;
+
+    // ---- branches ----
+    case JP_N16:
+        emit(tr, UOP_JP, 0, 0, n16);
+        return 2;
+
+    case JR_E8:
+        emit(tr, UOP_JP, 0, 0, (addr_t)(next + (int8_t)n8));
+        return 2;
+
+    case JP_HL:
+        emit(tr, UOP_JP_HL, 0, 0, 0);
+        return 2;
+
+    case JP_CC_N16:
+        return tr_cond(tr, UOP_JP_CC, UOP_JP, cc, n16) ? 2 : 1;
+
+    case JR_CC_E8:
+        return tr_cond(tr, UOP_JP_CC, UOP_JP, cc, (addr_t)(next + (int8_t)n8)) ? 2 : 1;
+
+    case CALL_N16:
+        emit(tr, UOP_CALL, 0, 0, n16);
+        return 2;
+
+    case RST_U3:
+        emit(tr, UOP_CALL, 0, 0, (addr_t)(extract_n3(op) << 3));
+        return 2;
+
+    case CALL_CC_N16:
+        return tr_cond(tr, UOP_CALL_CC, UOP_CALL, cc, n16) ? 2 : 1;
+
+    case RET:
+        emit(tr, UOP_RET, 0, 0, 0);
+        return 2;
+
+    case RET_CC:
+        return tr_cond(tr, UOP_RET_CC, UOP_RET, cc, 0) ? 2 : 1;
+
+    // LD A, (C), LD (C), A (always I/O), interrupts and control
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Computes which flags are live after each micro-operation:
+ *        those that are not are not computed, and micro-operations whose
+ *        only effect is on dead flags are dropped (kind set to UOP_EXIT + 1).
+ */
+static void tr_liveness(block_tr_t *tr)
+{
+    uint8_t live = FLAGS_ALL; // everything is live after the block
+    for (size_t i = tr->nb_uops; i-- > 0;)
+    {
+        block_uop_t *u = &tr->uops[i];
+        if (uop_ends_block(u))
+        {
+            live = FLAGS_ALL;
+            continue;
+        }
+
+        if (uop_may_exit_after(u))
+        {
+            live = FLAGS_ALL;
+        }
+        const uint8_t written = uop_flags_written(u);
+        u->live = (written & live) != 0;
+        if (!u->live && written != 0 && uop_flags_only(u))
+        {
+            u->kind = UOP_EXIT + 1;
+            continue;
+        }
+
+        live = (uint8_t)((live & ~written) | uop_flags_read(u));
+        if (uop_may_exit_before(u))
+        {
+            live = FLAGS_ALL;
+        }
+    }
+}
+
+/**
+ * @brief Tells whether two consecutive moves to the halves of a register
+ *        pair can be fused into one 16-bit move
+ */
+static bool tr_fusable(const block_uop_t *a, const block_uop_t *b)
+{
+    if (a->kind != b->kind || (a->kind != UOP_LD8 && a->kind != UOP_LD8_I))
+    {
+        return false;
+    }
+    const uint8_t dst_pair = (uint8_t)(a->dst & ~1);
+    if (dst_pair == OFF_AF || (b->dst & ~1) != dst_pair || b->dst == a->dst)
+    {
+        return false;
+    }
+    if (a->kind == UOP_LD8_I)
+    {
+        return true;
+    }
+    // the same halves of another pair
+    const uint8_t src_pair = (uint8_t)(a->src & ~1);
+    return src_pair != OFF_AF && src_pair != dst_pair && (b->src & ~1) == src_pair
+           && (a->src & 1) == (a->dst & 1) && (b->src & 1) == (b->dst & 1);
+}
+
+/**
+ * @brief Drops the dead micro-operations and fuses register moves
+ */
+static void tr_compact(block_tr_t *tr)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < tr->nb_uops; ++i)
+    {
+        block_uop_t *u = &tr->uops[i];
+        if (u->kind > UOP_EXIT)
+        {
+            continue;
+        }
+
+        if (n > 0 && tr_fusable(&tr->uops[n - 1], u))
+        {
+            block_uop_t *prev = &tr->uops[n - 1];
+            const uint8_t dst = (uint8_t)(u->dst & ~1);
+            if (u->kind == UOP_LD8_I)
+            {
+                const uint8_t hi = (u->dst & 1) ? (uint8_t)u->imm : (uint8_t)prev->imm;
+                const uint8_t lo = (u->dst & 1) ? (uint8_t)prev->imm : (uint8_t)u->imm;
+                prev->kind = UOP_LD16_I;
+                prev->imm = merge8(lo, hi);
+            }
+            else
+            {
+                prev->kind = UOP_LD16;
+                prev->src = (uint8_t)(u->src & ~1);
+            }
+            prev->dst = dst;
+            prev->bytes = (uint8_t)(prev->bytes + u->bytes);
+            prev->at = u->at;
+            prev->cycles = u->cycles;
+            prev->prev = u->prev;
+            continue;
+        }
+
+        tr->uops[n++] = *u;
+    }
+    tr->nb_uops = n;
+}
+
+// The blocks are found by their offset in the code ring
+_Static_assert(BLOCK_CODE_MAX_BYTES < UINT16_MAX, "the offsets of the blocks must fit in the entries");
+
+#define block_at(cache, offset) ((block_t *)((cache)->code + (offset)))
+
+/**
+ * @brief Removes the entry of the block at offset in the code ring, if it
+ *        is still in its set
+ */
+static void block_unlink(block_cache_t *cache, size_t offset)
+{
+    uint16_t *set = cache->entries[block_at(cache, offset)->addr % BLOCK_CACHE_SETS];
+    for (size_t way = 0; way < BLOCK_CACHE_WAYS; ++way)
+    {
+        if (set[way] == offset + 1)
+        {
+            memmove(&set[way], &set[way + 1], (BLOCK_CACHE_WAYS - 1 - way) * sizeof(set[0]));
+            set[BLOCK_CACHE_WAYS - 1] = 0;
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Makes a block the most recent one of its set, the oldest one
+ *        leaving the set if it is full (but not the code ring)
+ */
+static void block_link(block_cache_t *cache, size_t offset)
+{
+    const block_t *b = block_at(cache, offset);
+    uint16_t *set = cache->entries[b->addr % BLOCK_CACHE_SETS];
+    // A block of the same address is stale
+    size_t way = 0;
+    while (way < BLOCK_CACHE_WAYS - 1 && set[way] != 0 && block_at(cache, set[way] - 1)->addr != b->addr)
+    {
+        ++way;
+    }
+    memmove(&set[1], &set[0], way * sizeof(set[0]));
+    set[0] = (uint16_t)(offset + 1);
+}
+
+/**
+ * @brief Drops the oldest block of the code ring
+ */
+static void block_drop_oldest(block_cache_t *cache)
+{
+    block_unlink(cache, cache->tail);
+    const size_t size = block_at(cache, cache->tail)->size;
+    cache->code_used -= size;
+    cache->tail += size;
+    if (cache->code_used == 0)
+    {
+        cache->head = 0;
+        cache->tail = 0;
+        cache->end = 0;
+    }
+    else if (cache->tail == cache->end)
+    {
+        cache->tail = 0;
+        cache->end = 0;
+    }
+}
+
+/**
+ * @brief Doubles the code ring (or allocates it if there is none yet) if it
+ *        can: the blocks keep their offsets as it has not wrapped around
+ */
+static void block_cache_grow(block_cache_t *cache)
+{
+    const size_t size = cache->code == NULL ? BLOCK_CODE_MIN_BYTES : 2 * cache->code_size;
+    if (size <= BLOCK_CODE_MAX_BYTES)
+    {
+        uint8_t *code = realloc(cache->code, size);
+        if (code != NULL)
+        {
+            cache->code = code;
+            cache->code_size = size;
+        }
+    }
+}
+
+// Largest block, which always fits in an empty code ring
+#define BLOCK_MAX_SIZE (sizeof(block_t) + (2 * BLOCK_MAX_INSTR + 1) * sizeof(block_uop_t))
+_Static_assert(BLOCK_MAX_SIZE <= BLOCK_CODE_MIN_BYTES, "a block must fit in the smallest code ring");
+
+/**
+ * @brief Takes the room of a block at the head of the code ring, dropping
+ *        the oldest blocks until it fits
+ */
+static int block_alloc(block_cache_t *cache, size_t size, size_t *offset)
+{
+    size = (size + _Alignof(block_t) - 1) / _Alignof(block_t) * _Alignof(block_t);
+    // The blocks are in [tail, head[, or in [tail, end[ then [0, head[ once wrapped around
+    bool wrapped = cache->code_used != 0 && cache->tail >= cache->head;
+    if (cache->code == NULL || (!wrapped && cache->head + size > cache->code_size))
+    {
+        block_cache_grow(cache);
+    }
+    M_EXIT_IF_NULL(cache->code, BLOCK_CODE_MIN_BYTES);
+
+    for (;;)
+    {
+        if (!wrapped)
+        {
+            if (cache->head + size <= cache->code_size)
+            {
+                break;
+            }
+            // No room left at the end: the ring goes on from its start
+            cache->end = cache->head;
+            cache->head = 0;
+            wrapped = cache->code_used != 0;
+            continue;
+        }
+        else if (cache->head + size <= cache->tail)
+        {
+            break;
+        }
+        block_drop_oldest(cache);
+        wrapped = cache->code_used != 0 && cache->tail >= cache->head;
+    }
+
+    *offset = cache->head;
+    cache->head += size;
+    cache->code_used += size;
+    block_at(cache, *offset)->size = (uint16_t)size;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Translates the block starting at pc
+ *
+ * @param cache cache the block is stored into (its oldest blocks may be dropped)
+ * @param cpu CPU whose bus holds the code
+ * @param pc address of the block
+ * @param block set to the new block
+ * @return error code
+ */
+static int block_translate(block_cache_t *cache, const cpu_t *cpu, addr_t pc, block_t **block)
+{
+    const decode_cache_t *dc = cpu->decode_cache;
+    const addr_t start = pc;
+    const bool banked = decode_banked(start);
+
+    // Only what is read before being written is cleared: most blocks are short
+    block_tr_t *tr = malloc(sizeof(block_tr_t));
+    M_EXIT_IF_NULL(tr, sizeof(block_tr_t));
+    tr->cpu = cpu;
+    tr->nb_uops = 0;
+    memset(&tr->instr, 0, sizeof(tr->instr));
+    memset(&tr->consts, 0, sizeof(tr->consts));
+
+    // The generations are read before the code (which may extend to the next line)
+    const uint16_t line0 = (uint16_t)decode_line_of(start);
+    const uint16_t next_line = (uint16_t)((line0 + 1) % DECODE_NB_LINES);
+    const uint32_t gen0 = dc->line_gen[line0];
+    const uint32_t next_gen = dc->line_gen[next_line];
+    addr_t end = start; // last byte of the block
+
+    uint16_t at = 0;
+    uint8_t prev = 0;
+    uint8_t nb_instr = 0;
+    bool ended = false;
+
+    while (!ended && nb_instr < BLOCK_MAX_INSTR)
+    {
+        data_t op = rd(cpu, pc);
+        const instruction_t *lu = &instruction_direct[op];
+        if (op == PREFIXED)
+        {
+            op = rd(cpu, (addr_t)(pc + 1));
+            lu = &instruction_prefixed[op];
+        }
+
+        const addr_t last = (addr_t)(pc + lu->bytes - 1);
+        if (last < pc || last - start >= BLOCK_MAX_BYTES
+            || !decode_cacheable(pc) || !decode_cacheable(last)
+            || decode_banked(pc) != banked || decode_banked(last) != banked)
+        {
+            break;
+        }
+
+        tr->instr.pc = pc;
+        tr->instr.at = at;
+        tr->instr.bytes = lu->bytes;
+        tr->instr.cycles = lu->cycles;
+        tr->instr.xtra = lu->xtra_cycles;
+        tr->instr.prev = prev;
+
+        const size_t before = tr->nb_uops;
+        const int result = tr_instr(tr, lu, op);
+        if (result == 0)
+        {
+            tr->nb_uops = before;
+            break;
+        }
+        ended = result == 2;
+        ++nb_instr;
+        end = last;
+        if (!ended)
+        {
+            at = (uint16_t)(at + lu->cycles);
+            prev = lu->cycles;
+            pc = (addr_t)(pc + lu->bytes);
+        }
+    }
+
+    uint16_t span = at;
+    if (!ended)
+    {
+        // The next instruction is left to cpu_cycle
+        tr->instr.pc = pc;
+        tr->instr.at = at;
+        tr->instr.bytes = 0;
+        tr->instr.cycles = 0;
+        tr->instr.xtra = 0;
+        tr->instr.prev = prev;
+        emit(tr, UOP_EXIT, 0, 0, 0);
+        span = (uint16_t)(at - prev);
+    }
+
+    tr_liveness(tr);
+    tr_compact(tr);
+
+    size_t offset = 0;
+    M_EXIT_IF_ERR_DO_SOMETHING(block_alloc(cache, sizeof(block_t) + tr->nb_uops * sizeof(block_uop_t), &offset), free(tr));
+    block_t *b = block_at(cache, offset);
+    b->addr = start;
+    b->last = end;
+    b->bank = banked ? dc->bank : 0;
+    b->span = span;
+    const bool two_lines = decode_line_of(end) != line0;
+    b->line[0] = line0;
+    b->line[1] = two_lines ? next_line : line0;
+    b->gen[0] = gen0;
+    b->gen[1] = two_lines ? next_gen : gen0;
+    b->nb_instr = nb_instr;
+    b->nb_uops = (uint8_t)tr->nb_uops;
+    for (size_t i = 0; i < tr->nb_uops; ++i)
+    {
+        b->uops[i] = tr->uops[i];
+    }
+    block_link(cache, offset);
+
+    free(tr);
+    *block = b;
+    return ERR_NONE;
+}
+
+// ======================================================================
+// Cache
+
+// ==== see cpu-block.h ========================================
+int block_cache_create(block_cache_t **cache)
+{
+    M_REQUIRE_NON_NULL(cache);
+
+    *cache = calloc(1, sizeof(block_cache_t));
+    M_EXIT_IF_NULL(*cache, sizeof(block_cache_t));
+
+    return ERR_NONE;
+}
+
+// ==== see cpu-block.h ========================================
+void block_cache_free(block_cache_t **cache)
+{
+    if (cache != NULL && *cache != NULL)
+    {
+        free((*cache)->code);
+        free(*cache);
+        *cache = NULL;
+    }
+}
+
+static inline bool block_up_to_date(const block_t *b, const decode_cache_t *dc, addr_t addr)
+{
+    return b->gen[0] == dc->line_gen[b->line[0]] && b->gen[1] == dc->line_gen[b->line[1]]
+           && (!decode_banked(addr) || b->bank == dc->bank);
+}
+
+// ==== see cpu-block.h ========================================
+block_t *block_cache_lookup(block_cache_t *cache, const cpu_t *cpu, addr_t addr)
+{
+    if (cache == NULL || cpu == NULL || cpu->decode_cache == NULL)
+    {
+        return NULL;
+    }
+
+    const uint16_t *set = cache->entries[addr % BLOCK_CACHE_SETS];
+    for (size_t way = 0; way < BLOCK_CACHE_WAYS && set[way] != 0; ++way)
+    {
+        block_t *b = block_at(cache, set[way] - 1);
+        if (b->addr == addr)
+        {
+            return block_up_to_date(b, cpu->decode_cache, addr) ? b : NULL;
+        }
+    }
+    return NULL;
+}
+
+// ==== see cpu-block.h ========================================
+size_t block_length(const block_t *block)
+{
+    return block == NULL ? 0 : block->nb_instr;
+}
+
+// ======================================================================
+// Execution
+
+static inline addr_t uop_addr(const cpu_t *cpu, uint8_t mode, uint16_t imm)
+{
+    switch (mode)
+    {
+    case AM_BC: return cpu->BC;
+    case AM_DE: return cpu->DE;
+    case AM_IMM: return imm;
+    default: return cpu->HL;
+    }
+}
+
+static inline void uop_post_addr(cpu_t *cpu, uint8_t mode)
+{
+    if (mode == AM_HLI) ++cpu->HL;
+    else if (mode == AM_HLD) --cpu->HL;
+}
+
+// Writes to plain memory (checked beforehand)
+static inline void uop_write(cpu_t *cpu, addr_t addr, data_t data)
+{
+    *bus_lookup(cpu_bus(cpu), cpu->pages, addr) = data;
+    decode_cache_invalidate(cpu->decode_cache, addr);
+    bus_watch_mark(cpu->watch, addr);
+}
+
+static inline void uop_write16(cpu_t *cpu, addr_t addr, addr_t data16)
+{
+    uop_write(cpu, addr, lsb8(data16));
+    uop_write(cpu, (addr_t)(addr + 1), msb8(data16));
+}
+
+static inline void uop_alu(cpu_t *cpu, uint8_t op, data_t v, bool live)
+{
+    if (!live)
+    {
+        switch (op)
+        {
+        case ALU_ADD: cpu->A = (data_t)(cpu->A + v); break;
+        case ALU_ADC: cpu->A = (data_t)(cpu->A + v + CARRY(cpu)); break;
+        case ALU_SUB: cpu->A = (data_t)(cpu->A - v); break;
+        case ALU_SBC: cpu->A = (data_t)(cpu->A - v - CARRY(cpu)); break;
+        case ALU_AND: cpu->A &= v; break;
+        case ALU_XOR: cpu->A ^= v; break;
+        case ALU_OR:  cpu->A |= v; break;
+        default: break;
+        }
+        return;
+    }
+
+    switch (op)
+    {
+    case ALU_ADD: cpu->A = add8(cpu, cpu->A, v, 0); break;
+    case ALU_ADC: cpu->A = add8(cpu, cpu->A, v, CARRY(cpu)); break;
+    case ALU_SUB: cpu->A = sub8(cpu, cpu->A, v, 0); break;
+    case ALU_SBC: cpu->A = sub8(cpu, cpu->A, v, CARRY(cpu)); break;
+    case ALU_AND: cpu->A = and8(cpu, cpu->A, v); break;
+    case ALU_XOR: cpu->A = xor8(cpu, cpu->A, v); break;
+    case ALU_OR:  cpu->A = or8(cpu, cpu->A, v); break;
+    default: (void)sub8(cpu, cpu->A, v, 0); break;
+    }
+}
+
+static inline data_t uop_rot(cpu_t *cpu, uint8_t kind, data_t x)
+{
+    switch (kind)
+    {
+    case ROT_RLC: return rlc(cpu, x);
+    case ROT_RRC: return rrc(cpu, x);
+    case ROT_RL: return rl(cpu, x);
+    case ROT_RR: return rr(cpu, x);
+    case ROT_SLA: return sla(cpu, x);
+    case ROT_SRA: return sra(cpu, x);
+    case ROT_SWAP: return swap(cpu, x);
+    default: return srl(cpu, x);
+    }
+}
+
+static inline bool uop_cc(const cpu_t *cpu, uint8_t cc)
+{
+    switch (cc)
+    {
+    case CC_NZ: return !(cpu->F & FLAG_Z);
+    case CC_Z: return (cpu->F & FLAG_Z) != 0;
+    case CC_NC: return !(cpu->F & FLAG_C);
+    default: return (cpu->F & FLAG_C) != 0;
+    }
+}
+
+// Leaves the block before the instruction of u (the last executed one is the previous)
+#define EXIT_BEFORE(u) \
+    do { \
+        cpu->PC = (u)->pc; \
+        *last_at = (uint16_t)((u)->at - (u)->prev); \
+        *last_cycles = (u)->prev; \
+        return ERR_NONE; \
+    } while (0)
+
+// Leaves the block after the instruction of u, which lasts the given cycles
+#define EXIT_AFTER(u, pc_after, nb_cycles) \
+    do { \
+        cpu->PC = (pc_after); \
+        *last_at = (u)->at; \
+        *last_cycles = (uint8_t)(nb_cycles); \
+        return ERR_NONE; \
+    } while (0)
+
+// After a write: leaves if the block has modified its own code
+#define CHECK_CODE(u) \
+    do { \
+        if (!block_up_to_date(b, cpu->decode_cache, start)) \
+            EXIT_AFTER(u, (addr_t)((u)->pc + (u)->bytes), (u)->cycles); \
+    } while (0)
+
+/**
+ * @brief Runs the micro-operations of a block
+ */
+static int block_exec(const block_t *b, cpu_t *cpu, uint16_t *last_at, uint8_t *last_cycles)
+{
+    const addr_t start = cpu->PC;
+
+    for (const block_uop_t *u = b->uops; ; ++u)
+    {
+        switch (u->kind)
+        {
+        // ---- moves and constants ----
+        case UOP_LD8:
+            R8(cpu, u->dst) = R8(cpu, u->src);
+            break;
+
+        case UOP_LD8_I:
+            R8(cpu, u->dst) = (uint8_t)u->imm;
+            break;
+
+        case UOP_LD16:
+            R16(cpu, u->dst) = R16(cpu, u->src);
+            break;
+
+        case UOP_LD16_I:
+            R16(cpu, u->dst) = u->imm;
+            break;
+
+        case UOP_SET_F:
+            cpu->F = (flags_t)((cpu->F & u->src) | u->imm);
+            break;
+
+        // ---- 8-bit arithmetic and logic ----
+        case UOP_ALU:
+            uop_alu(cpu, u->dst, R8(cpu, u->src), u->live);
+            break;
+
+        case UOP_ALU_I:
+            uop_alu(cpu, u->dst, (data_t)u->imm, u->live);
+            break;
+
+        case UOP_INC8:
+            if (u->live) R8(cpu, u->dst) = inc8(cpu, R8(cpu, u->dst));
+            else ++R8(cpu, u->dst);
+            break;
+
+        case UOP_DEC8:
+            if (u->live) R8(cpu, u->dst) = dec8(cpu, R8(cpu, u->dst));
+            else --R8(cpu, u->dst);
+            break;
+
+        case UOP_ROT:
+            R8(cpu, u->dst) = uop_rot(cpu, u->src, R8(cpu, u->dst));
+            break;
+
+        case UOP_ROTA:
+            cpu->A = uop_rot(cpu, u->src, cpu->A);
+            cpu->F &= FLAG_C;
+            break;
+
+        case UOP_BIT:
+            bit_test(cpu, R8(cpu, u->src), u->imm);
+            break;
+
+        case UOP_RES:
+            R8(cpu, u->dst) &= (uint8_t)u->imm;
+            break;
+
+        case UOP_SET:
+            R8(cpu, u->dst) |= (uint8_t)u->imm;
+            break;
+
+        case UOP_CPL:
+            cpu->A = (data_t)~cpu->A;
+            cpu->F |= FLAG_N | FLAG_H;
+            break;
+
+        case UOP_CCF:
+            cpu->F = (flags_t)((cpu->F & FLAG_Z) | (~cpu->F & FLAG_C));
+            break;
+
+        case UOP_DAA:
+            daa(cpu);
+            break;
+
+        // ---- 16-bit arithmetic ----
+        case UOP_INC16:
+            ++R16(cpu, u->dst);
+            break;
+
+        case UOP_DEC16:
+            --R16(cpu, u->dst);
+            break;
+
+        case UOP_ADD_HL:
+            if (u->live) add_hl(cpu, R16(cpu, u->src));
+            else cpu->HL = (uint16_t)(cpu->HL + R16(cpu, u->src));
+            break;
+
+        case UOP_ADD_SP:
+            cpu->SP = add_sp(cpu, (data_t)u->imm);
+            break;
+
+        case UOP_LD_HL_SP:
+            cpu->HL = add_sp(cpu, (data_t)u->imm);
+            break;
+
+        // ---- memory ----
+        case UOP_LOAD:
+        {
+            const addr_t addr = uop_addr(cpu, u->src, u->imm);
+            if (!block_readable(addr)) EXIT_BEFORE(u);
+            R8(cpu, u->dst) = rd(cpu, addr);
+            uop_post_addr(cpu, u->src);
+        }
+        break;
+
+        case UOP_STORE:
+        {
+            const addr_t addr = uop_addr(cpu, u->dst, u->imm);
+            if (!block_writable(cpu, addr)) EXIT_BEFORE(u);
+            uop_write(cpu, addr, u->src == NO_REG ? (data_t)u->imm : R8(cpu, u->src));
+            uop_post_addr(cpu, u->dst);
+            CHECK_CODE(u);
+        }
+        break;
+
+        case UOP_STORE_SP:
+            if (!block_writable16(cpu, u->imm)) EXIT_BEFORE(u);
+            uop_write16(cpu, u->imm, cpu->SP);
+            CHECK_CODE(u);
+            break;
+
+        case UOP_ALU_M:
+            if (!block_readable(cpu->HL)) EXIT_BEFORE(u);
+            uop_alu(cpu, u->dst, rd(cpu, cpu->HL), u->live);
+            break;
+
+        case UOP_INC_M:
+        case UOP_DEC_M:
+        {
+            if (!block_writable(cpu, cpu->HL)) EXIT_BEFORE(u);
+            const data_t v = rd(cpu, cpu->HL);
+            uop_write(cpu, cpu->HL, u->kind == UOP_INC_M ? inc8(cpu, v) : dec8(cpu, v));
+            CHECK_CODE(u);
+        }
+        break;
+
+        case UOP_ROT_M:
+            if (!block_writable(cpu, cpu->HL)) EXIT_BEFORE(u);
+            uop_write(cpu, cpu->HL, uop_rot(cpu, u->src, rd(cpu, cpu->HL)));
+            CHECK_CODE(u);
+            break;
+
+        case UOP_BIT_M:
+            if (!block_readable(cpu->HL)) EXIT_BEFORE(u);
+            bit_test(cpu, rd(cpu, cpu->HL), u->imm);
+            break;
+
+        case UOP_RES_M:
+        case UOP_SET_M:
+        {
+            if (!block_writable(cpu, cpu->HL)) EXIT_BEFORE(u);
+            const data_t v = rd(cpu, cpu->HL);
+            uop_write(cpu, cpu->HL, u->kind == UOP_SET_M ? (data_t)(v | u->imm) : (data_t)(v & u->imm));
+            CHECK_CODE(u);
+        }
+        break;
+
+        case UOP_PUSH:
+            if (!block_writable16(cpu, (addr_t)(cpu->SP - 2))) EXIT_BEFORE(u);
+            cpu->SP = (uint16_t)(cpu->SP - 2);
+            uop_write16(cpu, cpu->SP, R16(cpu, u->src));
+            CHECK_CODE(u);
+            break;
+
+        case UOP_POP:
+            if (!block_readable16(cpu->SP)) EXIT_BEFORE(u);
+            R16(cpu, u->dst) = rd16(cpu, cpu->SP);
+            if (u->dst == OFF_AF) cpu->F &= 0xF0;
+            cpu->SP = (uint16_t)(cpu->SP + 2);
+            break;
+
+        // ---- end of block ----
+        case UOP_JP:
+            EXIT_AFTER(u, u->imm, u->cycles);
+
+        case UOP_JP_CC:
+            if (uop_cc(cpu, u->dst)) EXIT_AFTER(u, u->imm, u->cycles + u->xtra);
+            EXIT_AFTER(u, (addr_t)(u->pc + u->bytes), u->cycles);
+
+        case UOP_JP_HL:
+            EXIT_AFTER(u, cpu->HL, u->cycles);
+
+        case UOP_CALL:
+        case UOP_CALL_CC:
+        {
+            const bool taken = u->kind == UOP_CALL || uop_cc(cpu, u->dst);
+            if (!taken) EXIT_AFTER(u, (addr_t)(u->pc + u->bytes), u->cycles);
+            if (!block_writable16(cpu, (addr_t)(cpu->SP - 2))) EXIT_BEFORE(u);
+            cpu->SP = (uint16_t)(cpu->SP - 2);
+            uop_write16(cpu, cpu->SP, (addr_t)(u->pc + u->bytes));
+            EXIT_AFTER(u, u->imm, u->cycles + (u->kind == UOP_CALL_CC ? u->xtra : 0));
+        }
+
+        case UOP_RET:
+        case UOP_RET_CC:
+        {
+            const bool taken = u->kind == UOP_RET || uop_cc(cpu, u->dst);
+            if (!taken) EXIT_AFTER(u, (addr_t)(u->pc + u->bytes), u->cycles);
+            if (!block_readable16(cpu->SP)) EXIT_BEFORE(u);
+            const addr_t pc = rd16(cpu, cpu->SP);
+            cpu->SP = (uint16_t)(cpu->SP + 2);
+            EXIT_AFTER(u, pc, u->cycles + (u->kind == UOP_RET_CC ? u->xtra : 0));
+        }
+
+        default: // UOP_EXIT
+            EXIT_BEFORE(u);
+        }
+    }
+}
+
+// ==== see cpu-block.h ========================================
+int block_run(block_cache_t *cache, cpu_t *cpu, uint64_t budget,
+              uint16_t *last_at, uint8_t *last_cycles)
+{
+    M_REQUIRE_NON_NULL(cache);
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
+    M_REQUIRE_NON_NULL(cpu->decode_cache);
+    M_REQUIRE_NON_NULL(last_at);
+    M_REQUIRE_NON_NULL(last_cycles);
+
+    *last_at = 0;
+    *last_cycles = 0;
+
+    // Interrupts and HALT are handled by cpu_cycle
+    if (cpu->idle_time != 0 || cpu->HALT
+        || (cpu->IME && (cpu->IE & cpu->IF & INTERRUPTS_MASK) != 0)
+        || !decode_cacheable(cpu->PC))
+    {
+        return ERR_NONE;
+    }
+
+    block_t *b = block_cache_lookup(cache, cpu, cpu->PC);
+    if (b == NULL)
+    {
+        // cpu_cycle is stepping through a block refused for its budget:
+        // the addresses of its instructions do not start blocks
+        if (cpu->PC > cache->skip_pc && cpu->PC <= cache->skip_last)
+        {
+            cache->skip_pc = cpu->PC;
+            return ERR_NONE;
+        }
+        cache->skip_last = 0;
+        M_EXIT_IF_ERR(block_translate(cache, cpu, cpu->PC, &b));
+    }
+
+    if (b->nb_instr == 0)
+    {
+        return ERR_NONE;
+    }
+    if (b->span >= budget)
+    {
+        cache->skip_pc = cpu->PC;
+        cache->skip_last = b->last;
+        return ERR_NONE;
+    }
+
+    cpu->write_listener = 0;
+    bus_watch_clear(cpu->watch);
+    cpu_flags_sync(cpu); // blocks compute the flags they need eagerly
+    return block_exec(b, cpu, last_at, last_cycles);
+}
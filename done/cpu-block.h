@@ -0,0 +1,136 @@
+#pragma once
+
+/**
+ * @file cpu-block.h
+ * @brief Translation of the CPU's basic blocks to micro-operations.
+ *        A block is a straight-line sequence of instructions ending with a
+ *        branch; it is translated once to an array of micro-operations
+ *        (with register moves fused, constant flags folded and flags that
+ *        are never read not computed) and cached by (ROM bank, PC).
+ *
+ *        A block only touches plain memory: instructions accessing I/O
+ *        registers, writing to the ROM or changing the interrupt state
+ *        (EI, DI, RETI, HALT, STOP) end it and are left to cpu_cycle.
+ *        It is run only if it starts and ends before the next event of the
+ *        other components, so the result is the same as running it cycle
+ *        by cycle.
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "bus.h"
+#include "cpu.h"
+#include "cpu-decode.h"
+
+// A block covers at most BLOCK_MAX_BYTES bytes (and thus two lines of the
+// decode cache) and BLOCK_MAX_INSTR instructions
+#define BLOCK_MAX_BYTES DECODE_LINE_SIZE
+#define BLOCK_MAX_INSTR 32
+
+typedef struct block_ block_t;
+
+/**
+ * @brief The blocks are stored one after the other in a ring of code,
+ *        which starts at BLOCK_CODE_MIN_BYTES and is doubled, up to
+ *        BLOCK_CODE_MAX_BYTES, as long as it has not wrapped around. Once
+ *        it is full, the oldest blocks are dropped, one at a time, until
+ *        the new one fits: stale blocks of modified code age out without
+ *        taking the hot ones with them.
+ *        A block is found in the set of its address modulo
+ *        BLOCK_CACHE_SETS, which holds the last BLOCK_CACHE_WAYS blocks
+ *        translated in it.
+ *        The bounds come from the memory budget of an instance (see
+ *        gb-footprint.c), not from the code run: hot code which does not
+ *        fit is translated again, which is accepted.
+ */
+#define BLOCK_CACHE_SETS 256
+#define BLOCK_CACHE_WAYS 4
+#define BLOCK_CODE_MIN_BYTES 1536
+#define BLOCK_CODE_MAX_BYTES 12288
+
+/**
+ * @brief Block cache type.
+ *        An entry is up to date as long as the generation of the lines of
+ *        its code has not changed (see cpu-decode.h).
+ */
+typedef struct {
+    uint16_t entries[BLOCK_CACHE_SETS][BLOCK_CACHE_WAYS]; // offset in the code + 1 of the blocks, 0 if none
+    uint8_t* code;    // NULL until the first block is translated
+    size_t code_size;
+    size_t code_used; // by the blocks in the ring
+    size_t head;      // where the next block is stored
+    size_t tail;      // oldest block
+    size_t end;       // end of the oldest blocks once the ring has wrapped around, 0 otherwise
+    uint16_t skip_pc;   // last PC run by cpu_cycle through the block refused for its budget
+    uint16_t skip_last; // and last byte of that block (0 if none): no block is translated in between
+} block_cache_t;
+
+// Largest size of a block cache and of its blocks, in bytes
+#define BLOCK_CACHE_MAX_BYTES (sizeof(block_cache_t) + BLOCK_CODE_MAX_BYTES)
+
+/**
+ * @brief Allocates an empty block cache
+ *
+ * @param cache pointer to the cache pointer to set
+ * @return error code
+ */
+int block_cache_create(block_cache_t** cache);
+
+/**
+ * @brief Frees a block cache and all of its blocks
+ *
+ * @param cache pointer to the cache pointer to free (set to NULL)
+ */
+void block_cache_free(block_cache_t** cache);
+
+/**
+ * @brief Gets the up to date block starting at a given address, if any
+ *
+ * @param cache cache to look into
+ * @param cpu CPU the block is run on (its decode cache tells whether the block is up to date)
+ * @param addr address of the block's first instruction
+ * @return the block, NULL if there is none
+ */
+block_t* block_cache_lookup(block_cache_t* cache, const cpu_t* cpu, addr_t addr);
+
+/**
+ * @brief Gets the number of instructions translated in a block
+ *
+ * @param block block to look at
+ * @return number of instructions (0 if the instruction at its address cannot be translated)
+ */
+size_t block_length(const block_t* block);
+
+/**
+ * @brief Runs the block at PC (translated on first use, unless PC is inside
+ *        the block just refused for the budget), if the CPU is
+ *        ready to execute an instruction: not idle, not halted and without
+ *        an interrupt to serve.
+ *        The last executed instruction leaves the CPU idle for its
+ *        remaining cycles, exactly as if it had been run by cpu_cycle at
+ *        last_at cycles after the start of the block.
+ *
+ * @param cache cache of translated blocks
+ * @param cpu CPU to run, its decode cache must be enabled
+ * @param budget number of cycles before the next event of another component:
+ *        the last instruction of the block has to start before it
+ * @param last_at set to the number of cycles between the start of the block
+ *        and the start of its last executed instruction
+ * @param last_cycles set to the number of cycles of the last executed
+ *        instruction, 0 if nothing has been executed (then the instruction
+ *        at PC has to be run by cpu_cycle)
+ * @return error code
+ */
+int block_run(block_cache_t* cache, cpu_t* cpu, uint64_t budget,
+              uint16_t* last_at, uint8_t* last_cycles);
+
+#ifdef __cplusplus
+}
+#endif
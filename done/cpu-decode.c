@@ -0,0 +1,229 @@
+/**
+ * @file cpu-decode.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to manage the cache of pre-decoded instructions
+ * @date 2020
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "cartridge.h" // BANK_ROM1_START
+#include "gameboy.h"   // GRAPH_RAM_START, REGISTERS_END
+#include "cpu-decode.h"
+
+// Longest instruction (prefixed ones included), in bytes
+#define MAX_INSTR_BYTES 3
+
+// Distance between the work RAM and its echo
+#define ECHO_OFFSET (ECHO_RAM_START - WORK_RAM_START)
+
+// ==== see cpu-decode.h ========================================
+bool decode_cacheable(addr_t addr)
+{
+    return addr < GRAPH_RAM_START || (addr > REGISTERS_END && addr < REG_IE);
+}
+
+// ==== see cpu-decode.h ========================================
+bool decode_banked(addr_t addr)
+{
+    return addr >= BANK_ROM1_START && addr <= BANK_ROM1_END;
+}
+
+// ==== see cpu-decode.h ========================================
+int decode_cache_create(decode_cache_t **cache)
+{
+    M_REQUIRE_NON_NULL(cache);
+
+    *cache = calloc(1, sizeof(decode_cache_t));
+    M_EXIT_IF_NULL(*cache, sizeof(decode_cache_t));
+    (*cache)->entries = calloc(DECODE_MIN_SLOTS, sizeof(decoded_instr_t));
+    if ((*cache)->entries == NULL)
+    {
+        decode_cache_free(cache);
+        M_EXIT_ERR(ERR_MEM, ", cannot allocate %zu bytes of entries", DECODE_MIN_SLOTS * sizeof(decoded_instr_t));
+    }
+    (*cache)->nb_slots = DECODE_MIN_SLOTS;
+
+    return ERR_NONE;
+}
+
+// ==== see cpu-decode.h ========================================
+void decode_cache_free(decode_cache_t **cache)
+{
+    if (cache != NULL && *cache != NULL)
+    {
+        free((*cache)->entries);
+        free(*cache);
+        *cache = NULL;
+    }
+}
+
+/**
+ * @brief Gets the slot of an address
+ */
+static inline decoded_instr_t *decode_slot_of(decode_cache_t *cache, addr_t addr)
+{
+    return &cache->entries[addr & (cache->nb_slots - 1)];
+}
+
+// ==== see cpu-decode.h ========================================
+decoded_instr_t *decode_cache_lookup(decode_cache_t *cache, addr_t addr)
+{
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    decoded_instr_t *di = decode_slot_of(cache, addr);
+    if (!di->valid || di->addr != addr || (decode_banked(addr) && di->bank != cache->bank))
+    {
+        return NULL;
+    }
+
+    return di;
+}
+
+/**
+ * @brief Doubles the number of slots, the entries being dropped.
+ *        Without memory, the cache keeps its slots.
+ */
+static void decode_cache_grow(decode_cache_t *cache)
+{
+    cache->evicted = 0;
+    decoded_instr_t *entries = calloc(2 * cache->nb_slots, sizeof(decoded_instr_t));
+    if (entries != NULL)
+    {
+        free(cache->entries);
+        cache->entries = entries;
+        cache->nb_slots *= 2;
+    }
+}
+
+// ==== see cpu-decode.h ========================================
+decoded_instr_t *decode_cache_slot(decode_cache_t *cache, addr_t addr)
+{
+    if (cache == NULL || !decode_cacheable(addr))
+    {
+        return NULL;
+    }
+
+    decoded_instr_t *di = decode_slot_of(cache, addr);
+    if (di->valid && di->addr != addr && ++cache->evicted > cache->nb_slots && cache->nb_slots < DECODE_MAX_SLOTS)
+    {
+        decode_cache_grow(cache);
+        di = decode_slot_of(cache, addr);
+    }
+    di->valid = 0;
+    di->addr = addr;
+    di->bank = decode_banked(addr) ? cache->bank : 0;
+    return di;
+}
+
+/**
+ * @brief Invalidates the instruction starting at addr, if it is cached
+ */
+static inline void decode_invalidate_at(decode_cache_t *cache, addr_t addr)
+{
+    decoded_instr_t *di = decode_slot_of(cache, addr);
+    if (di->addr == addr)
+    {
+        di->valid = 0;
+    }
+}
+
+/**
+ * @brief Invalidates the instructions that may contain the byte at addr
+ *        (i.e. which start at most MAX_INSTR_BYTES - 1 bytes before it)
+ */
+static void decode_invalidate_range(decode_cache_t *cache, addr_t addr)
+{
+    for (int i = 0; i < MAX_INSTR_BYTES; ++i)
+    {
+        decode_invalidate_at(cache, (addr_t)(addr - i));
+    }
+    ++cache->line_gen[decode_line_of(addr)];
+}
+
+// ==== see cpu-decode.h ========================================
+void decode_cache_invalidate(decode_cache_t *cache, addr_t addr)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    decode_invalidate_range(cache, addr);
+
+    // The work RAM can also be executed from its echo (and vice-versa)
+    if (addr >= WORK_RAM_START && addr <= ECHO_RAM_END - ECHO_OFFSET)
+    {
+        decode_invalidate_range(cache, (addr_t)(addr + ECHO_OFFSET));
+    }
+    else if (addr >= ECHO_RAM_START && addr <= ECHO_RAM_END)
+    {
+        decode_invalidate_range(cache, (addr_t)(addr - ECHO_OFFSET));
+    }
+}
+
+// ==== see cpu-decode.h ========================================
+void decode_cache_invalidate_range(decode_cache_t *cache, addr_t start, addr_t end)
+{
+    if (cache == NULL || start > end)
+    {
+        return;
+    }
+
+    // Instructions starting before start may end in the range
+    const size_t first = start >= MAX_INSTR_BYTES - 1 ? start - (MAX_INSTR_BYTES - 1) : 0;
+    if (end - first + 1 >= cache->nb_slots)
+    {
+        // Faster through the slots
+        for (size_t i = 0; i < cache->nb_slots; ++i)
+        {
+            decoded_instr_t *di = &cache->entries[i];
+            if (di->addr >= first && di->addr <= end)
+            {
+                di->valid = 0;
+            }
+        }
+    }
+    else
+    {
+        for (size_t addr = first; addr <= end; ++addr)
+        {
+            decode_invalidate_at(cache, (addr_t)addr);
+        }
+    }
+    for (size_t line = decode_line_of(start); line <= decode_line_of(end); ++line)
+    {
+        ++cache->line_gen[line];
+    }
+}
+
+// ==== see cpu-decode.h ========================================
+void decode_cache_flush(decode_cache_t *cache)
+{
+    if (cache != NULL)
+    {
+        for (size_t i = 0; i < cache->nb_slots; ++i)
+        {
+            cache->entries[i].valid = 0;
+        }
+        for (size_t i = 0; i < DECODE_NB_LINES; ++i)
+        {
+            ++cache->line_gen[i];
+        }
+    }
+}
+
+// ==== see cpu-decode.h ========================================
+void decode_cache_set_bank(decode_cache_t *cache, uint16_t bank)
+{
+    if (cache != NULL)
+    {
+        cache->bank = bank;
+    }
+}
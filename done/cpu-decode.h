@@ -0,0 +1,181 @@
+#pragma once
+
+/**
+ * @file cpu-decode.h
+ * @brief Cache of pre-decoded instructions for the CPU
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bit.h"
+#include "bus.h"
+#include "memory.h"
+#include "opcode.h"
+
+typedef struct cpu_ cpu_t;
+typedef struct decoded_instr_ decoded_instr_t;
+
+/**
+ * @brief Type of the functions executing a decoded instruction
+ *        (PC, flags and idle_time are updated by the handler)
+ */
+typedef int (*cpu_handler_t)(const decoded_instr_t* di, cpu_t* cpu);
+
+/**
+ * @brief Instruction as fetched and decoded at a given address.
+ *        Everything that only depends on the instruction's bytes is
+ *        extracted once, when the entry is filled.
+ */
+struct decoded_instr_ {
+    const instruction_t* lu; // static description (family, opcode, ...)
+    cpu_handler_t handler;   // function executing the instruction
+    uint16_t imm;            // immediate operand (n8, e8 or n16), if any
+    uint16_t addr;           // address of the instruction, as several share a slot
+    uint16_t bank;           // ROM bank the instruction was fetched from
+    uint8_t reg_dst;         // register extracted from bits 3 to 5 of the opcode
+    uint8_t reg_src;         // register extracted from bits 0 to 2 of the opcode
+    uint8_t pair;            // register pair extracted from the opcode
+    uint8_t cc;              // condition code extracted from the opcode
+    uint8_t bytes;
+    uint8_t cycles;
+    uint8_t xtra_cycles;
+    bit_t valid;
+};
+
+/**
+ * @brief The bus is divided in lines of 2^DECODE_LINE_BITS bytes, each one
+ *        with a generation counter incremented whenever one of its bytes
+ *        is invalidated. A copy of the code of a line (e.g. a translated
+ *        block, see cpu-block.h) is up to date while its generation is unchanged.
+ */
+#define DECODE_LINE_BITS 6
+#define DECODE_LINE_SIZE (1 << DECODE_LINE_BITS)
+#define DECODE_NB_LINES (BUS_SIZE >> DECODE_LINE_BITS)
+
+#define decode_line_of(addr) ((addr) >> DECODE_LINE_BITS)
+
+/**
+ * @brief An instruction is cached in the slot of its address modulo the
+ *        number of slots, which starts small and doubles whenever more
+ *        valid entries than there are slots have been evicted, up to
+ *        DECODE_MAX_SLOTS: the cache holds the code being run, not the
+ *        whole bus.
+ */
+#define DECODE_MIN_SLOTS 64
+#define DECODE_MAX_SLOTS 256
+
+/**
+ * @brief Decode cache type
+ */
+typedef struct {
+    decoded_instr_t* entries; // nb_slots of them
+    size_t nb_slots;          // a power of 2
+    size_t evicted;           // valid entries replaced since the last growth
+    uint32_t line_gen[DECODE_NB_LINES];
+    uint16_t bank; // ROM bank currently mapped on BANK_ROM1
+} decode_cache_t;
+
+// Largest size of a decode cache and of its entries, in bytes
+#define DECODE_CACHE_MAX_BYTES (sizeof(decode_cache_t) + DECODE_MAX_SLOTS * sizeof(decoded_instr_t))
+
+/**
+ * @brief Allocates an empty decode cache
+ *
+ * @param cache pointer to the cache pointer to set
+ * @return error code
+ */
+int decode_cache_create(decode_cache_t** cache);
+
+/**
+ * @brief Frees a decode cache
+ *
+ * @param cache pointer to the cache pointer to free (set to NULL)
+ */
+void decode_cache_free(decode_cache_t** cache);
+
+/**
+ * @brief Gets the entry of the instruction starting at a given address
+ *
+ * @param cache cache to look into
+ * @param addr address of the instruction
+ * @return the entry, NULL if it is not valid (or may not be cached)
+ */
+decoded_instr_t* decode_cache_lookup(decode_cache_t* cache, addr_t addr);
+
+/**
+ * @brief Gets the entry to fill for the instruction starting at a given address
+ *
+ * @param cache cache to store into
+ * @param addr address of the instruction
+ * @return the entry to fill, NULL if instructions at addr may not be cached
+ *         (their bytes can change without going through the CPU)
+ */
+decoded_instr_t* decode_cache_slot(decode_cache_t* cache, addr_t addr);
+
+/**
+ * @brief Invalidates the entries of all instructions containing the byte at addr
+ *        (and moves the generation of its line).
+ *        To be called on every write to the bus.
+ *
+ * @param cache cache to modify (may be NULL)
+ * @param addr address that has been written
+ */
+void decode_cache_invalidate(decode_cache_t* cache, addr_t addr);
+
+/**
+ * @brief Invalidates the entries of all instructions containing a byte of
+ *        [start, end] (and moves the generation of their lines),
+ *        e.g. when a part of the bus is remapped
+ *
+ * @param cache cache to modify (may be NULL)
+ * @param start first address of the range (included)
+ * @param end last address of the range (included)
+ */
+void decode_cache_invalidate_range(decode_cache_t* cache, addr_t start, addr_t end);
+
+/**
+ * @brief Invalidates all entries (and moves the generation of all lines),
+ *        e.g. when the bus is remapped
+ *
+ * @param cache cache to modify (may be NULL)
+ */
+void decode_cache_flush(decode_cache_t* cache);
+
+/**
+ * @brief Tells whether the instruction at addr is fetched from the switchable ROM bank
+ *
+ * @param addr address of the instruction
+ * @return true if addr is in BANK_ROM1
+ */
+bool decode_banked(addr_t addr);
+
+/**
+ * @brief Tells whether instructions starting at addr may be cached.
+ *        OAM and I/O registers are written by other components than the CPU,
+ *        so the caches would not see those writes.
+ *
+ * @param addr address of the instruction
+ * @return true if instructions at addr may be cached
+ */
+bool decode_cacheable(addr_t addr);
+
+/**
+ * @brief Sets the ROM bank mapped on BANK_ROM1. Entries fetched from another
+ *        bank are not returned by decode_cache_lookup anymore.
+ *
+ * @param cache cache to modify (may be NULL)
+ * @param bank bank number
+ */
+void decode_cache_set_bank(decode_cache_t* cache, uint16_t bank);
+
+#ifdef __cplusplus
+}
+#endif
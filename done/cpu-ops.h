@@ -0,0 +1,195 @@
+#pragma once
+
+/**
+ * @file cpu-ops.h
+ * @brief Inline bus reads and ALU operations shared by the fast CPU
+ *        interpreters (cpu-threaded.c and cpu-block.c).
+ *        Unlike alu.h, results are directly written to the CPU's flags.
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "alu.h"
+#include "bit.h"
+#include "bus.h"
+#include "cpu.h"
+#include "cpu-alu.h" // cpu_flags_sync
+
+// ======================================================================
+// Bus reads, same semantics as bus_read and bus_read16
+
+static inline data_t rd(const cpu_t *cpu, addr_t addr)
+{
+    const data_t *p = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, addr);
+    return p != NULL ? *p : 0xFF;
+}
+
+static inline addr_t rd16(const cpu_t *cpu, addr_t addr)
+{
+    if (addr == 0xFFFF || bus_lookup(cpu_bus(cpu), cpu->pages, addr) == NULL)
+    {
+        return 0xFF;
+    }
+    return merge8(rd(cpu, addr), rd(cpu, (addr_t)(addr + 1)));
+}
+
+// ======================================================================
+// ALU operations, each one sets all of the flags it is defined to set
+
+#define CARRY(cpu) (((cpu)->F & FLAG_C) != 0)
+#define ZERO_IF(v) ((data_t)(v) == 0 ? FLAG_Z : 0)
+
+static inline data_t add8(cpu_t *cpu, data_t x, data_t y, int c)
+{
+    unsigned r = (unsigned)x + y + (unsigned)c;
+    cpu->F = (flags_t)(ZERO_IF(r)
+                       | (((x & 0xF) + (y & 0xF) + c) > 0xF ? FLAG_H : 0)
+                       | (r > 0xFF ? FLAG_C : 0));
+    return (data_t)r;
+}
+
+static inline data_t sub8(cpu_t *cpu, data_t x, data_t y, int c)
+{
+    int r = (int)x - y - c;
+    cpu->F = (flags_t)(ZERO_IF(r) | FLAG_N
+                       | ((int)(x & 0xF) - (y & 0xF) - c < 0 ? FLAG_H : 0)
+                       | (r < 0 ? FLAG_C : 0));
+    return (data_t)r;
+}
+
+static inline data_t and8(cpu_t *cpu, data_t x, data_t y)
+{
+    data_t r = x & y;
+    cpu->F = (flags_t)(ZERO_IF(r) | FLAG_H);
+    return r;
+}
+
+static inline data_t or8(cpu_t *cpu, data_t x, data_t y)
+{
+    data_t r = x | y;
+    cpu->F = (flags_t)ZERO_IF(r);
+    return r;
+}
+
+static inline data_t xor8(cpu_t *cpu, data_t x, data_t y)
+{
+    data_t r = x ^ y;
+    cpu->F = (flags_t)ZERO_IF(r);
+    return r;
+}
+
+static inline data_t inc8(cpu_t *cpu, data_t x)
+{
+    data_t r = (data_t)(x + 1);
+    cpu->F = (flags_t)((cpu->F & FLAG_C) | ZERO_IF(r) | ((x & 0xF) == 0xF ? FLAG_H : 0));
+    return r;
+}
+
+static inline data_t dec8(cpu_t *cpu, data_t x)
+{
+    data_t r = (data_t)(x - 1);
+    cpu->F = (flags_t)((cpu->F & FLAG_C) | ZERO_IF(r) | FLAG_N | ((x & 0xF) == 0 ? FLAG_H : 0));
+    return r;
+}
+
+static inline void add_hl(cpu_t *cpu, uint16_t x)
+{
+    unsigned r = (unsigned)cpu->HL + x;
+    cpu->F = (flags_t)((cpu->F & FLAG_Z)
+                       | (((cpu->HL & 0xFFF) + (x & 0xFFF)) > 0xFFF ? FLAG_H : 0)
+                       | (r > 0xFFFF ? FLAG_C : 0));
+    cpu->HL = (uint16_t)r;
+}
+
+// SP + e8, as computed by ADD SP, e8 and LD HL, SP + e8
+static inline uint16_t add_sp(cpu_t *cpu, data_t e)
+{
+    cpu->F = (flags_t)((((cpu->SP & 0xF) + (e & 0xF)) > 0xF ? FLAG_H : 0)
+                       | (((cpu->SP & 0xFF) + e) > 0xFF ? FLAG_C : 0));
+    return (uint16_t)(cpu->SP + (int8_t)e);
+}
+
+static inline void daa(cpu_t *cpu)
+{
+    data_t a = cpu->A;
+    flags_t f = cpu->F;
+    if (f & FLAG_N)
+    {
+        if (f & FLAG_C) a = (data_t)(a - 0x60);
+        if (f & FLAG_H) a = (data_t)(a - 0x06);
+    }
+    else
+    {
+        if ((f & FLAG_C) || cpu->A > 0x99)
+        {
+            a = (data_t)(a + 0x60);
+            f |= FLAG_C;
+        }
+        if ((f & FLAG_H) || (cpu->A & 0xF) > 0x9) a = (data_t)(a + 0x06);
+    }
+    cpu->A = a;
+    cpu->F = (flags_t)((f & (FLAG_N | FLAG_C)) | ZERO_IF(a));
+}
+
+// Rotations and shifts of the prefixed instructions (and of RLCA & co, see below)
+static inline data_t shift_flags(cpu_t *cpu, data_t r, int carry)
+{
+    cpu->F = (flags_t)(ZERO_IF(r) | (carry ? FLAG_C : 0));
+    return r;
+}
+
+static inline data_t rlc(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)((x << 1) | (x >> 7)), x & 0x80);
+}
+
+static inline data_t rrc(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)((x >> 1) | (x << 7)), x & 0x01);
+}
+
+static inline data_t rl(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)((x << 1) | CARRY(cpu)), x & 0x80);
+}
+
+static inline data_t rr(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)((x >> 1) | (CARRY(cpu) << 7)), x & 0x01);
+}
+
+static inline data_t sla(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)(x << 1), x & 0x80);
+}
+
+static inline data_t sra(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)((x >> 1) | (x & 0x80)), x & 0x01);
+}
+
+static inline data_t swap(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)((x << 4) | (x >> 4)), 0);
+}
+
+static inline data_t srl(cpu_t *cpu, data_t x)
+{
+    return shift_flags(cpu, (data_t)(x >> 1), x & 0x01);
+}
+
+static inline void bit_test(cpu_t *cpu, data_t x, int n)
+{
+    cpu->F = (flags_t)((cpu->F & FLAG_C) | FLAG_H | ((x >> n) & 1 ? 0 : FLAG_Z));
+}
+
+#ifdef __cplusplus
+}
+#endif
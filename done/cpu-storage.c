@@ -8,6 +8,8 @@
 #include "error.h"
 #include "cpu-storage.h"   // cpu_read_at_HL
 #include "cpu-registers.h" // cpu_BC_get
+#include "cpu-decode.h"    // decode_cache_invalidate
+#include "cpu-alu.h"       // cpu_flags_sync
 #include "gameboy.h"       // REGISTER_START
 #include "util.h"
 #include <inttypes.h> // PRIX8
@@ -16,40 +18,45 @@
 // ==== see cpu-storage.h ========================================
 data_t cpu_read_at_idx(const cpu_t *cpu, addr_t addr)
 {
-    if (cpu == NULL || cpu->bus == NULL)
+    if (cpu == NULL || !cpu_plugged(cpu))
     {
         return (data_t)0;
     }
-    data_t data = (data_t)0;
-
-    // Call bus_read from bus.c and reads from the cpu's bus at address addr
-    bus_read(*cpu->bus, addr, &data);
-    return data;
+    // Same as bus_read, through the page table if the cpu has one
+    const data_t *p = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, addr);
+    return p != NULL ? *p : (data_t)0xFF;
 }
 
 // ==== see cpu-storage.h ========================================
 addr_t cpu_read16_at_idx(const cpu_t *cpu, addr_t addr)
 {
-    if (cpu == NULL || cpu->bus == NULL)
+    if (cpu == NULL || !cpu_plugged(cpu))
     {
         return (data_t)0;
     }
-    addr_t a = (addr_t)0;
-
-    // Call bus_read16 from bus.c and read a word from the cpu's bus at addresses addr and addr+1
-    bus_read16(*cpu->bus, addr, &a);
-    return a;
+    // Same as bus_read16: 0xFF if nothing is plugged at addr or if addr is the last one
+    if (addr == 0xFFFF || bus_lookup(cpu_bus(cpu), cpu->pages, addr) == NULL)
+    {
+        return (addr_t)0xFF;
+    }
+    return merge8(cpu_read_at_idx(cpu, addr), cpu_read_at_idx(cpu, (addr_t)(addr + 1)));
 }
 
 // ==== see cpu-storage.h ========================================
 int cpu_write_at_idx(cpu_t *cpu, addr_t addr, data_t data)
 {
     M_REQUIRE_NON_NULL(cpu);
-    M_REQUIRE_NON_NULL(cpu->bus);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
 
-    // Call bus_write from bus.c and write to the cpu's bus at address addr,
-    // while getting potential errors
-    M_EXIT_IF_ERR(bus_write(*cpu->bus, addr, data));
+    // Same as bus_write, through the page table if the cpu has one
+    if (!bus_pages_trap(cpu->pages, addr, data))
+    {
+        data_t *p = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, addr);
+        M_REQUIRE_NON_NULL(p);
+        *p = data;
+        decode_cache_invalidate(cpu->decode_cache, addr);
+    }
+    bus_watch_record(cpu->watch, addr);
 
     cpu->write_listener = addr;
     return ERR_NONE;
@@ -59,11 +66,28 @@ int cpu_write_at_idx(cpu_t *cpu, addr_t addr, data_t data)
 int cpu_write16_at_idx(cpu_t *cpu, addr_t addr, addr_t data16)
 {
     M_REQUIRE_NON_NULL(cpu);
-    M_REQUIRE_NON_NULL(cpu->bus);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
 
-    // Call bus_write16 from bus.c and write to the cpu's bus at addresses addr and addr+1,
-    // while getting potential errors
-    M_EXIT_IF_ERR(bus_write16(*cpu->bus, addr, data16));
+    // Same as bus_write16, through the page table if the cpu has one
+    if (!bus_pages_trap(cpu->pages, addr, lsb8(data16)))
+    {
+        data_t *lo = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, addr);
+        M_REQUIRE_NON_NULL(lo);
+        *lo = lsb8(data16);
+    }
+    if (addr != 0xFFFF && !bus_pages_trap(cpu->pages, (addr_t)(addr + 1), msb8(data16)))
+    {
+        data_t *hi = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, (addr_t)(addr + 1));
+        M_REQUIRE_NON_NULL(hi);
+        *hi = msb8(data16);
+    }
+    decode_cache_invalidate(cpu->decode_cache, addr);
+    decode_cache_invalidate(cpu->decode_cache, (addr_t)(addr + 1));
+    bus_watch_record(cpu->watch, addr);
+    if (addr != 0xFFFF)
+    {
+        bus_watch_record(cpu->watch, (addr_t)(addr + 1));
+    }
 
     cpu->write_listener = addr;
     return ERR_NONE;
@@ -193,11 +217,13 @@ int cpu_dispatch_storage(const instruction_t *lu, cpu_t *cpu)
         break;
 
     case POP_R16:
+        cpu_flags_sync(cpu); // so that POP AF overwrites the pending flags
         cpu_reg_pair_set(cpu, extract_reg_pair(lu->opcode), cpu_read16_at_idx(cpu, cpu_reg_pair_SP_get(cpu, REG_AF_CODE)));
         cpu_reg_pair_SP_set(cpu, REG_AF_CODE, cpu_reg_pair_SP_get(cpu, REG_AF_CODE) + WORD_SIZE);
         break;
 
     case PUSH_R16:
+        cpu_flags_sync(cpu);
         cpu_reg_pair_SP_set(cpu, REG_AF_CODE, cpu_reg_pair_SP_get(cpu, REG_AF_CODE) - WORD_SIZE);
         M_EXIT_IF_ERR(cpu_write16_at_idx(cpu, cpu_reg_pair_SP_get(cpu, REG_AF_CODE), cpu_reg_pair_get(cpu, extract_reg_pair(lu->opcode))));
         break;
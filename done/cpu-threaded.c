@@ -0,0 +1,447 @@
+/**
+ * @file cpu-threaded.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Threaded-code interpreter for the CPU: one handler per opcode,
+ *        dispatched with GCC's computed goto
+ * @date 2020
+ *
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "alu.h"
+#include "bus.h"
+#include "cpu.h"
+#include "error.h"
+#include "opcode.h"
+#include "cpu-decode.h"
+#include "cpu-threaded.h"
+#include "cpu-ops.h"
+#include "gameboy.h" // REGISTERS_START
+
+#ifndef __GNUC__
+#error "cpu-threaded.c needs GCC's labels as values (computed goto)"
+#endif
+
+// Labels as values are a GNU extension
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+// ======================================================================
+// Bus writes, same semantics as cpu_write_at_idx and cpu_write16_at_idx,
+// without the error propagation for each access: a failed write is only
+// recorded in err (reads are in cpu-ops.h).
+
+static inline void wr(cpu_t *cpu, addr_t addr, data_t data, int *err)
+{
+    if (bus_pages_trap(cpu->pages, addr, data))
+    {
+        bus_watch_record(cpu->watch, addr);
+        cpu->write_listener = addr;
+        return;
+    }
+    data_t *p = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, addr);
+    if (p == NULL)
+    {
+        *err = ERR_BAD_PARAMETER;
+        return;
+    }
+    *p = data;
+    decode_cache_invalidate(cpu->decode_cache, addr);
+    bus_watch_record(cpu->watch, addr);
+    cpu->write_listener = addr;
+}
+
+static inline void wr16(cpu_t *cpu, addr_t addr, addr_t data16, int *err)
+{
+    if (cpu->pages != NULL && (cpu->pages->readonly[addr >> BUS_PAGE_BITS]
+                               || cpu->pages->readonly[(addr_t)(addr + 1) >> BUS_PAGE_BITS]))
+    {
+        // Rare enough to go through the byte by byte version
+        wr(cpu, addr, lsb8(data16), err);
+        if (addr != 0xFFFF)
+        {
+            wr(cpu, (addr_t)(addr + 1), msb8(data16), err);
+        }
+        cpu->write_listener = addr;
+        return;
+    }
+    data_t *lo = bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, addr);
+    data_t *hi = addr != 0xFFFF ? bus_lookup_sync(cpu_bus(cpu), cpu->pages, cpu->watch, (addr_t)(addr + 1)) : NULL;
+    if (lo == NULL || (addr != 0xFFFF && hi == NULL))
+    {
+        *err = ERR_BAD_PARAMETER;
+        return;
+    }
+    *lo = lsb8(data16);
+    decode_cache_invalidate(cpu->decode_cache, addr);
+    bus_watch_record(cpu->watch, addr);
+    if (hi != NULL)
+    {
+        *hi = msb8(data16);
+        decode_cache_invalidate(cpu->decode_cache, (addr_t)(addr + 1));
+        bus_watch_record(cpu->watch, (addr_t)(addr + 1));
+    }
+    cpu->write_listener = addr;
+}
+
+static inline void push(cpu_t *cpu, addr_t data16, int *err)
+{
+    cpu->SP = (uint16_t)(cpu->SP - 2);
+    wr16(cpu, cpu->SP, data16, err);
+}
+
+static inline addr_t pop(cpu_t *cpu)
+{
+    addr_t data16 = rd16(cpu, cpu->SP);
+    cpu->SP = (uint16_t)(cpu->SP + 2);
+    return data16;
+}
+
+// ======================================================================
+// Handlers generators.
+// Each handler ends with "goto next" (PC moves past the instruction),
+// "goto jump" (PC has been set) or "goto taken" (PC has been set by a
+// conditional branch, which lasts xtra_cycles more).
+
+#define N8 rd(cpu, (addr_t)(pc + 1))
+#define N16 rd16(cpu, (addr_t)(pc + 1))
+#define AT_HL rd(cpu, cpu->HL)
+
+#define COND_NZ (!(cpu->F & FLAG_Z))
+#define COND_Z (cpu->F & FLAG_Z)
+#define COND_NC (!(cpu->F & FLAG_C))
+#define COND_C (cpu->F & FLAG_C)
+
+// LD r, r' (the destination is given, the source depends on the opcode)
+#define LD_ROW(c0, c1, c2, c3, c4, c5, c6, c7, DST) \
+    op_##c0: cpu->DST = cpu->B; goto next; \
+    op_##c1: cpu->DST = cpu->C; goto next; \
+    op_##c2: cpu->DST = cpu->D; goto next; \
+    op_##c3: cpu->DST = cpu->E; goto next; \
+    op_##c4: cpu->DST = cpu->H; goto next; \
+    op_##c5: cpu->DST = cpu->L; goto next; \
+    op_##c6: cpu->DST = AT_HL; goto next; \
+    op_##c7: cpu->DST = cpu->A; goto next;
+
+// ALU A, r (OPER is applied to each operand)
+#define ALU_ROW(c0, c1, c2, c3, c4, c5, c6, c7, OPER) \
+    op_##c0: OPER(cpu->B); goto next; \
+    op_##c1: OPER(cpu->C); goto next; \
+    op_##c2: OPER(cpu->D); goto next; \
+    op_##c3: OPER(cpu->E); goto next; \
+    op_##c4: OPER(cpu->H); goto next; \
+    op_##c5: OPER(cpu->L); goto next; \
+    op_##c6: OPER(AT_HL); goto next; \
+    op_##c7: OPER(cpu->A); goto next;
+
+#define DO_ADD(v) cpu->A = add8(cpu, cpu->A, (v), 0)
+#define DO_ADC(v) cpu->A = add8(cpu, cpu->A, (v), CARRY(cpu))
+#define DO_SUB(v) cpu->A = sub8(cpu, cpu->A, (v), 0)
+#define DO_SBC(v) cpu->A = sub8(cpu, cpu->A, (v), CARRY(cpu))
+#define DO_AND(v) cpu->A = and8(cpu, cpu->A, (v))
+#define DO_XOR(v) cpu->A = xor8(cpu, cpu->A, (v))
+#define DO_OR(v)  cpu->A = or8(cpu, cpu->A, (v))
+#define DO_CP(v)  (void)sub8(cpu, cpu->A, (v), 0)
+
+// Prefixed operations reading and writing back their operand
+#define CB_ROW(c0, c1, c2, c3, c4, c5, c6, c7, OPER) \
+    cb_##c0: cpu->B = OPER(cpu, cpu->B); goto next; \
+    cb_##c1: cpu->C = OPER(cpu, cpu->C); goto next; \
+    cb_##c2: cpu->D = OPER(cpu, cpu->D); goto next; \
+    cb_##c3: cpu->E = OPER(cpu, cpu->E); goto next; \
+    cb_##c4: cpu->H = OPER(cpu, cpu->H); goto next; \
+    cb_##c5: cpu->L = OPER(cpu, cpu->L); goto next; \
+    cb_##c6: wr(cpu, cpu->HL, OPER(cpu, AT_HL), &err); goto next; \
+    cb_##c7: cpu->A = OPER(cpu, cpu->A); goto next;
+
+#define BIT_ROW(c0, c1, c2, c3, c4, c5, c6, c7, N) \
+    cb_##c0: bit_test(cpu, cpu->B, N); goto next; \
+    cb_##c1: bit_test(cpu, cpu->C, N); goto next; \
+    cb_##c2: bit_test(cpu, cpu->D, N); goto next; \
+    cb_##c3: bit_test(cpu, cpu->E, N); goto next; \
+    cb_##c4: bit_test(cpu, cpu->H, N); goto next; \
+    cb_##c5: bit_test(cpu, cpu->L, N); goto next; \
+    cb_##c6: bit_test(cpu, AT_HL, N); goto next; \
+    cb_##c7: bit_test(cpu, cpu->A, N); goto next;
+
+#define RES(cpu, x, N) (data_t)((x) & ~(1 << (N)))
+#define SET(cpu, x, N) (data_t)((x) | (1 << (N)))
+
+#define CHG_ROW(c0, c1, c2, c3, c4, c5, c6, c7, OPER, N) \
+    cb_##c0: cpu->B = OPER(cpu, cpu->B, N); goto next; \
+    cb_##c1: cpu->C = OPER(cpu, cpu->C, N); goto next; \
+    cb_##c2: cpu->D = OPER(cpu, cpu->D, N); goto next; \
+    cb_##c3: cpu->E = OPER(cpu, cpu->E, N); goto next; \
+    cb_##c4: cpu->H = OPER(cpu, cpu->H, N); goto next; \
+    cb_##c5: cpu->L = OPER(cpu, cpu->L, N); goto next; \
+    cb_##c6: wr(cpu, cpu->HL, OPER(cpu, AT_HL, N), &err); goto next; \
+    cb_##c7: cpu->A = OPER(cpu, cpu->A, N); goto next;
+
+// Addresses of the handlers of 16 consecutive opcodes (P is op_ or cb_)
+#define ROW16(P, h) \
+    &&P##h##0, &&P##h##1, &&P##h##2, &&P##h##3, &&P##h##4, &&P##h##5, &&P##h##6, &&P##h##7, \
+    &&P##h##8, &&P##h##9, &&P##h##A, &&P##h##B, &&P##h##C, &&P##h##D, &&P##h##E, &&P##h##F
+
+#define TABLE(P) { \
+    ROW16(P, 0), ROW16(P, 1), ROW16(P, 2), ROW16(P, 3), ROW16(P, 4), ROW16(P, 5), ROW16(P, 6), ROW16(P, 7), \
+    ROW16(P, 8), ROW16(P, 9), ROW16(P, A), ROW16(P, B), ROW16(P, C), ROW16(P, D), ROW16(P, E), ROW16(P, F) }
+
+// ==== see cpu-threaded.h ========================================
+int cpu_step_threaded(cpu_t *cpu)
+{
+    static const void *const direct[256] = TABLE(op_);
+    static const void *const prefixed[256] = TABLE(cb_);
+
+    int err = ERR_NONE;
+    cpu_flags_sync(cpu); // the flags are computed eagerly here
+    const addr_t pc = cpu->PC;
+    data_t op = rd(cpu, pc);
+    const instruction_t *lu = &instruction_direct[op];
+
+    goto *direct[op];
+
+    // ---- 0x00 - 0x3F ----
+    op_00: goto next;
+    op_01: cpu->BC = N16; goto next;
+    op_02: wr(cpu, cpu->BC, cpu->A, &err); goto next;
+    op_03: ++cpu->BC; goto next;
+    op_04: cpu->B = inc8(cpu, cpu->B); goto next;
+    op_05: cpu->B = dec8(cpu, cpu->B); goto next;
+    op_06: cpu->B = N8; goto next;
+    op_07: cpu->A = rlc(cpu, cpu->A); cpu->F &= FLAG_C; goto next;
+    op_08: wr16(cpu, N16, cpu->SP, &err); goto next;
+    op_09: add_hl(cpu, cpu->BC); goto next;
+    op_0A: cpu->A = rd(cpu, cpu->BC); goto next;
+    op_0B: --cpu->BC; goto next;
+    op_0C: cpu->C = inc8(cpu, cpu->C); goto next;
+    op_0D: cpu->C = dec8(cpu, cpu->C); goto next;
+    op_0E: cpu->C = N8; goto next;
+    op_0F: cpu->A = rrc(cpu, cpu->A); cpu->F &= FLAG_C; goto next;
+
+    op_10: goto next;
+    op_11: cpu->DE = N16; goto next;
+    op_12: wr(cpu, cpu->DE, cpu->A, &err); goto next;
+    op_13: ++cpu->DE; goto next;
+    op_14: cpu->D = inc8(cpu, cpu->D); goto next;
+    op_15: cpu->D = dec8(cpu, cpu->D); goto next;
+    op_16: cpu->D = N8; goto next;
+    op_17: cpu->A = rl(cpu, cpu->A); cpu->F &= FLAG_C; goto next;
+    op_18: cpu->PC = (addr_t)(pc + lu->bytes + (int8_t)N8); goto jump;
+    op_19: add_hl(cpu, cpu->DE); goto next;
+    op_1A: cpu->A = rd(cpu, cpu->DE); goto next;
+    op_1B: --cpu->DE; goto next;
+    op_1C: cpu->E = inc8(cpu, cpu->E); goto next;
+    op_1D: cpu->E = dec8(cpu, cpu->E); goto next;
+    op_1E: cpu->E = N8; goto next;
+    op_1F: cpu->A = rr(cpu, cpu->A); cpu->F &= FLAG_C; goto next;
+
+    op_20: if (COND_NZ) goto jr; goto next;
+    op_21: cpu->HL = N16; goto next;
+    op_22: wr(cpu, cpu->HL, cpu->A, &err); ++cpu->HL; goto next;
+    op_23: ++cpu->HL; goto next;
+    op_24: cpu->H = inc8(cpu, cpu->H); goto next;
+    op_25: cpu->H = dec8(cpu, cpu->H); goto next;
+    op_26: cpu->H = N8; goto next;
+    op_27: daa(cpu); goto next;
+    op_28: if (COND_Z) goto jr; goto next;
+    op_29: add_hl(cpu, cpu->HL); goto next;
+    op_2A: cpu->A = AT_HL; ++cpu->HL; goto next;
+    op_2B: --cpu->HL; goto next;
+    op_2C: cpu->L = inc8(cpu, cpu->L); goto next;
+    op_2D: cpu->L = dec8(cpu, cpu->L); goto next;
+    op_2E: cpu->L = N8; goto next;
+    op_2F: cpu->A = (data_t)~cpu->A; cpu->F |= FLAG_N | FLAG_H; goto next;
+
+    op_30: if (COND_NC) goto jr; goto next;
+    op_31: cpu->SP = N16; goto next;
+    op_32: wr(cpu, cpu->HL, cpu->A, &err); --cpu->HL; goto next;
+    op_33: ++cpu->SP; goto next;
+    op_34: wr(cpu, cpu->HL, inc8(cpu, AT_HL), &err); goto next;
+    op_35: wr(cpu, cpu->HL, dec8(cpu, AT_HL), &err); goto next;
+    op_36: wr(cpu, cpu->HL, N8, &err); goto next;
+    op_37: cpu->F = (flags_t)((cpu->F & FLAG_Z) | FLAG_C); goto next;
+    op_38: if (COND_C) goto jr; goto next;
+    op_39: add_hl(cpu, cpu->SP); goto next;
+    op_3A: cpu->A = AT_HL; --cpu->HL; goto next;
+    op_3B: --cpu->SP; goto next;
+    op_3C: cpu->A = inc8(cpu, cpu->A); goto next;
+    op_3D: cpu->A = dec8(cpu, cpu->A); goto next;
+    op_3E: cpu->A = N8; goto next;
+    op_3F: cpu->F = (flags_t)((cpu->F & FLAG_Z) | (~cpu->F & FLAG_C)); goto next;
+
+    // ---- 0x40 - 0x7F: LD r, r' and HALT ----
+    LD_ROW(40, 41, 42, 43, 44, 45, 46, 47, B)
+    LD_ROW(48, 49, 4A, 4B, 4C, 4D, 4E, 4F, C)
+    LD_ROW(50, 51, 52, 53, 54, 55, 56, 57, D)
+    LD_ROW(58, 59, 5A, 5B, 5C, 5D, 5E, 5F, E)
+    LD_ROW(60, 61, 62, 63, 64, 65, 66, 67, H)
+    LD_ROW(68, 69, 6A, 6B, 6C, 6D, 6E, 6F, L)
+    op_70: wr(cpu, cpu->HL, cpu->B, &err); goto next;
+    op_71: wr(cpu, cpu->HL, cpu->C, &err); goto next;
+    op_72: wr(cpu, cpu->HL, cpu->D, &err); goto next;
+    op_73: wr(cpu, cpu->HL, cpu->E, &err); goto next;
+    op_74: wr(cpu, cpu->HL, cpu->H, &err); goto next;
+    op_75: wr(cpu, cpu->HL, cpu->L, &err); goto next;
+    op_76: cpu->HALT = 1; goto next;
+    op_77: wr(cpu, cpu->HL, cpu->A, &err); goto next;
+    LD_ROW(78, 79, 7A, 7B, 7C, 7D, 7E, 7F, A)
+
+    // ---- 0x80 - 0xBF: ALU A, r ----
+    ALU_ROW(80, 81, 82, 83, 84, 85, 86, 87, DO_ADD)
+    ALU_ROW(88, 89, 8A, 8B, 8C, 8D, 8E, 8F, DO_ADC)
+    ALU_ROW(90, 91, 92, 93, 94, 95, 96, 97, DO_SUB)
+    ALU_ROW(98, 99, 9A, 9B, 9C, 9D, 9E, 9F, DO_SBC)
+    ALU_ROW(A0, A1, A2, A3, A4, A5, A6, A7, DO_AND)
+    ALU_ROW(A8, A9, AA, AB, AC, AD, AE, AF, DO_XOR)
+    ALU_ROW(B0, B1, B2, B3, B4, B5, B6, B7, DO_OR)
+    ALU_ROW(B8, B9, BA, BB, BC, BD, BE, BF, DO_CP)
+
+    // ---- 0xC0 - 0xFF ----
+    op_C0: if (COND_NZ) goto ret_taken; goto next;
+    op_C1: cpu->BC = pop(cpu); goto next;
+    op_C2: if (COND_NZ) goto jp_taken; goto next;
+    op_C3: cpu->PC = N16; goto jump;
+    op_C4: if (COND_NZ) goto call_taken; goto next;
+    op_C5: push(cpu, cpu->BC, &err); goto next;
+    op_C6: DO_ADD(N8); goto next;
+    op_C7: goto rst;
+    op_C8: if (COND_Z) goto ret_taken; goto next;
+    op_C9: cpu->PC = pop(cpu); goto jump;
+    op_CA: if (COND_Z) goto jp_taken; goto next;
+    op_CB: op = N8; lu = &instruction_prefixed[op]; goto *prefixed[op];
+    op_CC: if (COND_Z) goto call_taken; goto next;
+    op_CD: push(cpu, (addr_t)(pc + lu->bytes), &err); cpu->PC = N16; goto jump;
+    op_CE: DO_ADC(N8); goto next;
+    op_CF: goto rst;
+
+    op_D0: if (COND_NC) goto ret_taken; goto next;
+    op_D1: cpu->DE = pop(cpu); goto next;
+    op_D2: if (COND_NC) goto jp_taken; goto next;
+    op_D3: goto unknown;
+    op_D4: if (COND_NC) goto call_taken; goto next;
+    op_D5: push(cpu, cpu->DE, &err); goto next;
+    op_D6: DO_SUB(N8); goto next;
+    op_D7: goto rst;
+    op_D8: if (COND_C) goto ret_taken; goto next;
+    op_D9: cpu->IME = 1; cpu->PC = pop(cpu); goto jump;
+    op_DA: if (COND_C) goto jp_taken; goto next;
+    op_DB: goto unknown;
+    op_DC: if (COND_C) goto call_taken; goto next;
+    op_DD: goto unknown;
+    op_DE: DO_SBC(N8); goto next;
+    op_DF: goto rst;
+
+    op_E0: wr(cpu, (addr_t)(REGISTERS_START + N8), cpu->A, &err); goto next;
+    op_E1: cpu->HL = pop(cpu); goto next;
+    op_E2: wr(cpu, (addr_t)(REGISTERS_START + cpu->C), cpu->A, &err); goto next;
+    op_E3: goto unknown;
+    op_E4: goto unknown;
+    op_E5: push(cpu, cpu->HL, &err); goto next;
+    op_E6: DO_AND(N8); goto next;
+    op_E7: goto rst;
+    op_E8: cpu->SP = add_sp(cpu, N8); goto next;
+    op_E9: cpu->PC = cpu->HL; goto jump;
+    op_EA: wr(cpu, N16, cpu->A, &err); goto next;
+    op_EB: goto unknown;
+    op_EC: goto unknown;
+    op_ED: goto unknown;
+    op_EE: DO_XOR(N8); goto next;
+    op_EF: goto rst;
+
+    op_F0: cpu->A = rd(cpu, (addr_t)(REGISTERS_START + N8)); goto next;
+    op_F1: cpu->AF = pop(cpu) & 0xFFF0; goto next;
+    op_F2: cpu->A = rd(cpu, (addr_t)(REGISTERS_START + cpu->C)); goto next;
+    op_F3: cpu->IME = 0; goto next;
+    op_F4: goto unknown;
+    op_F5: push(cpu, cpu->AF, &err); goto next;
+    op_F6: DO_OR(N8); goto next;
+    op_F7: goto rst;
+    op_F8: cpu->HL = add_sp(cpu, N8); goto next;
+    op_F9: cpu->SP = cpu->HL; goto next;
+    op_FA: cpu->A = rd(cpu, N16); goto next;
+    op_FB: cpu->IME = 1; goto next;
+    op_FC: goto unknown;
+    op_FD: goto unknown;
+    op_FE: DO_CP(N8); goto next;
+    op_FF: goto rst;
+
+    // ---- prefixed ----
+    CB_ROW(00, 01, 02, 03, 04, 05, 06, 07, rlc)
+    CB_ROW(08, 09, 0A, 0B, 0C, 0D, 0E, 0F, rrc)
+    CB_ROW(10, 11, 12, 13, 14, 15, 16, 17, rl)
+    CB_ROW(18, 19, 1A, 1B, 1C, 1D, 1E, 1F, rr)
+    CB_ROW(20, 21, 22, 23, 24, 25, 26, 27, sla)
+    CB_ROW(28, 29, 2A, 2B, 2C, 2D, 2E, 2F, sra)
+    CB_ROW(30, 31, 32, 33, 34, 35, 36, 37, swap)
+    CB_ROW(38, 39, 3A, 3B, 3C, 3D, 3E, 3F, srl)
+    BIT_ROW(40, 41, 42, 43, 44, 45, 46, 47, 0)
+    BIT_ROW(48, 49, 4A, 4B, 4C, 4D, 4E, 4F, 1)
+    BIT_ROW(50, 51, 52, 53, 54, 55, 56, 57, 2)
+    BIT_ROW(58, 59, 5A, 5B, 5C, 5D, 5E, 5F, 3)
+    BIT_ROW(60, 61, 62, 63, 64, 65, 66, 67, 4)
+    BIT_ROW(68, 69, 6A, 6B, 6C, 6D, 6E, 6F, 5)
+    BIT_ROW(70, 71, 72, 73, 74, 75, 76, 77, 6)
+    BIT_ROW(78, 79, 7A, 7B, 7C, 7D, 7E, 7F, 7)
+    CHG_ROW(80, 81, 82, 83, 84, 85, 86, 87, RES, 0)
+    CHG_ROW(88, 89, 8A, 8B, 8C, 8D, 8E, 8F, RES, 1)
+    CHG_ROW(90, 91, 92, 93, 94, 95, 96, 97, RES, 2)
+    CHG_ROW(98, 99, 9A, 9B, 9C, 9D, 9E, 9F, RES, 3)
+    CHG_ROW(A0, A1, A2, A3, A4, A5, A6, A7, RES, 4)
+    CHG_ROW(A8, A9, AA, AB, AC, AD, AE, AF, RES, 5)
+    CHG_ROW(B0, B1, B2, B3, B4, B5, B6, B7, RES, 6)
+    CHG_ROW(B8, B9, BA, BB, BC, BD, BE, BF, RES, 7)
+    CHG_ROW(C0, C1, C2, C3, C4, C5, C6, C7, SET, 0)
+    CHG_ROW(C8, C9, CA, CB, CC, CD, CE, CF, SET, 1)
+    CHG_ROW(D0, D1, D2, D3, D4, D5, D6, D7, SET, 2)
+    CHG_ROW(D8, D9, DA, DB, DC, DD, DE, DF, SET, 3)
+    CHG_ROW(E0, E1, E2, E3, E4, E5, E6, E7, SET, 4)
+    CHG_ROW(E8, E9, EA, EB, EC, ED, EE, EF, SET, 5)
+    CHG_ROW(F0, F1, F2, F3, F4, F5, F6, F7, SET, 6)
+    CHG_ROW(F8, F9, FA, FB, FC, FD, FE, FF, SET, 7)
+
+    // ---- shared tails ----
+jr:
+    cpu->PC = (addr_t)(pc + lu->bytes + (int8_t)N8);
+    goto taken;
+
+jp_taken:
+    cpu->PC = N16;
+    goto taken;
+
+call_taken:
+    push(cpu, (addr_t)(pc + lu->bytes), &err);
+    cpu->PC = N16;
+    goto taken;
+
+ret_taken:
+    cpu->PC = pop(cpu);
+    goto taken;
+
+rst:
+    push(cpu, (addr_t)(pc + lu->bytes), &err);
+    cpu->PC = (addr_t)(extract_n3(op) << 3);
+    goto jump;
+
+unknown:
+    fprintf(stderr, "Unknown instruction, Code: 0x%" PRIX8 "\n", op);
+    return ERR_INSTR;
+
+taken:
+    if (err != ERR_NONE) return err;
+    cpu->idle_time += lu->xtra_cycles;
+    cpu->idle_time += lu->cycles - 1;
+    return ERR_NONE;
+
+next:
+    if (err != ERR_NONE) return err;
+    cpu->PC = (addr_t)(pc + lu->bytes);
+    cpu->idle_time += lu->cycles - 1;
+    return ERR_NONE;
+
+jump:
+    if (err != ERR_NONE) return err;
+    cpu->idle_time += lu->cycles - 1;
+    return ERR_NONE;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+/**
+ * @file cpu-threaded.h
+ * @brief Threaded-code interpreter for the CPU (alternative to cpu_dispatch)
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "cpu.h"
+
+/**
+ * @brief Executes the instruction at PC, same as the cpu_dispatch family
+ *        (PC, flags, memory, idle_time and write_listener are updated).
+ *        Each of the 256 + 256 opcodes has its own handler, reached with
+ *        GCC's computed goto. Interrupts and HALT are handled by the caller.
+ *
+ * @param cpu cpu which shall execute, with a bus plugged (not checked)
+ * @return error code (only for invalid opcodes and writes to unmapped addresses)
+ */
+int cpu_step_threaded(cpu_t* cpu);
+
+#ifdef __cplusplus
+}
+#endif
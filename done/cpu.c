@@ -7,6 +7,7 @@
  */
 
 #include <stdint.h>
+#include <stddef.h> // offsetof
 
 #include "alu.h"
 #include "bus.h"
@@ -16,6 +17,11 @@
 #include "cpu-storage.h"
 #include "cpu-registers.h"
 #include "cpu-alu.h"
+#include "cpu-decode.h"
+#include "cpu-threaded.h"
+
+// The prebuilt libraries read the registers, the ALU output and the bus at fixed offsets
+_Static_assert(offsetof(cpu_t, alu) == 0x0C && offsetof(cpu_t, bus) == 0x10, "cpu_t layout changed");
 
 // ==== see cpu.h ========================================
 int cpu_init(cpu_t *cpu)
@@ -42,6 +48,61 @@ int cpu_plug(cpu_t *cpu, bus_t *bus)
     return bus_plug(*cpu->bus, &cpu->high_ram, HIGH_RAM_START, HIGH_RAM_END);
 }
 
+// ==== see cpu.h ========================================
+int cpu_enable_decode_cache(cpu_t *cpu)
+{
+    M_REQUIRE_NON_NULL(cpu);
+
+    if (cpu->decode_cache == NULL)
+    {
+        M_EXIT_IF_ERR(decode_cache_create(&cpu->decode_cache));
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see cpu.h ========================================
+int cpu_use_pages(cpu_t *cpu, bus_pages_t *pages)
+{
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE_NON_NULL(pages);
+
+    cpu->pages = pages;
+
+    return ERR_NONE;
+}
+
+// ==== see cpu.h ========================================
+int cpu_use_watch(cpu_t *cpu, bus_watch_t *watch)
+{
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE_NON_NULL(watch);
+
+    cpu->watch = watch;
+
+    return ERR_NONE;
+}
+
+// ==== see cpu.h ========================================
+int cpu_use_profile(cpu_t *cpu, profile_t *profile)
+{
+    M_REQUIRE_NON_NULL(cpu);
+
+    cpu->profile = profile;
+
+    return ERR_NONE;
+}
+
+// ==== see cpu.h ========================================
+int cpu_enable_lazy_flags(cpu_t *cpu)
+{
+    M_REQUIRE_NON_NULL(cpu);
+
+    cpu->lazy_flags = 1;
+
+    return ERR_NONE;
+}
+
 // ==== see cpu.h ========================================
 void cpu_free(cpu_t *cpu)
 {
@@ -49,6 +110,7 @@ void cpu_free(cpu_t *cpu)
     {
         bus_unplug(cpu->bus, &cpu->high_ram);
         component_free(&cpu->high_ram);
+        decode_cache_free(&cpu->decode_cache);
         cpu->bus = NULL;
     }
 }
@@ -67,18 +129,17 @@ typedef enum
 } cc_t;
 
 /**
- * @brief Extract cc code from instruction opcode and check the appropriate flag
+ * @brief Checks the flag corresponding to an (already extracted) cc code
  *
  * @param cpu the cpu that contains the flags
- * @param op the instruction's opcode
+ * @param cc the condition code
  * @return int 0 (false) if the corresponding flag is not correct, else true (any value) otw.
  */
-int check_CC(cpu_t *cpu, opcode_t op)
+static int cpu_check_cc(const cpu_t *cpu, uint8_t cc)
 {
     if (cpu != NULL)
     {
-        uint8_t cc = extract_cc(op);
-        flags_t f = lsb8(cpu_reg_pair_get(cpu, REG_AF_CODE));
+        const flags_t f = cpu_flags_get(cpu);
 
         switch (cc)
         {
@@ -101,6 +162,18 @@ int check_CC(cpu_t *cpu, opcode_t op)
     return 0;
 }
 
+/**
+ * @brief Extract cc code from instruction opcode and check the appropriate flag
+ *
+ * @param cpu the cpu that contains the flags
+ * @param op the instruction's opcode
+ * @return int 0 (false) if the corresponding flag is not correct, else true (any value) otw.
+ */
+int check_CC(cpu_t *cpu, opcode_t op)
+{
+    return cpu_check_cc(cpu, extract_cc(op));
+}
+
 static int cpu_dispatch(const instruction_t *lu, cpu_t *cpu)
 {
     M_REQUIRE_NON_NULL(lu);
@@ -305,6 +378,357 @@ static int cpu_dispatch(const instruction_t *lu, cpu_t *cpu)
     return ERR_NONE;
 }
 
+// ======================================================================
+// Handlers of decoded instructions (see cpu-decode.h).
+// They use the operands extracted once at decoding time instead of
+// reading them again from the bus and the opcode.
+
+static int cpu_exec_alu(const decoded_instr_t *di, cpu_t *cpu)
+{
+    return cpu_dispatch_alu(di->lu, cpu);
+}
+
+static int cpu_exec_storage(const decoded_instr_t *di, cpu_t *cpu)
+{
+    return cpu_dispatch_storage(di->lu, cpu);
+}
+
+static int cpu_exec_ld_r8_r8(const decoded_instr_t *di, cpu_t *cpu)
+{
+    if (di->reg_dst == di->reg_src)
+    {
+        M_EXIT_ERR(ERR_INSTR, "Used LD_R8_R8 with both registers equal\n\t reg_kind = %u", di->reg_dst);
+    }
+    cpu_reg_set(cpu, di->reg_dst, cpu_reg_get(cpu, di->reg_src));
+    cpu->PC += di->bytes;
+    return ERR_NONE;
+}
+
+static int cpu_exec_ld_r8_n8(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu_reg_set(cpu, di->reg_dst, (data_t)di->imm);
+    cpu->PC += di->bytes;
+    return ERR_NONE;
+}
+
+static int cpu_exec_ld_r16sp_n16(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu_reg_pair_SP_set(cpu, di->pair, di->imm);
+    cpu->PC += di->bytes;
+    return ERR_NONE;
+}
+
+static int cpu_exec_jp_cc_n16(const decoded_instr_t *di, cpu_t *cpu)
+{
+    if (cpu_check_cc(cpu, di->cc))
+    {
+        cpu->PC = di->imm;
+        cpu->idle_time += di->xtra_cycles;
+    }
+    else
+    {
+        cpu->PC += di->bytes;
+    }
+    return ERR_NONE;
+}
+
+static int cpu_exec_jp_hl(const decoded_instr_t *di, cpu_t *cpu)
+{
+    (void)di;
+    cpu->PC = cpu_HL_get(cpu);
+    return ERR_NONE;
+}
+
+static int cpu_exec_jp_n16(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu->PC = di->imm;
+    return ERR_NONE;
+}
+
+static int cpu_exec_jr_cc_e8(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu->PC += di->bytes;
+    if (cpu_check_cc(cpu, di->cc))
+    {
+        cpu->PC += (int8_t)di->imm;
+        cpu->idle_time += di->xtra_cycles;
+    }
+    return ERR_NONE;
+}
+
+static int cpu_exec_jr_e8(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu->PC += di->bytes + (int8_t)di->imm;
+    return ERR_NONE;
+}
+
+static int cpu_exec_call_cc_n16(const decoded_instr_t *di, cpu_t *cpu)
+{
+    if (cpu_check_cc(cpu, di->cc))
+    {
+        M_EXIT_IF_ERR(cpu_SP_push(cpu, cpu->PC + di->bytes));
+        cpu->PC = di->imm;
+        cpu->idle_time += di->xtra_cycles;
+    }
+    else
+    {
+        cpu->PC += di->bytes;
+    }
+    return ERR_NONE;
+}
+
+static int cpu_exec_call_n16(const decoded_instr_t *di, cpu_t *cpu)
+{
+    M_EXIT_IF_ERR(cpu_SP_push(cpu, cpu->PC + di->bytes));
+    cpu->PC = di->imm;
+    return ERR_NONE;
+}
+
+static int cpu_exec_ret(const decoded_instr_t *di, cpu_t *cpu)
+{
+    (void)di;
+    cpu->PC = cpu_SP_pop(cpu);
+    return ERR_NONE;
+}
+
+static int cpu_exec_ret_cc(const decoded_instr_t *di, cpu_t *cpu)
+{
+    if (cpu_check_cc(cpu, di->cc))
+    {
+        cpu->PC = cpu_SP_pop(cpu);
+        cpu->idle_time += di->xtra_cycles;
+    }
+    else
+    {
+        cpu->PC += di->bytes;
+    }
+    return ERR_NONE;
+}
+
+static int cpu_exec_rst_u3(const decoded_instr_t *di, cpu_t *cpu)
+{
+    M_EXIT_IF_ERR(cpu_SP_push(cpu, cpu->PC + di->bytes));
+    cpu->PC = extract_n3(di->lu->opcode) << 3;
+    return ERR_NONE;
+}
+
+static int cpu_exec_edi(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu->IME = extract_ime(di->lu->opcode);
+    cpu->PC += di->bytes;
+    return ERR_NONE;
+}
+
+static int cpu_exec_reti(const decoded_instr_t *di, cpu_t *cpu)
+{
+    (void)di;
+    cpu->IME = 1;
+    cpu->PC = cpu_SP_pop(cpu);
+    return ERR_NONE;
+}
+
+static int cpu_exec_halt(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu->HALT = 1;
+    cpu->PC += di->bytes;
+    return ERR_NONE;
+}
+
+static int cpu_exec_nop(const decoded_instr_t *di, cpu_t *cpu)
+{
+    cpu->PC += di->bytes;
+    return ERR_NONE;
+}
+
+static int cpu_exec_unknown(const decoded_instr_t *di, cpu_t *cpu)
+{
+    (void)di;
+    fprintf(stderr, "Unknown instruction, Code: 0x%" PRIX8 "\n", cpu_read_at_idx(cpu, cpu->PC));
+    return ERR_INSTR;
+}
+
+/**
+ * @brief Selects the handler of a given instruction family
+ *
+ * @param family the instruction's family
+ * @return cpu_handler_t the function executing it
+ */
+static cpu_handler_t cpu_handler_of(opcode_family family)
+{
+    switch (family)
+    {
+    case LD_R8_R8:
+        return cpu_exec_ld_r8_r8;
+    case LD_R8_N8:
+        return cpu_exec_ld_r8_n8;
+    case LD_R16SP_N16:
+        return cpu_exec_ld_r16sp_n16;
+
+    case LD_A_BCR:
+    case LD_A_CR:
+    case LD_A_DER:
+    case LD_A_HLRU:
+    case LD_A_N16R:
+    case LD_A_N8R:
+    case LD_BCR_A:
+    case LD_CR_A:
+    case LD_DER_A:
+    case LD_HLRU_A:
+    case LD_HLR_N8:
+    case LD_HLR_R8:
+    case LD_N16R_A:
+    case LD_N16R_SP:
+    case LD_N8R_A:
+    case LD_R8_HLR:
+    case LD_SP_HL:
+    case POP_R16:
+    case PUSH_R16:
+        return cpu_exec_storage;
+
+    case JP_CC_N16:
+        return cpu_exec_jp_cc_n16;
+    case JP_HL:
+        return cpu_exec_jp_hl;
+    case JP_N16:
+        return cpu_exec_jp_n16;
+    case JR_CC_E8:
+        return cpu_exec_jr_cc_e8;
+    case JR_E8:
+        return cpu_exec_jr_e8;
+    case CALL_CC_N16:
+        return cpu_exec_call_cc_n16;
+    case CALL_N16:
+        return cpu_exec_call_n16;
+    case RET:
+        return cpu_exec_ret;
+    case RET_CC:
+        return cpu_exec_ret_cc;
+    case RST_U3:
+        return cpu_exec_rst_u3;
+    case EDI:
+        return cpu_exec_edi;
+    case RETI:
+        return cpu_exec_reti;
+    case HALT:
+        return cpu_exec_halt;
+    case STOP:
+    case NOP:
+        return cpu_exec_nop;
+
+    case ADD_A_HLR:
+    case ADD_A_N8:
+    case ADD_A_R8:
+    case INC_HLR:
+    case INC_R8:
+    case ADD_HL_R16SP:
+    case INC_R16SP:
+    case SUB_A_HLR:
+    case SUB_A_N8:
+    case SUB_A_R8:
+    case DEC_HLR:
+    case DEC_R8:
+    case DEC_R16SP:
+    case AND_A_HLR:
+    case AND_A_R8:
+    case AND_A_N8:
+    case OR_A_HLR:
+    case OR_A_N8:
+    case OR_A_R8:
+    case XOR_A_HLR:
+    case XOR_A_N8:
+    case XOR_A_R8:
+    case CPL:
+    case CP_A_HLR:
+    case CP_A_N8:
+    case CP_A_R8:
+    case SLA_HLR:
+    case SLA_R8:
+    case SRA_HLR:
+    case SRA_R8:
+    case SRL_HLR:
+    case SRL_R8:
+    case ROTCA:
+    case ROTA:
+    case ROTC_HLR:
+    case ROT_HLR:
+    case ROTC_R8:
+    case ROT_R8:
+    case SWAP_HLR:
+    case SWAP_R8:
+    case BIT_U3_HLR:
+    case BIT_U3_R8:
+    case CHG_U3_HLR:
+    case CHG_U3_R8:
+    case LD_HLSP_S8:
+    case DAA:
+    case SCCF:
+        return cpu_exec_alu;
+
+    default:
+        return cpu_exec_unknown;
+    }
+}
+
+/**
+ * @brief Fetches and decodes the instruction at a given address
+ *
+ * @param cpu the cpu whose bus holds the instruction
+ * @param addr address of the instruction
+ * @param di (modified) entry to fill
+ */
+static void cpu_decode(const cpu_t *cpu, addr_t addr, decoded_instr_t *di)
+{
+    data_t prefix = cpu_read_at_idx(cpu, addr);
+    const instruction_t *lu = &instruction_direct[prefix];
+    if (prefix == PREFIXED)
+    {
+        lu = &instruction_prefixed[cpu_read_at_idx(cpu, (addr_t)(addr + 1))];
+    }
+
+    di->lu = lu;
+    di->handler = cpu_handler_of(lu->family);
+    di->reg_dst = extract_reg(lu->opcode, 3);
+    di->reg_src = extract_reg(lu->opcode, 0);
+    di->pair = extract_reg_pair(lu->opcode);
+    di->cc = extract_cc(lu->opcode);
+    di->bytes = lu->bytes;
+    di->cycles = lu->cycles;
+    di->xtra_cycles = lu->xtra_cycles;
+
+    di->imm = 0;
+    if (lu->kind == DIRECT && lu->bytes == 2)
+    {
+        di->imm = cpu_read_at_idx(cpu, (addr_t)(addr + 1));
+    }
+    else if (lu->kind == DIRECT && lu->bytes == 3)
+    {
+        di->imm = FROM_GameBoy_16(cpu_read16_at_idx(cpu, (addr_t)(addr + 1)));
+    }
+
+    di->valid = 1;
+}
+
+/**
+ * @brief Executes a decoded instruction, same as cpu_dispatch
+ *
+ * @param di the decoded instruction
+ * @param cpu the cpu which shall execute
+ * @return Error code
+ */
+static int cpu_dispatch_decoded(const decoded_instr_t *di, cpu_t *cpu)
+{
+    // Set flags and value to 0
+    cpu->alu.flags = (flags_t)0;
+    cpu->alu.value = (uint16_t)0;
+
+    M_EXIT_IF_ERR(di->handler(di, cpu));
+
+    // Update idle_time
+    cpu->idle_time += di->cycles - 1;
+
+    return ERR_NONE;
+}
+
 /**
  * @brief Outputs the least significant index for which both arguments' respective bits are 1
  *
@@ -327,6 +751,110 @@ interrupt_t first_interrupt(data_t IE, data_t IF)
     return JOYPAD + 1;
 }
 
+// ==== see cpu.h ========================================
+int cpu_step_switch(cpu_t *cpu)
+{
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
+
+    decoded_instr_t *di = decode_cache_lookup(cpu->decode_cache, cpu->PC);
+    if (di == NULL)
+    {
+        di = decode_cache_slot(cpu->decode_cache, cpu->PC);
+        if (di != NULL)
+        {
+            cpu_decode(cpu, cpu->PC, di);
+        }
+    }
+    if (di != NULL)
+    {
+        return cpu_dispatch_decoded(di, cpu);
+    }
+
+    // No cache, or an address that may not be cached
+    data_t prefix = cpu_read_at_idx(cpu, cpu->PC);
+    if (prefix == PREFIXED)
+    {
+        data_t opcode = cpu_read_data_after_opcode(cpu);
+        return cpu_dispatch(&instruction_prefixed[opcode], cpu);
+    }
+
+    return cpu_dispatch(&instruction_direct[prefix], cpu);
+}
+
+/**
+ * @brief Executes the instruction at PC with the interpreter the program is built with
+ *
+ * @param cpu the CPU which shall execute
+ * @return Error code
+ */
+static inline int cpu_step(cpu_t *cpu)
+{
+#ifdef CPU_THREADED
+    return cpu_step_threaded(cpu);
+#else
+    return cpu_step_switch(cpu);
+#endif
+}
+
+#ifdef CPU_PROFILE
+/**
+ * @brief Gets the ROM bank an address is fetched from, for the profile
+ */
+static uint16_t cpu_profile_bank(const cpu_t *cpu, addr_t addr)
+{
+    return cpu->decode_cache != NULL && decode_banked(addr) ? cpu->decode_cache->bank : 0;
+}
+
+/**
+ * @brief Executes the instruction at PC and counts it in the profile of
+ *        the cpu: its opcode, its cycles, and the call or the return it makes
+ *
+ * @param cpu the CPU which shall execute
+ * @return Error code
+ */
+static int cpu_step_profiled(cpu_t *cpu)
+{
+    const addr_t pc = cpu->PC;
+    const uint16_t sp = cpu->SP;
+    const uint16_t bank = cpu_profile_bank(cpu, pc);
+    const data_t prefix = cpu_read_at_idx(cpu, pc);
+    const data_t opcode = prefix == PREFIXED ? cpu_read_data_after_opcode(cpu) : prefix;
+    const instruction_t *lu = prefix == PREFIXED ? &instruction_prefixed[opcode] : &instruction_direct[opcode];
+
+    M_EXIT_IF_ERR(cpu_step(cpu));
+    M_EXIT_IF_ERR(profile_instr(cpu->profile, bank, pc, prefix == PREFIXED ? PROFILE_CB | opcode : opcode,
+                                (uint8_t)(cpu->idle_time + 1)));
+
+    // Taken if the return address has been pushed or popped
+    switch (lu->family)
+    {
+    case CALL_N16:
+    case CALL_CC_N16:
+    case RST_U3:
+        if (cpu->SP == (uint16_t)(sp - 2))
+        {
+            M_EXIT_IF_ERR(profile_call(cpu->profile, cpu_profile_bank(cpu, cpu->PC), cpu->PC, cpu->SP));
+        }
+        break;
+
+    case RET:
+    case RET_CC:
+    case RETI:
+        if (cpu->SP == (uint16_t)(sp + 2))
+        {
+            profile_return(cpu->profile, sp);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return ERR_NONE;
+}
+#endif
+
 /**
 * @brief Update ALU of cpu, execute instruction, update idle_time and PC
 *
@@ -336,7 +864,7 @@ interrupt_t first_interrupt(data_t IE, data_t IF)
 int cpu_do_cycle(cpu_t *cpu)
 {
     M_REQUIRE_NON_NULL(cpu);
-    M_REQUIRE_NON_NULL(cpu->bus);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
 
     if ((cpu->IME != 0))
     {
@@ -350,27 +878,33 @@ int cpu_do_cycle(cpu_t *cpu)
             M_EXIT_IF_ERR(cpu_SP_push(cpu, cpu->PC));
             cpu->PC = 0x40 + (i << 3);
             cpu->idle_time += INTERRUPT_IDLE_TIME;
+#ifdef CPU_PROFILE
+            if (cpu->profile != NULL)
+            {
+                M_EXIT_IF_ERR(profile_interrupt(cpu->profile, cpu->PC, cpu->SP, (uint8_t)(cpu->idle_time + 1)));
+            }
+#endif
             return ERR_NONE;
         }
     }
 
-    data_t prefix = cpu_read_at_idx(cpu, cpu->PC);
-    if (prefix == PREFIXED)
+#ifdef CPU_PROFILE
+    if (cpu->profile != NULL)
     {
-        data_t opcode = cpu_read_data_after_opcode(cpu);
-        return cpu_dispatch(&instruction_prefixed[opcode], cpu);
+        return cpu_step_profiled(cpu);
     }
-
-    return cpu_dispatch(&instruction_direct[prefix], cpu);
+#endif
+    return cpu_step(cpu);
 }
 
 //==== see cpu.h ========================================
 int cpu_cycle(cpu_t *cpu)
 {
     M_REQUIRE_NON_NULL(cpu);
-    M_REQUIRE_NON_NULL(cpu->bus);
+    M_REQUIRE(cpu_plugged(cpu), ERR_BAD_PARAMETER, "cpu %s is not plugged", "cpu");
 
     cpu->write_listener = (addr_t)0;
+    bus_watch_clear(cpu->watch);
     if (cpu->idle_time != 0)
     {
         --cpu->idle_time;
@@ -391,6 +925,45 @@ int cpu_cycle(cpu_t *cpu)
     return ERR_NONE;
 }
 
+// ==== see cpu.h ========================================
+uint64_t cpu_next_event(const cpu_t *cpu, uint64_t now)
+{
+    if (cpu == NULL)
+    {
+        return SCHED_NEVER;
+    }
+
+    if (cpu->idle_time != 0)
+    {
+        return now + cpu->idle_time;
+    }
+
+    if (cpu->HALT == 1 && first_interrupt(cpu->IE, cpu->IF) > JOYPAD)
+    {
+        // Only an interrupt, raised by another component, can wake the CPU up
+        return SCHED_NEVER;
+    }
+
+    return now;
+}
+
+// ==== see cpu.h ========================================
+int cpu_skip_cycles(cpu_t *cpu, uint64_t nb_cycles)
+{
+    M_REQUIRE_NON_NULL(cpu);
+    M_REQUIRE(cpu->idle_time == 0 || nb_cycles <= cpu->idle_time, ERR_BAD_PARAMETER,
+              "cannot skip %" PRIu64 " cycles, only %u idle", nb_cycles, cpu->idle_time);
+
+    cpu->write_listener = (addr_t)0;
+    bus_watch_clear(cpu->watch);
+    if (cpu->idle_time != 0)
+    {
+        cpu->idle_time = (uint8_t)(cpu->idle_time - nb_cycles);
+    }
+
+    return ERR_NONE;
+}
+
 // ==== see cpu.h ========================================
 void cpu_request_interrupt(cpu_t *cpu, interrupt_t i)
 {
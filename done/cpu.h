@@ -18,6 +18,9 @@ extern "C" {
 #include "bus.h"
 #include "error.h"
 #include "opcode.h"
+#include "scheduler.h"
+#include "cpu-decode.h"
+#include "profile.h"
 
 
 //=========================================================================
@@ -36,12 +39,37 @@ typedef enum {
 #define HIGH_RAM_SIZE ((HIGH_RAM_END - HIGH_RAM_START)+1)
 
 #define INTERRUPT_IDLE_TIME 5
+
+//=========================================================================
+/**
+ * @brief Kinds of pending flags computations (see lazy_flags_t)
+ */
+typedef enum {
+    LAZY_NONE, // F is up to date
+    LAZY_ADD,  // ADD, ADC, INC
+    LAZY_SUB,  // SUB, SBC, CP, DEC
+    LAZY_AND,
+    LAZY_OR    // OR, XOR
+} lazy_op_t;
+
+/**
+ * @brief Last 8-bit ALU operation, whose Z, N and H flags have not been
+ *        written to F yet (see cpu_flags_sync in cpu-alu.h).
+ *        The C flag is always up to date in F.
+ */
+typedef struct {
+    uint8_t op; // lazy_op_t
+    uint8_t x;
+    uint8_t y;
+    uint8_t res;
+} lazy_flags_t;
+
 //=========================================================================
 /**
  * @brief Structure representing a CPU with register pairs, a Program Counter
  * a Stack Pointer, a bus and other elements
  */
-typedef struct {
+typedef struct cpu_ {
     union {
         struct {
             uint8_t F;
@@ -79,11 +107,39 @@ typedef struct {
     data_t IE;
     data_t IF;
     bit_t HALT;
+    lazy_flags_t lazy;
     component_t high_ram;
     addr_t write_listener;
     uint8_t idle_time;
+    bit_t lazy_flags; // 1 if ALU instructions leave their Z, N and H flags pending in lazy
+    decode_cache_t* decode_cache; // NULL if instructions are decoded at each fetch
+    bus_pages_t* pages; // NULL if the bus is only accessed through its bus_t table
+    bus_watch_t* watch; // NULL if no component watches the writes to the bus
+    profile_t* profile; // NULL if the instructions are not profiled (see cpu_use_profile)
 } cpu_t;
 
+/**
+ * @brief Gets the bus_t table of a cpu, for bus_lookup
+ *
+ * @param cpu cpu
+ * @return the table, NULL if the cpu has none (then its page table is detached, see bus_pages_detach)
+ */
+static inline data_t* const* cpu_bus(const cpu_t* cpu)
+{
+    return cpu->bus != NULL ? *cpu->bus : NULL;
+}
+
+/**
+ * @brief Tells whether a cpu is plugged to a bus, through a bus_t table or a page table
+ *
+ * @param cpu cpu
+ * @return true if the cpu can access the bus
+ */
+static inline bool cpu_plugged(const cpu_t* cpu)
+{
+    return cpu->bus != NULL || cpu->pages != NULL;
+}
+
 
 //=========================================================================
 /**
@@ -95,6 +151,40 @@ typedef struct {
 int cpu_cycle(cpu_t* cpu);
 
 
+/**
+ * @brief Executes the instruction at PC with the switch-based dispatcher
+ *        (see cpu_dispatch and cpu-decode.h). cpu_cycle uses it unless
+ *        the program is built with CPU_THREADED (see cpu-threaded.h).
+ *        Interrupts and HALT are handled by the caller.
+ *
+ * @param cpu the CPU which shall execute
+ * @return error code
+ */
+int cpu_step_switch(cpu_t* cpu);
+
+
+/**
+ * @brief Computes the next cycle at which the CPU does something,
+ *        i.e. the end of its idle time or of a HALT
+ *
+ * @param cpu the CPU
+ * @param now current cycle
+ * @return cycle of the next CPU action (SCHED_NEVER if halted without pending interrupt)
+ */
+uint64_t cpu_next_event(const cpu_t* cpu, uint64_t now);
+
+
+/**
+ * @brief Runs several idle CPU cycles at once. The caller must ensure
+ *        that the CPU does nothing during those cycles (see cpu_next_event)
+ *
+ * @param cpu (modified), the CPU which shall run
+ * @param nb_cycles number of cycles to run
+ * @return error code
+ */
+int cpu_skip_cycles(cpu_t* cpu, uint64_t nb_cycles);
+
+
 /**
  * @brief Plugs a bus into the cpu
  *
@@ -116,6 +206,68 @@ int cpu_plug(cpu_t* cpu, bus_t* bus);
 int cpu_init(cpu_t* cpu);
 
 
+/**
+ * @brief Makes the cpu keep its decoded instructions in a cache
+ *        (see cpu-decode.h). The cache is freed by cpu_free.
+ *
+ * @param cpu cpu to modify
+ *
+ * @return error code
+ */
+int cpu_enable_decode_cache(cpu_t* cpu);
+
+
+/**
+ * @brief Makes the cpu access its bus through a page table (see bus.h),
+ *        kept up to date by the owner of the bus
+ *
+ * @param cpu cpu to modify
+ * @param pages page table of the cpu's bus
+ *
+ * @return error code
+ */
+int cpu_use_pages(cpu_t* cpu, bus_pages_t* pages);
+
+
+/**
+ * @brief Makes the cpu queue its writes to watched addresses (see bus.h)
+ *        for their watchers; the queue is emptied at the start of each
+ *        cpu_cycle, and dispatched by the owner of the bus
+ *
+ * @param cpu cpu to modify
+ * @param watch watches of the cpu's bus
+ *
+ * @return error code
+ */
+int cpu_use_watch(cpu_t* cpu, bus_watch_t* watch);
+
+
+/**
+ * @brief Makes the cpu count the instructions it executes, and the calls
+ *        and returns among them, in a profile (see profile.h). Only a
+ *        program built with CPU_PROFILE counts them: without it, the
+ *        instructions are run as if there were no profile.
+ *
+ * @param cpu cpu to modify
+ * @param profile profile to fill, NULL to stop profiling
+ *
+ * @return error code
+ */
+int cpu_use_profile(cpu_t* cpu, profile_t* profile);
+
+
+/**
+ * @brief Makes the 8-bit arithmetic and logic instructions of the cpu
+ *        record their operands instead of computing their Z, N and H
+ *        flags, which are only computed when read (see cpu_flags_sync).
+ *
+ * @param cpu cpu to modify
+ *
+ * @return error code
+ */
+int cpu_enable_lazy_flags(cpu_t* cpu);
+
+
 /**
  * @brief Frees a cpu
  *
@@ -0,0 +1,248 @@
+/**
+ * @file framebuffer.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to fill a frame buffer and to convert it to an image
+ * @date 2020
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "error.h"
+#include "image.h"
+
+#include "framebuffer.h"
+
+// SSSE3 is checked at run time (see framebuffer_map_line)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FRAMEBUFFER_SSSE3
+#endif
+
+#define LINE_WORDS (FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS)
+
+#define FNV_OFFSET UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME  UINT64_C(0x100000001b3)
+
+// Bytes of the scaled pixel of a color in the tables of framebuffer_blit_rgb,
+// copied as a whole: one store of 2 vector registers, whatever the scale
+#define BLIT_ENTRY_SIZE 32
+_Static_assert(3 * FRAMEBUFFER_MAX_SCALE <= BLIT_ENTRY_SIZE, "BLIT_ENTRY_SIZE is too small");
+
+#define BYTES_ONES UINT64_C(0x0101010101010101)
+#define BYTES_BITS UINT64_C(0x8040201008040201)
+#define BYTES_LOW7 UINT64_C(0x7F7F7F7F7F7F7F7F)
+#define BYTES_HIGH UINT64_C(0x8080808080808080)
+
+// Byte i keeps bit i of its copy of b, which is then moved to its bit 0
+#define SPREAD(b) ((((((b) * BYTES_ONES) & BYTES_BITS) + BYTES_LOW7) & BYTES_HIGH) >> 7)
+#define SPREAD4(b) SPREAD(b), SPREAD((b) + 1), SPREAD((b) + 2), SPREAD((b) + 3)
+#define SPREAD16(b) SPREAD4(b), SPREAD4((b) + 4), SPREAD4((b) + 8), SPREAD4((b) + 12)
+#define SPREAD64(b) SPREAD16(b), SPREAD16((b) + 16), SPREAD16((b) + 32), SPREAD16((b) + 48)
+
+/**
+ * @brief Spreads the 8 bits of a byte over the 8 bytes of a word: entry b
+ *        has bit i of b in its byte i, so that the 8 pixels of a byte of
+ *        each plane are expanded and combined by one lookup per plane
+ */
+static const uint64_t spread[256] = {
+    SPREAD64(UINT64_C(0)), SPREAD64(UINT64_C(64)), SPREAD64(UINT64_C(128)), SPREAD64(UINT64_C(192))
+};
+
+// ==== see framebuffer.h ========================================
+int framebuffer_set_line(framebuffer_t *fb, size_t y, const uint32_t *msb, const uint32_t *lsb)
+{
+    M_REQUIRE_NON_NULL(msb);
+    M_REQUIRE_NON_NULL(lsb);
+
+    const uint32_t *const planes[] = {lsb, msb};
+    return framebuffer_set_indices(fb, y, planes, 2);
+}
+
+// ==== see framebuffer.h ========================================
+int framebuffer_set_indices(framebuffer_t *fb, size_t y, const uint32_t *const *planes, size_t count)
+{
+    M_REQUIRE_NON_NULL(fb);
+    M_REQUIRE_NON_NULL(planes);
+    M_REQUIRE(count <= FRAMEBUFFER_INDEX_BITS, ERR_BAD_PARAMETER, "Invalid number of planes %zu", count);
+    M_REQUIRE(y < FRAMEBUFFER_HEIGHT, ERR_BAD_PARAMETER, "Invalid line %zu", y);
+    for (size_t k = 0; k < count; ++k)
+    {
+        M_REQUIRE_NON_NULL(planes[k]);
+    }
+
+    uint8_t *pixels = fb->pixels[y];
+    for (size_t i = 0; i < LINE_WORDS; ++i)
+    {
+        // 8 pixels at a time
+        for (unsigned shift = 0; shift < IMAGE_LINE_WORD_BITS; shift += 8)
+        {
+            uint64_t indices = 0;
+            for (size_t k = 0; k < count; ++k)
+            {
+                indices |= spread[(uint8_t)(planes[k][i] >> shift)] << k;
+            }
+            for (size_t b = 0; b < 8; ++b)
+            {
+                pixels[b] = (uint8_t)(indices >> (8 * b));
+            }
+            pixels += 8;
+        }
+    }
+    return ERR_NONE;
+}
+
+#ifdef FRAMEBUFFER_SSSE3
+_Static_assert(FRAMEBUFFER_INDICES == 16 && FRAMEBUFFER_WIDTH % 16 == 0,
+               "map_line_ssse3 maps 16 pixels through 16 entries at a time");
+
+/**
+ * @brief Same as the loop of framebuffer_map_line, for CPUs with SSSE3: the
+ *        whole table fits in a register, one shuffle maps 16 pixels
+ */
+__attribute__((target("ssse3")))
+static void map_line_ssse3(uint8_t *pixels, const uint8_t *table)
+{
+    const __m128i lut = _mm_loadu_si128((const __m128i *)table);
+    const __m128i mask = _mm_set1_epi8(FRAMEBUFFER_INDICES - 1);
+    for (size_t x = 0; x < FRAMEBUFFER_WIDTH; x += 16)
+    {
+        const __m128i indices = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + x)), mask);
+        _mm_storeu_si128((__m128i *)(pixels + x), _mm_shuffle_epi8(lut, indices));
+    }
+}
+#endif
+
+// ==== see framebuffer.h ========================================
+int framebuffer_map_line(framebuffer_t *fb, size_t y, const uint8_t *table)
+{
+    M_REQUIRE_NON_NULL(fb);
+    M_REQUIRE_NON_NULL(table);
+    M_REQUIRE(y < FRAMEBUFFER_HEIGHT, ERR_BAD_PARAMETER, "Invalid line %zu", y);
+
+    uint8_t *pixels = fb->pixels[y];
+#ifdef FRAMEBUFFER_SSSE3
+    if (__builtin_cpu_supports("ssse3"))
+    {
+        map_line_ssse3(pixels, table);
+        return ERR_NONE;
+    }
+#endif
+    for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x)
+    {
+        pixels[x] = table[pixels[x] & (FRAMEBUFFER_INDICES - 1)];
+    }
+    return ERR_NONE;
+}
+
+// ==== see framebuffer.h ========================================
+int framebuffer_get_line(const framebuffer_t *fb, size_t y, uint32_t *msb, uint32_t *lsb)
+{
+    M_REQUIRE_NON_NULL(fb);
+    M_REQUIRE_NON_NULL(msb);
+    M_REQUIRE_NON_NULL(lsb);
+    M_REQUIRE(y < FRAMEBUFFER_HEIGHT, ERR_BAD_PARAMETER, "Invalid line %zu", y);
+
+    for (size_t i = 0; i < LINE_WORDS; ++i)
+    {
+        uint32_t m = 0;
+        uint32_t l = 0;
+        for (size_t x = 0; x < IMAGE_LINE_WORD_BITS; ++x)
+        {
+            const uint8_t color = fb->pixels[y][i * IMAGE_LINE_WORD_BITS + x];
+            m |= (uint32_t)((color >> 1) & 1) << x;
+            l |= (uint32_t)(color & 1) << x;
+        }
+        msb[i] = m;
+        lsb[i] = l;
+    }
+    return ERR_NONE;
+}
+
+// ==== see framebuffer.h ========================================
+int framebuffer_to_image(const framebuffer_t *fb, image_t *pim)
+{
+    M_REQUIRE_NON_NULL(fb);
+    M_REQUIRE_NON_NULL(pim);
+    M_REQUIRE(pim->height == FRAMEBUFFER_HEIGHT && pim->content != NULL, ERR_BAD_PARAMETER,
+              "Invalid image height %zu", pim->height);
+
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y)
+    {
+        const image_line_t *line = &pim->content[y];
+        M_REQUIRE(line->msb != NULL && line->lsb != NULL && line->opacity != NULL
+                  && line->msb->size == FRAMEBUFFER_WIDTH, ERR_BAD_PARAMETER,
+                  "Invalid line %zu", y);
+
+        M_EXIT_IF_ERR(framebuffer_get_line(fb, y, line->msb->content, line->lsb->content));
+        for (size_t i = 0; i < LINE_WORDS; ++i)
+        {
+            line->opacity->content[i] = UINT32_MAX;
+        }
+    }
+    return ERR_NONE;
+}
+
+// ==== see framebuffer.h ========================================
+int framebuffer_blit_rgb(const framebuffer_t *fb, uint8_t *rgb, size_t stride, size_t scale)
+{
+    M_REQUIRE_NON_NULL(fb);
+    M_REQUIRE_NON_NULL(rgb);
+    M_REQUIRE(scale >= 1 && scale <= FRAMEBUFFER_MAX_SCALE, ERR_BAD_PARAMETER, "Invalid scale %zu", scale);
+    const size_t width = 3 * scale;
+    const size_t row = FRAMEBUFFER_WIDTH * width;
+    M_REQUIRE(stride >= row, ERR_BAD_PARAMETER, "Invalid stride %zu", stride);
+
+    // The scaled pixel of each color, then its RGB bytes repeated up to the end
+    uint8_t table[4][BLIT_ENTRY_SIZE];
+    for (size_t c = 0; c < 4; ++c)
+    {
+        memset(table[c], 255 - 85 * (int)c, sizeof(table[c]));
+    }
+
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y)
+    {
+        const uint8_t *pixels = fb->pixels[y];
+        uint8_t *const first = rgb + y * scale * stride;
+
+        // Each pixel writes a whole entry, the next one overwrites its end,
+        // but for the last ones, which must not write past the row
+        uint8_t *out = first;
+        size_t x = 0;
+        for (; x < FRAMEBUFFER_WIDTH && (size_t)(out - first) + BLIT_ENTRY_SIZE <= row; ++x, out += width)
+        {
+            memcpy(out, table[pixels[x] & 3], BLIT_ENTRY_SIZE);
+        }
+        for (; x < FRAMEBUFFER_WIDTH; ++x, out += width)
+        {
+            memcpy(out, table[pixels[x] & 3], width);
+        }
+
+        // The other rows of the line are the same
+        for (size_t r = 1; r < scale; ++r)
+        {
+            memcpy(first + r * stride, first, row);
+        }
+    }
+    return ERR_NONE;
+}
+
+// ==== see framebuffer.h ========================================
+uint64_t framebuffer_hash(const framebuffer_t *fb)
+{
+    if (fb == NULL)
+    {
+        return 0;
+    }
+
+    uint64_t hash = FNV_OFFSET;
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y)
+    {
+        for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x)
+        {
+            hash = (hash ^ fb->pixels[y][x]) * FNV_PRIME;
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+/**
+ * @file framebuffer.h
+ * @brief Frame buffer of the Game Boy screen, one byte per pixel
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAMEBUFFER_WIDTH  160
+#define FRAMEBUFFER_HEIGHT 144
+
+#define FRAMEBUFFER_MAX_SCALE 8 // of framebuffer_blit_rgb
+
+#define FRAMEBUFFER_INDEX_BITS 4
+#define FRAMEBUFFER_INDICES    (1 << FRAMEBUFFER_INDEX_BITS) // size of the tables of framebuffer_map_line
+
+/**
+ * @brief Frame buffer type: the color (0 to 3) of each pixel, line by line,
+ *        so that pixel (x, y) is simply pixels[y][x]
+ */
+typedef struct {
+    uint8_t pixels[FRAMEBUFFER_HEIGHT][FRAMEBUFFER_WIDTH];
+} framebuffer_t;
+
+/**
+ * @brief Gets a line of a frame buffer
+ *
+ * @param fb frame buffer
+ * @param y index of the line
+ * @return pointer to the FRAMEBUFFER_WIDTH pixels of the line, NULL if y is out of the frame
+ */
+static inline const uint8_t* framebuffer_line(const framebuffer_t* fb, size_t y)
+{
+    return fb != NULL && y < FRAMEBUFFER_HEIGHT ? fb->pixels[y] : NULL;
+}
+
+/**
+ * @brief Sets a line of a frame buffer from the bit planes of an image line
+ *        (see image_line_t: pixel x is bit x % 32 of word x / 32)
+ *
+ * @param fb frame buffer
+ * @param y index of the line
+ * @param msb FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS words of the msb plane
+ * @param lsb FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS words of the lsb plane
+ * @return error code
+ */
+int framebuffer_set_line(framebuffer_t* fb, size_t y, const uint32_t* msb, const uint32_t* lsb);
+
+/**
+ * @brief Sets a line of a frame buffer to pixel indices given as bit planes:
+ *        bit k of pixel x is pixel x of plane k (in the layout of image_line_t)
+ *
+ * @param fb frame buffer
+ * @param y index of the line
+ * @param planes count planes of FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS words, least significant first
+ * @param count number of planes, at most FRAMEBUFFER_INDEX_BITS
+ * @return error code
+ */
+int framebuffer_set_indices(framebuffer_t* fb, size_t y, const uint32_t* const* planes, size_t count);
+
+/**
+ * @brief Maps each pixel of a line through a table: the pixels are indices
+ *        (below FRAMEBUFFER_INDICES) replaced by their entries
+ *
+ * @param fb frame buffer
+ * @param y index of the line
+ * @param table FRAMEBUFFER_INDICES entries
+ * @return error code
+ */
+int framebuffer_map_line(framebuffer_t* fb, size_t y, const uint8_t* table);
+
+/**
+ * @brief Gets the bit planes of a line of a frame buffer (the inverse of
+ *        framebuffer_set_line, the pixels being colors)
+ *
+ * @param fb frame buffer
+ * @param y index of the line
+ * @param msb set to the FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS words of the msb plane
+ * @param lsb set to the FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS words of the lsb plane
+ * @return error code
+ */
+int framebuffer_get_line(const framebuffer_t* fb, size_t y, uint32_t* msb, uint32_t* lsb);
+
+/**
+ * @brief Copies a frame buffer into an image of the same size, all of
+ *        whose pixels become opaque
+ *
+ * @param fb frame buffer
+ * @param pim image to copy into (see image_create)
+ * @return error code
+ */
+int framebuffer_to_image(const framebuffer_t* fb, image_t* pim);
+
+/**
+ * @brief Copies a frame buffer into an RGB image, 3 bytes per pixel, color
+ *        c shown as the grey 255 - 85 c. Each pixel becomes a square of
+ *        scale x scale pixels.
+ *
+ * @param fb frame buffer (of colors, see framebuffer_map_line)
+ * @param rgb FRAMEBUFFER_HEIGHT * scale rows of stride bytes
+ * @param stride bytes from a row of rgb to the next, at least 3 * FRAMEBUFFER_WIDTH * scale
+ * @param scale from 1 to FRAMEBUFFER_MAX_SCALE
+ * @return error code
+ */
+int framebuffer_blit_rgb(const framebuffer_t* fb, uint8_t* rgb, size_t stride, size_t scale);
+
+/**
+ * @brief Hashes the pixels of a frame buffer (64-bit FNV-1a, line by line),
+ *        the same on any host: two runs showing the same frame give the same hash
+ *
+ * @param fb frame buffer
+ * @return the hash, 0 if fb is NULL
+ */
+uint64_t framebuffer_hash(const framebuffer_t* fb);
+
+#ifdef __cplusplus
+}
+#endif
@@ -6,8 +6,12 @@
  *
  */
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "bus.h"
 #include "component.h"
@@ -15,94 +19,305 @@
 #include "cpu.h"
 #include "bootrom.h"
 #include "timer.h"
+#include "cpu-storage.h"
+#include "cpu-alu.h" // cpu_flags_sync
+#include "scheduler.h"
+#include "cpu-block.h"
+#include "cpu-decode.h"
+#include "framebuffer.h"
 
-// ==== see gameboy.h ========================================
-int gameboy_create(gameboy_t *gameboy, const char *filename)
+static int blargg_bus_listener(gameboy_t *gameboy, addr_t addr)
 {
-
     M_REQUIRE_NON_NULL(gameboy);
-    memset(gameboy, 0, sizeof(gameboy_t));
 
-    // Instanciate components
-    component_t workRAM;
-    memset(&workRAM, 0, sizeof(component_t));
+    if (addr == BLARGG_REG)
+    {
+        data_t data = cpu_read_at_idx(&gameboy->cpu, addr);
+        if (gameboy->serial != NULL)
+        {
+            return gameboy->serial(gameboy->serial_arg, data);
+        }
+        printf("%c", data);
+    }
+    return ERR_NONE;
+}
 
-    component_t registers;
-    memset(&registers, 0, sizeof(component_t));
+static int blargg_watch(void *gameboy, addr_t addr)
+{
+    return blargg_bus_listener(gameboy, addr);
+}
 
-    component_t externRAM;
-    memset(&externRAM, 0, sizeof(component_t));
+// The timer registers are computed when the cpu accesses them (see bus_watch_lazy)
+static int timer_lazy(void *gameboy, addr_t addr)
+{
+    (void)addr;
+    gameboy_t *gb = gameboy;
+    // The cpu runs during cycle gameboy->cycles, see gameboy_cycle()
+    return timer_sync(&gb->timer, gb->cycles);
+}
 
-    component_t videoRAM;
-    memset(&videoRAM, 0, sizeof(component_t));
+// Watchers of the bus (see bus_watch_add), one per listener
+static int timer_watch(void *timer, addr_t addr)
+{
+    return timer_bus_listener(timer, addr);
+}
 
-    component_t graphRAM;
-    memset(&graphRAM, 0, sizeof(component_t));
+static int bootrom_watch(void *gameboy, addr_t addr)
+{
+    return bootrom_bus_listener(gameboy, addr);
+}
 
-    component_t useless;
-    memset(&useless, 0, sizeof(component_t));
+static int joypad_watch(void *pad, addr_t addr)
+{
+    return joypad_bus_listener(pad, addr);
+}
 
-    component_t echoRAM;
-    memset(&echoRAM, 0, sizeof(component_t));
+static int lcdc_watch(void *screen, addr_t addr)
+{
+    return lcdc_bus_listener(screen, addr);
+}
 
-    M_EXIT_IF_ERR(cpu_init(&gameboy->cpu));
+/**
+ * @brief Makes the listeners of the components watch the registers they handle
+ *
+ * @param gameboy The gameboy to set up
+ * @return int Error code
+ */
+static int gameboy_watch(gameboy_t *gameboy)
+{
+    bus_watch_t *watch = &gameboy->watch;
+    M_EXIT_IF_ERR(bus_watch_lazy(watch, TIMER_START, TIMER_END, timer_lazy, gameboy));
+    M_EXIT_IF_ERR(bus_watch_add(watch, TIMER_START, TIMER_END, timer_watch, &gameboy->timer));
+    M_EXIT_IF_ERR(bus_watch_add(watch, REG_BOOT_ROM_DISABLE, REG_BOOT_ROM_DISABLE, bootrom_watch, gameboy));
+    M_EXIT_IF_ERR(bus_watch_add(watch, REG_P1, REG_P1, joypad_watch, &gameboy->pad));
+    M_EXIT_IF_ERR(bus_watch_add(watch, REG_LCDC, REG_WX, lcdc_watch, &gameboy->screen));
+    M_EXIT_IF_ERR(bus_watch_dirty(watch, TILE_SRC_ADDR_LOW, TILE_DATA_END, TILE_SIZE_LOG2, gameboy->screen.tiles_dirty));
+#ifdef BLARGG
+    M_EXIT_IF_ERR(bus_watch_add(watch, BLARGG_REG, BLARGG_REG, blargg_watch, gameboy));
+#endif
+    return cpu_use_watch(&gameboy->cpu, watch);
+}
 
-    // Create the components
-    M_EXIT_IF_ERR(component_create(&workRAM, MEM_SIZE(WORK_RAM)));
-    ++gameboy->nb_components;
+/**
+ * @brief Plugs one of the memories of the RAM block as a component
+ *
+ * @param gameboy The gameboy to set up
+ * @param bus bus to plug into
+ * @param index index of the component
+ * @param memory memory of the component, in gameboy->ram
+ * @param start address from where to plug (included)
+ * @param end address until where to plug (included)
+ * @return int Error code
+ */
+static int gameboy_plug_ram(gameboy_t *gameboy, bus_t bus, gb_components index, data_t *memory,
+                            addr_t start, addr_t end)
+{
+    memory_t *mem = &gameboy->memories[index];
+    mem->size = (size_t)(end - start) + 1;
+    mem->memory = memory;
 
-    M_EXIT_IF_ERR(component_create(&registers, MEM_SIZE(REGISTERS)));
-    ++gameboy->nb_components;
-    M_EXIT_IF_ERR(component_create(&externRAM, MEM_SIZE(EXTERN_RAM)));
-    ++gameboy->nb_components;
-    M_EXIT_IF_ERR(component_create(&videoRAM, MEM_SIZE(VIDEO_RAM)));
-    ++gameboy->nb_components;
-    M_EXIT_IF_ERR(component_create(&graphRAM, MEM_SIZE(GRAPH_RAM)));
+    component_t *c = &gameboy->components[index];
+    c->mem = mem;
+    M_EXIT_IF_ERR(bus_plug(bus, c, start, end));
     ++gameboy->nb_components;
-    M_EXIT_IF_ERR(component_create(&useless, MEM_SIZE(USELESS)));
-    ++gameboy->nb_components;
-    M_EXIT_IF_ERR(component_create(&echoRAM, MEM_SIZE(ECHO_RAM)));
-
-    M_EXIT_IF_ERR(component_create(&gameboy->bootrom, MEM_SIZE(BOOT_ROM)));
-    M_EXIT_IF_ERR(cartridge_init(&gameboy->cartridge, filename));
-
-    // Plug the components to the bus
-    M_EXIT_IF_ERR(bus_plug(gameboy->bus, &workRAM, WORK_RAM_START, WORK_RAM_END));
-    M_EXIT_IF_ERR(component_shared(&echoRAM, &workRAM)); // echoRam and workRam point to the same memory space
-    M_EXIT_IF_ERR(bus_plug(gameboy->bus, &registers, REGISTERS_START, REGISTERS_END));
-    M_EXIT_IF_ERR(bus_plug(gameboy->bus, &externRAM, EXTERN_RAM_START, EXTERN_RAM_END));
-    M_EXIT_IF_ERR(bus_plug(gameboy->bus, &videoRAM, VIDEO_RAM_START, VIDEO_RAM_END));
-    M_EXIT_IF_ERR(bus_plug(gameboy->bus, &graphRAM, GRAPH_RAM_START, GRAPH_RAM_END));
-    M_EXIT_IF_ERR(bus_plug(gameboy->bus, &useless, USELESS_START, USELESS_END));
-    M_EXIT_IF_ERR(bootrom_plug(&gameboy->bootrom, gameboy->bus));
-    M_EXIT_IF_ERR(cartridge_plug(&gameboy->cartridge, gameboy->bus));
-
-    gameboy->components[WORK_RAM] = workRAM;
-    gameboy->components[REGISTERS] = registers;
-    gameboy->components[EXTERN_RAM] = externRAM;
-    gameboy->components[VIDEO_RAM] = videoRAM;
-    gameboy->components[GRAPH_RAM] = graphRAM;
-    gameboy->components[USELESS] = useless;
+    return ERR_NONE;
+}
 
-    gameboy->boot = (bit_t)1;
-    gameboy->cycles = 1;
+/**
+ * @brief Plugs everything to a bus_t table, then copies it to the page
+ *        table of the gameboy, which is all the cpu uses afterwards
+ *
+ * @param gameboy The gameboy to set up
+ * @param bus bus to plug into, not used anymore once this returns
+ * @return int Error code
+ */
+static int gameboy_plug(gameboy_t *gameboy, bus_t *bus)
+{
+    gameboy_ram_t *ram = &gameboy->ram;
+
+    // The echo RAM is left unplugged
+    M_EXIT_IF_ERR(gameboy_plug_ram(gameboy, *bus, WORK_RAM, ram->work, WORK_RAM_START, WORK_RAM_END));
+    M_EXIT_IF_ERR(gameboy_plug_ram(gameboy, *bus, REGISTERS, ram->registers, REGISTERS_START, REGISTERS_END));
+    M_EXIT_IF_ERR(gameboy_plug_ram(gameboy, *bus, EXTERN_RAM, ram->external, EXTERN_RAM_START, EXTERN_RAM_END));
+    M_EXIT_IF_ERR(gameboy_plug_ram(gameboy, *bus, VIDEO_RAM, ram->video, VIDEO_RAM_START, VIDEO_RAM_END));
+    M_EXIT_IF_ERR(gameboy_plug_ram(gameboy, *bus, GRAPH_RAM, ram->graph, GRAPH_RAM_START, GRAPH_RAM_END));
+    M_EXIT_IF_ERR(gameboy_plug_ram(gameboy, *bus, USELESS, ram->useless, USELESS_START, USELESS_END));
+    M_EXIT_IF_ERR(bootrom_plug(&gameboy->bootrom, *bus));
+    M_EXIT_IF_ERR(cartridge_plug(&gameboy->cartridge, *bus));
 
     M_EXIT_IF_ERR(timer_init(&gameboy->timer, &gameboy->cpu));
-    M_EXIT_IF_ERR(cpu_plug(&gameboy->cpu, &gameboy->bus));
-
-    
-
+    M_EXIT_IF_ERR(cpu_plug(&gameboy->cpu, bus));
     M_EXIT_IF_ERR(joypad_init_and_plug(&gameboy->pad, &gameboy->cpu));
     M_EXIT_IF_ERR(lcdc_init(gameboy));
-    M_EXIT_IF_ERR(lcdc_plug(&gameboy->screen, gameboy->bus));
+    M_EXIT_IF_ERR(lcdc_plug(&gameboy->screen, *bus));
+
+    // Everything is plugged: only the I/O page is not direct
+    M_EXIT_IF_ERR(bus_pages_update(&gameboy->pages, *bus, 0, BUS_SIZE - 1));
+    M_EXIT_IF_ERR(bus_pages_detach(&gameboy->pages, *bus, &gameboy->io, 1));
+    gameboy->cpu.bus = NULL;
+    return cpu_use_pages(&gameboy->cpu, &gameboy->pages);
+}
+
+/**
+ * @brief Creates a gameboy, the external RAM of its cartridge kept in the
+ *        save file if with_save (see cartridge_init_with_save)
+ */
+static int gameboy_create_save(gameboy_t *gameboy, const char *filename, bit_t with_save)
+{
+
+    M_REQUIRE_NON_NULL(gameboy);
+    memset(gameboy, 0, sizeof(gameboy_t));
+
+    // The ROM is loaded first, so that a missing one leaves nothing to free
+    // (gameboy_free only frees what has been created)
+    M_EXIT_IF_ERR(with_save ? cartridge_init_with_save(&gameboy->cartridge, filename)
+                  : cartridge_init(&gameboy->cartridge, filename));
+    cartridge_count_cycles(&gameboy->cartridge, &gameboy->cycles);
+
+    M_EXIT_IF_ERR(cpu_init(&gameboy->cpu));
+    // The high RAM of the cpu is in the RAM block too
+    component_free(&gameboy->cpu.high_ram);
+    gameboy->memories[GB_NB_COMPONENTS].size = HIGH_RAM_SIZE;
+    gameboy->memories[GB_NB_COMPONENTS].memory = gameboy->ram.high;
+    gameboy->cpu.high_ram.mem = &gameboy->memories[GB_NB_COMPONENTS];
+    M_EXIT_IF_ERR(cpu_enable_decode_cache(&gameboy->cpu));
+    M_EXIT_IF_ERR(cpu_enable_lazy_flags(&gameboy->cpu));
+
+    // Shared by all the gameboys, like the ROM of the cartridge
+    M_EXIT_IF_ERR(bootrom_init_blank(&gameboy->bootrom));
+
+    // The bus_t table (512 KiB) is only needed while plugging
+    bus_t *bus = calloc(1, sizeof(bus_t));
+    M_REQUIRE_NON_NULL_CUSTOM_ERR(bus, ERR_MEM);
+    const int err = gameboy_plug(gameboy, bus);
+    free(bus);
+    M_EXIT_IF_ERR(err);
+
+    gameboy->boot = (bit_t)1;
+    gameboy->cycles = 1;
+
+    M_EXIT_IF_ERR(cartridge_protect(&gameboy->cartridge, &gameboy->pages));
+    M_EXIT_IF_ERR(gameboy_watch(gameboy));
 
     M_EXIT_IF_ERR(cpu_write_at_idx(&gameboy->cpu, REG_P1, 0));
 
     gameboy->screen.on_cycle = -1;
     gameboy->screen.next_cycle = -1;
+    gameboy->screen.DMA_to = GRAPH_RAM_END + 1; // no DMA transfer pending
     M_EXIT_IF_ERR(cpu_write_at_idx(&gameboy->cpu, REG_LCDC, 0));
 
     gameboy->cpu.SP = 0xE000;
+
+    M_EXIT_IF_ERR(block_cache_create(&gameboy->blocks));
+
+    return scheduler_init(&gameboy->scheduler);
+}
+
+// ==== see gameboy.h ========================================
+int gameboy_create(gameboy_t *gameboy, const char *filename)
+{
+    return gameboy_create_save(gameboy, filename, 0);
+}
+
+// ==== see gameboy.h ========================================
+int gameboy_create_with_save(gameboy_t *gameboy, const char *filename)
+{
+    return gameboy_create_save(gameboy, filename, 1);
+}
+
+/**
+ * @brief Moves a pointer into a gameboy to the same place in another one
+ *
+ * @param p pointer to move, left as is if it is not into from
+ * @param from gameboy p may point into
+ * @param to gameboy to move it to
+ * @return the moved pointer
+ */
+static void *gameboy_rebase(const void *p, const gameboy_t *from, gameboy_t *to)
+{
+    const uintptr_t at = (uintptr_t)p;
+    const uintptr_t start = (uintptr_t)from;
+    if (at < start || at >= start + sizeof(gameboy_t))
+    {
+        return (void *)(uintptr_t)p;
+    }
+    return (char *)to + (at - start);
+}
+
+#define REBASE(gameboy, model, field) ((field) = gameboy_rebase((field), (model), (gameboy)))
+
+// ==== see gameboy.h ========================================
+int gameboy_clone(gameboy_t *gameboy, const gameboy_t *model)
+{
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE_NON_NULL(model);
+    M_REQUIRE(model->cpu.pages == &model->pages, ERR_BAD_PARAMETER, "gameboy %s is not created", "model");
+
+    memcpy(gameboy, model, sizeof(gameboy_t));
+
+    // What the model owns outside of the block is not copied
+    memset(&gameboy->cartridge, 0, sizeof(cartridge_t));
+    gameboy->cpu.decode_cache = NULL;
+    gameboy->cpu.profile = NULL;
+    gameboy->blocks = NULL;
+    memset(&gameboy->screen.display, 0, sizeof(image_t));
+
+    cpu_t *cpu = &gameboy->cpu;
+    REBASE(gameboy, model, cpu->pages);
+    REBASE(gameboy, model, cpu->watch);
+    REBASE(gameboy, model, cpu->high_ram.mem);
+
+    bus_pages_t *pages = &gameboy->pages;
+    for (unsigned page = 0; page < BUS_NB_PAGES; ++page)
+    {
+        const uintptr_t first = (uintptr_t)page << BUS_PAGE_BITS;
+        if (pages->base[page] != 0)
+        {
+            pages->base[page] = (uintptr_t)gameboy_rebase((void *)(pages->base[page] + first), model, gameboy) - first;
+        }
+        REBASE(gameboy, model, pages->rows[page]);
+    }
+    for (size_t i = 0; i < BUS_PAGE_SIZE; ++i)
+    {
+        REBASE(gameboy, model, gameboy->io[i]);
+    }
+
+    bus_watch_t *watch = &gameboy->watch;
+    for (size_t i = 0; i < watch->nb_watches; ++i)
+    {
+        REBASE(gameboy, model, watch->watches[i].owner);
+    }
+    REBASE(gameboy, model, watch->lazy.owner);
+    REBASE(gameboy, model, watch->dirty.bits);
+
+    REBASE(gameboy, model, gameboy->screen.cpu);
+    REBASE(gameboy, model, gameboy->timer.cpu);
+    REBASE(gameboy, model, gameboy->pad.cpu);
+    REBASE(gameboy, model, gameboy->pad.p_P1);
+    for (size_t i = 0; i < GB_NB_COMPONENTS; ++i)
+    {
+        REBASE(gameboy, model, gameboy->components[i].mem);
+    }
+    for (size_t i = 0; i < GB_NB_COMPONENTS + 1; ++i)
+    {
+        REBASE(gameboy, model, gameboy->memories[i].memory);
+    }
+
+    M_EXIT_IF_ERR(cartridge_clone(&gameboy->cartridge, &model->cartridge, pages));
+    REBASE(gameboy, model, gameboy->cartridge.cycles);
+    if (model->cpu.decode_cache != NULL)
+    {
+        M_EXIT_IF_ERR(cpu_enable_decode_cache(cpu));
+        decode_cache_set_bank(cpu->decode_cache, model->cpu.decode_cache->bank);
+    }
+    if (model->blocks != NULL)
+    {
+        M_EXIT_IF_ERR(block_cache_create(&gameboy->blocks));
+    }
+    if (model->screen.display.content != NULL)
+    {
+        M_EXIT_IF_ERR(lcdc_enable_display(&gameboy->screen));
+    }
     return ERR_NONE;
 }
 
@@ -111,21 +326,15 @@ void gameboy_free(gameboy_t *gameboy)
 {
     if (gameboy != NULL)
     {
-        for (size_t i = 0; i < GB_NB_COMPONENTS; ++i)
-        {
-            // Unplug the bus from all components and free them
-            bus_unplug(gameboy->bus, &gameboy->components[i]);
-            component_free(&gameboy->components[i]);
-        }
-        component_t temp = {NULL, ECHO_RAM_START, ECHO_RAM_END};
-        bus_unplug(gameboy->bus, &temp);
+        // The memories of the components are in the block
+        memset(gameboy->components, 0, sizeof(gameboy->components));
+        gameboy->cpu.high_ram.mem = NULL;
 
-        bus_unplug(gameboy->bus, &gameboy->bootrom);
-        bus_unplug(gameboy->bus, &gameboy->cartridge.c);
-        component_free(&gameboy->cartridge.c);
-        component_free(&gameboy->bootrom);
+        cartridge_free(&gameboy->cartridge);
+        bootrom_free(&gameboy->bootrom);
         lcdc_free(&gameboy->screen);
         cpu_free(&gameboy->cpu);
+        block_cache_free(&gameboy->blocks);
 
         gameboy->cycles = 0;
         gameboy->nb_components = 0;
@@ -133,54 +342,539 @@ void gameboy_free(gameboy_t *gameboy)
     }
 }
 
-#ifdef BLARGG
-static int blargg_bus_listener(gameboy_t *gameboy, addr_t addr)
+// The components are saved field by field, pointers and configuration
+// excluded, into structures of fixed size integers cleared first: the same
+// state gives the same bytes, padding included
+
+// Registers of the cpu
+typedef struct
+{
+    uint16_t AF;
+    uint16_t BC;
+    uint16_t DE;
+    uint16_t HL;
+    uint16_t PC;
+    uint16_t SP;
+    uint16_t alu_value;
+    uint16_t write_listener;
+    uint8_t alu_flags;
+    uint8_t IME;
+    uint8_t IE;
+    uint8_t IF;
+    uint8_t HALT;
+    uint8_t idle_time;
+    uint8_t lazy_flags;
+    uint8_t lazy_op;
+    uint8_t lazy_x;
+    uint8_t lazy_y;
+    uint8_t lazy_res;
+} gameboy_cpu_state_t;
+
+typedef struct
+{
+    uint64_t cycle;
+    uint16_t counter;
+} gameboy_timer_state_t;
+
+typedef struct
+{
+    uint8_t intern;
+    uint8_t old_state;
+    uint8_t keys_state[NB_GB_KEY_ROWS];
+} gameboy_pad_state_t;
+
+typedef struct
+{
+    uint64_t next_cycle;
+    uint64_t on_cycle;
+    uint64_t tiles_dirty[TILE_COUNT / 64];
+    uint16_t DMA_from;
+    uint16_t DMA_to;
+    uint8_t on;
+    uint8_t window_y;
+    framebuffer_t frame;
+    lcdc_tile_t tiles[TILE_COUNT];
+    uint8_t palettes[FRAMEBUFFER_INDICES];
+} gameboy_screen_state_t;
+
+// Layout of a state (see gameboy_save_state), followed by the one of the cartridge
+typedef struct
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t size;
+    uint64_t cycles;
+    uint64_t boot;
+    gameboy_cpu_state_t cpu;
+    gameboy_timer_state_t timer;
+    gameboy_pad_state_t pad;
+    gameboy_screen_state_t screen;
+    gameboy_ram_t ram;
+} gameboy_state_t;
+
+#define STATE_MAGIC "GBST"
+
+#define STATE_AT(state, member) ((state) + offsetof(gameboy_state_t, member))
+#define STATE_SIZE(member) sizeof(((gameboy_state_t *)NULL)->member)
+#define STATE_PUT(state, member, value) memcpy(STATE_AT(state, member), &(value), STATE_SIZE(member))
+#define STATE_GET(state, member, value) memcpy(&(value), STATE_AT(state, member), STATE_SIZE(member))
+
+// ==== see gameboy.h ========================================
+size_t gameboy_state_size(const gameboy_t *gameboy)
+{
+    return gameboy == NULL ? 0 : sizeof(gameboy_state_t) + cartridge_state_size(&gameboy->cartridge);
+}
+
+// ==== see gameboy.h ========================================
+int gameboy_save_state(const gameboy_t *gameboy, void *state, size_t size)
 {
     M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE_NON_NULL(state);
+    const uint64_t total = gameboy_state_size(gameboy);
+    M_REQUIRE(size >= total, ERR_BAD_PARAMETER, "state buffer of %zu bytes is too small", size);
+
+    uint8_t *out = state;
+    memset(out, 0, sizeof(gameboy_state_t));
+    const uint32_t version = GAMEBOY_STATE_VERSION;
+    const uint64_t boot = gameboy->boot;
+    memcpy(STATE_AT(out, magic), STATE_MAGIC, STATE_SIZE(magic));
+    STATE_PUT(out, version, version);
+    STATE_PUT(out, size, total);
+    STATE_PUT(out, cycles, gameboy->cycles);
+    STATE_PUT(out, boot, boot);
+
+    const cpu_t *cpu = &gameboy->cpu;
+    gameboy_cpu_state_t regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.AF = cpu->AF;
+    regs.BC = cpu->BC;
+    regs.DE = cpu->DE;
+    regs.HL = cpu->HL;
+    regs.PC = cpu->PC;
+    regs.SP = cpu->SP;
+    regs.alu_value = cpu->alu.value;
+    regs.write_listener = cpu->write_listener;
+    regs.alu_flags = cpu->alu.flags;
+    regs.IME = cpu->IME;
+    regs.IE = cpu->IE;
+    regs.IF = cpu->IF;
+    regs.HALT = cpu->HALT;
+    regs.idle_time = cpu->idle_time;
+    regs.lazy_flags = cpu->lazy_flags;
+    regs.lazy_op = cpu->lazy.op;
+    regs.lazy_x = cpu->lazy.x;
+    regs.lazy_y = cpu->lazy.y;
+    regs.lazy_res = cpu->lazy.res;
+    STATE_PUT(out, cpu, regs);
+
+    gameboy_timer_state_t timer;
+    memset(&timer, 0, sizeof(timer));
+    timer.cycle = gameboy->timer.cycle;
+    timer.counter = gameboy->timer.counter;
+    STATE_PUT(out, timer, timer);
+
+    gameboy_pad_state_t pad;
+    memset(&pad, 0, sizeof(pad));
+    pad.intern = gameboy->pad.intern;
+    pad.old_state = gameboy->pad.old_state;
+    memcpy(pad.keys_state, gameboy->pad.keys_state, sizeof(pad.keys_state));
+    STATE_PUT(out, pad, pad);
+
+    // Large: written in place
+    const lcdc_t *screen = &gameboy->screen;
+    STATE_PUT(out, screen.next_cycle, screen->next_cycle);
+    STATE_PUT(out, screen.on_cycle, screen->on_cycle);
+    STATE_PUT(out, screen.tiles_dirty, screen->tiles_dirty);
+    STATE_PUT(out, screen.DMA_from, screen->DMA_from);
+    STATE_PUT(out, screen.DMA_to, screen->DMA_to);
+    STATE_PUT(out, screen.on, screen->on);
+    STATE_PUT(out, screen.window_y, screen->window_y);
+    STATE_PUT(out, screen.frame, screen->frame);
+    STATE_PUT(out, screen.tiles, screen->tiles);
+    STATE_PUT(out, screen.palettes, screen->palettes);
+
+    STATE_PUT(out, ram, gameboy->ram);
+
+    return cartridge_save_state(&gameboy->cartridge, out + sizeof(gameboy_state_t));
+}
 
-    if (addr == BLARGG_REG)
+/**
+ * @brief Restores the memory of a component from the RAM block of a
+ *        state: only the lines which have changed are copied, and their
+ *        decoded instructions dropped
+ *
+ * @param gameboy The gameboy to restore
+ * @param c component of the RAM block
+ * @param ram RAM block of the state
+ */
+static void gameboy_load_memory(gameboy_t *gameboy, const component_t *c, const uint8_t *ram)
+{
+    if (c->mem == NULL)
     {
-        data_t data = cpu_read_at_idx(&gameboy->cpu, addr);
-        printf("%c", data);
+        return;
+    }
+    data_t *memory = c->mem->memory;
+    const data_t *saved = ram + (memory - (data_t *)&gameboy->ram);
+    for (size_t at = 0; at < c->mem->size; at += DECODE_LINE_SIZE)
+    {
+        const size_t n = c->mem->size - at < DECODE_LINE_SIZE ? c->mem->size - at : DECODE_LINE_SIZE;
+        if (memcmp(memory + at, saved + at, n) != 0)
+        {
+            memcpy(memory + at, saved + at, n);
+            decode_cache_invalidate_range(gameboy->cpu.decode_cache, (addr_t)(c->start + at),
+                                          (addr_t)(c->start + at + n - 1));
+        }
     }
-    return ERR_NONE;
 }
-#endif
 
 // ==== see gameboy.h ========================================
-int gameboy_run_until(gameboy_t *gameboy, uint64_t cycle)
+int gameboy_load_state(gameboy_t *gameboy, const void *state, size_t size)
 {
     M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE_NON_NULL(state);
+    M_REQUIRE(gameboy->cpu.pages == &gameboy->pages, ERR_BAD_PARAMETER, "gameboy %s is not created", "gameboy");
+    M_REQUIRE(size >= sizeof(gameboy_state_t), ERR_BAD_PARAMETER, "state of %zu bytes is too small", size);
+
+    const uint8_t *in = state;
+    uint32_t version = 0;
+    uint64_t total = 0;
+    STATE_GET(in, version, version);
+    STATE_GET(in, size, total);
+    M_REQUIRE(memcmp(STATE_AT(in, magic), STATE_MAGIC, STATE_SIZE(magic)) == 0 && version == GAMEBOY_STATE_VERSION,
+              ERR_BAD_PARAMETER, "not a state of version %d", GAMEBOY_STATE_VERSION);
+    M_REQUIRE(total == gameboy_state_size(gameboy) && size >= total, ERR_BAD_PARAMETER,
+              "state of %zu bytes, of another ROM", size);
+
+    // First, as it checks that the state is of the same ROM
+    M_EXIT_IF_ERR(cartridge_load_state(&gameboy->cartridge, &gameboy->cpu, in + sizeof(gameboy_state_t)));
+
+    const uint8_t *ram = STATE_AT(in, ram);
+    for (size_t i = 0; i < GB_NB_COMPONENTS; ++i)
+    {
+        gameboy_load_memory(gameboy, &gameboy->components[i], ram);
+    }
+    gameboy_load_memory(gameboy, &gameboy->cpu.high_ram, ram);
+
+    // The pointers and the configuration of the gameboy are kept
+    cpu_t *cpu = &gameboy->cpu;
+    gameboy_cpu_state_t regs;
+    STATE_GET(in, cpu, regs);
+    cpu->AF = regs.AF;
+    cpu->BC = regs.BC;
+    cpu->DE = regs.DE;
+    cpu->HL = regs.HL;
+    cpu->PC = regs.PC;
+    cpu->SP = regs.SP;
+    cpu->alu.value = regs.alu_value;
+    cpu->write_listener = regs.write_listener;
+    cpu->alu.flags = regs.alu_flags;
+    cpu->IME = regs.IME;
+    cpu->IE = regs.IE;
+    cpu->IF = regs.IF;
+    cpu->HALT = regs.HALT;
+    cpu->idle_time = regs.idle_time;
+    cpu->lazy_flags = regs.lazy_flags;
+    cpu->lazy.op = regs.lazy_op;
+    cpu->lazy.x = regs.lazy_x;
+    cpu->lazy.y = regs.lazy_y;
+    cpu->lazy.res = regs.lazy_res;
+
+    gameboy_timer_state_t timer;
+    STATE_GET(in, timer, timer);
+    gameboy->timer.cycle = timer.cycle;
+    gameboy->timer.counter = timer.counter;
+
+    gameboy_pad_state_t pad;
+    STATE_GET(in, pad, pad);
+    gameboy->pad.intern = pad.intern;
+    gameboy->pad.old_state = pad.old_state;
+    memcpy(gameboy->pad.keys_state, pad.keys_state, sizeof(pad.keys_state));
+
+    lcdc_t *screen = &gameboy->screen;
+    STATE_GET(in, screen.next_cycle, screen->next_cycle);
+    STATE_GET(in, screen.on_cycle, screen->on_cycle);
+    STATE_GET(in, screen.tiles_dirty, screen->tiles_dirty);
+    STATE_GET(in, screen.DMA_from, screen->DMA_from);
+    STATE_GET(in, screen.DMA_to, screen->DMA_to);
+    STATE_GET(in, screen.on, screen->on);
+    STATE_GET(in, screen.window_y, screen->window_y);
+    STATE_GET(in, screen.frame, screen->frame);
+    STATE_GET(in, screen.tiles, screen->tiles);
+    STATE_GET(in, screen.palettes, screen->palettes);
+    if (screen->display.content != NULL)
+    {
+        M_EXIT_IF_ERR(framebuffer_to_image(&screen->frame, &screen->display));
+    }
 
-    while (gameboy->cycles < cycle)
+    uint64_t boot = 0;
+    STATE_GET(in, cycles, gameboy->cycles);
+    STATE_GET(in, boot, boot);
+    if (boot)
+    {
+        // Over the first bank of the cartridge, which may have been switched
+        M_EXIT_IF_ERR(bus_pages_remap(&gameboy->pages, &gameboy->bootrom, 0));
+    }
+    else if (gameboy->boot)
+    {
+        M_EXIT_IF_ERR(bus_pages_remap(&gameboy->pages, &gameboy->cartridge.rom0, 0));
+    }
+    if (boot != gameboy->boot)
     {
-if(gameboy->cycles ==1832921){
-    // printf("%zu\n", gameboy->cycles);
+        decode_cache_invalidate_range(gameboy->cpu.decode_cache, BOOT_ROM_START, BOOT_ROM_END);
+        gameboy->boot = (bit_t)boot;
+    }
+
+    // Nothing is pending between two runs
+    bus_watch_clear(&gameboy->watch);
+    gameboy->pages.trap.pending = 0;
+    return ERR_NONE;
 }
-if(gameboy->cycles % 500000 ==0){
-    // printf("%zu\n", gameboy->cycles);
+
+/**
+ * @brief Runs one cycle of every component (in lockstep)
+ *
+ * @param gameboy The gameboy to run
+ * @param written set to true if the CPU has written to registers watched
+ *        by the other components (their next events may have moved)
+ * @return int Error code
+ */
+static int gameboy_cycle(gameboy_t *gameboy, bool *written)
+{
+    // The timer only has to be run for its interrupt, the cpu accesses
+    // to its registers synchronize it otherwise
+    if (gameboy->cycles >= scheduler_get(&gameboy->scheduler, SCHED_TIMER))
+    {
+        M_EXIT_IF_ERR(timer_sync(&gameboy->timer, gameboy->cycles));
+    }
+    M_EXIT_IF_ERR(cpu_cycle(&gameboy->cpu));
+    ++gameboy->cycles;
+
+    M_EXIT_IF_ERR(lcdc_cycle(&gameboy->screen, gameboy->cycles));
+
+    // Only the written addresses which are watched are dispatched
+    if (gameboy->pages.trap.pending)
+    {
+        M_EXIT_IF_ERR(cartridge_bus_listener(&gameboy->cartridge, &gameboy->cpu));
+    }
+    *written = gameboy->watch.nb_written != 0;
+    if (*written)
+    {
+        M_EXIT_IF_ERR(bus_watch_dispatch(&gameboy->watch));
+    }
+
+    return ERR_NONE;
 }
-        M_EXIT_IF_ERR(timer_cycle(&gameboy->timer));
-        M_EXIT_IF_ERR(cpu_cycle(&gameboy->cpu));
-        ++gameboy->cycles;
 
-        gameboy->screen.on_cycle = gameboy->cycles;
-        gameboy->screen.next_cycle = gameboy->cycles + 1;
-        gameboy->screen.window_y = cpu_read_at_idx(&gameboy->cpu, REG_WY);
-        gameboy->screen.DMA_from = cpu_read_at_idx(&gameboy->cpu, REG_DMA);
-        gameboy->screen.DMA_to = cpu_read_at_idx(&gameboy->cpu, REG_DMA) + LINE_TOTAL_CYCLES;
-        gameboy->screen.on = (cpu_read_at_idx(&gameboy->cpu, REG_LCDC) & LCDC_REG_LCD_STATUS_MASK != 0);
+/**
+ * @brief Computes the next cycle at which the LCDC has to be run
+ *
+ * @param gameboy The gameboy
+ * @return uint64_t The value of gameboy->cycles before the LCDC cycle (SCHED_NEVER if switched off)
+ */
+static uint64_t gameboy_lcdc_next(const gameboy_t *gameboy)
+{
+    const lcdc_t *lcd = &gameboy->screen;
 
-        M_EXIT_IF_ERR(lcdc_cycle(&gameboy->screen, gameboy->cycles));
+    // The LCDC is run with the incremented cycle, see gameboy_cycle()
+    if (lcd->next_cycle != (uint64_t)-1)
+    {
+        return lcd->next_cycle - 1;
+    }
+    if (cpu_read_at_idx(&gameboy->cpu, REG_LCDC) & LCDC_REG_LCD_STATUS_MASK)
+    {
+        // The LCDC has been switched on and starts on next cycle
+        return gameboy->cycles;
+    }
+    return SCHED_NEVER;
+}
 
-        M_EXIT_IF_ERR(timer_bus_listener(&gameboy->timer, gameboy->cpu.write_listener));
-        M_EXIT_IF_ERR(bootrom_bus_listener(gameboy, gameboy->cpu.write_listener));
-        M_EXIT_IF_ERR(joypad_bus_listener(&gameboy->pad, gameboy->cpu.write_listener));
-        M_EXIT_IF_ERR(lcdc_bus_listener(&gameboy->screen, gameboy->cpu.write_listener));
-#ifdef BLARGG
-        M_EXIT_IF_ERR(blargg_bus_listener(gameboy, gameboy->cpu.write_listener));
+/**
+ * @brief Updates the deadline of the event of a component other than the
+ *        CPU, expressed as the value of gameboy->cycles when the component
+ *        has to be run cycle by cycle. It only moves when the event has
+ *        occurred or when the CPU has written to the registers of the
+ *        component.
+ *
+ * @param gameboy The gameboy to schedule
+ * @param event event to update (not SCHED_CPU)
+ * @return int Error code
+ */
+static int gameboy_schedule_event(gameboy_t *gameboy, sched_event_t event)
+{
+    uint64_t next = SCHED_NEVER;
+    switch (event)
+    {
+    case SCHED_TIMER:
+        next = timer_next_overflow(&gameboy->timer);
+        break;
+    case SCHED_LCDC:
+        next = gameboy_lcdc_next(gameboy);
+        break;
+    case SCHED_DMA:
+        // A DMA transfer copies one byte per cycle
+        next = gameboy->screen.DMA_to <= GRAPH_RAM_END ? gameboy->cycles : SCHED_NEVER;
+        break;
+    default:
+        M_EXIT_ERR(ERR_BAD_PARAMETER, ", event %d is not scheduled", event);
+    }
+    return scheduler_set(&gameboy->scheduler, event, next);
+}
+
+/**
+ * @brief Updates the deadlines of the events of all the components but
+ *        the CPU (see gameboy_schedule_event)
+ *
+ * @param gameboy The gameboy to schedule
+ * @return int Error code
+ */
+static int gameboy_schedule(gameboy_t *gameboy)
+{
+    for (sched_event_t e = SCHED_TIMER; e < SCHED_NB_EVENTS; ++e)
+    {
+        M_EXIT_IF_ERR(gameboy_schedule_event(gameboy, e));
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Runs a whole block of instructions (see cpu-block.h) if its last
+ *        instruction starts before the next event of the other components.
+ *
+ * @param gameboy The gameboy to run, its CPU due
+ * @param next cycle of the next event of the other components
+ * @param ran set to true if a block has been run, false if gameboy_cycle() has to be used
+ * @return int Error code
+ */
+static int gameboy_run_block(gameboy_t *gameboy, uint64_t next, bool *ran)
+{
+    *ran = false;
+    if (gameboy->blocks == NULL)
+    {
+        return ERR_NONE;
+    }
+#ifdef CPU_PROFILE
+    // Profiled instructions are run one by one, by cpu_cycle
+    if (gameboy->cpu.profile != NULL)
+    {
+        return ERR_NONE;
+    }
 #endif
+
+    uint16_t last_at = 0;
+    uint8_t last_cycles = 0;
+    M_EXIT_IF_ERR(block_run(gameboy->blocks, &gameboy->cpu, next - gameboy->cycles, &last_at, &last_cycles));
+    if (last_cycles == 0)
+    {
+        return ERR_NONE;
     }
 
+    // Same state as right after gameboy_cycle() has run the last instruction
+    gameboy->cycles += (uint64_t)last_at + 1;
+    gameboy->cpu.idle_time = (uint8_t)(last_cycles - 1);
+    gameboy->cpu.write_listener = 0;
+
+    *ran = true;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Runs the CPU alone until the next event of the other components,
+ *        or until it writes to their registers. The timer and the LCDC do
+ *        nothing before their next event, and the CPU only waits for an
+ *        interrupt they raise when halted, so the cycles in which the CPU
+ *        is idle or halted are skipped at once.
+ *
+ * @param gameboy The gameboy to run
+ * @param next cycle of the next event of the other components (after gameboy->cycles)
+ * @return int Error code
+ */
+static int gameboy_run_cpu(gameboy_t *gameboy, uint64_t next)
+{
+    cpu_t *cpu = &gameboy->cpu;
+
+    while (gameboy->cycles < next)
+    {
+        const uint64_t due = cpu_next_event(cpu, gameboy->cycles);
+        if (due > gameboy->cycles)
+        {
+            const uint64_t until = due < next ? due : next;
+            M_EXIT_IF_ERR(cpu_skip_cycles(cpu, until - gameboy->cycles));
+            gameboy->cycles = until;
+            continue;
+        }
+
+        bool ran = false;
+        M_EXIT_IF_ERR(gameboy_run_block(gameboy, next, &ran));
+        if (!ran)
+        {
+            bool written = false;
+            M_EXIT_IF_ERR(gameboy_cycle(gameboy, &written));
+            if (written)
+            {
+                // The next event has to be computed again
+                return gameboy_schedule(gameboy);
+            }
+        }
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see gameboy.h ========================================
+int gameboy_set_serial(gameboy_t *gameboy, gameboy_serial_t serial, void *arg)
+{
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE_NON_NULL(serial);
+
+#ifndef BLARGG
+    // Without BLARGG, the serial port is only watched once it has a receiver
+    if (gameboy->serial == NULL)
+    {
+        M_EXIT_IF_ERR(bus_watch_add(&gameboy->watch, BLARGG_REG, BLARGG_REG, blargg_watch, gameboy));
+    }
+#endif
+    gameboy->serial = serial;
+    gameboy->serial_arg = arg;
+    return ERR_NONE;
+}
+
+// ==== see gameboy.h ========================================
+int gameboy_run_until(gameboy_t *gameboy, uint64_t cycle)
+{
+    M_REQUIRE_NON_NULL(gameboy);
+
+    // The gameboy may have been changed since the last run (state loaded, key pressed)
+    M_EXIT_IF_ERR(gameboy_schedule(gameboy));
+
+    while (gameboy->cycles < cycle)
+    {
+        uint64_t next = scheduler_next(&gameboy->scheduler);
+        if (next > gameboy->cycles)
+        {
+            M_EXIT_IF_ERR(gameboy_run_cpu(gameboy, next < cycle ? next : cycle));
+            continue;
+        }
+
+        // The events due are run by gameboy_cycle(), then scheduled again
+        bool written = false;
+        M_EXIT_IF_ERR(gameboy_cycle(gameboy, &written));
+        if (written)
+        {
+            M_EXIT_IF_ERR(gameboy_schedule(gameboy));
+            continue;
+        }
+        for (sched_event_t e = SCHED_TIMER; e < SCHED_NB_EVENTS; ++e)
+        {
+            if (scheduler_get(&gameboy->scheduler, e) <= next)
+            {
+                M_EXIT_IF_ERR(gameboy_schedule_event(gameboy, e));
+            }
+        }
+    }
+
+    // F and the timer registers are visible from outside
+    cpu_flags_sync(&gameboy->cpu);
+    M_EXIT_IF_ERR(timer_sync(&gameboy->timer, gameboy->cycles - 1));
+
     return ERR_NONE;
 }
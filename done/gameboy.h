@@ -18,6 +18,8 @@
 #include "timer.h"
 #include "lcdc.h"
 #include "joypad.h"
+#include "scheduler.h"
+#include "cpu-block.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,22 +27,100 @@ extern "C" {
 
 #define GB_NB_COMPONENTS 6
 
+#define GB_CACHE_LINE 64
+
+/**
+ * @brief Adresses of the GameBoy
+ *
+ */
+#define MEM_SIZE(X) (X ## _END - X ## _START + 1)
+
+#define BOOT_ROM_START   0x0000
+#define BOOT_ROM_END     0x00FF
+
+#define VIDEO_RAM_START  0x8000
+#define VIDEO_RAM_END    0x9FFF
+
+#define EXTERN_RAM_START 0xA000
+#define EXTERN_RAM_END   0xBFFF
+
+#define WORK_RAM_START   0xC000
+#define WORK_RAM_END     0xDFFF
+
+#define ECHO_RAM_START   0xE000
+#define ECHO_RAM_END     0xFDFF
+
+#define GRAPH_RAM_START  0xFE00
+#define GRAPH_RAM_END    0xFE9F
+
+#define USELESS_START    0xFEA0
+#define USELESS_END      0xFEFF
+
+#define REGISTERS_START  0xFF00
+#define REGISTERS_END    0xFF7F
+
+
+// Memory-mapped "IO" registers
+#define REGS_START      0xFF00
+#define BLARGG_REG      0xFF01
+
+#define REGS_LCDC_START 0xFF40
+#define REGS_LCDC_END   0xFF4C
+#define REG_BOOT_ROM_DISABLE  0xFF50
+
+
+/**
+ * @brief Receiver of the bytes written to the serial port (see gameboy_set_serial)
+ */
+typedef int (*gameboy_serial_t)(void* arg, data_t byte);
+
+/**
+ * @brief Mutable memories of a Game Boy, in the order of the bus. The OAM
+ *        and the unused area after it fill a page, which is thus direct
+ *        (see bus_pages_t).
+ */
+typedef struct {
+    data_t video[MEM_SIZE(VIDEO_RAM)];
+    data_t external[MEM_SIZE(EXTERN_RAM)];
+    data_t work[MEM_SIZE(WORK_RAM)];
+    data_t graph[MEM_SIZE(GRAPH_RAM)];
+    data_t useless[MEM_SIZE(USELESS)];
+    data_t registers[MEM_SIZE(REGISTERS)];
+    data_t high[HIGH_RAM_SIZE];
+} gameboy_ram_t;
+
 /**
  * @brief Game Boy data structure.
- *        Regroups everything needed to simulate the Game Boy.
+ *        Regroups everything needed to simulate the Game Boy, in one block
+ *        which owns all of its mutable memories: only the ROMs (shared, see
+ *        cartridge_init_from_file and bootrom.h), the external RAM of the
+ *        cartridge and the caches are outside. The state used by each
+ *        instruction comes first.
+ *        The bus has no bus_t table: the page table is enough once
+ *        everything is plugged (see bus_pages_detach).
+ *        The block is cache-line aligned: a gameboy_t on the heap is
+ *        allocated with aligned_alloc.
  */
 struct gameboy_{
-    bus_t bus;
-    cpu_t cpu;
+    _Alignas(GB_CACHE_LINE) cpu_t cpu;
     uint64_t cycles;
+    block_cache_t* blocks; // NULL if instructions are only run by cpu_cycle
+    scheduler_t scheduler;
     gbtimer_t timer;
+    _Alignas(GB_CACHE_LINE) bus_pages_t pages; // page table of the bus, used by the cpu
+    data_t* io[BUS_PAGE_SIZE]; // entries of the I/O page, the only one which is not direct
+    bus_watch_t watch; // components watching the writes of the cpu
+    lcdc_t screen;
+    joypad_t pad;
     cartridge_t cartridge;
+    component_t bootrom;
     component_t components[GB_NB_COMPONENTS];
+    memory_t memories[GB_NB_COMPONENTS + 1]; // of the components, then of the high RAM of the cpu
     size_t nb_components;
-    component_t bootrom;
     bit_t boot;
-    lcdc_t screen;
-    joypad_t pad;
+    gameboy_serial_t serial; // receiver of the serial port, NULL to print it (with BLARGG)
+    void* serial_arg;
+    _Alignas(GB_CACHE_LINE) gameboy_ram_t ram;
 };
 
 /**
@@ -55,12 +135,41 @@ typedef enum {
 #define GB_TICS_PER_CYCLE 4
 
 /**
- * @brief Creates a gameboy
+ * @brief Creates a gameboy. The external RAM of its cartridge is private
+ *        (see cartridge_init) and its clock counts the emulated time (see
+ *        cartridge_count_cycles): nothing is written next to the ROM, and
+ *        a run only depends on the ROM and the inputs.
  *
  * @param gameboy pointer to gameboy to create
  */
 int gameboy_create(gameboy_t* gameboy, const char* filename);
 
+/**
+ * @brief Creates a gameboy whose battery backed cartridge keeps its
+ *        external RAM in the save file next to the ROM (see
+ *        cartridge_init_with_save), as a player expects
+ *
+ * @param gameboy pointer to gameboy to create
+ * @param filename ROM file
+ * @return error code
+ */
+int gameboy_create_with_save(gameboy_t* gameboy, const char* filename);
+
+/**
+ * @brief Creates a gameboy as a copy of another one, typically a model
+ *        freshly created and never run, shared by many instances: the
+ *        whole block is copied at once, then its pointers to the model
+ *        are moved to the copy. The ROMs are shared with the model, the
+ *        external RAM of the cartridge is copied (and never written back
+ *        to the save file of a battery backed cartridge), the caches start
+ *        empty. The model may be copied by several threads at once.
+ *
+ * @param gameboy pointer to gameboy to create
+ * @param model gameboy to copy
+ * @return error code
+ */
+int gameboy_clone(gameboy_t* gameboy, const gameboy_t* model);
+
 /**
  * @brief Destroys a gameboy
  *
@@ -69,49 +178,66 @@ int gameboy_create(gameboy_t* gameboy, const char* filename);
 void gameboy_free(gameboy_t* gameboy);
 
 /**
- * @brief Runs a gamefor for/until a given cycle
+ * @brief Version of the states saved by gameboy_save_state, to be
+ *        incremented whenever their layout changes: the states hold the
+ *        fields of the components (pointers and configuration excluded),
+ *        with no uninitialized byte
  */
-int gameboy_run_until(gameboy_t* gameboy, uint64_t cycle);
+#define GAMEBOY_STATE_VERSION 2
 
 /**
- * @brief Adresses of the GameBoy
+ * @brief Gets the size of the state of a gameboy, which only depends on
+ *        its cartridge
  *
+ * @param gameboy pointer to the gameboy
+ * @return size in bytes, 0 if gameboy is NULL
  */
-#define MEM_SIZE(X) (X ## _END - X ## _START + 1)
-
-#define BOOT_ROM_START   0x0000
-#define BOOT_ROM_END     0x00FF
-
-#define VIDEO_RAM_START  0x8000
-#define VIDEO_RAM_END    0x9FFF
-
-#define EXTERN_RAM_START 0xA000
-#define EXTERN_RAM_END   0xBFFF
-
-#define WORK_RAM_START   0xC000
-#define WORK_RAM_END     0xDFFF
-
-#define ECHO_RAM_START   0xE000
-#define ECHO_RAM_END     0xFDFF
-
-#define GRAPH_RAM_START  0xFE00
-#define GRAPH_RAM_END    0xFE9F
-
-#define USELESS_START    0xFEA0
-#define USELESS_END      0xFEFF
-
-#define REGISTERS_START  0xFF00
-#define REGISTERS_END    0xFF7F
+size_t gameboy_state_size(const gameboy_t* gameboy);
 
+/**
+ * @brief Saves the state of a gameboy between two runs: the cpu, the
+ *        timer, the LCDC (with its screen), the joypad, all the RAM, the
+ *        cycle and the banks and RAM of the cartridge. The pointers are not
+ *        saved: they are those of the gameboy the state is loaded into.
+ *
+ * @param gameboy pointer to the gameboy
+ * @param state buffer of at least gameboy_state_size(gameboy) bytes
+ * @param size size of the buffer
+ * @return error code
+ */
+int gameboy_save_state(const gameboy_t* gameboy, void* state, size_t size);
 
-// Memory-mapped "IO" registers
-#define REGS_START      0xFF00
-#define BLARGG_REG      0xFF01
+/**
+ * @brief Restores a state saved by gameboy_save_state from a gameboy
+ *        running the same ROM (possibly another one). Only the decoded
+ *        instructions of the memory lines which have changed are dropped.
+ *
+ * @param gameboy pointer to the gameboy
+ * @param state state to restore
+ * @param size size of the state
+ * @return error code (ERR_BAD_PARAMETER if it is not a state of the same ROM and version)
+ */
+int gameboy_load_state(gameboy_t* gameboy, const void* state, size_t size);
 
-#define REGS_LCDC_START 0xFF40
-#define REGS_LCDC_END   0xFF4C
-#define REG_BOOT_ROM_DISABLE  0xFF50
+/**
+ * @brief Sends the bytes written to the serial port (BLARGG_REG) to a
+ *        receiver, instead of printing them (as done with BLARGG)
+ *
+ * @param gameboy pointer to the gameboy
+ * @param serial receiver, called with arg and each byte written
+ * @param arg argument of the receiver
+ * @return error code
+ */
+int gameboy_set_serial(gameboy_t* gameboy, gameboy_serial_t serial, void* arg);
 
+/**
+ * @brief Runs a gamefor for/until a given cycle.
+ *        Components are only run cycle by cycle when one of their events
+ *        is due (see scheduler.h), the cycles in between are skipped at once.
+ *        A deadline is only computed again when its event has been run or
+ *        when a register watched by the components has been written.
+ */
+int gameboy_run_until(gameboy_t* gameboy, uint64_t cycle);
 
 #ifdef __cplusplus
 }
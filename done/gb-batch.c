@@ -0,0 +1,622 @@
+/**
+ * @file gb-batch.c
+ * @brief Headless runner of many ROMs at once: runs the jobs of a manifest
+ *        on a pool of threads, each job on its own gameboy, and streams
+ *        their results as JSON lines
+ *
+ * A manifest has one job per line (empty lines and lines starting with #
+ * are skipped):
+ *
+ *     ROM CYCLES [INPUT [OUTPUT]]
+ *
+ * ROM is run for CYCLES cycles. INPUT is an input script ("-" for none),
+ * with one key event per line, in order of cycles:
+ *
+ *     CYCLE press|release RIGHT|LEFT|UP|DOWN|A|B|SELECT|START
+ *
+ * OUTPUT ("-" for none) is the prefix of the files the final state is
+ * dumped to: OUTPUT.mem.bin (work RAM, as dump_mem.bin of test-gameboy)
+ * and OUTPUT.frame.pgm (screen). The fields may be quoted ("a b.gb").
+ *
+ * Each worker creates a gameboy once per ROM it runs and copies it for
+ * each job (see gameboy_clone). The external RAM of the cartridges is
+ * private (see gameboy_create): nothing is written next to the ROMs.
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include "gameboy.h"
+#include "joypad.h"
+#include "framebuffer.h"
+#include "error.h"
+#include "tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define MAX_LINE 4096
+#define MAX_FIELDS 4
+#define SERIAL_MAX 4096 // bytes of serial output kept per job
+
+/**
+ * @brief A key event of an input script
+ */
+typedef struct {
+    uint64_t cycle;
+    gb_key_t key;
+    bool pressed;
+} input_t;
+
+/**
+ * @brief A job of the manifest
+ */
+typedef struct {
+    size_t line;  // in the manifest
+    char* rom;
+    uint64_t cycles;
+    char* input;  // NULL if none
+    char* output; // NULL if none
+} job_t;
+
+/**
+ * @brief The serial output of a job
+ */
+typedef struct {
+    char data[SERIAL_MAX];
+    size_t size;
+    bool truncated;
+} serial_t;
+
+/**
+ * @brief The jobs [begin, end) left to a worker: it takes them from the
+ *        front, the other workers steal them from the back
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} deque_t;
+
+typedef struct {
+    const job_t* jobs;
+    deque_t* deques;
+    size_t nb_workers;
+    pthread_mutex_t out_lock;
+    FILE* out;
+    size_t failed;
+} pool_t;
+
+typedef struct {
+    pool_t* pool;
+    size_t id;
+} worker_t;
+
+/**
+ * @brief Gameboy freshly created from a ROM, copied by the jobs of the ROM
+ */
+typedef struct {
+    gameboy_t* gb;
+    const char* rom; // NULL if gb is not created
+} model_t;
+
+static const char* const key_names[NB_GB_KEYS] = {
+    "RIGHT", "LEFT", "UP", "DOWN", "A", "B", "SELECT", "START"
+};
+
+// Printed with the errors, see tool_error
+#define USAGE "[-j threads] manifest"
+static const char* const examples[] = { "nightly.txt > results.jsonl", "-j 4 - < nightly.txt", NULL };
+
+/**
+ * @brief Splits a line into whitespace separated fields, in place. A field
+ *        may be quoted to contain spaces.
+ *
+ * @param line the line, modified
+ * @param fields set to the fields
+ * @return the number of fields, MAX_FIELDS + 1 if there are too many
+ */
+static size_t split(char* line, char* fields[MAX_FIELDS])
+{
+    size_t count = 0;
+    char* p = line;
+    for (;;) {
+        p += strspn(p, " \t\r\n");
+        if (*p == '\0' || *p == '#') {
+            return count;
+        }
+        if (count == MAX_FIELDS) {
+            return MAX_FIELDS + 1;
+        }
+
+        char* end = NULL;
+        if (*p == '"') {
+            ++p;
+            end = strchr(p, '"');
+            if (end == NULL) {
+                return MAX_FIELDS + 1;
+            }
+        } else {
+            end = p + strcspn(p, " \t\r\n");
+        }
+        fields[count++] = p;
+        if (*end == '\0') {
+            return count;
+        }
+        *end = '\0';
+        p = end + 1;
+    }
+}
+
+/**
+ * @brief Parses a number of cycles
+ *
+ * @return error code
+ */
+static int parse_cycles(const char* field, uint64_t* cycles)
+{
+    char* end = NULL;
+    const unsigned long long value = strtoull(field, &end, 0);
+    M_REQUIRE(end != field && *end == '\0' && field[0] != '-', ERR_BAD_PARAMETER,
+              "invalid number of cycles \"%s\"", field);
+    *cycles = (uint64_t) value;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Reads the jobs of a manifest
+ *
+ * @param file the manifest
+ * @param jobs set to the jobs (to free with free_jobs)
+ * @param nb_jobs set to the number of jobs
+ * @return error code
+ */
+static int read_manifest(FILE* file, job_t** jobs, size_t* nb_jobs)
+{
+    char line[MAX_LINE];
+    size_t capacity = 0;
+    size_t number = 0;
+    *jobs = NULL;
+    *nb_jobs = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        ++number;
+        char* fields[MAX_FIELDS];
+        const size_t count = split(line, fields);
+        if (count == 0) {
+            continue;
+        }
+        M_REQUIRE(count >= 2 && count <= MAX_FIELDS, ERR_BAD_PARAMETER,
+                  "manifest line %zu: expected ROM CYCLES [INPUT [OUTPUT]]", number);
+
+        if (*nb_jobs == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            job_t* const grown = realloc(*jobs, capacity * sizeof(job_t));
+            M_REQUIRE_NON_NULL_CUSTOM_ERR(grown, ERR_MEM);
+            *jobs = grown;
+        }
+
+        job_t* job = &(*jobs)[*nb_jobs];
+        memset(job, 0, sizeof(*job));
+        job->line = number;
+        M_EXIT_IF_ERR(parse_cycles(fields[1], &job->cycles));
+        job->rom = strdup(fields[0]);
+        M_REQUIRE_NON_NULL_CUSTOM_ERR(job->rom, ERR_MEM);
+        ++*nb_jobs;
+        if (count > 2 && strcmp(fields[2], "-") != 0) {
+            job->input = strdup(fields[2]);
+            M_REQUIRE_NON_NULL_CUSTOM_ERR(job->input, ERR_MEM);
+        }
+        if (count > 3 && strcmp(fields[3], "-") != 0) {
+            job->output = strdup(fields[3]);
+            M_REQUIRE_NON_NULL_CUSTOM_ERR(job->output, ERR_MEM);
+        }
+    }
+    return ERR_NONE;
+}
+
+static void free_jobs(job_t* jobs, size_t nb_jobs)
+{
+    for (size_t i = 0; i < nb_jobs; ++i) {
+        free(jobs[i].rom);
+        free(jobs[i].input);
+        free(jobs[i].output);
+    }
+    free(jobs);
+}
+
+/**
+ * @brief Reads an input script
+ *
+ * @param filename the script
+ * @param inputs set to its key events (to free)
+ * @param nb_inputs set to the number of key events
+ * @return error code
+ */
+static int read_inputs(const char* filename, input_t** inputs, size_t* nb_inputs)
+{
+    FILE* file = fopen(filename, "r");
+    M_EXIT_IF(file == NULL, ERR_IO, "cannot open input script \"%s\"", filename);
+
+    char line[MAX_LINE];
+    size_t capacity = 0;
+    size_t number = 0;
+    int err = ERR_NONE;
+    *inputs = NULL;
+    *nb_inputs = 0;
+
+    while (err == ERR_NONE && fgets(line, sizeof(line), file) != NULL) {
+        ++number;
+        char* fields[MAX_FIELDS];
+        const size_t count = split(line, fields);
+        if (count == 0) {
+            continue;
+        }
+
+        input_t input = { 0, NB_GB_KEYS, false };
+        if (count != 3 || parse_cycles(fields[0], &input.cycle) != ERR_NONE
+            || (strcmp(fields[1], "press") != 0 && strcmp(fields[1], "release") != 0)) {
+            err = ERR_BAD_PARAMETER;
+            break;
+        }
+        input.pressed = strcmp(fields[1], "press") == 0;
+        for (size_t k = 0; k < NB_GB_KEYS; ++k) {
+            if (strcmp(fields[2], key_names[k]) == 0) {
+                input.key = (gb_key_t) k;
+            }
+        }
+        if (input.key == NB_GB_KEYS || (*nb_inputs > 0 && input.cycle < (*inputs)[*nb_inputs - 1].cycle)) {
+            err = ERR_BAD_PARAMETER;
+            break;
+        }
+
+        if (*nb_inputs == capacity) {
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            input_t* const grown = realloc(*inputs, capacity * sizeof(input_t));
+            if (grown == NULL) {
+                err = ERR_MEM;
+                break;
+            }
+            *inputs = grown;
+        }
+        (*inputs)[(*nb_inputs)++] = input;
+    }
+    fclose(file);
+
+    if (err != ERR_NONE) {
+        free(*inputs);
+        *inputs = NULL;
+        *nb_inputs = 0;
+    }
+    M_EXIT_IF(err != ERR_NONE, err, "input script \"%s\", line %zu", filename, number);
+    return ERR_NONE;
+}
+
+// The serial port of a job goes to its result
+static int serial_receive(void* arg, data_t byte)
+{
+    serial_t* serial = arg;
+    if (serial->size < SERIAL_MAX) {
+        serial->data[serial->size++] = (char) byte;
+    } else {
+        serial->truncated = true;
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Dumps the final state of a job (see the output files above)
+ *
+ * @return error code
+ */
+static int dump_outputs(const gameboy_t* gb, const char* prefix)
+{
+    char filename[MAX_LINE + 16];
+    const component_t* ram = &gb->components[WORK_RAM];
+
+    snprintf(filename, sizeof(filename), "%s.mem.bin", prefix);
+    FILE* file = fopen(filename, "wb");
+    M_EXIT_IF(file == NULL, ERR_IO, "cannot open \"%s\" for writing", filename);
+    const size_t written = fwrite(ram->mem->memory, 1, ram->mem->size, file);
+    fclose(file);
+    M_EXIT_IF(written != ram->mem->size, ERR_IO, "cannot write \"%s\"", filename);
+
+    snprintf(filename, sizeof(filename), "%s.frame.pgm", prefix);
+    file = fopen(filename, "wb");
+    M_EXIT_IF(file == NULL, ERR_IO, "cannot open \"%s\" for writing", filename);
+    fprintf(file, "P5\n%d %d\n3\n", FRAMEBUFFER_WIDTH, FRAMEBUFFER_HEIGHT);
+    size_t pixels = 0;
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y) {
+        uint8_t grey[FRAMEBUFFER_WIDTH];
+        for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x) {
+            grey[x] = (uint8_t) (3 - gb->screen.frame.pixels[y][x]); // color 0 is the lightest
+        }
+        pixels += fwrite(grey, 1, sizeof(grey), file);
+    }
+    fclose(file);
+    M_EXIT_IF(pixels != sizeof(gb->screen.frame.pixels), ERR_IO, "cannot write \"%s\"", filename);
+
+    return ERR_NONE;
+}
+
+/**
+ * @brief Runs a job on a gameboy of its own
+ *
+ * @param job the job
+ * @param model gameboy of the last ROM run, created again if it is another one
+ * @param gb the gameboy to run the job on (freed by the caller)
+ * @param serial receives the serial output
+ * @return error code
+ */
+static int run_job(const job_t* job, model_t* model, gameboy_t* gb, serial_t* serial)
+{
+    if (model->rom == NULL || strcmp(model->rom, job->rom) != 0) {
+        gameboy_free(model->gb);
+        model->rom = NULL;
+        memset(model->gb, 0, sizeof(gameboy_t));
+        M_EXIT_IF_ERR(gameboy_create(model->gb, job->rom));
+        model->rom = job->rom;
+    }
+
+    input_t* inputs = NULL;
+    size_t nb_inputs = 0;
+    if (job->input != NULL) {
+        M_EXIT_IF_ERR(read_inputs(job->input, &inputs, &nb_inputs));
+    }
+
+    int err = gameboy_clone(gb, model->gb);
+    if (err == ERR_NONE) {
+        err = gameboy_set_serial(gb, serial_receive, serial);
+    }
+    for (size_t i = 0; err == ERR_NONE && i < nb_inputs && inputs[i].cycle < job->cycles; ++i) {
+        err = gameboy_run_until(gb, inputs[i].cycle);
+        if (err == ERR_NONE) {
+            err = inputs[i].pressed ? joypad_key_pressed(&gb->pad, inputs[i].key)
+                                    : joypad_key_released(&gb->pad, inputs[i].key);
+        }
+    }
+    free(inputs);
+
+    M_EXIT_IF_ERR(err);
+    M_EXIT_IF_ERR(gameboy_run_until(gb, job->cycles));
+    if (job->output != NULL) {
+        M_EXIT_IF_ERR(dump_outputs(gb, job->output));
+    }
+    return ERR_NONE;
+}
+
+// ======================================================================
+static void print_string(FILE* out, const char* s, size_t size)
+{
+    fputc('"', out);
+    for (size_t i = 0; i < size; ++i) {
+        const unsigned char c = (unsigned char) s[i];
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c < 0x20 || c >= 0x7F) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/**
+ * @brief Prints the result of a job as one JSON line
+ */
+static void print_result(FILE* out, size_t index, const job_t* job, int err,
+                         const gameboy_t* gb, const serial_t* serial)
+{
+    fprintf(out, "{\"job\":%zu,\"line\":%zu,\"rom\":", index, job->line);
+    print_string(out, job->rom, strlen(job->rom));
+    fprintf(out, ",\"cycles\":%" PRIu64, job->cycles);
+
+    if (err != ERR_NONE) {
+        fputs(",\"status\":\"error\",\"error\":", out);
+        const char* msg = err > ERR_NONE && err < NB_ERR ? ERR_MESSAGES[err - ERR_NONE] : "unknown error";
+        print_string(out, msg, strlen(msg));
+    } else {
+        const cpu_t* cpu = &gb->cpu;
+        fprintf(out, ",\"status\":\"ok\",\"cpu\":{\"A\":%u,\"F\":%u,\"B\":%u,\"C\":%u,\"D\":%u,\"E\":%u,"
+                "\"H\":%u,\"L\":%u,\"SP\":%u,\"PC\":%u,\"IME\":%u,\"IE\":%u,\"IF\":%u,\"HALT\":%u}",
+                cpu->A, cpu->F, cpu->B, cpu->C, cpu->D, cpu->E, cpu->H, cpu->L,
+                cpu->SP, cpu->PC, cpu->IME, cpu->IE, cpu->IF, cpu->HALT);
+        fprintf(out, ",\"frame\":\"%016" PRIx64 "\"", framebuffer_hash(&gb->screen.frame));
+    }
+    fputs(",\"serial\":", out);
+    print_string(out, serial->data, serial->size);
+    fprintf(out, ",\"serial_truncated\":%s}\n", serial->truncated ? "true" : "false");
+}
+
+// ======================================================================
+/**
+ * @brief Takes the next job of a worker: from its own jobs, else half of
+ *        the jobs left to another worker
+ *
+ * @return true if a job was taken
+ */
+static bool take_job(pool_t* pool, size_t id, size_t* job)
+{
+    deque_t* own = &pool->deques[id];
+    for (;;) {
+        pthread_mutex_lock(&own->lock);
+        const bool found = own->begin < own->end;
+        if (found) {
+            *job = own->begin++;
+        }
+        pthread_mutex_unlock(&own->lock);
+        if (found) {
+            return true;
+        }
+
+        size_t begin = 0;
+        size_t end = 0;
+        for (size_t k = 1; k < pool->nb_workers && begin == end; ++k) {
+            deque_t* victim = &pool->deques[(id + k) % pool->nb_workers];
+            pthread_mutex_lock(&victim->lock);
+            const size_t left = victim->end - victim->begin;
+            if (left > 0) {
+                end = victim->end;
+                victim->end -= (left + 1) / 2;
+                begin = victim->end;
+            }
+            pthread_mutex_unlock(&victim->lock);
+        }
+        if (begin == end) {
+            // (no job is ever added: they are all taken)
+            return false;
+        }
+
+        pthread_mutex_lock(&own->lock);
+        own->begin = begin;
+        own->end = end;
+        pthread_mutex_unlock(&own->lock);
+    }
+}
+
+static void* worker(void* arg)
+{
+    const worker_t* self = arg;
+    pool_t* pool = self->pool;
+
+    gameboy_t* gb = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    model_t model = { aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t)), NULL };
+    serial_t* serial = malloc(sizeof(serial_t));
+    size_t index = 0;
+    if (model.gb != NULL) {
+        memset(model.gb, 0, sizeof(gameboy_t));
+    }
+    while ((gb != NULL && model.gb != NULL && serial != NULL) && take_job(pool, self->id, &index)) {
+        const job_t* job = &pool->jobs[index];
+        memset(gb, 0, sizeof(gameboy_t));
+        serial->size = 0;
+        serial->truncated = false;
+
+        const int err = run_job(job, &model, gb, serial);
+
+        pthread_mutex_lock(&pool->out_lock);
+        print_result(pool->out, index, job, err, gb, serial);
+        fflush(pool->out);
+        if (err != ERR_NONE) {
+            ++pool->failed;
+        }
+        pthread_mutex_unlock(&pool->out_lock);
+        gameboy_free(gb);
+    }
+    if (gb == NULL || model.gb == NULL || serial == NULL) {
+        pthread_mutex_lock(&pool->out_lock);
+        ++pool->failed;
+        pthread_mutex_unlock(&pool->out_lock);
+    }
+    gameboy_free(model.gb);
+    free(serial);
+    free(model.gb);
+    free(gb);
+    return NULL;
+}
+
+/**
+ * @brief Runs all the jobs, each worker starting with a contiguous share of them
+ *
+ * @return error code
+ */
+static int run_jobs(const job_t* jobs, size_t nb_jobs, size_t nb_workers, FILE* out, size_t* failed)
+{
+    pool_t pool = { jobs, NULL, nb_workers, PTHREAD_MUTEX_INITIALIZER, out, 0 };
+    pool.deques = calloc(nb_workers, sizeof(deque_t));
+    worker_t* workers = calloc(nb_workers, sizeof(worker_t));
+    pthread_t* threads = calloc(nb_workers, sizeof(pthread_t));
+    if (pool.deques == NULL || workers == NULL || threads == NULL) {
+        free(pool.deques);
+        free(workers);
+        free(threads);
+        return ERR_MEM;
+    }
+
+    for (size_t i = 0; i < nb_workers; ++i) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].begin = i * nb_jobs / nb_workers;
+        pool.deques[i].end = (i + 1) * nb_jobs / nb_workers;
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    // (the jobs of a worker which cannot be started are stolen by the others)
+    size_t started = 0;
+    for (; started < nb_workers; ++started) {
+        if (pthread_create(&threads[started], NULL, worker, &workers[started]) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        // (the jobs are run by the calling thread)
+        worker(&workers[0]);
+    }
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < nb_workers; ++i) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    pthread_mutex_destroy(&pool.out_lock);
+    free(pool.deques);
+    free(workers);
+    free(threads);
+
+    *failed = pool.failed;
+    return ERR_NONE;
+}
+
+// ======================================================================
+int main(int argc, char* argv[])
+{
+    long nb_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        nb_threads = atol(argv[2]);
+        arg = 3;
+    }
+    if (arg >= argc) {
+        tool_error(argv[0], "please provide a manifest", USAGE, examples);
+        return 1;
+    }
+    if (nb_threads < 1) {
+        tool_error(argv[0], "invalid number of threads", USAGE, examples);
+        return 1;
+    }
+
+    FILE* manifest = strcmp(argv[arg], "-") == 0 ? stdin : fopen(argv[arg], "r");
+    if (manifest == NULL) {
+        tool_error(argv[0], "cannot open the manifest", USAGE, examples);
+        return 1;
+    }
+    job_t* jobs = NULL;
+    size_t nb_jobs = 0;
+    int err = read_manifest(manifest, &jobs, &nb_jobs);
+    if (manifest != stdin) {
+        fclose(manifest);
+    }
+    if (err != ERR_NONE) {
+        free_jobs(jobs, nb_jobs);
+        tool_error(argv[0], "invalid manifest", USAGE, examples);
+        return err;
+    }
+
+    size_t failed = 0;
+    if (nb_jobs > 0) {
+        const size_t nb_workers = (size_t) nb_threads < nb_jobs ? (size_t) nb_threads : nb_jobs;
+        err = run_jobs(jobs, nb_jobs, nb_workers, stdout, &failed);
+    }
+    free_jobs(jobs, nb_jobs);
+
+    return err != ERR_NONE ? err : failed > 0;
+}
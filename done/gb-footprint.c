@@ -0,0 +1,169 @@
+/**
+ * @file gb-footprint.c
+ * @brief Memory footprint report of a gameboy: layout of gameboy_t, heap
+ *        used outside of it, and resident memory of many copies of a
+ *        model (see gameboy_clone) running the same ROM
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include "gameboy.h"
+#include "cpu-decode.h"
+#include "cpu-block.h"
+#include "error.h"
+#include "tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#define DEFAULT_NB_INSTANCES 64
+#define DEFAULT_CYCLES GB_CYCLES_PER_S
+
+// Target per instance, the ROM excluded but the caches included
+#define INSTANCE_LIMIT ((size_t) 100 * 1024)
+
+#define MEMBER(m) { #m, offsetof(gameboy_t, m), sizeof(((gameboy_t*) NULL)->m) }
+
+static const struct {
+    const char* name;
+    size_t offset;
+    size_t size;
+} members[] = {
+    MEMBER(cpu), MEMBER(cycles), MEMBER(blocks), MEMBER(scheduler), MEMBER(timer),
+    MEMBER(pages), MEMBER(io), MEMBER(watch), MEMBER(screen), MEMBER(pad),
+    MEMBER(cartridge), MEMBER(bootrom), MEMBER(components), MEMBER(memories),
+    MEMBER(nb_components), MEMBER(boot), MEMBER(serial), MEMBER(serial_arg), MEMBER(ram)
+};
+
+#define NB_MEMBERS (sizeof(members) / sizeof(members[0]))
+
+// Printed with the errors, see tool_error
+#define USAGE "input_file [instances [cycles]]"
+static const char* const examples[] = { "rom.gb 1000 1048576", "game.gb", NULL };
+
+// ======================================================================
+static size_t heap_used(void)
+{
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// ======================================================================
+static size_t resident(void)
+{
+    FILE* file = fopen("/proc/self/statm", "r");
+    unsigned long size = 0;
+    unsigned long pages = 0;
+    if (file != NULL) {
+        if (fscanf(file, "%lu %lu", &size, &pages) != 2) {
+            pages = 0;
+        }
+        fclose(file);
+    }
+    return (size_t) pages * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+// ======================================================================
+static int serial_ignore(void* arg, data_t byte)
+{
+    (void) arg;
+    (void) byte;
+    return ERR_NONE;
+}
+
+// ======================================================================
+static void print_layout(void)
+{
+    printf("gameboy_t: %zu bytes, aligned on %zu\n", sizeof(gameboy_t), _Alignof(gameboy_t));
+    printf("  %-14s %8s %8s\n", "member", "offset", "size");
+    for (size_t i = 0; i < NB_MEMBERS; ++i) {
+        printf("  %-14s %8zu %8zu\n", members[i].name, members[i].offset, members[i].size);
+    }
+}
+
+// ======================================================================
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        tool_error(argv[0], "please provide input_file", USAGE, examples);
+        return 1;
+    }
+
+    const char* const filename = argv[1];
+    const size_t nb = argc > 2 ? (size_t) atoll(argv[2]) : DEFAULT_NB_INSTANCES;
+    const uint64_t cycles = argc > 3 ? (uint64_t) atoll(argv[3]) : DEFAULT_CYCLES;
+    if (nb == 0) {
+        tool_error(argv[0], "please provide at least one instance", USAGE, examples);
+        return 1;
+    }
+
+    print_layout();
+
+    gameboy_t* model = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* fleet = aligned_alloc(_Alignof(gameboy_t), nb * sizeof(gameboy_t));
+    if (model == NULL || fleet == NULL) {
+        free(model);
+        free(fleet);
+        fputs("not enough memory\n", stderr);
+        return ERR_MEM;
+    }
+    memset(model, 0, sizeof(gameboy_t));
+    int err = gameboy_create(model, filename);
+    if (err == ERR_NONE) {
+        err = gameboy_set_serial(model, serial_ignore, NULL);
+    }
+
+    // The caches start small and grow with the code run, up to a bound
+    const size_t caches_min = (model->cpu.decode_cache != NULL
+                               ? sizeof(decode_cache_t) + DECODE_MIN_SLOTS * sizeof(decoded_instr_t) : 0)
+                              + (model->blocks != NULL ? sizeof(block_cache_t) : 0);
+    const size_t caches_max = (model->cpu.decode_cache != NULL ? DECODE_CACHE_MAX_BYTES : 0)
+                              + (model->blocks != NULL ? BLOCK_CACHE_MAX_BYTES : 0);
+    const size_t heap_before = heap_used();
+    const size_t rss_before = resident();
+    size_t created = 0;
+    for (; err == ERR_NONE && created < nb; ++created) {
+        err = gameboy_clone(&fleet[created], model);
+        if (err != ERR_NONE) {
+            gameboy_free(&fleet[created]);
+        }
+    }
+    const size_t heap = created > 0 ? (heap_used() - heap_before) / created : 0;
+
+    for (size_t i = 0; err == ERR_NONE && i < created; ++i) {
+        err = gameboy_run_until(&fleet[i], cycles);
+    }
+    const size_t rss = created > 0 ? (resident() - rss_before) / created : 0;
+    const size_t heap_run = created > 0 ? (heap_used() - heap_before) / created : 0;
+
+    for (size_t i = 0; i < created; ++i) {
+        gameboy_free(&fleet[i]);
+    }
+    gameboy_free(model);
+    free(fleet);
+    free(model);
+
+    if (err != ERR_NONE) {
+        fprintf(stderr, "%s\n", ERR_MESSAGES[err - ERR_NONE]);
+        return err;
+    }
+
+    // The caches are counted at their largest, whatever the code run
+    const size_t instance = sizeof(gameboy_t) + heap - caches_min + caches_max;
+    const int fits = instance <= INSTANCE_LIMIT && rss <= INSTANCE_LIMIT;
+    printf("heap outside of gameboy_t: %zu bytes per instance when created, %zu after %" PRIu64 " cycles, caches included\n",
+           heap, heap_run, cycles);
+    printf("caches: %zu bytes per instance when created, %zu at most\n", caches_min, caches_max);
+    printf("resident: %zu bytes per instance after %" PRIu64 " cycles (%zu instances, caches included, limit %zu): %s\n",
+           rss, cycles, created, INSTANCE_LIMIT, rss <= INSTANCE_LIMIT ? "ok" : "too big");
+    printf("instance: %zu bytes at most, ROM excluded, caches included (limit %zu): %s\n",
+           instance, INSTANCE_LIMIT, instance <= INSTANCE_LIMIT ? "ok" : "too big");
+
+    return fits ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+/**
+ * @file gb-movie.c
+ * @brief Headless player of input movies (see movie.h): replays the key
+ *        events recorded by gbsimulator as fast as the host can, then
+ *        prints the final cycle and the hash of the final frame, which are
+ *        the same on any host
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include "gameboy.h"
+#include "movie.h"
+#include "framebuffer.h"
+#include "error.h"
+#include "tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+// Printed with the errors, see tool_error
+#define USAGE "input_file movie_file [cycles]"
+static const char* const examples[] = { "game.gb game.gbm", "game.gb game.gbm 62914560", NULL };
+
+// ======================================================================
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+}
+
+// ======================================================================
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        tool_error(argv[0], "please provide input_file and movie_file", USAGE, examples);
+        return 1;
+    }
+
+    movie_t movie;
+    int err = movie_load(&movie, argv[2]);
+    if (err != ERR_NONE) {
+        fprintf(stderr, "cannot read movie \"%s\": %s\n", argv[2], ERR_MESSAGES[err - ERR_NONE]);
+        return err;
+    }
+    const uint64_t cycles = argc > 3 ? (uint64_t) atoll(argv[3]) : movie.length;
+
+    gameboy_t* gb = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    if (gb == NULL) {
+        movie_free(&movie);
+        fputs("not enough memory\n", stderr);
+        return ERR_MEM;
+    }
+    memset(gb, 0, sizeof(gameboy_t));
+
+    const double start = now();
+    err = gameboy_create(gb, argv[1]);
+    if (err == ERR_NONE) {
+        err = movie_play_until(&movie, gb, cycles);
+    }
+    const double elapsed = now() - start;
+
+    if (err == ERR_NONE) {
+        printf("cycles %" PRIu64 " events %zu frame %016" PRIx64 "\n",
+               gb->cycles, movie.next, framebuffer_hash(&gb->screen.frame));
+        fprintf(stderr, "%.3f s, %.1f times real time\n", elapsed,
+                elapsed > 0 ? (double) gb->cycles / GB_CYCLES_PER_S / elapsed : 0.0);
+    } else {
+        fprintf(stderr, "%s\n", ERR_MESSAGES[err - ERR_NONE]);
+    }
+
+    gameboy_free(gb);
+    free(gb);
+    movie_free(&movie);
+    return err;
+}
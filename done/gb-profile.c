@@ -0,0 +1,110 @@
+/**
+ * @file gb-profile.c
+ * @brief Headless profiler of the guest code (see profile.h): runs a ROM,
+ *        with the key events of a movie if any, then prints the opcodes and
+ *        the (bank, PC) which consumed the most cycles, and writes the cycles
+ *        of each call stack to a file for flame graphs, e.g.
+ *
+ *     gb-profile game.gb 41943040 game.folded && flamegraph.pl game.folded > game.svg
+ *
+ * It has to be built with CPU_PROFILE (see the Makefile).
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include "gameboy.h"
+#include "movie.h"
+#include "profile.h"
+#include "error.h"
+#include "tool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+// (bank, PC) printed
+#define PROFILE_TOP 50
+
+// Printed with the errors, see tool_error
+#define USAGE "[-m movie_file] input_file cycles [collapsed_file]"
+static const char* const examples[] = { "game.gb 10485760", "-m game.gbm game.gb 62914560 game.folded", NULL };
+
+#ifdef CPU_PROFILE
+// ======================================================================
+static int write_collapsed(const profile_t* profile, const char* filename)
+{
+    FILE* file = fopen(filename, "w");
+    if (file == NULL) {
+        return ERR_IO;
+    }
+    const int err = profile_write_collapsed(profile, file);
+    return fclose(file) != 0 && err == ERR_NONE ? ERR_IO : err;
+}
+#endif
+
+// ======================================================================
+int main(int argc, char* argv[])
+{
+#ifndef CPU_PROFILE
+    (void) argc;
+    tool_error(argv[0], "built without CPU_PROFILE, nothing would be counted", USAGE, examples);
+    return 1;
+#else
+    const char* movie_file = NULL;
+    int arg = 1;
+    if (argc > 2 && strcmp(argv[1], "-m") == 0) {
+        movie_file = argv[2];
+        arg = 3;
+    }
+    if (argc - arg < 2) {
+        tool_error(argv[0], "please provide input_file and cycles", USAGE, examples);
+        return 1;
+    }
+    const char* input_file = argv[arg];
+    const uint64_t cycles = (uint64_t) atoll(argv[arg + 1]);
+    const char* collapsed_file = argc - arg > 2 ? argv[arg + 2] : NULL;
+
+    movie_t movie;
+    memset(&movie, 0, sizeof(movie));
+    int err = movie_file != NULL ? movie_load(&movie, movie_file) : ERR_NONE;
+    if (err != ERR_NONE) {
+        fprintf(stderr, "cannot read movie \"%s\": %s\n", movie_file, ERR_MESSAGES[err - ERR_NONE]);
+        return err;
+    }
+
+    profile_t profile;
+    gameboy_t* gb = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    if (gb == NULL || profile_create(&profile) != ERR_NONE) {
+        free(gb);
+        movie_free(&movie);
+        fputs("not enough memory\n", stderr);
+        return ERR_MEM;
+    }
+    memset(gb, 0, sizeof(gameboy_t));
+
+    err = gameboy_create(gb, input_file);
+    if (err == ERR_NONE) {
+        err = cpu_use_profile(&gb->cpu, &profile);
+    }
+    if (err == ERR_NONE) {
+        err = movie_file != NULL ? movie_play_until(&movie, gb, cycles) : gameboy_run_until(gb, cycles);
+    }
+    if (err == ERR_NONE) {
+        err = profile_write_report(&profile, stdout, PROFILE_TOP);
+    }
+    if (err == ERR_NONE && collapsed_file != NULL) {
+        err = write_collapsed(&profile, collapsed_file);
+    }
+    if (err != ERR_NONE) {
+        fprintf(stderr, "%s\n", ERR_MESSAGES[err - ERR_NONE]);
+    }
+
+    gameboy_free(gb);
+    free(gb);
+    profile_free(&profile);
+    movie_free(&movie);
+    return err;
+#endif
+}
@@ -2,8 +2,16 @@
 #include "gameboy.h"
 #include "lcdc.h"
 #include "error.h"
+#include "rewind.h"
+#include "movie.h"
+#include "handoff.h"
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
 
 // Key press bits
@@ -16,12 +24,42 @@
 #define MY_KEY_SELECT_BIT 0x40
 #define MY_KEY_START_BIT 0x80
 
-#define SCALE 3
-
-// typedef struct gameboy_ gameboy_t;
-gameboy_t gameboy;
-struct timeval start;
-struct timeval paused;
+// Size of a pixel of the gameboy on screen, see the -s option
+#define DEFAULT_SCALE 3
+
+// Period of the image generator, in ms: it only shows the latest frame
+#define DISPLAY_PERIOD 16
+
+// Frames emulated per second, about 59.7
+#define FRAMES_PER_S (GB_CYCLES_PER_S / FRAME_TOTAL_CYCLES)
+
+// One record per frame, the last minute, a keyframe per second
+#define REWIND_SECONDS 60
+#define REWIND_CAPACITY ((size_t) 32 << 20)
+
+// Period of the emulation thread while paused, in ns
+#define PAUSE_PERIOD 10000000L
+
+/**
+ * @brief State of the simulator. The gameboy, its history and its movie
+ *        are only used by the emulation thread once it runs; the UI thread
+ *        gets the frames from the triple buffer and gives the key events
+ *        through the queue. sidlib calls the image generator without any
+ *        argument, hence the single instance, private to this file.
+ */
+typedef struct {
+    gameboy_t gameboy;
+    rewind_t history;
+    movie_t movie;
+    const char* movie_file; // NULL if the run is not recorded
+    frame_slot_t frames;
+    key_queue_t keys;
+    atomic_uint rewinds;    // seconds to go back, asked by the UI
+    atomic_bool paused;
+    atomic_bool stop;
+} simulator_t;
+
+static simulator_t simulator;
 
 uint64_t get_time_in_GB_cyles_since(struct timeval *from)
 {
@@ -45,29 +83,139 @@ uint64_t get_time_in_GB_cyles_since(struct timeval *from)
 }
 
 // ======================================================================
-static void set_grey(guchar *pixels, int row, int col, int width, guchar grey)
+static void generate_image(guchar *pixels, int height, int width)
 {
-    const size_t i = (size_t)(3 * (row * width + col)); // 3 = RGB
-    pixels[i + 2] = pixels[i + 1] = pixels[i] = grey;
+    (void)height;
+    const framebuffer_t *frame = frame_slot_latest(&simulator.frames, NULL);
+    framebuffer_blit_rgb(frame, pixels, 3 * (size_t)width, (size_t)width / LCD_WIDTH); // 3 = RGB
 }
 
 // ======================================================================
-static void generate_image(guchar *pixels, int height, int width)
+// Emulation thread
+
+/**
+ * @brief Gets the cycle at which the frame being drawn is complete: the
+ *        start of the next VBlank, or a frame later if the LCD is off
+ */
+static uint64_t next_vblank(const gameboy_t *gb)
+{
+    const uint64_t vblank = LCD_HEIGHT * LINE_TOTAL_CYCLES;
+    if (gb->screen.on_cycle == (uint64_t)-1 || gb->cycles < gb->screen.on_cycle)
+    {
+        return gb->cycles + FRAME_TOTAL_CYCLES;
+    }
+    const uint64_t frame_cycle = (gb->cycles - gb->screen.on_cycle) % FRAME_TOTAL_CYCLES;
+    return gb->cycles - frame_cycle + (frame_cycle < vblank ? vblank : FRAME_TOTAL_CYCLES + vblank);
+}
+
+/**
+ * @brief Sets the start of the time the gameboy runs on so that it is at
+ *        the right cycle now: after a pause or going back in time
+ */
+static void sync_start(struct timeval *start)
+{
+    struct timeval current;
+    struct timeval elapsed;
+    gettimeofday(&current, NULL);
+    elapsed.tv_sec = (time_t)(simulator.gameboy.cycles / GB_CYCLES_PER_S);
+    elapsed.tv_usec = (suseconds_t)((simulator.gameboy.cycles % GB_CYCLES_PER_S) * 1000000 / GB_CYCLES_PER_S);
+    timersub(&current, &elapsed, start);
+}
+
+// ======================================================================
+static void publish_frame(void)
+{
+    *frame_slot_back(&simulator.frames) = simulator.gameboy.screen.frame;
+    frame_slot_publish(&simulator.frames);
+}
+
+// ======================================================================
+static int apply_keys(void)
 {
+    key_event_t event;
+    while (key_queue_pop(&simulator.keys, &event))
+    {
+        if (simulator.movie_file != NULL)
+        {
+            M_EXIT_IF_ERR(movie_record(&simulator.movie, &simulator.gameboy, event.key, event.pressed));
+        }
+        M_EXIT_IF_ERR(event.pressed ? joypad_key_pressed(&simulator.gameboy.pad, event.key)
+                      : joypad_key_released(&simulator.gameboy.pad, event.key));
+    }
+    return ERR_NONE;
+}
 
-    gameboy_run_until(&gameboy, get_time_in_GB_cyles_since(&start));
-    // gameboy_run_until(&gameboy, 5000000);
-    gameboy_t g = gameboy;
+/**
+ * @brief Runs the gameboy a frame at a time, paced to GB_CYCLES_PER_S, and
+ *        publishes each frame once complete
+ */
+static void *emulate(void *arg)
+{
+    (void)arg;
+    struct timeval start;
+    sync_start(&start);
 
-    for (int x = 0; x < width; ++x)
+    int err = ERR_NONE;
+    while (err == ERR_NONE && !atomic_load(&simulator.stop))
     {
-        for (int y = 0; y < height; ++y)
+        const unsigned rewinds = atomic_exchange(&simulator.rewinds, 0);
+        if (rewinds > 0 && rewind_back(&simulator.history, &simulator.gameboy, rewinds * FRAMES_PER_S) == ERR_NONE)
+        {
+            // The events after the state restored are not part of the run anymore
+            if (simulator.movie_file != NULL)
+            {
+                err = movie_rewind(&simulator.movie, simulator.gameboy.cycles);
+            }
+            publish_frame();
+        }
+        if (atomic_load(&simulator.paused))
+        {
+            const struct timespec period = {0, PAUSE_PERIOD};
+            nanosleep(&period, NULL);
+        }
+        if (rewinds > 0 || atomic_load(&simulator.paused))
+        {
+            // The gameboy time goes on from now
+            sync_start(&start);
+            continue;
+        }
+
+        err = apply_keys();
+        if (err == ERR_NONE)
+        {
+            err = gameboy_run_until(&simulator.gameboy, next_vblank(&simulator.gameboy));
+        }
+        if (err == ERR_NONE)
+        {
+            publish_frame();
+            err = rewind_push(&simulator.history, &simulator.gameboy);
+        }
+
+        // Ahead of time: waits for it, behind: catches up at once
+        const uint64_t now = get_time_in_GB_cyles_since(&start);
+        if (now < simulator.gameboy.cycles)
         {
-            uint8_t output = 0;
-            image_get_pixel(&output, &(gameboy.screen.display), x / SCALE, y / SCALE);
-            set_grey(pixels, y, x, width, 255 - 85 * output);
+            const uint64_t ns = (simulator.gameboy.cycles - now) * 1000000000 / GB_CYCLES_PER_S;
+            const struct timespec ahead = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+            nanosleep(&ahead, NULL);
         }
     }
+
+    if (err != ERR_NONE)
+    {
+        fprintf(stderr, "emulation stopped: %s\n", ERR_MESSAGES[err - ERR_NONE]);
+    }
+    return NULL;
+}
+
+// ======================================================================
+static void set_key(gb_key_t key, bool pressed)
+{
+    const key_event_t event = {key, pressed};
+    if (!key_queue_push(&simulator.keys, event))
+    {
+        fputs("too many key events, one is dropped\n", stderr);
+    }
 }
 
 // ======================================================================
@@ -91,58 +239,50 @@ static gboolean keypress_handler(guint keyval, gpointer data)
     {
     case GDK_KEY_Up:
         do_key(UP);
-        joypad_key_pressed(&gameboy.pad, UP_KEY);
+        set_key(UP_KEY, true);
         return TRUE;
 
     case GDK_KEY_Down:
         do_key(DOWN);
-        joypad_key_pressed(&gameboy.pad, DOWN_KEY);
+        set_key(DOWN_KEY, true);
         return TRUE;
 
     case GDK_KEY_Right:
         do_key(RIGHT);
-        joypad_key_pressed(&gameboy.pad, RIGHT_KEY);
+        set_key(RIGHT_KEY, true);
         return TRUE;
 
     case GDK_KEY_Left:
         do_key(LEFT);
-        joypad_key_pressed(&gameboy.pad, LEFT_KEY);
+        set_key(LEFT_KEY, true);
         return TRUE;
 
     case 'A':
     case 'a':
         do_key(A);
-        joypad_key_pressed(&gameboy.pad, A_KEY);
+        set_key(A_KEY, true);
         return TRUE;
     case 'Z':
     case 'z':
         do_key(B);
-        joypad_key_pressed(&gameboy.pad, B_KEY);
+        set_key(B_KEY, true);
         return TRUE;
     case 'P':
     case 'p':
         do_key(SELECT);
-        joypad_key_pressed(&gameboy.pad, SELECT_KEY);
+        set_key(SELECT_KEY, true);
         return TRUE;
     case 'L':
     case 'l':
         do_key(START);
-        joypad_key_pressed(&gameboy.pad, START_KEY);
+        set_key(START_KEY, true);
         return TRUE;
     case GDK_KEY_space:
-        if (psd->timeout_id > 0)
-        {
-            gettimeofday(&paused, NULL);
-        }
-        else
-        {
-            struct timeval current;
-            gettimeofday(&current, NULL);
-            timersub(&current, &paused, &paused);
-            timeradd(&start, &paused, &start);
-            timerclear(&paused);
-        }
+        atomic_store(&simulator.paused, psd->timeout_id > 0);
         return ds_simple_key_handler(keyval, data);
+    case GDK_KEY_BackSpace:
+        atomic_fetch_add(&simulator.rewinds, 1);
+        return TRUE;
     }
 
     return ds_simple_key_handler(keyval, data);
@@ -170,43 +310,43 @@ static gboolean keyrelease_handler(guint keyval, gpointer data)
     {
     case GDK_KEY_Up:
         do_key(UP);
-        joypad_key_released(&gameboy.pad, UP_KEY);
+        set_key(UP_KEY, false);
         return TRUE;
 
     case GDK_KEY_Down:
         do_key(DOWN);
-        joypad_key_released(&gameboy.pad, DOWN_KEY);
+        set_key(DOWN_KEY, false);
         return TRUE;
 
     case GDK_KEY_Right:
         do_key(RIGHT);
-        joypad_key_released(&gameboy.pad, RIGHT_KEY);
+        set_key(RIGHT_KEY, false);
         return TRUE;
 
     case GDK_KEY_Left:
         do_key(LEFT);
-        joypad_key_released(&gameboy.pad, LEFT_KEY);
+        set_key(LEFT_KEY, false);
         return TRUE;
 
     case 'A':
     case 'a':
         do_key(A);
-        joypad_key_released(&gameboy.pad, A_KEY);
+        set_key(A_KEY, false);
         return TRUE;
     case 'Z':
     case 'z':
         do_key(B);
-        joypad_key_released(&gameboy.pad, B_KEY);
+        set_key(B_KEY, false);
         return TRUE;
     case 'P':
     case 'p':
         do_key(SELECT);
-        joypad_key_released(&gameboy.pad, SELECT_KEY);
+        set_key(SELECT_KEY, false);
         return TRUE;
     case 'L':
     case 'l':
         do_key(START);
-        joypad_key_released(&gameboy.pad, START_KEY);
+        set_key(START_KEY, false);
         return TRUE;
     }
 
@@ -217,22 +357,61 @@ static gboolean keyrelease_handler(guint keyval, gpointer data)
 // ======================================================================
 int main(int argc, char *argv[])
 {
-    if (argc <= 1)
+    // gbsimulator [-s scale] input_file [movie_file]
+    int arg = 1;
+    int scale = DEFAULT_SCALE;
+    if (argc > 2 && strcmp(argv[1], "-s") == 0)
+    {
+        scale = atoi(argv[2]);
+        arg = 3;
+    }
+    if (scale < 1 || scale > FRAMEBUFFER_MAX_SCALE)
+    {
+        fprintf(stderr, "please provide a scale from 1 to %d\n", FRAMEBUFFER_MAX_SCALE);
+        return 1;
+    }
+    if (argc <= arg)
     {
         error("please provide an input file (binary image)");
         return 1;
     }
+    const char *const filename = argv[arg];
+    // The key events are recorded into the movie file, if any (see gb-movie),
+    // from a blank cartridge, as it is played: the save file is left as is
+    simulator.movie_file = argc > arg + 1 ? argv[arg + 1] : NULL;
+
+    M_EXIT_IF_ERR(simulator.movie_file != NULL ? gameboy_create(&simulator.gameboy, filename)
+                  : gameboy_create_with_save(&simulator.gameboy, filename));
+    M_EXIT_IF_ERR(rewind_create(&simulator.history, &simulator.gameboy, REWIND_CAPACITY,
+                                REWIND_SECONDS * FRAMES_PER_S, FRAMES_PER_S));
+    if (simulator.movie_file != NULL)
+    {
+        M_EXIT_IF_ERR(movie_create(&simulator.movie, &simulator.gameboy));
+    }
+    M_EXIT_IF_ERR(frame_slot_init(&simulator.frames));
+    M_EXIT_IF_ERR(key_queue_init(&simulator.keys));
+    atomic_init(&simulator.rewinds, 0);
+    atomic_init(&simulator.paused, false);
+    atomic_init(&simulator.stop, false);
 
-    gettimeofday(&start, NULL);
-    timerclear(&paused);
-    
-    M_EXIT_IF_ERR(gameboy_create(&gameboy, argv[1]));
+    pthread_t emulation;
+    M_REQUIRE(pthread_create(&emulation, NULL, emulate, NULL) == 0, ERR_MEM,
+              "cannot start the emulation of %s", filename);
 
     sd_launch(&argc, &argv,
-              sd_init(argv[1], (int)LCD_WIDTH * SCALE, (int)LCD_HEIGHT * SCALE, 40,
+              sd_init(filename, (int)LCD_WIDTH * scale, (int)LCD_HEIGHT * scale, DISPLAY_PERIOD,
                       generate_image, keypress_handler, keyrelease_handler));
 
-    gameboy_free(&gameboy);
+    atomic_store(&simulator.stop, true);
+    pthread_join(emulation, NULL);
+
+    if (simulator.movie_file != NULL)
+    {
+        M_EXIT_IF_ERR(movie_save(&simulator.movie, &simulator.gameboy, simulator.movie_file));
+        movie_free(&simulator.movie);
+    }
+    rewind_free(&simulator.history);
+    gameboy_free(&simulator.gameboy);
 
     return 0;
 }
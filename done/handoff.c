@@ -0,0 +1,118 @@
+/**
+ * @file handoff.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to hand the frames and the key events over between threads
+ * @date 2020
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "error.h"
+#include "handoff.h"
+
+// Set in middle when the producer has published it since the consumer took it
+#define FRAME_SLOT_FRESH 4u
+#define FRAME_SLOT_INDEX 3u
+
+_Static_assert((KEY_QUEUE_SIZE & (KEY_QUEUE_SIZE - 1)) == 0, "KEY_QUEUE_SIZE must be a power of 2");
+
+// ==== see handoff.h ========================================
+int frame_slot_init(frame_slot_t *slot)
+{
+    M_REQUIRE_NON_NULL(slot);
+
+    memset(slot->frames, 0, sizeof(slot->frames));
+    slot->back = 0;
+    atomic_init(&slot->middle, 1u);
+    slot->front = 2;
+    return ERR_NONE;
+}
+
+// ==== see handoff.h ========================================
+framebuffer_t *frame_slot_back(frame_slot_t *slot)
+{
+    return slot == NULL ? NULL : &slot->frames[slot->back];
+}
+
+// ==== see handoff.h ========================================
+void frame_slot_publish(frame_slot_t *slot)
+{
+    if (slot == NULL)
+    {
+        return;
+    }
+    // Releases the frame rendered, acquires the one the consumer left
+    const unsigned middle = atomic_exchange_explicit(&slot->middle, slot->back | FRAME_SLOT_FRESH,
+                                                     memory_order_acq_rel);
+    slot->back = middle & FRAME_SLOT_INDEX;
+}
+
+// ==== see handoff.h ========================================
+const framebuffer_t *frame_slot_latest(frame_slot_t *slot, bool *fresh)
+{
+    if (slot == NULL)
+    {
+        return NULL;
+    }
+    const bool newer = (atomic_load_explicit(&slot->middle, memory_order_relaxed) & FRAME_SLOT_FRESH) != 0;
+    if (newer)
+    {
+        const unsigned middle = atomic_exchange_explicit(&slot->middle, slot->front, memory_order_acq_rel);
+        slot->front = middle & FRAME_SLOT_INDEX;
+    }
+    if (fresh != NULL)
+    {
+        *fresh = newer;
+    }
+    return &slot->frames[slot->front];
+}
+
+// ==== see handoff.h ========================================
+int key_queue_init(key_queue_t *queue)
+{
+    M_REQUIRE_NON_NULL(queue);
+
+    memset(queue->events, 0, sizeof(queue->events));
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return ERR_NONE;
+}
+
+// ==== see handoff.h ========================================
+bool key_queue_push(key_queue_t *queue, key_event_t event)
+{
+    if (queue == NULL)
+    {
+        return false;
+    }
+    const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&queue->head, memory_order_acquire) == KEY_QUEUE_SIZE)
+    {
+        return false;
+    }
+    queue->events[tail & (KEY_QUEUE_SIZE - 1)] = event;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// ==== see handoff.h ========================================
+bool key_queue_pop(key_queue_t *queue, key_event_t *event)
+{
+    if (queue == NULL || event == NULL)
+    {
+        return false;
+    }
+    const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    if (head == atomic_load_explicit(&queue->tail, memory_order_acquire))
+    {
+        return false;
+    }
+    *event = queue->events[head & (KEY_QUEUE_SIZE - 1)];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+/**
+ * @file handoff.h
+ * @brief Lock-free handoff between the emulation thread and the UI thread:
+ *        the frames one way (triple buffer), the key events the other way
+ *        (single producer, single consumer queue)
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "framebuffer.h"
+#include "joypad.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_SLOT_BUFFERS 3
+
+// Number of key events a queue holds, a power of 2
+#define KEY_QUEUE_SIZE 64
+
+/**
+ * @brief Triple buffer of frames: the producer renders into its back
+ *        buffer, then swaps it with the middle one; the consumer swaps its
+ *        front buffer with the middle one when that is a newer frame. None
+ *        of them ever waits for the other, and the consumer always gets
+ *        the latest complete frame.
+ */
+typedef struct {
+    framebuffer_t frames[FRAME_SLOT_BUFFERS];
+    _Alignas(64) atomic_uint middle; // index of the middle buffer, with a bit set until the consumer takes it
+    _Alignas(64) unsigned back;      // owned by the producer
+    _Alignas(64) unsigned front;     // owned by the consumer
+} frame_slot_t;
+
+/**
+ * @brief Key event, from the UI to the emulation
+ */
+typedef struct {
+    gb_key_t key;
+    bool pressed;
+} key_event_t;
+
+/**
+ * @brief Queue of key events from a single producer to a single consumer.
+ *        head and tail only grow, on lines of their own.
+ */
+typedef struct {
+    key_event_t events[KEY_QUEUE_SIZE];
+    _Alignas(64) atomic_size_t head; // next event to pop, written by the consumer
+    _Alignas(64) atomic_size_t tail; // next event to push, written by the producer
+} key_queue_t;
+
+/**
+ * @brief Initializes a triple buffer, with three blank frames
+ *
+ * @param slot triple buffer to initialize
+ * @return error code
+ */
+int frame_slot_init(frame_slot_t* slot);
+
+/**
+ * @brief Gets the buffer the producer renders the next frame into
+ *
+ * @param slot triple buffer
+ * @return the back buffer, NULL if slot is NULL
+ */
+framebuffer_t* frame_slot_back(frame_slot_t* slot);
+
+/**
+ * @brief Publishes the back buffer, as the latest frame, to the consumer
+ *        (producer side)
+ *
+ * @param slot triple buffer
+ */
+void frame_slot_publish(frame_slot_t* slot);
+
+/**
+ * @brief Gets the latest frame published (consumer side). It stays valid
+ *        until the next call.
+ *
+ * @param slot triple buffer
+ * @param fresh set to whether the frame was published since the previous call (if not NULL)
+ * @return the front buffer, NULL if slot is NULL
+ */
+const framebuffer_t* frame_slot_latest(frame_slot_t* slot, bool* fresh);
+
+/**
+ * @brief Initializes an empty queue
+ *
+ * @param queue queue to initialize
+ * @return error code
+ */
+int key_queue_init(key_queue_t* queue);
+
+/**
+ * @brief Pushes a key event (producer side)
+ *
+ * @param queue queue
+ * @param event event to push
+ * @return true if pushed, false if the queue is full
+ */
+bool key_queue_push(key_queue_t* queue, key_event_t event);
+
+/**
+ * @brief Pops the oldest key event (consumer side)
+ *
+ * @param queue queue
+ * @param event set to the event popped
+ * @return true if popped, false if the queue is empty
+ */
+bool key_queue_pop(key_queue_t* queue, key_event_t* event);
+
+#ifdef __cplusplus
+}
+#endif
@@ -57,17 +57,35 @@ static int valid(image_line_t *piml)
 
 // ======================================================================
 int image_line_create(image_line_t *piml, size_t size)
+{
+    return image_line_create_in(piml, size, NULL);
+}
+
+// ======================================================================
+int image_line_create_in(image_line_t *piml, size_t size, bit_vector_arena_t *arena)
 {
     M_REQUIRE_NON_NULL(piml);
     M_REQUIRE(size > 0, ERR_BAD_PARAMETER, "Invalid Size: %zu is zero", size);
 
+    if (arena == NULL)
+    {
 #define do_imlc(I, X) \
     I->X = bit_vector_create(size, 0)
 
+        do_image_line(piml);
+#undef do_imlc
+
+        return valid(piml);
+    }
+
+#define do_imlc(I, X) \
+    I->X = bit_vector_arena_create(arena, size, 0)
+
     do_image_line(piml);
 #undef do_imlc
 
-    return valid(piml);
+    // nothing to free: the vectors belong to the arena
+    return piml->msb == NULL || piml->lsb == NULL || piml->opacity == NULL ? ERR_MEM : ERR_NONE;
 }
 
 // ======================================================================
@@ -90,19 +108,41 @@ int image_line_set_word(image_line_t *piml, size_t index, uint32_t msb, uint32_t
     return ERR_NONE;
 }
 
+// ======================================================================
+#define M_REQUIRE_SAME_SIZE_IMAGE_LINE(iml)                                                           \
+    do                                                                                                \
+    {                                                                                                 \
+        M_REQUIRE_NON_NULL_IMAGE_LINE(iml);                                                           \
+        M_REQUIRE(((iml).msb->size == (iml).lsb->size) && ((iml).lsb->size == (iml).opacity->size), \
+                  ERR_BAD_PARAMETER, "Incorrect sizes in image_line (%zu, %zu, %zu)",                \
+                  (iml).lsb->size, (iml).msb->size, (iml).opacity->size);                            \
+    } while (0)
+
 // ======================================================================
 int image_line_shift(image_line_t *output, image_line_t iml, int64_t shift)
 {
     M_REQUIRE_NON_NULL(output);
     M_REQUIRE_NON_NULL_IMAGE_LINE(iml);
 
+    M_EXIT_IF_ERR(image_line_create(output, iml.msb->size));
+    M_EXIT_IF_ERR_DO_SOMETHING(image_line_shift_to(output, iml, shift), image_line_free(output));
+    return ERR_NONE;
+}
+
+// ======================================================================
+int image_line_shift_to(image_line_t *output, image_line_t iml, int64_t shift)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml);
+    M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(*output, iml);
+
 #define do_imlc(I, X) \
-    I->X = bit_vector_shift(iml.X, shift)
+    M_REQUIRE(bit_vector_shift_to(I->X, iml.X, shift) != NULL, ERR_BAD_PARAMETER, "%s", "Cannot shift a line into itself")
 
     do_image_line(output);
 #undef do_imlc
 
-    return valid(output);
+    return ERR_NONE;
 }
 
 // ======================================================================
@@ -112,13 +152,25 @@ int image_line_extract_wrap_ext(image_line_t *output, image_line_t iml, int64_t
     M_REQUIRE_NON_NULL_IMAGE_LINE(iml);
     M_REQUIRE(size > 0, ERR_BAD_PARAMETER, "%s", "Size argument cannot be zero");
 
+    M_EXIT_IF_ERR(image_line_create(output, size));
+    M_EXIT_IF_ERR_DO_SOMETHING(image_line_extract_wrap_ext_to(output, iml, index), image_line_free(output));
+    return ERR_NONE;
+}
+
+// ======================================================================
+int image_line_extract_wrap_ext_to(image_line_t *output, image_line_t iml, int64_t index)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml);
+    M_REQUIRE_SAME_SIZE_IMAGE_LINE(*output);
+
 #define do_imlc(I, X) \
-    I->X = bit_vector_extract_wrap_ext(iml.X, index, size)
+    M_REQUIRE(bit_vector_extract_wrap_ext_to(I->X, iml.X, index) != NULL, ERR_BAD_PARAMETER, "%s", "Cannot extract a line into itself")
 
     do_image_line(output);
 #undef do_imlc
 
-    return valid(output);
+    return ERR_NONE;
 }
 
 // ======================================================================
@@ -127,95 +179,48 @@ int image_line_map_colors(image_line_t *output, image_line_t iml, palette_t map)
     M_REQUIRE_NON_NULL(output);
     M_REQUIRE_NON_NULL_IMAGE_LINE(iml);
 
-    if (map == DEFAULT_PALETTE)
-    {
-#define do_imlc(I, X) \
-    I->X = bit_vector_cpy(iml.X)
-
-        do_image_line(output);
-#undef do_imlc
-        return ERR_NONE;
-    }
+    M_EXIT_IF_ERR(image_line_create(output, iml.msb->size));
+    M_EXIT_IF_ERR_DO_SOMETHING(image_line_map_colors_to(output, iml, map), image_line_free(output));
+    return ERR_NONE;
+}
 
-    output->lsb = bit_vector_create(iml.lsb->size, 0);
-    output->msb = bit_vector_create(iml.msb->size, 0);
-    output->opacity = bit_vector_cpy(iml.opacity);
+// ======================================================================
+int image_line_map_colors_to(image_line_t *output, image_line_t iml, palette_t map)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml);
+    M_REQUIRE_SAME_SIZE_IMAGE_LINE(iml);
+    M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(*output, iml);
 
-    for (size_t i = 0; i < PALETTE_COLOR_COUNT; ++i)
+    const size_t size = iml.msb->size;
+    const size_t words = size_to_content_size(size);
+    for (size_t i = 0; i < words; ++i)
     {
-        bit_vector_t *mask = NULL;
-
-        const bit_t color_bit_0 = (bit_t)(map & (1 << (i * 2)));
-        const bit_t color_bit_1 = (bit_t)(map & (1 << (i * 2 + 1)));
-
-        if (color_bit_0 || color_bit_1)
+        const uint32_t msb = iml.msb->content[i];
+        const uint32_t lsb = iml.lsb->content[i];
+        // pixels of each of the colors
+        const uint32_t colors[PALETTE_COLOR_COUNT] = {~msb & ~lsb, ~msb & lsb, msb & ~lsb, msb & lsb};
+
+        uint32_t new_msb = 0;
+        uint32_t new_lsb = 0;
+        for (size_t c = 0; c < PALETTE_COLOR_COUNT; ++c)
         {
-            switch (i)
+            if (map & (1 << (c * 2)))
             {
-            case 0:
-            {
-                bit_vector_t *tmp = bit_vector_not(bit_vector_cpy(iml.lsb));
-
-                if (tmp == NULL)
-                {
-                    image_line_free(output);
-                    return ERR_MEM;
-                }
-
-                mask = bit_vector_and(bit_vector_not(bit_vector_cpy(iml.msb)), tmp);
-                bit_vector_free(&tmp);
+                new_lsb |= colors[c];
             }
-            break;
-
-            case 1:
-            {
-                mask = bit_vector_and(bit_vector_not(bit_vector_cpy(iml.msb)), iml.lsb);
-            }
-            break;
-
-            case 2:
+            if (map & (1 << (c * 2 + 1)))
             {
-                mask = bit_vector_and(bit_vector_not(bit_vector_cpy(iml.lsb)), iml.msb);
+                new_msb |= colors[c];
             }
-            break;
-
-            case 3:
-            {
-                mask = bit_vector_and(bit_vector_cpy(iml.lsb), iml.msb);
-            }
-            break;
-            }
-
-            if (mask == NULL)
-            {
-                image_line_free(output);
-                return ERR_MEM;
-            }
-
-            if (color_bit_0)
-            {
-                output->lsb = bit_vector_or(output->lsb, mask);
-
-                if (output->lsb == NULL)
-                {
-                    image_line_free(output);
-                    return ERR_MEM;
-                }
-            }
-
-            if (color_bit_1)
-            {
-                output->msb = bit_vector_or(output->msb, mask);
-
-                if (output->msb == NULL)
-                {
-                    image_line_free(output);
-                    return ERR_MEM;
-                }
-            }
-
-            bit_vector_free(&mask);
         }
+
+        // no color past the end of the line
+        const size_t rest = (i == words - 1) ? size % IMAGE_LINE_WORD_BITS : 0;
+        const uint32_t mask = rest == 0 ? UINT32_MAX : UINT32_MAX >> (IMAGE_LINE_WORD_BITS - rest);
+        output->msb->content[i] = new_msb & mask;
+        output->lsb->content[i] = new_lsb & mask;
+        output->opacity->content[i] = iml.opacity->content[i];
     }
 
     return ERR_NONE;
@@ -229,33 +234,36 @@ int image_line_below_with_opacity(image_line_t *output, image_line_t iml1, image
     M_REQUIRE_NON_NULL_IMAGE_LINE(iml2);
     M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(iml1, iml2);
 
-    bit_vector_t *notopacity = bit_vector_not(bit_vector_cpy(p_opacity));
+    M_EXIT_IF_ERR(image_line_create(output, iml1.msb->size));
+    M_EXIT_IF_ERR_DO_SOMETHING(image_line_below_with_opacity_to(output, iml1, iml2, p_opacity), image_line_free(output));
+    return ERR_NONE;
+}
 
-    bit_vector_t *m_above_and_opacity = bit_vector_and(bit_vector_cpy(iml2.msb), p_opacity);
-    bit_vector_t *l_above_and_opacity = bit_vector_and(bit_vector_cpy(iml2.lsb), p_opacity);
-    bit_vector_t *m_below_and_notopacity = bit_vector_and(bit_vector_cpy(iml1.msb), notopacity);
-    bit_vector_t *l_below_and_notopacity = bit_vector_and(bit_vector_cpy(iml1.lsb), notopacity);
+// ======================================================================
+int image_line_below_with_opacity_to(image_line_t *output, image_line_t iml1, image_line_t iml2,
+                                     const bit_vector_t *p_opacity)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL(p_opacity);
+    M_REQUIRE_SAME_SIZE_IMAGE_LINE(iml1);
+    M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(iml1, iml2);
+    M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(*output, iml1);
+    M_REQUIRE(p_opacity->size == iml1.msb->size, ERR_BAD_PARAMETER, "%s", "Sizes do not match");
 
-    if (notopacity == NULL ||
-        m_above_and_opacity == NULL || m_below_and_notopacity == NULL ||
-        l_above_and_opacity == NULL || l_below_and_notopacity == NULL)
+    // word by word, each read before being written, so that output may be one of the inputs
+    const size_t words = size_to_content_size(iml1.msb->size);
+    for (size_t i = 0; i < words; ++i)
     {
-        bit_vector_free(&notopacity);
-        bit_vector_free(&m_above_and_opacity);
-        bit_vector_free(&m_below_and_notopacity);
-        bit_vector_free(&l_above_and_opacity);
-        bit_vector_free(&l_below_and_notopacity);
-        return ERR_MEM;
+        const uint32_t opacity = p_opacity->content[i];
+        const uint32_t below_opacity = iml1.opacity->content[i];
+        const uint32_t msb = (iml1.msb->content[i] & ~opacity) | (iml2.msb->content[i] & opacity);
+        const uint32_t lsb = (iml1.lsb->content[i] & ~opacity) | (iml2.lsb->content[i] & opacity);
+
+        output->msb->content[i] = msb;
+        output->lsb->content[i] = lsb;
+        output->opacity->content[i] = below_opacity | opacity;
     }
 
-    output->msb = bit_vector_or(m_below_and_notopacity, m_above_and_opacity);
-    output->lsb = bit_vector_or(l_below_and_notopacity, l_above_and_opacity);
-    output->opacity = bit_vector_or(bit_vector_cpy(iml1.opacity), p_opacity);
-
-    bit_vector_free(&notopacity);
-    bit_vector_free(&m_above_and_opacity);
-    bit_vector_free(&l_above_and_opacity);
-
     return ERR_NONE;
 }
 
@@ -270,42 +278,50 @@ int image_line_below(image_line_t *output, image_line_t iml1, image_line_t iml2)
     return image_line_below_with_opacity(output, iml1, iml2, iml2.opacity);
 }
 
+// ======================================================================
+int image_line_below_to(image_line_t *output, image_line_t iml1, image_line_t iml2)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml1);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml2);
+    M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(iml1, iml2);
+
+    return image_line_below_with_opacity_to(output, iml1, iml2, iml2.opacity);
+}
+
 // ======================================================================
 int image_line_join(image_line_t *output, image_line_t iml1, image_line_t iml2, int64_t start)
 {
     M_REQUIRE_NON_NULL(output);
     M_REQUIRE_NON_NULL_IMAGE_LINE(iml1);
     M_REQUIRE_NON_NULL_IMAGE_LINE(iml2);
-    M_REQUIRE((iml1.msb->size == iml1.lsb->size) &&
-                  (iml1.lsb->size == iml1.opacity->size),
-              ERR_BAD_PARAMETER,
-              "Incorrect sizes in image_line #1 (%zu, %zu, %zu)",
-              iml1.lsb->size, iml1.msb->size, iml1.opacity->size);
+
+    M_EXIT_IF_ERR(image_line_create(output, iml1.msb->size));
+    M_EXIT_IF_ERR_DO_SOMETHING(image_line_join_to(output, iml1, iml2, start), image_line_free(output));
+    return ERR_NONE;
+}
+
+// ======================================================================
+int image_line_join_to(image_line_t *output, image_line_t iml1, image_line_t iml2, int64_t start)
+{
+    M_REQUIRE_NON_NULL(output);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml1);
+    M_REQUIRE_NON_NULL_IMAGE_LINE(iml2);
+    M_REQUIRE_SAME_SIZE_IMAGE_LINE(iml1);
     M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(iml1, iml2);
+    M_REQUIRE_MATCHING_IMAGE_LINE_SIZE(*output, iml1);
     M_REQUIRE(start >= 0, ERR_BAD_PARAMETER, "Incorrect start (%ld < 0)", start);
     M_REQUIRE(start < (int64_t)iml1.msb->size, ERR_BAD_PARAMETER,
               "Incorrect start (%ld >= %zu)", start, iml1.msb->size);
 
-    const int64_t size = (int64_t)iml1.lsb->size;
-
-    if (start % size == 0)
-    {
+    // (a join at 0 is a copy of iml2)
 #define do_imlc(I, X) \
-    I->X = bit_vector_cpy(iml2.X)
+    bit_vector_join_to(I->X, iml1.X, iml2.X, start)
 
-        do_image_line(output);
-#undef do_imlc
-    }
-    else
-    {
-#define do_imlc(I, X) \
-    I->X = bit_vector_join(iml1.X, iml2.X, start)
-
-        do_image_line(output);
+    do_image_line(output);
 #undef do_imlc
-    }
 
-    return valid(output);
+    return ERR_NONE;
 }
 
 // ======================================================================
@@ -56,6 +56,17 @@ typedef struct image_ image_t;
  */
 int image_line_create(image_line_t* piml, size_t size);
 
+//=========================================================================
+/**
+ * @brief Create an image line in an arena (see bit_vector_arena_create):
+ *        it is released with the arena, not by image_line_free
+ * @param piml pointer to image line
+ * @param size length of line in pixels
+ * @param arena arena to allocate from, NULL to allocate on the heap
+ * @return Error code
+ */
+int image_line_create_in(image_line_t* piml, size_t size, bit_vector_arena_t* arena);
+
 //=========================================================================
 /**
  * @brief Sets value of a word in the image line
@@ -77,6 +88,16 @@ int image_line_set_word(image_line_t* piml, size_t index, uint32_t msb, uint32_t
  */
 int image_line_shift(image_line_t* output, image_line_t iml, int64_t shift);
 
+//=========================================================================
+/**
+ * @brief Shift image line into an existing one
+ * @param output image line to write to, of the size of iml (not iml itself)
+ * @param iml image line to shift
+ * @param shift shift amount
+ * @return Error code
+ */
+int image_line_shift_to(image_line_t* output, image_line_t iml, int64_t shift);
+
 //=========================================================================
 /**
  * @brief Extract image line (wrapping)
@@ -88,6 +109,16 @@ int image_line_shift(image_line_t* output, image_line_t iml, int64_t shift);
  */
 int image_line_extract_wrap_ext(image_line_t* output, image_line_t iml, int64_t index, size_t size);
 
+//=========================================================================
+/**
+ * @brief Extract image line (wrapping) into an existing one
+ * @param output image line to write to, of the size to extract (not iml itself)
+ * @param iml image line to extract
+ * @param index index from which to extract
+ * @return Error code
+ */
+int image_line_extract_wrap_ext_to(image_line_t* output, image_line_t iml, int64_t index);
+
 //=========================================================================
 /**
  * @brief Apply Palette to image line
@@ -98,6 +129,16 @@ int image_line_extract_wrap_ext(image_line_t* output, image_line_t iml, int64_t
  */
 int image_line_map_colors(image_line_t* output, image_line_t iml, palette_t map);
 
+//=========================================================================
+/**
+ * @brief Apply Palette to image line, into an existing one
+ * @param output image line to write to, of the size of iml (may be iml itself)
+ * @param iml image line to use palette on
+ * @param map palette to use
+ * @return Error code
+ */
+int image_line_map_colors_to(image_line_t* output, image_line_t iml, palette_t map);
+
 //=========================================================================
 /**
  * @brief Combine two image lines using opacity
@@ -109,6 +150,18 @@ int image_line_map_colors(image_line_t* output, image_line_t iml, palette_t map)
  */
 int image_line_below_with_opacity(image_line_t* output, image_line_t iml1, image_line_t iml2, bit_vector_t* p_opacity);
 
+//=========================================================================
+/**
+ * @brief Combine two image lines using opacity, into an existing one
+ * @param output image line to write to, of the size of iml1 (may be iml1 or iml2)
+ * @param iml1 image line to combine
+ * @param iml2 image line to combine
+ * @param p_opacity bit vector pointer to use for opacity
+ * @return Error code
+ */
+int image_line_below_with_opacity_to(image_line_t* output, image_line_t iml1, image_line_t iml2,
+                                     const bit_vector_t* p_opacity);
+
 //=========================================================================
 /**
  * @brief Combine two image lines (using iml2 opacity)
@@ -119,6 +172,16 @@ int image_line_below_with_opacity(image_line_t* output, image_line_t iml1, image
  */
 int image_line_below(image_line_t* output, image_line_t iml1, image_line_t iml2);
 
+//=========================================================================
+/**
+ * @brief Combine two image lines (using iml2 opacity), into an existing one
+ * @param output image line to write to, of the size of iml1 (may be iml1 or iml2)
+ * @param iml1 image line to combine
+ * @param iml2 image line to combine
+ * @return Error code
+ */
+int image_line_below_to(image_line_t* output, image_line_t iml1, image_line_t iml2);
+
 //=========================================================================
 /**
  * @brief Join two image lines
@@ -130,6 +193,17 @@ int image_line_below(image_line_t* output, image_line_t iml1, image_line_t iml2)
  */
 int image_line_join(image_line_t* output, image_line_t iml1, image_line_t iml2, int64_t start);
 
+//=========================================================================
+/**
+ * @brief Join two image lines into an existing one
+ * @param output image line to write to, of the size of iml1 (may be iml1 or iml2)
+ * @param iml1 image line to join (values from 0 to start)
+ * @param iml2 image line to join (values from start to end)
+ * @param start index from which to use iml2 values
+ * @return Error code
+ */
+int image_line_join_to(image_line_t* output, image_line_t iml1, image_line_t iml2, int64_t start);
+
 //=========================================================================
 /**
  * @brief Free image line
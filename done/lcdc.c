@@ -0,0 +1,761 @@
+/**
+ * @file lcdc.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to simulate the LCD controller of the Gameboy
+ * @date 2020
+ *
+ * Each line is rendered at once when the controller enters mode 3: the
+ * background, the window and the sprites are computed 32 pixels at a time
+ * in the layout of image_line_t (pixel x is bit x % 32 of word x / 32),
+ * then unpacked into the frame buffer (and copied into the display image
+ * if it is enabled).
+ *
+ * The lines are composed of the colors of the tiles, the palettes being
+ * applied to the frame buffer line at the end: each pixel is unpacked as an
+ * index (color, plus which palette) into lcdc_t.palettes, which holds the
+ * colors of the three palettes and is only updated when they are written.
+ *
+ * The tiles are decoded (bits reversed into the layout of the lines) once
+ * per write to them: the writes to VRAM mark them dirty, see bus_watch_dirty.
+ *
+ * The frames are the ones of the reference (prebuilt) controller, quirks
+ * included: the sprites are never flipped horizontally and the window is
+ * never drawn. Define LCDC_HARDWARE to draw them as the Game Boy does.
+ */
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "bit.h"
+#include "bus.h"
+#include "cpu.h"
+#include "error.h"
+#include "gameboy.h"
+#include "image.h"
+
+#include "lcdc.h"
+
+_Static_assert(LCD_WIDTH == FRAMEBUFFER_WIDTH && LCD_HEIGHT == FRAMEBUFFER_HEIGHT,
+               "the frame buffer has the size of the screen");
+_Static_assert(TILE_SIZE == 1 << TILE_SIZE_LOG2 && TILE_COUNT * TILE_SIZE == TILE_DATA_END - TILE_SRC_ADDR_LOW + 1,
+               "the tiles are tracked one by one");
+
+#define LINE_WORDS (LCD_WIDTH / IMAGE_LINE_WORD_BITS)
+#define TILE_WIDTH 8
+#define TILE_HEIGHT 8
+#define BG_SIZE (TILE_LINE_SIZE * TILE_WIDTH)          // 256 pixels, both ways
+#define BG_WORDS (BG_SIZE / IMAGE_LINE_WORD_BITS)
+#define TILES_PER_WORD (IMAGE_LINE_WORD_BITS / TILE_WIDTH)
+
+#define OAM_START 0xFE00
+#define OAM_END 0xFE9F
+#define OAM_NB_SPRITES 40
+#define OAM_ENTRY_SIZE 4
+#define SPRITES_PER_LINE 10
+
+#define SPRITE_Y_OFFSET 16
+#define SPRITE_X_OFFSET 8
+#define SPRITE_TILE_HEIGHT(lcdc) (((lcdc) & LCDC_REG_OBJ_SIZE_MASK) ? 2 * TILE_HEIGHT : TILE_HEIGHT)
+
+#define SPRITE_ATTR_PALETTE_MASK 0x10
+#define SPRITE_ATTR_XFLIP_MASK 0x20
+#define SPRITE_ATTR_YFLIP_MASK 0x40
+#define SPRITE_ATTR_BEHIND_MASK 0x80
+
+// The pixel indices: bits 0-1 are the color of the tile, bit 2 is set for
+// the sprites and bit 3 selects OBP1 for them, a blank (color 0) pixel for
+// the background
+#define INDEX_BGP   0x0
+#define INDEX_OBP0  0x4
+#define INDEX_BLANK 0x8
+#define INDEX_OBP1  0xC
+#define INDEX_PLANES 4
+
+_Static_assert(INDEX_PLANES == FRAMEBUFFER_INDEX_BITS, "the indices fit the tables of the frame buffer");
+
+/**
+ * @brief One line of pixels as the three bit planes of image_line_t, plus
+ *        the bit 3 of their indices (OBP1 or blank)
+ */
+typedef struct
+{
+    uint32_t msb[BG_WORDS];
+    uint32_t lsb[BG_WORDS];
+    uint32_t opacity[BG_WORDS];
+    uint32_t alt[BG_WORDS];
+} lcdc_line_t;
+
+/**
+ * @brief Gets a register of the controller. The registers are accessed
+ *        directly: writing them with cpu_write_at_idx would trigger
+ *        lcdc_bus_listener again.
+ *
+ * @param lcd The LCD controller
+ * @param addr Address of the register
+ * @return pointer to the register
+ */
+static data_t *lcdc_reg(const lcdc_t *lcd, addr_t addr)
+{
+    return bus_lookup(cpu_bus(lcd->cpu), lcd->cpu->pages, addr);
+}
+
+/**
+ * @brief Reads a byte of the memory seen by the controller (VRAM, OAM or DMA source)
+ *
+ * @param lcd The LCD controller
+ * @param addr Address to read
+ * @return data_t The byte read
+ */
+static data_t lcdc_read(const lcdc_t *lcd, addr_t addr)
+{
+    return *bus_lookup(cpu_bus(lcd->cpu), lcd->cpu->pages, addr);
+}
+
+/**
+ * @brief Reverses the bits of a byte of a tile, so that its leftmost pixel
+ *        (bit 7) becomes pixel 0 of the line
+ *
+ * @param b The byte
+ * @return uint8_t The byte with its bits reversed
+ */
+static uint8_t lcdc_reverse(uint8_t b)
+{
+    b = (uint8_t)((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+    b = (uint8_t)((b & 0xCC) >> 2 | (b & 0x33) << 2);
+    return (uint8_t)((b & 0xAA) >> 1 | (b & 0x55) << 1);
+}
+
+/**
+ * @brief Gets a row of a tile, decoding the tile first if it has been written
+ *
+ * @param lcd The LCD controller
+ * @param addr The address of the row (of its lsb byte)
+ * @param lsb Set to the lsb of the 8 pixels of the row, leftmost pixel in bit 0
+ * @param msb Set to the msb of the 8 pixels of the row
+ */
+static void lcdc_tile_row(lcdc_t *lcd, addr_t addr, uint8_t *lsb, uint8_t *msb)
+{
+    const size_t index = (size_t)(addr - TILE_SRC_ADDR_LOW) >> TILE_SIZE_LOG2;
+    lcdc_tile_t *tile = &lcd->tiles[index];
+    uint64_t *dirty = &lcd->tiles_dirty[index / 64];
+    const uint64_t bit = (uint64_t)1 << (index % 64);
+
+    if (*dirty & bit)
+    {
+        const addr_t start = (addr_t)(TILE_SRC_ADDR_LOW + index * TILE_SIZE);
+        for (size_t row = 0; row < TILE_SIZE / 2; ++row)
+        {
+            tile->lsb[row] = lcdc_reverse(lcdc_read(lcd, (addr_t)(start + 2 * row)));
+            tile->msb[row] = lcdc_reverse(lcdc_read(lcd, (addr_t)(start + 2 * row + 1)));
+        }
+        *dirty &= ~bit;
+    }
+
+    const size_t row = (addr % TILE_SIZE) / 2;
+    *lsb = tile->lsb[row];
+    *msb = tile->msb[row];
+}
+
+/**
+ * @brief Updates the colors of a palette in the palettes of the lines
+ *
+ * @param lcd The LCD controller
+ * @param reg The register of the palette: REG_BGP, REG_OBP0 or REG_OBP1
+ */
+static void lcdc_update_palette(lcdc_t *lcd, addr_t reg)
+{
+    const palette_t palette = *lcdc_reg(lcd, reg);
+    const size_t index = reg == REG_BGP ? INDEX_BGP : reg == REG_OBP0 ? INDEX_OBP0 : INDEX_OBP1;
+    for (size_t c = 0; c < PALETTE_COLOR_COUNT; ++c)
+    {
+        lcd->palettes[index + c] = (uint8_t)((palette >> (2 * c)) & 0x3);
+    }
+}
+
+/**
+ * @brief Updates the three palettes of the lines
+ *
+ * @param lcd The LCD controller
+ */
+static void lcdc_update_palettes(lcdc_t *lcd)
+{
+    lcdc_update_palette(lcd, REG_BGP);
+    lcdc_update_palette(lcd, REG_OBP0);
+    lcdc_update_palette(lcd, REG_OBP1);
+}
+
+/**
+ * @brief Sets the mode of the controller in STAT, requesting the LCD_STAT
+ *        interrupt if the mode (0 to 2) has its interrupt enabled
+ *
+ * @param lcd The LCD controller
+ * @param mode The new mode
+ */
+static void lcdc_set_mode(lcdc_t *lcd, data_t mode)
+{
+    data_t *stat = lcdc_reg(lcd, REG_STAT);
+    *stat = (data_t)((*stat & ~STAT_REG_MODE_MASK) | mode);
+    if (mode <= 2 && bit_get(*stat, (int)(mode + 3)))
+    {
+        cpu_request_interrupt(lcd->cpu, LCD_STAT);
+    }
+}
+
+/**
+ * @brief Compares LY to LYC in STAT, requesting the LCD_STAT interrupt
+ *        if they are equal and that interrupt is enabled
+ *
+ * @param lcd The LCD controller
+ */
+static void lcdc_update_lyc(lcdc_t *lcd)
+{
+    data_t *stat = lcdc_reg(lcd, REG_STAT);
+    const bit_t equal = *lcdc_reg(lcd, REG_LY) == *lcdc_reg(lcd, REG_LYC);
+    bit_edit(stat, STAT_REG_LYC_EQ_LY_BIT, equal);
+    if (equal && bit_get(*stat, STAT_REG_INT_LYC_BIT))
+    {
+        cpu_request_interrupt(lcd->cpu, LCD_STAT);
+    }
+}
+
+/**
+ * @brief Computes the address of a background or window tile
+ *
+ * @param lcdc The value of LCDC
+ * @param tile The index of the tile in the tile map
+ * @return addr_t The address of the tile
+ */
+static addr_t lcdc_tile_addr(data_t lcdc, data_t tile)
+{
+    if (lcdc & LCDC_REG_TILE_SOURCE_MASK)
+    {
+        return (addr_t)(TILE_SRC_ADDR_LOW + tile * TILE_SIZE);
+    }
+    // Signed indices, 0 being in the middle of the area
+    return (addr_t)(TILE_SRC_ADDR_HIGH + (data_t)(tile + 0x80) * TILE_SIZE);
+}
+
+/**
+ * @brief Draws a row of background or window tiles into a line of
+ *        BG_SIZE pixels, tile column c being drawn from pixel 8 * c
+ *
+ * @param lcd The LCD controller
+ * @param line The line to draw into
+ * @param map The address of the tile map
+ * @param y The line of the map to draw
+ * @param first The first tile column to draw
+ * @param count The number of tiles to draw (columns wrap around)
+ */
+static void lcdc_draw_tiles(lcdc_t *lcd, lcdc_line_t *line, addr_t map, data_t y,
+                            size_t first, size_t count)
+{
+    const data_t lcdc = *lcdc_reg(lcd, REG_LCDC);
+    const addr_t row = (addr_t)((y / TILE_HEIGHT) * TILE_LINE_SIZE);
+    const addr_t offset = (addr_t)((y % TILE_HEIGHT) * 2);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t column = (first + i) % TILE_LINE_SIZE;
+        const addr_t tile = lcdc_tile_addr(lcdc, lcdc_read(lcd, (addr_t)(map + row + column)));
+        uint8_t l = 0, m = 0;
+        lcdc_tile_row(lcd, (addr_t)(tile + offset), &l, &m);
+        const uint32_t lsb = l;
+        const uint32_t msb = m;
+
+        const size_t word = column / TILES_PER_WORD;
+        const unsigned shift = (unsigned)(column % TILES_PER_WORD) * TILE_WIDTH;
+        const uint32_t mask = ~((uint32_t)0xFF << shift);
+        line->msb[word] = (line->msb[word] & mask) | msb << shift;
+        line->lsb[word] = (line->lsb[word] & mask) | lsb << shift;
+        line->opacity[word] = line->msb[word] | line->lsb[word];
+    }
+}
+
+/**
+ * @brief Gets 32 consecutive pixels of a line of BG_SIZE pixels, wrapping around
+ *
+ * @param words One plane of the line
+ * @param x The first pixel
+ * @return uint32_t The pixels x to x + 31
+ */
+static uint32_t lcdc_word_wrap(const uint32_t *words, size_t x)
+{
+    const size_t word = (x / IMAGE_LINE_WORD_BITS) % BG_WORDS;
+    const unsigned shift = (unsigned)(x % IMAGE_LINE_WORD_BITS);
+    if (shift == 0)
+    {
+        return words[word];
+    }
+    return words[word] >> shift | words[(word + 1) % BG_WORDS] << (IMAGE_LINE_WORD_BITS - shift);
+}
+
+#ifdef LCDC_HARDWARE
+/**
+ * @brief Gets 32 consecutive pixels of a line of LCD_WIDTH pixels, the
+ *        pixels out of the line being 0
+ *
+ * @param words One plane of the line
+ * @param x The first pixel (may be negative)
+ * @return uint32_t The pixels x to x + 31
+ */
+static uint32_t lcdc_word_zero(const uint32_t *words, int x)
+{
+    if (x <= -IMAGE_LINE_WORD_BITS || x >= LCD_WIDTH)
+    {
+        return 0;
+    }
+    if (x < 0)
+    {
+        return words[0] << -x;
+    }
+    const size_t word = (size_t)x / IMAGE_LINE_WORD_BITS;
+    const unsigned shift = (unsigned)x % IMAGE_LINE_WORD_BITS;
+    uint32_t result = words[word] >> shift;
+    if (shift != 0 && word + 1 < LINE_WORDS)
+    {
+        result |= words[word + 1] << (IMAGE_LINE_WORD_BITS - shift);
+    }
+    return result;
+}
+#endif
+
+/**
+ * @brief Renders the background of a line and the window over it
+ *
+ * @param lcd The LCD controller
+ * @param ly The line to render
+ * @param out The rendered line
+ */
+static void lcdc_render_background(lcdc_t *lcd, data_t ly, lcdc_line_t *out)
+{
+    const data_t lcdc = *lcdc_reg(lcd, REG_LCDC);
+    const data_t scx = *lcdc_reg(lcd, REG_SCX);
+    const data_t y = (data_t)(*lcdc_reg(lcd, REG_SCY) + ly);
+    const addr_t bg_map = (lcdc & LCDC_REG_BG_AREA_MASK) ? TILE_ADDR_BASE_HIGH : TILE_ADDR_BASE_LOW;
+
+    // Only the tiles under the screen are drawn
+    lcdc_line_t bg = {{0}, {0}, {0}, {0}};
+    lcdc_draw_tiles(lcd, &bg, bg_map, y, scx / TILE_WIDTH, VISIBLE_LINE_SIZE + 1);
+    for (size_t i = 0; i < LINE_WORDS; ++i)
+    {
+        const size_t x = scx + i * IMAGE_LINE_WORD_BITS;
+        out->msb[i] = lcdc_word_wrap(bg.msb, x);
+        out->lsb[i] = lcdc_word_wrap(bg.lsb, x);
+        out->opacity[i] = lcdc_word_wrap(bg.opacity, x);
+        out->alt[i] = 0;
+    }
+
+    const data_t wx_reg = *lcdc_reg(lcd, REG_WX);
+    if (wx_reg < WINDOW_OFFSET_X || wx_reg - WINDOW_OFFSET_X >= LCD_WIDTH
+        || !(lcdc & LCDC_REG_WIN_MASK) || ly < *lcdc_reg(lcd, REG_WY))
+    {
+        return;
+    }
+
+    const int wx = wx_reg - WINDOW_OFFSET_X;
+#ifdef LCDC_HARDWARE
+    const addr_t win_map = (lcdc & LCDC_REG_WIN_AREA_MASK) ? TILE_ADDR_BASE_HIGH : TILE_ADDR_BASE_LOW;
+    lcdc_line_t win = {{0}, {0}, {0}, {0}};
+    lcdc_draw_tiles(lcd, &win, win_map, lcd->window_y, 0, VISIBLE_LINE_SIZE);
+#endif
+
+    // Pixel x >= wx of the line is pixel x - wx of the window
+    for (size_t i = 0; i < LINE_WORDS; ++i)
+    {
+        const int x = (int)(i * IMAGE_LINE_WORD_BITS);
+        const uint32_t mask = wx <= x ? ~(uint32_t)0
+                              : wx >= x + IMAGE_LINE_WORD_BITS ? 0
+                              : ~(uint32_t)0 << (wx - x);
+#ifdef LCDC_HARDWARE
+        out->msb[i] = (out->msb[i] & ~mask) | (lcdc_word_zero(win.msb, x - wx) & mask);
+        out->lsb[i] = (out->lsb[i] & ~mask) | (lcdc_word_zero(win.lsb, x - wx) & mask);
+        out->opacity[i] = (out->opacity[i] & ~mask) | (lcdc_word_zero(win.opacity, x - wx) & mask);
+#else
+        // The reference controller joins the two lines the other way round:
+        // the background is kept right of wx and blank left of it, the
+        // window itself never shows
+        out->msb[i] &= mask;
+        out->lsb[i] &= mask;
+        out->opacity[i] &= mask;
+        out->alt[i] |= ~mask;
+#endif
+    }
+    ++lcd->window_y;
+}
+
+/**
+ * @brief Selects the (at most SPRITES_PER_LINE) sprites on a line, in
+ *        order of priority: by x coordinate, then by index in the OAM
+ *
+ * @param lcd The LCD controller
+ * @param ly The line
+ * @param sprites The indices of the selected sprites
+ * @return size_t The number of selected sprites
+ */
+static size_t lcdc_select_sprites(const lcdc_t *lcd, data_t ly, uint8_t sprites[SPRITES_PER_LINE])
+{
+    const unsigned height = SPRITE_TILE_HEIGHT(*lcdc_reg(lcd, REG_LCDC));
+    uint16_t keys[SPRITES_PER_LINE];
+    size_t count = 0;
+
+    for (uint8_t i = 0; i < OAM_NB_SPRITES && count < SPRITES_PER_LINE; ++i)
+    {
+        const addr_t entry = (addr_t)(OAM_START + i * OAM_ENTRY_SIZE);
+        const data_t y = (data_t)(lcdc_read(lcd, entry) - SPRITE_Y_OFFSET);
+        if (y <= ly && ly < y + height)
+        {
+            // Insertion sort of at most SPRITES_PER_LINE keys
+            const uint16_t key = (uint16_t)(lcdc_read(lcd, (addr_t)(entry + 1)) << 8 | i);
+            size_t j = count++;
+            for (; j > 0 && keys[j - 1] > key; --j)
+            {
+                keys[j] = keys[j - 1];
+            }
+            keys[j] = key;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        sprites[i] = (uint8_t)(keys[i] & 0xFF);
+    }
+    return count;
+}
+
+/**
+ * @brief Draws a sprite below the sprites already drawn on a line
+ *
+ * @param line The line of sprites
+ * @param x The x coordinate of the leftmost pixel of the sprite
+ * @param msb The msb of the 8 pixels of the sprite, pixel 0 in bit 0
+ * @param lsb The lsb of the 8 pixels of the sprite
+ * @param opacity The opacity of the 8 pixels of the sprite
+ * @param alt Whether the sprite uses OBP1
+ */
+static void lcdc_draw_sprite(lcdc_line_t *line, data_t x, uint32_t msb, uint32_t lsb, uint32_t opacity, bit_t alt)
+{
+    const size_t word = x / IMAGE_LINE_WORD_BITS;
+    const unsigned shift = x % IMAGE_LINE_WORD_BITS;
+    // The 8 pixels may straddle two words
+    const uint64_t m = (uint64_t)msb << shift;
+    const uint64_t l = (uint64_t)lsb << shift;
+    const uint64_t o = (uint64_t)opacity << shift;
+    const uint64_t a = alt ? o : 0;
+
+    for (size_t i = 0; i < 2 && word + i < LINE_WORDS; ++i)
+    {
+        const unsigned s = (unsigned)i * IMAGE_LINE_WORD_BITS;
+        uint32_t *op = &line->opacity[word + i];
+        const uint32_t visible = (uint32_t)(o >> s) & ~*op;
+        line->msb[word + i] |= (uint32_t)(m >> s) & visible;
+        line->lsb[word + i] |= (uint32_t)(l >> s) & visible;
+        line->alt[word + i] |= (uint32_t)(a >> s) & visible;
+        *op |= (uint32_t)(o >> s);
+    }
+}
+
+/**
+ * @brief Renders the sprites on a line: all of them, and only the ones
+ *        which are in front of the background
+ *
+ * @param lcd The LCD controller
+ * @param ly The line
+ * @param all The line of all the sprites
+ * @param front The line of the sprites in front of the background
+ */
+static void lcdc_render_sprites(lcdc_t *lcd, data_t ly, lcdc_line_t *all, lcdc_line_t *front)
+{
+    const data_t lcdc = *lcdc_reg(lcd, REG_LCDC);
+    uint8_t sprites[SPRITES_PER_LINE];
+    const size_t count = lcdc_select_sprites(lcd, ly, sprites);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const addr_t entry = (addr_t)(OAM_START + sprites[i] * OAM_ENTRY_SIZE);
+        const data_t y = (data_t)(lcdc_read(lcd, entry) - SPRITE_Y_OFFSET);
+        const data_t x = (data_t)(lcdc_read(lcd, (addr_t)(entry + 1)) - SPRITE_X_OFFSET);
+        const data_t tile = lcdc_read(lcd, (addr_t)(entry + 2));
+        const data_t attr = lcdc_read(lcd, (addr_t)(entry + 3));
+        if (x >= LCD_WIDTH)
+        {
+            continue;
+        }
+
+        data_t row = (data_t)(ly - y);
+        if (attr & SPRITE_ATTR_YFLIP_MASK)
+        {
+            row = (data_t)(SPRITE_TILE_HEIGHT(lcdc) - 1 - row);
+        }
+        const addr_t addr = (addr_t)(TILE_SRC_ADDR_LOW + tile * TILE_SIZE + row * 2);
+        uint8_t lsb = 0, msb = 0;
+        lcdc_tile_row(lcd, addr, &lsb, &msb);
+#ifdef LCDC_HARDWARE
+        if (attr & SPRITE_ATTR_XFLIP_MASK)
+        {
+            lsb = lcdc_reverse(lsb);
+            msb = lcdc_reverse(msb);
+        }
+#endif
+        // (the reference controller never flips the sprites horizontally)
+
+        const uint32_t opacity = msb | lsb;
+        const bit_t alt = (attr & SPRITE_ATTR_PALETTE_MASK) != 0;
+        lcdc_draw_sprite(all, x, msb, lsb, opacity, alt);
+        if (!(attr & SPRITE_ATTR_BEHIND_MASK))
+        {
+            lcdc_draw_sprite(front, x, msb, lsb, opacity, alt);
+        }
+    }
+}
+
+/**
+ * @brief Renders a line into the display: background, window and sprites.
+ *        The line is left as it is if the background is switched off.
+ *
+ * @param lcd The LCD controller
+ * @param ly The line to render
+ * @return int Error code
+ */
+static int lcdc_render_line(lcdc_t *lcd, data_t ly)
+{
+    const data_t lcdc = *lcdc_reg(lcd, REG_LCDC);
+    if (!(lcdc & LCDC_REG_BG_MASK))
+    {
+        return ERR_NONE;
+    }
+
+    lcdc_line_t line;
+    lcdc_render_background(lcd, ly, &line);
+    uint32_t sprite[LINE_WORDS] = {0};
+
+    if (lcdc & LCDC_REG_OBJ_MASK)
+    {
+        lcdc_line_t all = {{0}, {0}, {0}, {0}};
+        lcdc_line_t front = {{0}, {0}, {0}, {0}};
+        lcdc_render_sprites(lcd, ly, &all, &front);
+
+        for (size_t i = 0; i < LINE_WORDS; ++i)
+        {
+            // The sprites behind the background only show on its color 0
+            const uint32_t bg = line.opacity[i] | ~all.opacity[i];
+            line.msb[i] = (line.msb[i] & bg) | (all.msb[i] & ~bg);
+            line.lsb[i] = (line.lsb[i] & bg) | (all.lsb[i] & ~bg);
+            line.alt[i] = (line.alt[i] & bg) | (all.alt[i] & ~bg);
+            sprite[i] = ~bg | front.opacity[i];
+
+            line.msb[i] = (line.msb[i] & ~front.opacity[i]) | (front.msb[i] & front.opacity[i]);
+            line.lsb[i] = (line.lsb[i] & ~front.opacity[i]) | (front.lsb[i] & front.opacity[i]);
+            line.alt[i] = (line.alt[i] & ~front.opacity[i]) | (front.alt[i] & front.opacity[i]);
+            line.opacity[i] = ~(uint32_t)0;
+        }
+    }
+
+    const uint32_t *const planes[INDEX_PLANES] = {line.lsb, line.msb, sprite, line.alt};
+    M_EXIT_IF_ERR(framebuffer_set_indices(&lcd->frame, ly, planes, INDEX_PLANES));
+    M_EXIT_IF_ERR(framebuffer_map_line(&lcd->frame, ly, lcd->palettes));
+
+    if (lcd->display.content != NULL)
+    {
+        const image_line_t *dest = &lcd->display.content[ly];
+        M_EXIT_IF_ERR(framebuffer_get_line(&lcd->frame, ly, dest->msb->content, dest->lsb->content));
+        memcpy(dest->opacity->content, line.opacity, sizeof(uint32_t) * LINE_WORDS);
+    }
+    return ERR_NONE;
+}
+
+/**
+ * @brief Runs the controller at one of its events: the start of a mode
+ *
+ * @param lcd The LCD controller
+ * @param cycle The current cycle
+ * @return int Error code
+ */
+static int lcdc_event(lcdc_t *lcd, uint64_t cycle)
+{
+    const uint64_t frame_cycle = (cycle - lcd->on_cycle) % FRAME_TOTAL_CYCLES;
+    if (frame_cycle == 0)
+    {
+        lcd->window_y = 0;
+    }
+
+    const data_t ly = (data_t)(frame_cycle / LINE_TOTAL_CYCLES);
+    const uint64_t line_cycle = frame_cycle % LINE_TOTAL_CYCLES;
+
+    if (ly >= LCD_HEIGHT)
+    {
+        M_REQUIRE(line_cycle == 0, ERR_BAD_PARAMETER,
+                  "LCDC run at cycle %" PRIu64 " of VBLANK line %u", line_cycle, ly);
+        if (ly == LCD_HEIGHT)
+        {
+            lcdc_set_mode(lcd, 1);
+            cpu_request_interrupt(lcd->cpu, VBLANK);
+        }
+        *lcdc_reg(lcd, REG_LY) = ly;
+        lcdc_update_lyc(lcd);
+        lcd->next_cycle += LINE_TOTAL_CYCLES;
+        return ERR_NONE;
+    }
+
+    switch (line_cycle)
+    {
+    case LINE_MODE_2_START_CYCLE:
+        *lcdc_reg(lcd, REG_LY) = ly;
+        lcdc_update_lyc(lcd);
+        lcdc_set_mode(lcd, 2);
+        lcd->next_cycle += LINE_MODE_2_CYCLES;
+        break;
+
+    case LINE_MODE_3_START_CYCLE:
+        lcdc_set_mode(lcd, 3);
+        M_EXIT_IF_ERR(lcdc_render_line(lcd, ly));
+        lcd->next_cycle += LINE_MODE_3_CYCLES;
+        break;
+
+    case LINE_MODE_0_START_CYCLE:
+        lcdc_set_mode(lcd, 0);
+        lcd->next_cycle += LINE_MODE_0_CYCLES;
+        break;
+
+    default:
+        M_EXIT(ERR_BAD_PARAMETER, "LCDC run at cycle %" PRIu64 " of line %u", line_cycle, ly);
+    }
+    return ERR_NONE;
+}
+
+// ==== see lcdc.h ========================================
+int lcdc_init(gameboy_t *gb)
+{
+    M_REQUIRE_NON_NULL(gb);
+
+    lcdc_t *lcd = &gb->screen;
+    lcd->cpu = &gb->cpu;
+    const data_t *lcdc = cpu_plugged(&gb->cpu) ? bus_lookup(cpu_bus(&gb->cpu), gb->cpu.pages, REG_LCDC) : NULL;
+    lcd->on = lcdc != NULL && (*lcdc & LCDC_REG_LCD_STATUS_MASK);
+    lcd->next_cycle = (uint64_t)-1;
+    lcd->on_cycle = lcd->on ? 0 : (uint64_t)-1;
+    lcd->DMA_from = 0;
+    lcd->DMA_to = OAM_END + 1;
+    lcd->window_y = 0;
+    memset(&lcd->display, 0, sizeof(lcd->display));
+    memset(&lcd->frame, 0, sizeof(lcd->frame));
+    memset(lcd->tiles_dirty, 0xFF, sizeof(lcd->tiles_dirty));
+    memset(lcd->palettes, 0, sizeof(lcd->palettes));
+    if (lcdc != NULL)
+    {
+        lcdc_update_palettes(lcd);
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see lcdc.h ========================================
+int lcdc_enable_display(lcdc_t *lcd)
+{
+    M_REQUIRE_NON_NULL(lcd);
+    if (lcd->display.content != NULL)
+    {
+        return ERR_NONE;
+    }
+
+    M_EXIT_IF_ERR(image_create(&lcd->display, LCD_WIDTH, LCD_HEIGHT));
+    return framebuffer_to_image(&lcd->frame, &lcd->display);
+}
+
+// ==== see lcdc.h ========================================
+void lcdc_free(lcdc_t *lcd)
+{
+    if (lcd != NULL && lcd->display.content != NULL)
+    {
+        image_free(&lcd->display);
+    }
+}
+
+// ==== see lcdc.h ========================================
+int lcdc_plug(lcdc_t *lcd, bus_t bus)
+{
+    M_REQUIRE_NON_NULL(lcd);
+    M_REQUIRE_NON_NULL(bus);
+    // The registers are plugged with the other ones, see gameboy_create
+    return ERR_NONE;
+}
+
+// ==== see lcdc.h ========================================
+int lcdc_cycle(lcdc_t *lcd, uint64_t cycle)
+{
+    M_REQUIRE_NON_NULL(lcd);
+    M_REQUIRE_NON_NULL(lcd->cpu);
+    M_REQUIRE(cycle <= lcd->next_cycle, ERR_BAD_PARAMETER,
+              "LCDC cycle %" PRIu64 " is after its next event %" PRIu64, cycle, lcd->next_cycle);
+
+    // A DMA transfer copies one byte to the OAM per cycle
+    if (lcd->DMA_to <= OAM_END)
+    {
+        const data_t data = lcdc_read(lcd, lcd->DMA_from++);
+        *bus_lookup(cpu_bus(lcd->cpu), lcd->cpu->pages, lcd->DMA_to++) = data;
+    }
+
+    if (cycle == lcd->next_cycle)
+    {
+        return lcdc_event(lcd, cycle);
+    }
+    if (lcd->next_cycle == (uint64_t)-1 && (*lcdc_reg(lcd, REG_LCDC) & LCDC_REG_LCD_STATUS_MASK))
+    {
+        // Switched on: the first frame starts now. The palettes are read
+        // again, in case they were written without lcdc_bus_listener knowing
+        lcdc_update_palettes(lcd);
+        lcd->on_cycle = cycle;
+        lcd->next_cycle = cycle;
+        return lcdc_event(lcd, cycle);
+    }
+    return ERR_NONE;
+}
+
+// ==== see lcdc.h ========================================
+int lcdc_bus_listener(lcdc_t *lcd, addr_t addr)
+{
+    M_REQUIRE_NON_NULL(lcd);
+    M_REQUIRE_NON_NULL(lcd->cpu);
+
+    switch (addr)
+    {
+    case REG_LCDC:
+    {
+        const bit_t on = (*lcdc_reg(lcd, REG_LCDC) & LCDC_REG_LCD_STATUS_MASK) != 0;
+        if (lcd->on && !on)
+        {
+            // Switched off: back to line 0, until switched on again
+            lcdc_set_mode(lcd, 0);
+            *lcdc_reg(lcd, REG_LY) = 0;
+            lcdc_update_lyc(lcd);
+            lcd->next_cycle = (uint64_t)-1;
+        }
+        lcd->on = on;
+        break;
+    }
+
+    case REG_LYC:
+        lcdc_update_lyc(lcd);
+        break;
+
+    case REG_DMA:
+        lcd->DMA_from = (addr_t)(*lcdc_reg(lcd, REG_DMA) << 8);
+        lcd->DMA_to = OAM_START;
+        break;
+
+    case REG_BGP:
+    case REG_OBP0:
+    case REG_OBP1:
+        lcdc_update_palette(lcd, addr);
+        break;
+
+    default:
+        if (addr >= TILE_SRC_ADDR_LOW && addr <= TILE_DATA_END)
+        {
+            const size_t index = (size_t)(addr - TILE_SRC_ADDR_LOW) >> TILE_SIZE_LOG2;
+            lcd->tiles_dirty[index / 64] |= (uint64_t)1 << (index % 64);
+        }
+        break;
+    }
+    return ERR_NONE;
+}
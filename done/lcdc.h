@@ -13,6 +13,7 @@
 #include "memory.h"
 #include "bit.h"
 #include "image.h"
+#include "framebuffer.h"
 
 typedef struct gameboy_ gameboy_t;
 
@@ -85,6 +86,10 @@ extern "C" {
 #define TILE_SRC_ADDR_HIGH 0x8800
 
 #define TILE_SIZE 16      // tile size (in bytes)
+#define TILE_SIZE_LOG2 4
+
+#define TILE_DATA_END 0x97FF // last byte of the tiles, from TILE_SRC_ADDR_LOW
+#define TILE_COUNT    384
 
 #define TILE_LINE_SIZE    32
 #define VISIBLE_LINE_SIZE 20
@@ -95,6 +100,14 @@ extern "C" {
 #define WINDOW_OFFSET_X  7
 
 // ======================================================================
+/**
+ * @brief A decoded tile: the bit planes of its rows, leftmost pixel in bit 0
+ */
+typedef struct {
+    uint8_t lsb[8];
+    uint8_t msb[8];
+} lcdc_tile_t;
+
 /**
  * @brief lcdc type
  */
@@ -105,8 +118,12 @@ typedef struct {
     uint64_t on_cycle;
     addr_t   DMA_from;
     addr_t   DMA_to;
-    image_t  display;
+    image_t  display; // only rendered into once enabled, see lcdc_enable_display
     data_t   window_y;
+    framebuffer_t frame;
+    uint64_t tiles_dirty[TILE_COUNT / 64]; // tiles written since decoded, see bus_watch_dirty
+    lcdc_tile_t tiles[TILE_COUNT];
+    uint8_t palettes[FRAMEBUFFER_INDICES]; // colors of the pixel indices of the lines, see lcdc.c
 } lcdc_t;
 
 
@@ -119,6 +136,17 @@ typedef struct {
 int lcdc_init(gameboy_t* gb);
 
 
+/**
+ * @brief Makes a LCD controler also render its frames into its display
+ *        image, for the code which uses image_t (the frames are always
+ *        rendered into the frame buffer)
+ *
+ * @param lcd LCD controler
+ * @return error code
+ */
+int lcdc_enable_display(lcdc_t* lcd);
+
+
 /**
  * @brief Frees a LCD controler
  * @param lcd LCD controler to free
@@ -146,7 +174,9 @@ int lcdc_cycle(lcdc_t* lcd, uint64_t cycle);
 
 
 /**
- * @brief LCD controler bus listening handler
+ * @brief LCD controler bus listening handler. The writes to the tiles are
+ *        tracked by the gameboy (see bus_watch_dirty): they only have to be
+ *        notified here when they are not done by the cpu.
  *
  * @param lcd LCD controler
  * @param address trigger address
@@ -0,0 +1,276 @@
+/**
+ * @file movie.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to record the key events of a run and to replay them
+ * @date 2020
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "error.h"
+#include "cartridge.h"
+#include "movie.h"
+
+#define MOVIE_MAGIC "GBMV"
+#define MOVIE_HEADER_SIZE (4 + 4 + 8 + 8 + 8)
+#define MOVIE_PRESSED 0x80
+
+// At most 10 bytes of varint and the key
+#define MOVIE_EVENT_MAX 11
+
+// ======================================================================
+static void put_le(uint8_t *out, uint64_t value, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+// ======================================================================
+static uint64_t get_le(const uint8_t *in, size_t size)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+/**
+ * @brief Drops the events from a cycle on
+ */
+static void movie_truncate(movie_t *movie, uint64_t cycle)
+{
+    while (movie->count > 0 && movie->events[movie->count - 1].cycle >= cycle)
+    {
+        --movie->count;
+    }
+    if (movie->next > movie->count)
+    {
+        movie->next = movie->count;
+    }
+}
+
+// ======================================================================
+static int movie_append(movie_t *movie, const movie_event_t *event)
+{
+    if (movie->count == movie->capacity)
+    {
+        const size_t capacity = movie->capacity == 0 ? 64 : 2 * movie->capacity;
+        movie_event_t *const grown = realloc(movie->events, capacity * sizeof(movie_event_t));
+        M_REQUIRE_NON_NULL_CUSTOM_ERR(grown, ERR_MEM);
+        movie->events = grown;
+        movie->capacity = capacity;
+    }
+    movie->events[movie->count++] = *event;
+    return ERR_NONE;
+}
+
+// ==== see movie.h ========================================
+int movie_create(movie_t *movie, const gameboy_t *gameboy)
+{
+    M_REQUIRE_NON_NULL(movie);
+    M_REQUIRE_NON_NULL(gameboy);
+
+    memset(movie, 0, sizeof(movie_t));
+    movie->rom = cartridge_rom_id(&gameboy->cartridge);
+    M_REQUIRE(movie->rom != 0, ERR_BAD_PARAMETER, "gameboy %s has no cartridge", "gameboy");
+    M_REQUIRE(!gameboy->cartridge.battery, ERR_BAD_PARAMETER, "gameboy %s runs on a save file", "gameboy");
+    return ERR_NONE;
+}
+
+// ==== see movie.h ========================================
+int movie_record(movie_t *movie, const gameboy_t *gameboy, gb_key_t key, bool pressed)
+{
+    M_REQUIRE_NON_NULL(movie);
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE(key < NB_GB_KEYS, ERR_BAD_PARAMETER, "invalid key %d", (int)key);
+    M_REQUIRE(movie->rom == cartridge_rom_id(&gameboy->cartridge), ERR_BAD_PARAMETER,
+              "movie of ROM %016llx", (unsigned long long)movie->rom);
+
+    movie_truncate(movie, gameboy->cycles + 1);
+    const movie_event_t event = {gameboy->cycles, key, pressed};
+    M_EXIT_IF_ERR(movie_append(movie, &event));
+    if (movie->length < event.cycle)
+    {
+        movie->length = event.cycle;
+    }
+    return ERR_NONE;
+}
+
+// ==== see movie.h ========================================
+int movie_rewind(movie_t *movie, uint64_t cycle)
+{
+    M_REQUIRE_NON_NULL(movie);
+
+    // The state restored was saved before the events of its cycle were given
+    movie_truncate(movie, cycle);
+    if (movie->length > cycle)
+    {
+        movie->length = cycle;
+    }
+    return ERR_NONE;
+}
+
+// ==== see movie.h ========================================
+int movie_save(movie_t *movie, const gameboy_t *gameboy, const char *filename)
+{
+    M_REQUIRE_NON_NULL(movie);
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE_NON_NULL(filename);
+    M_REQUIRE(movie->rom == cartridge_rom_id(&gameboy->cartridge), ERR_BAD_PARAMETER,
+              "movie of ROM %016llx", (unsigned long long)movie->rom);
+
+    movie_truncate(movie, gameboy->cycles + 1);
+    movie->length = gameboy->cycles;
+
+    const size_t size = MOVIE_HEADER_SIZE + movie->count * MOVIE_EVENT_MAX;
+    uint8_t *const data = malloc(size);
+    M_REQUIRE_NON_NULL_CUSTOM_ERR(data, ERR_MEM);
+
+    memcpy(data, MOVIE_MAGIC, 4);
+    put_le(data + 4, MOVIE_VERSION, 4);
+    put_le(data + 8, movie->rom, 8);
+    put_le(data + 16, movie->length, 8);
+    put_le(data + 24, movie->count, 8);
+    uint8_t *out = data + MOVIE_HEADER_SIZE;
+    uint64_t previous = 0;
+    for (size_t i = 0; i < movie->count; ++i)
+    {
+        const movie_event_t *event = &movie->events[i];
+        uint64_t delta = event->cycle - previous;
+        previous = event->cycle;
+        while (delta >= 0x80)
+        {
+            *out++ = (uint8_t)(delta | 0x80);
+            delta >>= 7;
+        }
+        *out++ = (uint8_t)delta;
+        *out++ = (uint8_t)(event->key | (event->pressed ? MOVIE_PRESSED : 0));
+    }
+
+    const size_t written = (size_t)(out - data);
+    FILE *file = fopen(filename, "wb");
+    int err = ERR_IO;
+    if (file != NULL)
+    {
+        err = fwrite(data, 1, written, file) == written ? ERR_NONE : ERR_IO;
+        if (fclose(file) != 0)
+        {
+            err = ERR_IO;
+        }
+    }
+    free(data);
+    return err;
+}
+
+/**
+ * @brief Decodes the events of a movie file
+ */
+static int movie_decode(movie_t *movie, const uint8_t *data, size_t size)
+{
+    M_REQUIRE(size >= MOVIE_HEADER_SIZE && memcmp(data, MOVIE_MAGIC, 4) == 0
+              && get_le(data + 4, 4) == MOVIE_VERSION, ERR_IO, "not a movie of version %d", MOVIE_VERSION);
+
+    movie->rom = get_le(data + 8, 8);
+    movie->length = get_le(data + 16, 8);
+    const uint64_t count = get_le(data + 24, 8);
+    M_REQUIRE(count <= (size - MOVIE_HEADER_SIZE) / 2, ERR_IO, "movie of %zu bytes is truncated", size);
+
+    const uint8_t *in = data + MOVIE_HEADER_SIZE;
+    const uint8_t *const end = data + size;
+    uint64_t cycle = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t delta = 0;
+        unsigned shift = 0;
+        while (in < end && (*in & 0x80) != 0 && shift < 63)
+        {
+            delta |= (uint64_t)(*in++ & 0x7F) << shift;
+            shift += 7;
+        }
+        M_REQUIRE(end - in >= 2, ERR_IO, "movie of %zu bytes is truncated", size);
+        delta |= (uint64_t)*in++ << shift;
+        const uint8_t code = *in++;
+
+        const movie_event_t event = {cycle + delta, (gb_key_t)(code & ~MOVIE_PRESSED), (code & MOVIE_PRESSED) != 0};
+        M_REQUIRE(event.cycle >= cycle && event.key < NB_GB_KEYS && event.cycle <= movie->length, ERR_IO,
+                  "invalid event %zu", (size_t)i);
+        M_EXIT_IF_ERR(movie_append(movie, &event));
+        cycle = event.cycle;
+    }
+    return ERR_NONE;
+}
+
+// ==== see movie.h ========================================
+int movie_load(movie_t *movie, const char *filename)
+{
+    M_REQUIRE_NON_NULL(movie);
+    M_REQUIRE_NON_NULL(filename);
+    memset(movie, 0, sizeof(movie_t));
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+    {
+        return ERR_IO;
+    }
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+    {
+        size = ftell(file);
+    }
+    uint8_t *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    int err = data == NULL ? (size < 0 ? ERR_IO : ERR_MEM) : ERR_NONE;
+    if (err == ERR_NONE && (fseek(file, 0, SEEK_SET) != 0 || fread(data, 1, (size_t)size, file) != (size_t)size))
+    {
+        err = ERR_IO;
+    }
+    fclose(file);
+
+    if (err == ERR_NONE)
+    {
+        err = movie_decode(movie, data, (size_t)size);
+    }
+    free(data);
+    if (err != ERR_NONE)
+    {
+        movie_free(movie);
+    }
+    return err;
+}
+
+// ==== see movie.h ========================================
+int movie_play_until(movie_t *movie, gameboy_t *gameboy, uint64_t cycle)
+{
+    M_REQUIRE_NON_NULL(movie);
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE(movie->rom == cartridge_rom_id(&gameboy->cartridge), ERR_BAD_PARAMETER,
+              "movie of ROM %016llx", (unsigned long long)movie->rom);
+
+    for (; movie->next < movie->count && movie->events[movie->next].cycle <= cycle; ++movie->next)
+    {
+        const movie_event_t *event = &movie->events[movie->next];
+        M_EXIT_IF_ERR(gameboy_run_until(gameboy, event->cycle));
+        M_EXIT_IF_ERR(event->pressed ? joypad_key_pressed(&gameboy->pad, event->key)
+                      : joypad_key_released(&gameboy->pad, event->key));
+    }
+    return gameboy_run_until(gameboy, cycle);
+}
+
+// ==== see movie.h ========================================
+void movie_free(movie_t *movie)
+{
+    if (movie != NULL)
+    {
+        free(movie->events);
+        memset(movie, 0, sizeof(movie_t));
+    }
+}
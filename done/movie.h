@@ -0,0 +1,138 @@
+#pragma once
+
+/**
+ * @file movie.h
+ * @brief Input movies: the key events of a run, at the cycle they happened,
+ *        to replay it exactly, at any speed and on any host
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "gameboy.h"
+#include "joypad.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Version of the files written by movie_save, to be incremented
+ *        whenever their layout, or what a run depends on, changes
+ *        (version 1 identified the ROM by its header only, version 2 was
+ *        recorded with the external RAM of the save file and the clock of
+ *        the cartridge on the host time).
+ *
+ * A movie file is little-endian: "GBMV", the version (4 bytes), the id of
+ * the ROM (8 bytes, see cartridge_rom_id), the length of the movie and
+ * the number of events (8 bytes each), then for each event the number of
+ * cycles since the previous one as a varint (7 bits per byte, lowest
+ * first) and a byte with the key in its low bits and 0x80 if pressed.
+ */
+#define MOVIE_VERSION 3
+
+/**
+ * @brief Key event of a movie
+ */
+typedef struct {
+    uint64_t cycle; // of the gameboy when the key is pressed or released
+    gb_key_t key;
+    bool pressed;
+} movie_event_t;
+
+/**
+ * @brief Movie type: the events in order of cycles, and the next one to
+ *        play (see movie_play_until)
+ */
+typedef struct {
+    uint64_t rom;    // see cartridge_rom_id
+    uint64_t length; // in cycles, from the creation of the gameboy
+    movie_event_t* events;
+    size_t count;
+    size_t capacity;
+    size_t next;
+} movie_t;
+
+/**
+ * @brief Creates an empty movie of the ROM of a gameboy, to record a run
+ *        from the creation of the gameboy. It must have been created by
+ *        gameboy_create, as it is to play the movie: the external RAM of
+ *        its cartridge starts blank and its clock counts the cycles.
+ *
+ * @param movie movie to create
+ * @param gameboy gameboy to record
+ * @return error code (ERR_BAD_PARAMETER if the gameboy keeps the external
+ *         RAM of its cartridge in a save file)
+ */
+int movie_create(movie_t* movie, const gameboy_t* gameboy);
+
+/**
+ * @brief Records a key event at the current cycle of a gameboy, before the
+ *        key is given to its joypad. The events recorded after that cycle
+ *        (before the gameboy went back to a previous state) are dropped.
+ *
+ * @param movie movie to record into
+ * @param gameboy gameboy recorded
+ * @param key key pressed or released
+ * @param pressed whether the key is pressed
+ * @return error code
+ */
+int movie_record(movie_t* movie, const gameboy_t* gameboy, gb_key_t key, bool pressed);
+
+/**
+ * @brief Drops the events recorded from a cycle on, when the gameboy
+ *        recorded goes back to a state saved at that cycle (before the keys
+ *        of that cycle were given to its joypad): the run goes on from there
+ *
+ * @param movie movie to cut
+ * @param cycle of the gameboy after going back
+ * @return error code
+ */
+int movie_rewind(movie_t* movie, uint64_t cycle);
+
+/**
+ * @brief Writes a movie to a file, ending at the current cycle of a gameboy
+ *        (the events after it are dropped)
+ *
+ * @param movie movie to write
+ * @param gameboy gameboy recorded
+ * @param filename file to write
+ * @return error code
+ */
+int movie_save(movie_t* movie, const gameboy_t* gameboy, const char* filename);
+
+/**
+ * @brief Reads a movie written by movie_save, to be played from its start
+ *
+ * @param movie movie to read into
+ * @param filename file to read
+ * @return error code (ERR_IO if the file cannot be read or is not a movie)
+ */
+int movie_load(movie_t* movie, const char* filename);
+
+/**
+ * @brief Runs a gameboy until a given cycle, giving its joypad the key
+ *        events of a movie exactly at their cycle: the gameboy runs up to
+ *        each event, then gets it
+ *
+ * @param movie movie to play, from the next event not played yet
+ * @param gameboy gameboy to run, created from the ROM of the movie
+ * @param cycle cycle to run until (the events at this cycle included)
+ * @return error code (ERR_BAD_PARAMETER if the movie is of another ROM)
+ */
+int movie_play_until(movie_t* movie, gameboy_t* gameboy, uint64_t cycle);
+
+/**
+ * @brief Frees a movie
+ *
+ * @param movie movie to free
+ */
+void movie_free(movie_t* movie);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,380 @@
+/**
+ * @file profile.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to count the instructions executed and their call stacks
+ * @date 2020
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "error.h"
+#include "profile.h"
+
+#define PROFILE_PCS_INITIAL 4096
+#define PROFILE_NODES_INITIAL 256
+
+#define PROFILE_KEY(bank, addr) (((uint32_t)(bank) << 16) | (addr))
+#define PROFILE_KEY_BANK(key) (((key) & ~PROFILE_INTERRUPT) >> 16)
+#define PROFILE_KEY_ADDR(key) ((key) & 0xFFFF)
+
+// Names of the interrupts, by handler (0x40, 0x48, ...)
+static const char *const PROFILE_INTERRUPT_NAMES[] = {
+    "int_vblank", "int_lcd_stat", "int_timer", "int_serial", "int_joypad"
+};
+
+#define PROFILE_FIRST_VECTOR 0x40
+#define PROFILE_NB_VECTORS (sizeof(PROFILE_INTERRUPT_NAMES) / sizeof(PROFILE_INTERRUPT_NAMES[0]))
+
+// ======================================================================
+static size_t profile_hash(uint32_t key, size_t capacity)
+{
+    return (size_t)((key * 0x9E3779B1u) >> 7) & (capacity - 1);
+}
+
+/**
+ * @brief Finds the entry of a (bank, PC) in a hash table, or the free one where it goes
+ */
+static profile_pc_t *profile_pc_find(profile_pc_t *pcs, size_t capacity, uint32_t key)
+{
+    size_t i = profile_hash(key, capacity);
+    while (pcs[i].key != key && pcs[i].key != PROFILE_FREE)
+    {
+        i = (i + 1) & (capacity - 1);
+    }
+    return &pcs[i];
+}
+
+/**
+ * @brief Allocates an empty hash table of (bank, PC)
+ */
+static profile_pc_t *profile_pcs_alloc(size_t capacity)
+{
+    profile_pc_t *const pcs = calloc(capacity, sizeof(profile_pc_t));
+    if (pcs != NULL)
+    {
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            pcs[i].key = PROFILE_FREE;
+        }
+    }
+    return pcs;
+}
+
+/**
+ * @brief Doubles the hash table of (bank, PC), kept at most half full
+ */
+static int profile_pcs_grow(profile_t *profile)
+{
+    const size_t capacity = 2 * profile->pcs_capacity;
+    profile_pc_t *const pcs = profile_pcs_alloc(capacity);
+    M_REQUIRE_NON_NULL_CUSTOM_ERR(pcs, ERR_MEM);
+
+    for (size_t i = 0; i < profile->pcs_capacity; ++i)
+    {
+        if (profile->pcs[i].key != PROFILE_FREE)
+        {
+            *profile_pc_find(pcs, capacity, profile->pcs[i].key) = profile->pcs[i];
+        }
+    }
+    free(profile->pcs);
+    profile->pcs = pcs;
+    profile->pcs_capacity = capacity;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Gets the node of the function on top of the call stack
+ */
+static uint32_t profile_current(const profile_t *profile)
+{
+    return profile->depth == 0 ? 0 : profile->stack[profile->depth - 1].node;
+}
+
+/**
+ * @brief Enters a function: goes to its node under the current one
+ *        (created if need be) and pushes it on the call stack
+ */
+static int profile_enter(profile_t *profile, uint32_t key, uint16_t sp)
+{
+    const uint32_t parent = profile_current(profile);
+    if (profile->depth == PROFILE_MAX_DEPTH)
+    {
+        return ERR_NONE;
+    }
+
+    uint32_t node = profile->nodes[parent].child;
+    while (node != 0 && profile->nodes[node].key != key)
+    {
+        node = profile->nodes[node].sibling;
+    }
+
+    if (node == 0)
+    {
+        if (profile->nb_nodes == profile->nodes_capacity)
+        {
+            const size_t capacity = 2 * profile->nodes_capacity;
+            M_REQUIRE(capacity <= UINT32_MAX, ERR_MEM, "too many call stacks (%zu)", profile->nb_nodes);
+            profile_node_t *const grown = realloc(profile->nodes, capacity * sizeof(profile_node_t));
+            M_REQUIRE_NON_NULL_CUSTOM_ERR(grown, ERR_MEM);
+            profile->nodes = grown;
+            profile->nodes_capacity = capacity;
+        }
+        node = (uint32_t)profile->nb_nodes++;
+        profile_node_t *const n = &profile->nodes[node];
+        n->key = key;
+        n->parent = parent;
+        n->child = 0;
+        n->sibling = profile->nodes[parent].child;
+        n->cycles = 0;
+        profile->nodes[parent].child = node;
+    }
+
+    profile->stack[profile->depth].node = node;
+    profile->stack[profile->depth].sp = sp;
+    ++profile->depth;
+    return ERR_NONE;
+}
+
+// ==== see profile.h ========================================
+int profile_create(profile_t *profile)
+{
+    M_REQUIRE_NON_NULL(profile);
+
+    memset(profile, 0, sizeof(profile_t));
+    profile->pcs = profile_pcs_alloc(PROFILE_PCS_INITIAL);
+    profile->nodes = calloc(PROFILE_NODES_INITIAL, sizeof(profile_node_t));
+    if (profile->pcs == NULL || profile->nodes == NULL)
+    {
+        profile_free(profile);
+        return ERR_MEM;
+    }
+    profile->pcs_capacity = PROFILE_PCS_INITIAL;
+    profile->nodes_capacity = PROFILE_NODES_INITIAL;
+    profile->nb_nodes = 1; // the root
+    return ERR_NONE;
+}
+
+// ==== see profile.h ========================================
+int profile_instr(profile_t *profile, uint16_t bank, addr_t pc, uint16_t opcode, uint8_t cycles)
+{
+    M_REQUIRE_NON_NULL(profile);
+    M_REQUIRE(opcode < 2 * PROFILE_NB_OPCODES, ERR_BAD_PARAMETER, "invalid opcode 0x%" PRIX16, opcode);
+
+    ++profile->opcodes[opcode].count;
+    profile->opcodes[opcode].cycles += cycles;
+
+    if (2 * (profile->nb_pcs + 1) > profile->pcs_capacity)
+    {
+        M_EXIT_IF_ERR(profile_pcs_grow(profile));
+    }
+    const uint32_t key = PROFILE_KEY(bank, pc);
+    profile_pc_t *const entry = profile_pc_find(profile->pcs, profile->pcs_capacity, key);
+    if (entry->key == PROFILE_FREE)
+    {
+        entry->key = key;
+        ++profile->nb_pcs;
+    }
+    // The last opcode seen at this address, in case the code there changes
+    entry->opcode = opcode;
+    ++entry->counter.count;
+    entry->counter.cycles += cycles;
+
+    profile->nodes[profile_current(profile)].cycles += cycles;
+    ++profile->instructions;
+    profile->cycles += cycles;
+    return ERR_NONE;
+}
+
+// ==== see profile.h ========================================
+int profile_call(profile_t *profile, uint16_t bank, addr_t target, uint16_t sp)
+{
+    M_REQUIRE_NON_NULL(profile);
+
+    return profile_enter(profile, PROFILE_KEY(bank, target), sp);
+}
+
+// ==== see profile.h ========================================
+int profile_interrupt(profile_t *profile, addr_t vector, uint16_t sp, uint8_t cycles)
+{
+    M_REQUIRE_NON_NULL(profile);
+
+    M_EXIT_IF_ERR(profile_enter(profile, PROFILE_INTERRUPT | vector, sp));
+    profile->nodes[profile_current(profile)].cycles += cycles;
+    profile->cycles += cycles;
+    return ERR_NONE;
+}
+
+// ==== see profile.h ========================================
+void profile_return(profile_t *profile, uint16_t sp)
+{
+    if (profile == NULL)
+    {
+        return;
+    }
+    // The stack grows down: the frames at or below sp are left
+    while (profile->depth > 0 && profile->stack[profile->depth - 1].sp <= sp)
+    {
+        --profile->depth;
+    }
+}
+
+// ======================================================================
+static int profile_cmp_counters(const profile_counter_t *a, const profile_counter_t *b)
+{
+    if (a->cycles != b->cycles)
+    {
+        return a->cycles < b->cycles ? 1 : -1;
+    }
+    if (a->count != b->count)
+    {
+        return a->count < b->count ? 1 : -1;
+    }
+    return 0;
+}
+
+static int profile_cmp_pcs(const void *a, const void *b)
+{
+    const profile_pc_t *const p = a;
+    const profile_pc_t *const q = b;
+    const int cmp = profile_cmp_counters(&p->counter, &q->counter);
+    return cmp != 0 ? cmp : (p->key > q->key) - (p->key < q->key);
+}
+
+static double profile_percent(const profile_t *profile, uint64_t cycles)
+{
+    return profile->cycles == 0 ? 0.0 : 100.0 * (double)cycles / (double)profile->cycles;
+}
+
+static void profile_write_opcode(FILE *out, uint16_t opcode)
+{
+    if (opcode & PROFILE_CB)
+    {
+        fprintf(out, "CB %02" PRIX16, (uint16_t)(opcode & 0xFF));
+    }
+    else
+    {
+        fprintf(out, "%02" PRIX16 "   ", opcode);
+    }
+}
+
+// ==== see profile.h ========================================
+int profile_write_report(const profile_t *profile, FILE *out, size_t top)
+{
+    M_REQUIRE_NON_NULL(profile);
+    M_REQUIRE_NON_NULL(out);
+
+    profile_pc_t *const pcs = malloc((profile->nb_pcs + 1) * sizeof(profile_pc_t));
+    M_REQUIRE_NON_NULL_CUSTOM_ERR(pcs, ERR_MEM);
+    size_t nb_pcs = 0;
+    for (size_t i = 0; i < profile->pcs_capacity; ++i)
+    {
+        if (profile->pcs[i].key != PROFILE_FREE)
+        {
+            pcs[nb_pcs++] = profile->pcs[i];
+        }
+    }
+    qsort(pcs, nb_pcs, sizeof(profile_pc_t), profile_cmp_pcs);
+
+    // The opcodes are sorted as the (bank, PC), keyed by opcode
+    profile_pc_t opcodes[2 * PROFILE_NB_OPCODES];
+    size_t nb_opcodes = 0;
+    for (uint16_t i = 0; i < 2 * PROFILE_NB_OPCODES; ++i)
+    {
+        if (profile->opcodes[i].count != 0)
+        {
+            opcodes[nb_opcodes].key = i;
+            opcodes[nb_opcodes].opcode = i;
+            opcodes[nb_opcodes].counter = profile->opcodes[i];
+            ++nb_opcodes;
+        }
+    }
+    qsort(opcodes, nb_opcodes, sizeof(profile_pc_t), profile_cmp_pcs);
+
+    fprintf(out, "instructions %" PRIu64 " cycles %" PRIu64 "\n", profile->instructions, profile->cycles);
+
+    fprintf(out, "\n== %zu opcodes, by cycles\nopcode %14s %14s %7s\n", nb_opcodes, "count", "cycles", "%");
+    for (size_t i = 0; i < nb_opcodes; ++i)
+    {
+        const profile_counter_t *const c = &opcodes[i].counter;
+        profile_write_opcode(out, opcodes[i].opcode);
+        fprintf(out, "  %14" PRIu64 " %14" PRIu64 " %6.2f%%\n", c->count, c->cycles,
+                profile_percent(profile, c->cycles));
+    }
+
+    const size_t shown = top == 0 || top > nb_pcs ? nb_pcs : top;
+    fprintf(out, "\n== %zu of %zu (bank, PC), by cycles\nbank:PC  opcode %14s %14s %7s\n",
+            shown, nb_pcs, "count", "cycles", "%");
+    for (size_t i = 0; i < shown; ++i)
+    {
+        fprintf(out, "%03" PRIX32 ":%04" PRIX32 " ", PROFILE_KEY_BANK(pcs[i].key), PROFILE_KEY_ADDR(pcs[i].key));
+        profile_write_opcode(out, pcs[i].opcode);
+        fprintf(out, "  %14" PRIu64 " %14" PRIu64 " %6.2f%%\n", pcs[i].counter.count, pcs[i].counter.cycles,
+                profile_percent(profile, pcs[i].counter.cycles));
+    }
+
+    free(pcs);
+    return ferror(out) ? ERR_IO : ERR_NONE;
+}
+
+/**
+ * @brief Writes the name of the function of a node
+ */
+static void profile_write_frame(FILE *out, uint32_t key)
+{
+    const uint32_t vector = PROFILE_KEY_ADDR(key);
+    if ((key & PROFILE_INTERRUPT) && vector >= PROFILE_FIRST_VECTOR && (vector - PROFILE_FIRST_VECTOR) % 8 == 0
+        && (vector - PROFILE_FIRST_VECTOR) / 8 < PROFILE_NB_VECTORS)
+    {
+        fputs(PROFILE_INTERRUPT_NAMES[(vector - PROFILE_FIRST_VECTOR) / 8], out);
+    }
+    else
+    {
+        fprintf(out, "%03" PRIX32 ":%04" PRIX32, PROFILE_KEY_BANK(key), vector);
+    }
+}
+
+// ==== see profile.h ========================================
+int profile_write_collapsed(const profile_t *profile, FILE *out)
+{
+    M_REQUIRE_NON_NULL(profile);
+    M_REQUIRE_NON_NULL(out);
+
+    uint32_t path[PROFILE_MAX_DEPTH];
+    for (size_t node = 0; node < profile->nb_nodes; ++node)
+    {
+        if (profile->nodes[node].cycles == 0)
+        {
+            continue;
+        }
+        size_t depth = 0;
+        for (uint32_t n = (uint32_t)node; n != 0; n = profile->nodes[n].parent)
+        {
+            path[depth++] = n;
+        }
+
+        fputs("root", out);
+        while (depth > 0)
+        {
+            fputc(';', out);
+            profile_write_frame(out, profile->nodes[path[--depth]].key);
+        }
+        fprintf(out, " %" PRIu64 "\n", profile->nodes[node].cycles);
+    }
+
+    return ferror(out) ? ERR_IO : ERR_NONE;
+}
+
+// ==== see profile.h ========================================
+void profile_free(profile_t *profile)
+{
+    if (profile != NULL)
+    {
+        free(profile->pcs);
+        free(profile->nodes);
+        memset(profile, 0, sizeof(profile_t));
+    }
+}
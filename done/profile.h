@@ -0,0 +1,175 @@
+#pragma once
+
+/**
+ * @file profile.h
+ * @brief Execution profile of the CPU: executions and cycles per opcode
+ *        (direct and CB-prefixed) and per (ROM bank, PC), and the cycles of
+ *        each guest call stack, rebuilt from CALL, RST, interrupts and
+ *        returns. It is only filled by a program built with CPU_PROFILE
+ *        (see cpu_use_profile); without it, the CPU does not look at it.
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROFILE_NB_OPCODES 256
+
+// Added to the opcode of a CB-prefixed instruction
+#define PROFILE_CB 0x100
+
+// Frames of the call stack kept, deeper calls are counted in the deepest one
+#define PROFILE_MAX_DEPTH 128
+
+/**
+ * @brief Executions and cycles consumed
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+} profile_counter_t;
+
+/**
+ * @brief Instruction at a (bank, PC), entry of an open addressing hash table
+ */
+typedef struct {
+    uint32_t key;    // (bank << 16) | PC, PROFILE_FREE if the entry is free
+    uint16_t opcode; // PROFILE_CB | opcode if CB-prefixed
+    profile_counter_t counter;
+} profile_pc_t;
+
+#define PROFILE_FREE UINT32_MAX
+
+/**
+ * @brief Node of the call tree: a function called from the one of its
+ *        parent, node 0 being the code run outside of any call
+ */
+typedef struct {
+    uint32_t key;     // (bank << 16) | entry address, PROFILE_INTERRUPT set for interrupts
+    uint32_t parent;
+    uint32_t child;   // first callee, 0 if none
+    uint32_t sibling; // next callee of the parent, 0 if none
+    uint64_t cycles;  // consumed in the function itself, not in its callees
+} profile_node_t;
+
+#define PROFILE_INTERRUPT 0x80000000u
+
+/**
+ * @brief Frame of the call stack
+ */
+typedef struct {
+    uint32_t node;
+    uint16_t sp; // where the return address is
+} profile_frame_t;
+
+/**
+ * @brief Execution profile
+ */
+typedef struct profile_ {
+    profile_counter_t opcodes[2 * PROFILE_NB_OPCODES]; // direct, then CB-prefixed
+    profile_pc_t* pcs;
+    size_t pcs_capacity; // a power of 2
+    size_t nb_pcs;
+    profile_node_t* nodes;
+    size_t nodes_capacity;
+    size_t nb_nodes;
+    profile_frame_t stack[PROFILE_MAX_DEPTH];
+    size_t depth;
+    uint64_t instructions;
+    uint64_t cycles; // of the instructions and of the interrupt entries
+} profile_t;
+
+/**
+ * @brief Creates an empty profile
+ *
+ * @param profile profile to create
+ * @return error code
+ */
+int profile_create(profile_t* profile);
+
+/**
+ * @brief Counts an instruction executed, in the function on top of the call stack
+ *
+ * @param profile profile
+ * @param bank ROM bank of the instruction (0 outside of the switchable bank)
+ * @param pc address of the instruction
+ * @param opcode opcode, PROFILE_CB | opcode if CB-prefixed
+ * @param cycles cycles consumed
+ * @return error code
+ */
+int profile_instr(profile_t* profile, uint16_t bank, addr_t pc, uint16_t opcode, uint8_t cycles);
+
+/**
+ * @brief Pushes a call (CALL or RST taken) on the call stack
+ *
+ * @param profile profile
+ * @param bank ROM bank of the function called (0 outside of the switchable bank)
+ * @param target address of the function called
+ * @param sp SP right after the return address has been pushed
+ * @return error code
+ */
+int profile_call(profile_t* profile, uint16_t bank, addr_t target, uint16_t sp);
+
+/**
+ * @brief Pushes an interrupt entry on the call stack
+ *
+ * @param profile profile
+ * @param vector address of the interrupt handler
+ * @param sp SP right after the return address has been pushed
+ * @param cycles cycles consumed by the entry
+ * @return error code
+ */
+int profile_interrupt(profile_t* profile, addr_t vector, uint16_t sp, uint8_t cycles);
+
+/**
+ * @brief Pops a return (RET or RETI taken) from the call stack, with the
+ *        frames left without returning (e.g. when SP is reset) above it.
+ *        A return to an address not pushed by a call (e.g. PUSH then RET,
+ *        used as a jump) pops nothing.
+ *
+ * @param profile profile
+ * @param sp SP right before the return address is popped
+ */
+void profile_return(profile_t* profile, uint16_t sp);
+
+/**
+ * @brief Writes the report of a profile: the opcodes and the (bank, PC),
+ *        sorted by cycles consumed
+ *
+ * @param profile profile
+ * @param out file to write to
+ * @param top maximum number of (bank, PC) written (0 for all of them)
+ * @return error code
+ */
+int profile_write_report(const profile_t* profile, FILE* out, size_t top);
+
+/**
+ * @brief Writes the cycles of each call stack in the collapsed format of
+ *        flame graphs: one line per stack, its frames from the outermost
+ *        one, separated by ';', then its cycles
+ *
+ * @param profile profile
+ * @param out file to write to
+ * @return error code
+ */
+int profile_write_collapsed(const profile_t* profile, FILE* out);
+
+/**
+ * @brief Frees a profile
+ *
+ * @param profile profile to free
+ */
+void profile_free(profile_t* profile);
+
+#ifdef __cplusplus
+}
+#endif
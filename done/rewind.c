@@ -0,0 +1,359 @@
+/**
+ * @file rewind.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to record the states of a gameboy and to go back to them
+ * @date 2020
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "error.h"
+#include "rewind.h"
+
+/*
+ * A record is a sequence of tokens, each made of the number of bytes which
+ * are the same in both states (0 in the XOR), then of the number of bytes
+ * which differ, both as varints, followed by the XOR of those bytes. A run
+ * of less than MIN_RUN same bytes is cheaper to keep in the literal bytes.
+ */
+#define MIN_RUN 4
+
+// A token covers at least MIN_RUN + 1 bytes for at most 2 bytes of lengths
+// (a length of more than 127 takes more bytes but covers that many), plus
+// the varints of the first token
+#define ENCODE_BOUND(n) ((n) + (n) / 2 + 16)
+
+#define RECORD(rw, i) (&(rw)->records[((rw)->first + (i)) % (rw)->nb_records])
+
+// ======================================================================
+static inline uint64_t load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// ======================================================================
+static inline uint8_t *put_varint(uint8_t *out, size_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+// ======================================================================
+static inline const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, size_t *value)
+{
+    size_t v = 0;
+    unsigned shift = 0;
+    while (in < end && (*in & 0x80) != 0 && shift < 8 * sizeof(size_t))
+    {
+        v |= (size_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    if (in < end)
+    {
+        v |= (size_t)*in++ << shift;
+    }
+    *value = v;
+    return in;
+}
+
+/**
+ * @brief Encodes state XOR previous (or state alone, if previous is NULL)
+ *
+ * @return size of the record, at most ENCODE_BOUND(size)
+ */
+static size_t rewind_encode(uint8_t *out, const uint8_t *state, const uint8_t *previous, size_t size)
+{
+    uint8_t *const start = out;
+    size_t i = 0;
+    while (i < size)
+    {
+        // Same bytes, 8 at a time
+        const size_t same = i;
+        if (previous != NULL)
+        {
+            while (i + 8 <= size && load64(state + i) == load64(previous + i))
+            {
+                i += 8;
+            }
+            while (i < size && state[i] == previous[i])
+            {
+                ++i;
+            }
+        }
+        else
+        {
+            while (i + 8 <= size && load64(state + i) == 0)
+            {
+                i += 8;
+            }
+            while (i < size && state[i] == 0)
+            {
+                ++i;
+            }
+        }
+        if (i == size)
+        {
+            break;
+        }
+
+        // Different bytes, up to the next run of MIN_RUN same ones
+        const size_t literal = i;
+        size_t run = 0;
+        for (; i < size && run < MIN_RUN; ++i)
+        {
+            const uint8_t x = previous != NULL ? state[i] ^ previous[i] : state[i];
+            run = x == 0 ? run + 1 : 0;
+        }
+        if (run == MIN_RUN)
+        {
+            i -= MIN_RUN;
+        }
+
+        out = put_varint(out, literal - same);
+        out = put_varint(out, i - literal);
+        for (size_t j = literal; j < i; ++j)
+        {
+            *out++ = previous != NULL ? state[j] ^ previous[j] : state[j];
+        }
+    }
+    return (size_t)(out - start);
+}
+
+/**
+ * @brief XORs a record into a state, which goes from the one of the
+ *        previous record to the one of the record, or the other way round
+ */
+static void rewind_apply(uint8_t *state, size_t size, const uint8_t *in, size_t length)
+{
+    const uint8_t *const end = in + length;
+    size_t i = 0;
+    while (in < end)
+    {
+        size_t same = 0;
+        size_t literal = 0;
+        in = get_varint(in, end, &same);
+        in = get_varint(in, end, &literal);
+        i += same;
+        if (i > size || literal > size - i || literal > (size_t)(end - in))
+        {
+            return;
+        }
+        for (size_t j = 0; j < literal; ++j)
+        {
+            state[i + j] ^= in[j];
+        }
+        i += literal;
+        in += literal;
+    }
+}
+
+// ======================================================================
+static void rewind_apply_record(rewind_t *rw, uint8_t *state, size_t index)
+{
+    const rewind_record_t *record = RECORD(rw, index);
+    if (record->keyframe)
+    {
+        memset(state, 0, rw->state_size);
+    }
+    rewind_apply(state, rw->state_size, rw->ring + record->offset, record->size);
+}
+
+// ======================================================================
+static void rewind_drop_oldest(rewind_t *rw)
+{
+    rw->first = (rw->first + 1) % rw->nb_records;
+    --rw->count;
+    --rw->cursor;
+}
+
+/**
+ * @brief Makes room for a record of at most bound bytes at rw->next,
+ *        dropping the oldest records (and the deltas which depend on them)
+ */
+static void rewind_make_room(rewind_t *rw, size_t bound)
+{
+    if (rw->next + bound > rw->capacity)
+    {
+        // The records at the end of the ring buffer are the oldest ones
+        while (rw->count > 0 && RECORD(rw, 0)->offset >= rw->next)
+        {
+            rewind_drop_oldest(rw);
+        }
+        rw->next = 0;
+    }
+    while (rw->count > 0 && (rw->count == rw->nb_records
+                             || (RECORD(rw, 0)->offset < rw->next + bound
+                                 && RECORD(rw, 0)->offset + RECORD(rw, 0)->size > rw->next)))
+    {
+        rewind_drop_oldest(rw);
+    }
+    while (rw->count > 0 && !RECORD(rw, 0)->keyframe)
+    {
+        rewind_drop_oldest(rw);
+    }
+    if (rw->count == 0)
+    {
+        rw->next = 0;
+    }
+}
+
+// ==== see rewind.h ========================================
+int rewind_create(rewind_t *rw, const gameboy_t *gameboy, size_t capacity, size_t nb_records,
+                  size_t keyframe_interval)
+{
+    M_REQUIRE_NON_NULL(rw);
+    M_REQUIRE_NON_NULL(gameboy);
+    memset(rw, 0, sizeof(rewind_t));
+
+    rw->state_size = gameboy_state_size(gameboy);
+    M_REQUIRE(capacity >= 2 * ENCODE_BOUND(rw->state_size), ERR_BAD_PARAMETER,
+              "ring buffer of %zu bytes is too small", capacity);
+    M_REQUIRE(nb_records >= 2 && keyframe_interval >= 1, ERR_BAD_PARAMETER,
+              "invalid number of records %zu", nb_records);
+
+    rw->capacity = capacity;
+    rw->nb_records = nb_records;
+    rw->keyframe_interval = keyframe_interval;
+    rw->ring = malloc(capacity);
+    rw->records = calloc(nb_records, sizeof(rewind_record_t));
+    rw->current = calloc(1, rw->state_size);
+    rw->work = calloc(1, rw->state_size);
+    if (rw->ring == NULL || rw->records == NULL || rw->current == NULL || rw->work == NULL)
+    {
+        // Frees what has been allocated
+        rewind_free(rw);
+        M_EXIT_ERR(ERR_MEM, ", cannot allocate %zu bytes for the history", capacity);
+    }
+    return ERR_NONE;
+}
+
+// ==== see rewind.h ========================================
+int rewind_push(rewind_t *rw, const gameboy_t *gameboy)
+{
+    M_REQUIRE_NON_NULL(rw);
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE(rw->ring != NULL, ERR_BAD_PARAMETER, "history %s is not created", "rw");
+    M_REQUIRE(gameboy_state_size(gameboy) == rw->state_size, ERR_BAD_PARAMETER,
+              "state of %zu bytes, of another ROM", gameboy_state_size(gameboy));
+
+    M_EXIT_IF_ERR(gameboy_save_state(gameboy, rw->work, rw->state_size));
+
+    // Drops the records after the current one, then makes room for the new one
+    rw->count = rw->cursor;
+    if (rw->count > 0)
+    {
+        const rewind_record_t *last = RECORD(rw, rw->count - 1);
+        rw->next = last->offset + last->size;
+    }
+    rewind_make_room(rw, ENCODE_BOUND(rw->state_size));
+
+    bool keyframe = true;
+    for (size_t i = 1; i < rw->keyframe_interval && i <= rw->count; ++i)
+    {
+        if (RECORD(rw, rw->count - i)->keyframe)
+        {
+            keyframe = false;
+            break;
+        }
+    }
+
+    rewind_record_t *record = RECORD(rw, rw->count);
+    record->offset = rw->next;
+    record->size = rewind_encode(rw->ring + rw->next, rw->work, keyframe ? NULL : rw->current, rw->state_size);
+    record->cycle = gameboy->cycles;
+    record->keyframe = keyframe;
+    rw->next += record->size;
+    ++rw->count;
+    rw->cursor = rw->count;
+
+    uint8_t *const swap = rw->current;
+    rw->current = rw->work;
+    rw->work = swap;
+    return ERR_NONE;
+}
+
+// ==== see rewind.h ========================================
+int rewind_seek(rewind_t *rw, gameboy_t *gameboy, size_t index)
+{
+    M_REQUIRE_NON_NULL(rw);
+    M_REQUIRE_NON_NULL(gameboy);
+    M_REQUIRE(index < rw->count, ERR_BAD_PARAMETER, "invalid record %zu", index);
+
+    // Nearest keyframe at or before index, and whether there is one
+    // between the current record and index
+    const size_t current = rw->cursor - 1;
+    size_t keyframe = index;
+    while (!RECORD(rw, keyframe)->keyframe)
+    {
+        --keyframe;
+    }
+    bool crossed = false;
+    for (size_t i = index < current ? index + 1 : current + 1; i <= (index < current ? current : index); ++i)
+    {
+        crossed |= RECORD(rw, i)->keyframe;
+    }
+
+    const size_t distance = index < current ? current - index : index - current;
+    if (!crossed && distance <= index - keyframe + 1)
+    {
+        if (index < current)
+        {
+            for (size_t i = current; i > index; --i)
+            {
+                rewind_apply_record(rw, rw->current, i);
+            }
+        }
+        else
+        {
+            for (size_t i = current + 1; i <= index; ++i)
+            {
+                rewind_apply_record(rw, rw->current, i);
+            }
+        }
+    }
+    else
+    {
+        for (size_t i = keyframe; i <= index; ++i)
+        {
+            rewind_apply_record(rw, rw->current, i);
+        }
+    }
+    rw->cursor = index + 1;
+
+    return gameboy_load_state(gameboy, rw->current, rw->state_size);
+}
+
+// ==== see rewind.h ========================================
+int rewind_back(rewind_t *rw, gameboy_t *gameboy, size_t back)
+{
+    M_REQUIRE_NON_NULL(rw);
+    M_REQUIRE(rw->cursor > 0, ERR_BAD_PARAMETER, "history of %zu records is empty", rw->count);
+
+    const size_t current = rw->cursor - 1;
+    return rewind_seek(rw, gameboy, back < current ? current - back : 0);
+}
+
+// ==== see rewind.h ========================================
+void rewind_free(rewind_t *rw)
+{
+    if (rw != NULL)
+    {
+        free(rw->ring);
+        free(rw->records);
+        free(rw->current);
+        free(rw->work);
+        memset(rw, 0, sizeof(rewind_t));
+    }
+}
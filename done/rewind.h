@@ -0,0 +1,112 @@
+#pragma once
+
+/**
+ * @file rewind.h
+ * @brief Rewind history of a gameboy: a state per frame, in a ring buffer
+ *        of fixed size
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "gameboy.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Record of a state in the ring buffer. A keyframe is the whole
+ *        state, a delta the XOR of the state with the one of the previous
+ *        record. Both are run-length encoded (see rewind.c), so that the
+ *        bytes which have not changed since the previous frame (or which
+ *        are 0, for a keyframe) cost almost nothing.
+ */
+typedef struct {
+    size_t offset;  // in the ring buffer
+    size_t size;    // encoded size
+    uint64_t cycle; // of the gameboy when the state was saved
+    bool keyframe;
+} rewind_record_t;
+
+/**
+ * @brief Rewind history type. The oldest records are dropped when the
+ *        ring buffer or the records are full, the deltas after the oldest
+ *        keyframe with it. As the XOR of two states is its own inverse,
+ *        a state is rebuilt from the nearest of the current state and of
+ *        the previous keyframe, one delta per frame.
+ */
+typedef struct {
+    uint8_t* ring;
+    size_t capacity;       // size of the ring buffer
+    size_t next;           // offset of the next record in the ring buffer
+    rewind_record_t* records; // circular
+    size_t nb_records;     // size of records
+    size_t first;          // index of the oldest record in records
+    size_t count;          // number of records
+    size_t cursor;         // number of records up to the current state (count unless sought back)
+    size_t keyframe_interval;
+    size_t state_size;
+    uint8_t* current;      // state of record cursor - 1
+    uint8_t* work;         // state being saved
+} rewind_t;
+
+/**
+ * @brief Creates an empty history for a gameboy
+ *
+ * @param rw history to create
+ * @param gameboy gameboy the states are saved from (only its state size is used)
+ * @param capacity size of the ring buffer, in bytes
+ * @param nb_records maximum number of records (e.g. frames per second times seconds)
+ * @param keyframe_interval number of records from a keyframe to the next one
+ * @return error code (ERR_BAD_PARAMETER if the ring buffer cannot hold two keyframes)
+ */
+int rewind_create(rewind_t* rw, const gameboy_t* gameboy, size_t capacity, size_t nb_records,
+                  size_t keyframe_interval);
+
+/**
+ * @brief Records the state of a gameboy, typically once per frame. The
+ *        records after the current one (see rewind_seek) are dropped first.
+ *
+ * @param rw history
+ * @param gameboy gameboy to record
+ * @return error code
+ */
+int rewind_push(rewind_t* rw, const gameboy_t* gameboy);
+
+/**
+ * @brief Restores the state of a record into a gameboy, which becomes the
+ *        current record: the next rewind_push drops those after it
+ *
+ * @param rw history
+ * @param gameboy gameboy to restore
+ * @param index index of the record, from 0 (the oldest) to count - 1
+ * @return error code
+ */
+int rewind_seek(rewind_t* rw, gameboy_t* gameboy, size_t index);
+
+/**
+ * @brief Restores the state recorded a number of records before the
+ *        current one (or the oldest one, if there are not that many)
+ *
+ * @param rw history
+ * @param gameboy gameboy to restore
+ * @param back number of records to go back
+ * @return error code (ERR_BAD_PARAMETER if nothing is recorded)
+ */
+int rewind_back(rewind_t* rw, gameboy_t* gameboy, size_t back);
+
+/**
+ * @brief Frees a history
+ *
+ * @param rw history to free
+ */
+void rewind_free(rewind_t* rw);
+
+#ifdef __cplusplus
+}
+#endif
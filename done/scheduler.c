@@ -0,0 +1,132 @@
+/**
+ * @file scheduler.c
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @brief Functions used to schedule the events of the Gameboy's components
+ * @date 2020
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "error.h"
+#include "scheduler.h"
+
+#define PARENT(i) (((i) - 1) / 2)
+#define LEFT_CHILD(i) (2 * (i) + 1)
+
+/**
+ * @brief Swaps two entries of the heap and keeps the index table up to date
+ *
+ * @param sched scheduler to modify
+ * @param i position of first entry
+ * @param j position of second entry
+ */
+static void sched_swap(scheduler_t *sched, size_t i, size_t j)
+{
+    sched_entry_t tmp = sched->heap[i];
+    sched->heap[i] = sched->heap[j];
+    sched->heap[j] = tmp;
+
+    sched->index[sched->heap[i].event] = i;
+    sched->index[sched->heap[j].event] = j;
+}
+
+/**
+ * @brief Moves an entry towards the root of the heap until its parent is earlier
+ *
+ * @param sched scheduler to modify
+ * @param i position of the entry
+ * @return size_t the new position of the entry
+ */
+static size_t sched_sift_up(scheduler_t *sched, size_t i)
+{
+    while (i > 0 && sched->heap[i].cycle < sched->heap[PARENT(i)].cycle)
+    {
+        sched_swap(sched, i, PARENT(i));
+        i = PARENT(i);
+    }
+    return i;
+}
+
+/**
+ * @brief Moves an entry towards the leaves of the heap until its children are later
+ *
+ * @param sched scheduler to modify
+ * @param i position of the entry
+ */
+static void sched_sift_down(scheduler_t *sched, size_t i)
+{
+    while (LEFT_CHILD(i) < SCHED_NB_EVENTS)
+    {
+        size_t child = LEFT_CHILD(i);
+
+        // Select the earliest of both children
+        if (child + 1 < SCHED_NB_EVENTS && sched->heap[child + 1].cycle < sched->heap[child].cycle)
+        {
+            ++child;
+        }
+
+        if (sched->heap[i].cycle <= sched->heap[child].cycle)
+        {
+            return;
+        }
+
+        sched_swap(sched, i, child);
+        i = child;
+    }
+}
+
+// ==== see scheduler.h ========================================
+int scheduler_init(scheduler_t *sched)
+{
+    M_REQUIRE_NON_NULL(sched);
+
+    // Every event is present in the heap, none of them is due yet
+    for (size_t i = 0; i < SCHED_NB_EVENTS; ++i)
+    {
+        sched->heap[i].cycle = SCHED_NEVER;
+        sched->heap[i].event = (sched_event_t)i;
+        sched->index[i] = i;
+    }
+
+    return ERR_NONE;
+}
+
+// ==== see scheduler.h ========================================
+int scheduler_set(scheduler_t *sched, sched_event_t event, uint64_t cycle)
+{
+    M_REQUIRE_NON_NULL(sched);
+    M_REQUIRE(event >= SCHED_CPU && event < SCHED_NB_EVENTS, ERR_BAD_PARAMETER,
+              "invalid event %d", event);
+
+    size_t i = sched->index[event];
+    sched->heap[i].cycle = cycle;
+
+    // The entry either moves up (earlier deadline) or down (later deadline)
+    sched_sift_down(sched, sched_sift_up(sched, i));
+
+    return ERR_NONE;
+}
+
+// ==== see scheduler.h ========================================
+uint64_t scheduler_get(const scheduler_t *sched, sched_event_t event)
+{
+    if (sched == NULL || event < SCHED_CPU || event >= SCHED_NB_EVENTS)
+    {
+        return SCHED_NEVER;
+    }
+
+    return sched->heap[sched->index[event]].cycle;
+}
+
+// ==== see scheduler.h ========================================
+uint64_t scheduler_next(const scheduler_t *sched)
+{
+    if (sched == NULL)
+    {
+        return SCHED_NEVER;
+    }
+
+    return sched->heap[0].cycle;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+/**
+ * @file scheduler.h
+ * @brief Event scheduler for the Game Boy components
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Deadline of an event that is not due
+ */
+#define SCHED_NEVER UINT64_MAX
+
+/**
+ * @brief Sources of events, each one owns exactly one slot in the scheduler.
+ *        The gameboy does not schedule SCHED_CPU: the CPU is due again after
+ *        each instruction, it is asked directly (see cpu_next_event).
+ */
+typedef enum {
+    SCHED_CPU, SCHED_TIMER, SCHED_LCDC, SCHED_DMA,
+    SCHED_NB_EVENTS
+} sched_event_t;
+
+/**
+ * @brief Entry of the scheduler: an event and the cycle at which it is due
+ */
+typedef struct {
+    uint64_t cycle;
+    sched_event_t event;
+} sched_entry_t;
+
+/**
+ * @brief Scheduler type, a min-heap of timestamped events (earliest first).
+ *        index[e] holds the position of event e inside the heap.
+ */
+typedef struct {
+    sched_entry_t heap[SCHED_NB_EVENTS];
+    size_t index[SCHED_NB_EVENTS];
+} scheduler_t;
+
+/**
+ * @brief Initiates a scheduler, no event is due
+ *
+ * @param sched scheduler to initiate
+ * @return error code
+ */
+int scheduler_init(scheduler_t* sched);
+
+/**
+ * @brief Sets (or moves) the deadline of an event
+ *
+ * @param sched scheduler to use
+ * @param event event to schedule
+ * @param cycle cycle at which the event is due (SCHED_NEVER to cancel it)
+ * @return error code
+ */
+int scheduler_set(scheduler_t* sched, sched_event_t event, uint64_t cycle);
+
+/**
+ * @brief Gets the deadline of a given event
+ *
+ * @param sched scheduler to read from
+ * @param event event to look for
+ * @return cycle at which the event is due (SCHED_NEVER if not due)
+ */
+uint64_t scheduler_get(const scheduler_t* sched, sched_event_t event);
+
+/**
+ * @brief Gets the cycle of the earliest event
+ *
+ * @param sched scheduler to read from
+ * @return cycle of the earliest event (SCHED_NEVER if none is due)
+ */
+uint64_t scheduler_next(const scheduler_t* sched);
+
+#ifdef __cplusplus
+}
+#endif
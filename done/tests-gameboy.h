@@ -0,0 +1,49 @@
+#pragma once
+
+/**
+ * @file tests-gameboy.h
+ * @brief Utilities for the tests running whole gameboys
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "tests.h"
+#include "error.h"
+#include "gameboy.h"
+
+/**
+ * @brief Serial callback dropping what the test ROMs print
+ */
+static inline int serial_ignore(void* arg, data_t byte)
+{
+    (void) arg;
+    (void) byte;
+    return ERR_NONE;
+}
+
+/**
+ * @brief Allocates and creates a gameboy running rom, printing nothing
+ */
+static inline gameboy_t* new_gameboy(const char* rom)
+{
+    gameboy_t* gb = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(gb);
+    memset(gb, 0, sizeof(gameboy_t));
+    ck_assert_err_none(gameboy_create(gb, rom));
+    ck_assert_err_none(gameboy_set_serial(gb, serial_ignore, NULL));
+    return gb;
+}
+
+/**
+ * @brief Frees a gameboy allocated by new_gameboy
+ */
+static inline void delete_gameboy(gameboy_t* gb)
+{
+    gameboy_free(gb);
+    free(gb);
+}
@@ -13,9 +13,76 @@
 #include "cpu.h"
 #include "bus.h"
 #include "gameboy.h"
+#include "cpu-storage.h"
 
 #include "timer.h"
 
+#define TAC_ENABLE_BIT 2
+#define TAC_SELECT_MASK 3
+
+/**
+ * @brief Index of the principal counter bit selected by the two LSBs of TAC
+ */
+static const uint8_t TAC_COUNTER_BIT[TAC_SELECT_MASK + 1] = {9, 3, 5, 7};
+
+/**
+ * @brief Indices of the registers in the array returned by timer_regs
+ */
+enum
+{
+    DIV_IDX,
+    TIMA_IDX,
+    TMA_IDX,
+    TAC_IDX
+};
+
+/**
+ * @brief Gets the registers of a timer. They are accessed directly rather than
+ *        with cpu_read_at_idx, which would synchronize the timer again.
+ *
+ * @param timer The given timer
+ * @return pointers to DIV, TIMA, TMA and TAC, NULL if one of them is not plugged
+ */
+static data_t *const *timer_regs(const gbtimer_t *timer)
+{
+    if (timer == NULL || timer->cpu == NULL)
+    {
+        return NULL;
+    }
+
+    // The registers are on the I/O page, which is never direct
+    data_t *const *regs = bus_row_entry(cpu_bus(timer->cpu), timer->cpu->pages, TIMER_START);
+    if (regs == NULL)
+    {
+        return NULL;
+    }
+    for (size_t i = 0; i < TIMER_SIZE; ++i)
+    {
+        if (regs[i] == NULL)
+        {
+            return NULL;
+        }
+    }
+    return regs;
+}
+
+/**
+ * @brief Number of counter tics between two falling edges of the timer's state
+ *
+ * @param tac The value of TAC
+ * @return uint32_t The period, 0 if the timer is stopped
+ */
+static uint32_t timer_period(data_t tac)
+{
+    if (bit_get(tac, TAC_ENABLE_BIT) == 0)
+    {
+        // State is constantly 0: no falling edge can occur
+        return 0;
+    }
+    // The selected bit falls each time the counter crosses a multiple of period
+    return (uint32_t)1 << (TAC_COUNTER_BIT[tac & TAC_SELECT_MASK] + 1);
+}
+
 // ==== see timer.h ========================================
 int timer_init(gbtimer_t *timer, cpu_t *cpu)
 {
@@ -25,6 +92,7 @@ int timer_init(gbtimer_t *timer, cpu_t *cpu)
     timer->cpu = cpu;
 
     timer->counter = (uint16_t)0;
+    timer->cycle = 0;
     return ERR_NONE;
 }
 
@@ -36,14 +104,15 @@ int timer_init(gbtimer_t *timer, cpu_t *cpu)
  */
 bit_t timer_state(gbtimer_t *timer)
 {
-    if (timer == NULL)
+    data_t *const *regs = timer_regs(timer);
+    if (regs == NULL)
     {
         return 0;
     }
 
-    data_t tac = cpu_read_at_idx(timer->cpu, REG_TAC);
+    data_t tac = *regs[TAC_IDX];
     bit_t x = bit_get((uint8_t)tac, 2);
-    data_t div = cpu_read_at_idx(timer->cpu, REG_DIV);
+    data_t div = *regs[DIV_IDX];
     bit_t y = 0;
     enum
     {
@@ -74,6 +143,35 @@ bit_t timer_state(gbtimer_t *timer)
     return x & y;
 }
 
+/**
+ * @brief Increments TIMA of the given timer a number of times, reloading it
+ *        from TMA and raising the timer interrupt when it overflows
+ *
+ * @param timer The given timer
+ * @param regs The registers of the timer
+ * @param nb_incr The number of increments
+ */
+static void timer_incr(gbtimer_t *timer, data_t *const *regs, uint64_t nb_incr)
+{
+    data_t tima = *regs[TIMA_IDX];
+
+    if (nb_incr <= (uint64_t)(0xFF - tima))
+    {
+        tima = (data_t)(tima + nb_incr);
+    }
+    else
+    {
+        //raise timer interrupt
+        cpu_request_interrupt(timer->cpu, TIMER);
+        //reload value, then overflow again every 0x100 - TMA increments
+        const data_t tma = *regs[TMA_IDX];
+        nb_incr -= (uint64_t)(0x100 - tima);
+        tima = (data_t)(tma + nb_incr % (uint64_t)(0x100 - tma));
+    }
+
+    *regs[TIMA_IDX] = tima;
+}
+
 /**
  * @brief Increment the given timer if a change in states occurs
  *
@@ -84,24 +182,15 @@ bit_t timer_state(gbtimer_t *timer)
 int timer_incr_if_state_change(gbtimer_t *timer, bit_t old_state)
 {
     M_REQUIRE_NON_NULL(timer);
-    data_t tima = cpu_read_at_idx(timer->cpu, REG_TIMA);
+    data_t *const *regs = timer_regs(timer);
+    M_REQUIRE_NON_NULL(regs);
 
     if (old_state && !timer_state(timer))
     {
-        if (tima == 0xFF)
-        {
-            //raise timer interrupt
-            cpu_request_interrupt(timer->cpu, TIMER);
-            //reload value
-            tima = cpu_read_at_idx(timer->cpu, REG_TMA);
-        }
-        else
-        {
-            ++tima;
-        }
+        timer_incr(timer, regs, 1);
     }
 
-    return cpu_write_at_idx(timer->cpu, REG_TIMA, tima);
+    return ERR_NONE;
 }
 
 // ==== see timer.h ========================================
@@ -109,16 +198,42 @@ int timer_cycle(gbtimer_t *timer)
 {
     M_REQUIRE_NON_NULL(timer);
 
-    // Get current state of principal timer
-    bit_t current_state = timer_state(timer);
+    return timer_sync(timer, timer->cycle + 1);
+}
 
-    // Increment counter by 4 (A cycle is 4 clock ticks)
-    timer->counter += GB_TICS_PER_CYCLE;
+// ==== see timer.h ========================================
+int timer_sync(gbtimer_t *timer, uint64_t cycle)
+{
+    M_REQUIRE_NON_NULL(timer);
+    data_t *const *regs = timer_regs(timer);
+    M_REQUIRE_NON_NULL(regs);
 
-    // copy 8 MSB from timer principal counter to DIV register
-    M_EXIT_IF_ERR(cpu_write_at_idx(timer->cpu, REG_DIV, msb8(timer->counter)));
+    if (cycle <= timer->cycle)
+    {
+        return ERR_NONE;
+    }
+
+    // Increment counter by 4 per cycle (A cycle is 4 clock ticks)
+    const uint64_t tics = (cycle - timer->cycle) * GB_TICS_PER_CYCLE;
 
-    return timer_incr_if_state_change(timer, current_state);
+    // The counter moves by less than half a period per cycle: each multiple
+    // of period it crosses is a falling edge
+    const uint32_t period = timer_period(*regs[TAC_IDX]);
+    if (period != 0)
+    {
+        const uint64_t nb_edges = (timer->counter % period + tics) / period;
+        if (nb_edges != 0)
+        {
+            timer_incr(timer, regs, nb_edges);
+        }
+    }
+
+    timer->counter = (uint16_t)(timer->counter + tics);
+    timer->cycle = cycle;
+
+    // copy 8 MSB from timer principal counter to DIV register
+    *regs[DIV_IDX] = msb8(timer->counter);
+    return ERR_NONE;
 }
 
 // ==== see timer.h ========================================
@@ -126,6 +241,8 @@ int timer_bus_listener(gbtimer_t *timer, addr_t addr)
 {
 
     M_REQUIRE_NON_NULL(timer);
+    data_t *const *regs = timer_regs(timer);
+    M_REQUIRE_NON_NULL(regs);
 
     bit_t current_state = timer_state(timer);
 
@@ -134,7 +251,7 @@ int timer_bus_listener(gbtimer_t *timer, addr_t addr)
     case REG_DIV:
         // Reset initial counter to 0
         timer->counter = 0;
-        M_EXIT_IF_ERR(cpu_write_at_idx(timer->cpu, REG_DIV, 0));
+        *regs[DIV_IDX] = 0;
         return timer_incr_if_state_change(timer, current_state);
 
         break;
@@ -148,3 +265,47 @@ int timer_bus_listener(gbtimer_t *timer, addr_t addr)
 
     return ERR_NONE;
 }
+
+// ==== see timer.h ========================================
+uint64_t timer_next_event(const gbtimer_t *timer, uint64_t now)
+{
+    data_t *const *regs = timer_regs(timer);
+    const uint32_t period = regs != NULL ? timer_period(*regs[TAC_IDX]) : 0;
+    if (period == 0)
+    {
+        return SCHED_NEVER;
+    }
+
+    uint32_t remaining = period - timer->counter % period;
+
+    // Number of timer cycles (rounded up) before the crossing,
+    // the falling edge is seen during the last of them
+    uint64_t nb_cycles = (remaining + GB_TICS_PER_CYCLE - 1) / GB_TICS_PER_CYCLE;
+
+    return now + nb_cycles - 1;
+}
+
+// ==== see timer.h ========================================
+uint64_t timer_next_overflow(const gbtimer_t *timer)
+{
+    data_t *const *regs = timer_regs(timer);
+    const uint32_t period = regs != NULL ? timer_period(*regs[TAC_IDX]) : 0;
+    if (period == 0)
+    {
+        return SCHED_NEVER;
+    }
+
+    // TIMA overflows on the (0x100 - TIMA)-th falling edge from now on
+    const uint64_t nb_edges = (uint64_t)(0x100 - *regs[TIMA_IDX]);
+    const uint64_t remaining = nb_edges * period - timer->counter % period;
+
+    return timer->cycle + (remaining + GB_TICS_PER_CYCLE - 1) / GB_TICS_PER_CYCLE;
+}
+
+// ==== see timer.h ========================================
+int timer_skip_cycles(gbtimer_t *timer, uint64_t nb_cycles)
+{
+    M_REQUIRE_NON_NULL(timer);
+
+    return timer_sync(timer, timer->cycle + nb_cycles);
+}
@@ -14,6 +14,7 @@
 #include "bit.h"
 #include "cpu.h"
 #include "bus.h"
+#include "scheduler.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,11 +32,16 @@ extern "C" {
 #define TIMER_SIZE      ((REG_TAC-REG_DIV)+1)
 
 /**
- * @brief Timer type
+ * @brief Timer type.
+ *        The timer is not run cycle by cycle: counter and the DIV and TIMA
+ *        registers are those after its last cycle, and are only brought up
+ *        to date (see timer_sync) when they are accessed or when TIMA
+ *        overflows (see timer_next_overflow).
  */
 typedef struct {
     cpu_t* cpu;
     uint16_t counter;
+    uint64_t cycle; // number of cycles the timer has run
 } gbtimer_t;
 
 /**
@@ -57,6 +63,51 @@ int timer_init(gbtimer_t* timer, cpu_t* cpu);
 int timer_cycle(gbtimer_t* timer);
 
 
+/**
+ * @brief Runs the timer until a given cycle at once: the falling edges of
+ *        its state during the elapsed cycles are counted rather than
+ *        detected one by one, TIMA and DIV are only written once
+ *
+ * @param timer timer to synchronize
+ * @param cycle number of cycles the timer has to have run (nothing is done if it already has)
+ * @return error code
+ */
+int timer_sync(gbtimer_t* timer, uint64_t cycle);
+
+
+/**
+ * @brief Computes the cycle during which TIMA overflows next, i.e. when
+ *        the timer interrupt is requested, if the registers are not written
+ *        in between
+ *
+ * @param timer timer
+ * @return cycle to synchronize the timer with (see timer_sync) for the overflow,
+ *         SCHED_NEVER if timer is stopped
+ */
+uint64_t timer_next_overflow(const gbtimer_t* timer);
+
+
+/**
+ * @brief Computes the next cycle during which a falling edge of the timer's
+ *        state increments TIMA
+ *
+ * @param timer timer
+ * @param now current cycle
+ * @return cycle of the next falling edge (SCHED_NEVER if timer is stopped)
+ */
+uint64_t timer_next_event(const gbtimer_t* timer, uint64_t now);
+
+
+/**
+ * @brief Runs several timer cycles at once (see timer_sync)
+ *
+ * @param timer timer to cycle
+ * @param nb_cycles number of cycles to run
+ * @return error code
+ */
+int timer_skip_cycles(gbtimer_t* timer, uint64_t nb_cycles);
+
+
 /**
  * @brief Timer bus listening handler
  *
@@ -0,0 +1,26 @@
+/**
+ * @file tool.c
+ * @brief Functions shared by the command line tools
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdio.h>
+
+#include "tool.h"
+
+// ==== see tool.h ========================================
+void tool_error(const char *pgm, const char *msg, const char *usage, const char *const examples[])
+{
+    fputs("ERROR: ", stderr);
+    if (msg != NULL)
+    {
+        fputs(msg, stderr);
+    }
+    fprintf(stderr, "\nusage:    %s %s\n", pgm, usage);
+    for (size_t i = 0; examples != NULL && examples[i] != NULL; ++i)
+    {
+        fprintf(stderr, "%s %s %s\n", i == 0 ? "examples:" : "         ", pgm, examples[i]);
+    }
+}
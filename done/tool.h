@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * @file tool.h
+ * @brief Functions shared by the command line tools (bench-cpu, ...)
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Prints an error message, then how to run a tool, on stderr
+ *
+ * @param pgm name the tool is run by (argv[0])
+ * @param msg error message, may be NULL
+ * @param usage arguments the tool takes
+ * @param examples arguments of some runs of the tool, NULL terminated
+ */
+void tool_error(const char* pgm, const char* msg, const char* usage, const char* const examples[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -895,6 +895,177 @@ START_TEST(bit_vector_deadboss)
 }
 END_TEST
 
+// ======================================================================
+// Bit by bit versions of the extractions and of the join, as reference
+// for the word-level ones and as baseline for the benchmark
+
+static void ref_set(bit_vector_t* pbv, size_t index, bit_t value)
+{
+    if (value) {
+        pbv->content[index / IMAGE_LINE_WORD_BITS] |= UINT32_C(1) << (index % IMAGE_LINE_WORD_BITS);
+    }
+}
+
+static bit_vector_t* ref_extract(const bit_vector_t* pbv, int64_t index, size_t size, int wrap)
+{
+    bit_vector_t* result = bit_vector_create(size, 0);
+    const int64_t period = (int64_t) pbv->size;
+    for (size_t i = 0; i < size; ++i) {
+        int64_t pos = index + (int64_t) i;
+        if (wrap) {
+            pos = ((pos % period) + period) % period;
+        }
+        if (pos >= 0 && pos < period) {
+            ref_set(result, i, bit_vector_get(pbv, (size_t) pos));
+        }
+    }
+    return result;
+}
+
+static bit_vector_t* ref_join(const bit_vector_t* pbv1, const bit_vector_t* pbv2, int64_t shift)
+{
+    bit_vector_t* result = bit_vector_create(pbv1->size, 0);
+    for (size_t i = 0; i < pbv1->size; ++i) {
+        ref_set(result, i, bit_vector_get((int64_t) i < shift ? pbv1 : pbv2, i));
+    }
+    return result;
+}
+
+static bit_vector_t* random_vector(size_t size)
+{
+    bit_vector_t* pbv = bit_vector_create(size, 0);
+    ck_assert_ptr_nonnull(pbv);
+    for (size_t i = 0; i < size; ++i) {
+        ref_set(pbv, i, (bit_t) (rand() % 2));
+    }
+    return pbv;
+}
+
+#define vector_match_bits(vec1, vec2) \
+    do { \
+        ck_assert_ptr_nonnull(vec1); \
+        ck_assert_ptr_nonnull(vec2); \
+        ck_assert_uint_eq((vec1)->size, (vec2)->size); \
+        for (size_t k = 0; k < (vec1)->size; ++k) { \
+            ck_assert_int_eq(bit_vector_get(vec1, k), bit_vector_get(vec2, k)); \
+        } \
+    } while(0)
+
+static const size_t random_sizes[] = { 1, 5, 31, 32, 33, 64, 100, 160, 256, 1000 };
+
+START_TEST(bit_vector_words_random)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    for (size_t n = 0; n < sizeof(random_sizes) / sizeof(random_sizes[0]); ++n) {
+        const size_t size = random_sizes[n];
+        for (int t = 0; t < 20; ++t) {
+            bit_vector_t* pbv1 = random_vector(size);
+            bit_vector_t* pbv2 = random_vector(size);
+            bit_vector_t* cpy1 = bit_vector_cpy(pbv1);
+            bit_vector_t* cpy2 = bit_vector_cpy(pbv2);
+            const int64_t index = (int64_t) (rand() % (6 * size + 1)) - 3 * (int64_t) size;
+            const size_t out_size = 1 + (size_t) rand() % (2 * size + 64);
+            const int64_t shift = (int64_t) ((size_t) rand() % (size + 1));
+
+            bit_vector_t* zero = bit_vector_extract_zero_ext(pbv1, index, out_size);
+            bit_vector_t* zero_ref = ref_extract(pbv1, index, out_size, 0);
+            vector_match_bits(zero, zero_ref);
+            vector_match_vector(zero, zero_ref);
+
+            bit_vector_t* wrap = bit_vector_extract_wrap_ext(pbv1, index, out_size);
+            bit_vector_t* wrap_ref = ref_extract(pbv1, index, out_size, 1);
+            vector_match_bits(wrap, wrap_ref);
+            vector_match_vector(wrap, wrap_ref);
+
+            bit_vector_t* shifted = bit_vector_shift(pbv1, index);
+            bit_vector_t* shifted_ref = ref_extract(pbv1, -index, size, 0);
+            vector_match_vector(shifted, shifted_ref);
+
+            // The inputs of a join are left untouched
+            bit_vector_t* join = bit_vector_join(pbv1, pbv2, shift);
+            bit_vector_t* join_ref = ref_join(pbv1, pbv2, shift);
+            vector_match_bits(join, join_ref);
+            vector_match_vector(pbv1, cpy1);
+            vector_match_vector(pbv2, cpy2);
+
+            bit_vector_free(&join_ref);
+            bit_vector_free(&join);
+            bit_vector_free(&shifted_ref);
+            bit_vector_free(&shifted);
+            bit_vector_free(&wrap_ref);
+            bit_vector_free(&wrap);
+            bit_vector_free(&zero_ref);
+            bit_vector_free(&zero);
+            bit_vector_free(&cpy2);
+            bit_vector_free(&cpy1);
+            bit_vector_free(&pbv2);
+            bit_vector_free(&pbv1);
+        }
+    }
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief Times the scrolling of a line (wrap extraction, shift and join),
+ *        bit by bit and by words
+ */
+static void bench_line(size_t size, int rounds)
+{
+    bit_vector_t* line = random_vector(size);
+    bit_vector_t* other = random_vector(size);
+    double times[2] = { 0, 0 };
+
+    for (int words = 0; words < 2; ++words) {
+        const double start = now();
+        for (int r = 0; r < rounds; ++r) {
+            const int64_t scroll = r % (int64_t) size;
+            bit_vector_t* wrap = words ? bit_vector_extract_wrap_ext(line, scroll, size)
+                                 : ref_extract(line, scroll, size, 1);
+            bit_vector_t* shifted = words ? bit_vector_shift(wrap, scroll)
+                                    : ref_extract(wrap, -scroll, size, 0);
+            bit_vector_t* join = words ? bit_vector_join(shifted, other, scroll)
+                                 : ref_join(shifted, other, scroll);
+            bit_vector_free(&join);
+            bit_vector_free(&shifted);
+            bit_vector_free(&wrap);
+        }
+        times[words] = now() - start;
+    }
+
+    printf("bit_vector %5zu bits: bit by bit %8.3f us, by words %6.3f us per line (x%.0f)\n",
+           size, times[0] * 1e6 / rounds, times[1] * 1e6 / rounds, times[0] / times[1]);
+    bit_vector_free(&other);
+    bit_vector_free(&line);
+}
+
+START_TEST(bit_vector_words_bench)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    bench_line(160, 2000);
+    bench_line(256, 2000);
+    bench_line(4096, 200);
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
 Suite* cartridge_test_suite()
 {
 
@@ -920,6 +1091,8 @@ Suite* cartridge_test_suite()
     tcase_add_test(tc1, bit_vector_join_exec);
     tcase_add_test(tc1, bit_vector_various);
     tcase_add_test(tc1, bit_vector_deadboss);
+    tcase_add_test(tc1, bit_vector_words_random);
+    tcase_add_test(tc1, bit_vector_words_bench);
 
     return s;
 }
@@ -208,6 +208,330 @@ START_TEST(bus_write_exec)
 }
 END_TEST
 
+START_TEST(bus_pages_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    bus_pages_t pages;
+    zero_init_var(pages);
+
+    ck_assert_int_eq(bus_pages_update(NULL, bus, 0, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_update(&pages, bus, 2, 1), ERR_ADDRESS);
+    ck_assert_int_eq(bus_pages_remap(NULL, &c, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_remap(&pages, &c, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_sync(&pages, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_detach(NULL, bus, NULL, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_detach(&pages, NULL, NULL, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_protect(NULL, 0, BUS_PAGE_SIZE - 1, true), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_pages_protect(&pages, 1, BUS_PAGE_SIZE - 1, true), ERR_ADDRESS);
+    ck_assert_int_eq(bus_pages_protect(&pages, 0, BUS_PAGE_SIZE, true), ERR_ADDRESS);
+
+    // not on page boundaries
+    ck_assert_int_eq(component_create(&c, 2 * BUS_PAGE_SIZE), ERR_NONE);
+    ck_assert_int_eq(bus_plug(bus, &c, 0x10, BUS_PAGE_SIZE + 0x0F), ERR_NONE);
+    ck_assert_int_eq(bus_pages_remap(&pages, &c, 0), ERR_ADDRESS);
+    component_free(&c);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(bus_pages_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    bus_pages_t pages;
+    zero_init_var(pages);
+    component_t other;
+    zero_init_var(other);
+
+    // pages 0 and 1 plugged, page 2 partly, page 3 mixed
+    ck_assert_int_eq(component_create(&c, 4 * BUS_PAGE_SIZE), ERR_NONE);
+    ck_assert_int_eq(component_create(&other, 1), ERR_NONE);
+    ck_assert_int_eq(bus_plug(bus, &c, 0, 2 * BUS_PAGE_SIZE + 0x7F), ERR_NONE);
+    ck_assert_int_eq(bus_forced_plug(bus, &other, 3 * BUS_PAGE_SIZE + 5, 3 * BUS_PAGE_SIZE + 5, 0), ERR_NONE);
+    ck_assert_int_eq(bus_pages_update(&pages, bus, 0, BUS_SIZE - 1), ERR_NONE);
+
+    ck_assert_ptr_eq(bus_page_ptr(&pages, 0), c.mem->memory);
+    ck_assert_ptr_eq(bus_page_ptr(&pages, BUS_PAGE_SIZE + 3), c.mem->memory + BUS_PAGE_SIZE + 3);
+    ck_assert_ptr_eq(bus_page_ptr(&pages, 2 * BUS_PAGE_SIZE), NULL);
+    ck_assert_ptr_eq(bus_page_ptr(&pages, 3 * BUS_PAGE_SIZE + 5), NULL);
+    ck_assert_ptr_eq(bus_page_ptr(&pages, BUS_SIZE - 1), NULL);
+
+    // bus_lookup gives the same result as the table
+    for (size_t addr = 0; addr < 4 * BUS_PAGE_SIZE; ++addr) {
+        ck_assert_ptr_eq(bus_lookup(bus, &pages, (addr_t) addr), bus[addr]);
+        ck_assert_ptr_eq(bus_lookup(bus, NULL, (addr_t) addr), bus[addr]);
+    }
+
+    // Remap pages 0 and 1 two pages further in the component
+    c.start = 0;
+    c.end = 2 * BUS_PAGE_SIZE - 1;
+    ck_assert_int_eq(bus_pages_remap(&pages, &c, 2 * BUS_PAGE_SIZE), ERR_NONE);
+    ck_assert_ptr_eq(bus_lookup(bus, &pages, 1), c.mem->memory + 2 * BUS_PAGE_SIZE + 1);
+    ck_assert_ptr_eq(bus[1], c.mem->memory + 1); // left to bus_pages_sync
+    ck_assert_int_eq(pages.nb_stale, 2);
+
+    ck_assert_int_eq(bus_pages_sync(&pages, bus), ERR_NONE);
+    ck_assert_int_eq(pages.nb_stale, 0);
+    for (size_t addr = 0; addr < 2 * BUS_PAGE_SIZE; ++addr) {
+        ck_assert_ptr_eq(bus[addr], c.mem->memory + 2 * BUS_PAGE_SIZE + addr);
+    }
+
+    // Writes to read-only pages are trapped
+    ck_assert(!bus_pages_trap(&pages, BUS_PAGE_SIZE, 0x12));
+    ck_assert(!bus_pages_trap(NULL, BUS_PAGE_SIZE, 0x12));
+    ck_assert_int_eq(bus_pages_protect(&pages, BUS_PAGE_SIZE, 3 * BUS_PAGE_SIZE - 1, true), ERR_NONE);
+    ck_assert(!bus_pages_trap(&pages, BUS_PAGE_SIZE - 1, 0x12));
+    ck_assert_int_eq(pages.trap.pending, 0);
+    ck_assert(bus_pages_trap(&pages, 2 * BUS_PAGE_SIZE + 7, 0x34));
+    ck_assert_int_eq(pages.trap.pending, 1);
+    ck_assert_int_eq(pages.trap.addr, 2 * BUS_PAGE_SIZE + 7);
+    ck_assert_int_eq(pages.trap.data, 0x34);
+    ck_assert_int_eq(bus_pages_protect(&pages, BUS_PAGE_SIZE, 2 * BUS_PAGE_SIZE - 1, false), ERR_NONE);
+    ck_assert(!bus_pages_trap(&pages, BUS_PAGE_SIZE, 0x12));
+    ck_assert(bus_pages_trap(&pages, 2 * BUS_PAGE_SIZE, 0x12));
+
+    component_free(&other);
+    component_free(&c);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(bus_pages_detach_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    bus_pages_t pages;
+    zero_init_var(pages);
+    component_t other;
+    zero_init_var(other);
+    data_t* rows[2][BUS_PAGE_SIZE];
+
+    // pages 0 and 1 direct, pages 2 and 3 need a row
+    ck_assert_int_eq(component_create(&c, 4 * BUS_PAGE_SIZE), ERR_NONE);
+    ck_assert_int_eq(component_create(&other, 1), ERR_NONE);
+    ck_assert_int_eq(bus_plug(bus, &c, 0, 2 * BUS_PAGE_SIZE + 0x7F), ERR_NONE);
+    ck_assert_int_eq(bus_forced_plug(bus, &other, 3 * BUS_PAGE_SIZE + 5, 3 * BUS_PAGE_SIZE + 5, 0), ERR_NONE);
+    ck_assert_int_eq(bus_pages_update(&pages, bus, 0, BUS_SIZE - 1), ERR_NONE);
+
+    ck_assert_int_eq(bus_pages_detach(&pages, bus, rows, 1), ERR_MEM);
+    ck_assert_int_eq(bus_pages_detach(&pages, bus, rows, 2), ERR_NONE);
+    ck_assert_ptr_eq(pages.rows[0], NULL);
+    ck_assert_ptr_eq(pages.rows[2], rows[0]);
+    ck_assert_ptr_eq(pages.rows[3], rows[1]);
+    ck_assert_ptr_eq(pages.rows[4], NULL);
+
+    // The table is not needed anymore
+    for (size_t addr = 0; addr < 4 * BUS_PAGE_SIZE; ++addr) {
+        ck_assert_ptr_eq(bus_lookup(NULL, &pages, (addr_t) addr), bus[addr]);
+    }
+    ck_assert_ptr_eq(bus_lookup(NULL, &pages, BUS_SIZE - 1), NULL);
+    ck_assert_ptr_eq(bus_row_entry(NULL, &pages, 3 * BUS_PAGE_SIZE + 5), &rows[1][5]);
+
+    // until the pages are computed again
+    ck_assert_int_eq(bus_pages_update(&pages, bus, 2 * BUS_PAGE_SIZE, 3 * BUS_PAGE_SIZE), ERR_NONE);
+    ck_assert_ptr_eq(pages.rows[2], NULL);
+    ck_assert_ptr_eq(pages.rows[3], NULL);
+    ck_assert_ptr_eq(bus_lookup(NULL, &pages, 2 * BUS_PAGE_SIZE), NULL);
+
+    component_free(&other);
+    component_free(&c);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// Records the calls of the watchers
+static char watch_log[16];
+static size_t watch_len = 0;
+
+static int watch_a(void* owner, addr_t addr)
+{
+    (void) owner;
+    watch_log[watch_len++] = (char)('a' + (addr & 0x0F));
+    return ERR_NONE;
+}
+
+static int watch_b(void* owner, addr_t addr)
+{
+    watch_log[watch_len++] = (char)('A' + (addr & 0x0F));
+    // a watcher writing to a watched address is not dispatched again
+    bus_watch_record(owner, 0x11);
+    return ERR_NONE;
+}
+
+START_TEST(bus_watch_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    static bus_watch_t watch;
+    zero_init_var(watch);
+
+    ck_assert_int_eq(bus_watch_add(NULL, 0, 1, watch_a, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_add(&watch, 0, 1, NULL, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_add(&watch, 2, 1, watch_a, NULL), ERR_ADDRESS);
+    for (int i = 0; i < BUS_WATCH_MAX; ++i) {
+        ck_assert_int_eq(bus_watch_add(&watch, 0, 1, watch_a, NULL), ERR_NONE);
+    }
+    ck_assert_int_eq(bus_watch_add(&watch, 0, 1, watch_a, NULL), ERR_MEM);
+    ck_assert_int_eq(bus_watch_dispatch(NULL), ERR_BAD_PARAMETER);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(bus_watch_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    static bus_watch_t watch;
+    zero_init_var(watch);
+    watch_len = 0;
+
+    ck_assert(!bus_watched(NULL, 0x10));
+    ck_assert_int_eq(bus_watch_add(&watch, 0x10, 0x12, watch_a, NULL), ERR_NONE);
+    ck_assert_int_eq(bus_watch_add(&watch, 0x12, 0x13, watch_b, &watch), ERR_NONE);
+    ck_assert_int_eq(bus_watch_add(&watch, 0xFFFF, 0xFFFF, watch_a, NULL), ERR_NONE);
+    ck_assert(!bus_watched(&watch, 0x0F));
+    ck_assert(bus_watched(&watch, 0x10));
+    ck_assert(bus_watched(&watch, 0x13));
+    ck_assert(!bus_watched(&watch, 0x14));
+    ck_assert(bus_watched(&watch, 0xFFFF));
+
+    bus_watch_record(&watch, 0x14);
+    bus_watch_record(&watch, 0x13);
+    bus_watch_record(&watch, 0x12);
+    bus_watch_record(&watch, 0xFFFF);
+    bus_watch_record(NULL, 0x10);
+    ck_assert_int_eq(watch.nb_written, 3);
+
+    // in the order of the writes, then of the watches
+    ck_assert_int_eq(bus_watch_dispatch(&watch), ERR_NONE);
+    watch_log[watch_len] = '\0';
+    ck_assert_int_eq(strcmp(watch_log, "DcCp"), 0);
+    ck_assert_int_eq(watch.nb_written, 0);
+
+    // the queue is bounded
+    for (int i = 0; i < 2 * BUS_WATCH_QUEUE; ++i) {
+        bus_watch_record(&watch, 0x10);
+    }
+    ck_assert_int_eq(watch.nb_written, BUS_WATCH_QUEUE);
+    bus_watch_clear(&watch);
+    ck_assert_int_eq(watch.nb_written, 0);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(bus_watch_lazy_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    static bus_watch_t watch;
+    static bus_pages_t pages;
+    static bus_t bus;
+    zero_init_var(watch);
+    zero_init_var(pages);
+    zero_init_var(bus);
+    watch_len = 0;
+    data_t data[2] = {0, 0};
+    bus[0x10] = &data[0];
+    bus[0x12] = &data[1];
+
+    ck_assert_int_eq(bus_watch_lazy(NULL, 0x10, 0x11, watch_a, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_lazy(&watch, 0x10, 0x11, NULL, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_lazy(&watch, 0x11, 0x10, watch_a, NULL), ERR_ADDRESS);
+    ck_assert_int_eq(bus_watch_lazy(&watch, 0x10, 0x11, watch_a, NULL), ERR_NONE);
+    ck_assert_int_eq(bus_watch_lazy(&watch, 0x10, 0x11, watch_a, NULL), ERR_MEM);
+
+    // the lazy range is brought up to date before being looked up
+    ck_assert_ptr_eq(bus_lookup_sync(bus, NULL, &watch, 0x10), &data[0]);
+    ck_assert_ptr_eq(bus_lookup_sync(bus, &pages, &watch, 0x11), NULL);
+    ck_assert_ptr_eq(bus_lookup_sync(bus, &pages, &watch, 0x12), &data[1]);
+    ck_assert_ptr_eq(bus_lookup_sync(bus, NULL, NULL, 0x10), &data[0]);
+    watch_log[watch_len] = '\0';
+    ck_assert_int_eq(strcmp(watch_log, "ab"), 0);
+    ck_assert_int_eq(watch.nb_written, 0);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(bus_watch_dirty_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    static bus_watch_t watch;
+    zero_init_var(watch);
+    watch_len = 0;
+    uint64_t bits[2] = {0, 0};
+
+    ck_assert_int_eq(bus_watch_dirty(NULL, 0x100, 0x1FF, 1, bits), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_dirty(&watch, 0x100, 0x1FF, 1, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_dirty(&watch, 0x1FF, 0x100, 1, bits), ERR_ADDRESS);
+    ck_assert_int_eq(bus_watch_dirty(&watch, 0x100, 0x1FF, 16, bits), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(bus_watch_dirty(&watch, 0x100, 0x1FF, 1, bits), ERR_NONE);
+    ck_assert_int_eq(bus_watch_dirty(&watch, 0x100, 0x1FF, 1, bits), ERR_MEM);
+
+    // one bit per 2 bytes, nothing is queued
+    bus_watch_record(&watch, 0x0FF);
+    bus_watch_record(&watch, 0x100);
+    bus_watch_record(&watch, 0x101);
+    bus_watch_mark(&watch, 0x1FE);
+    bus_watch_record(&watch, 0x200);
+    bus_watch_mark(NULL, 0x102);
+    ck_assert_uint_eq(bits[0], 1);
+    ck_assert_uint_eq(bits[1], UINT64_C(1) << 63);
+    ck_assert_int_eq(watch.nb_written, 0);
+    ck_assert_int_eq(bus_watch_dispatch(&watch), ERR_NONE);
+    ck_assert_int_eq(watch_len, 0);
+
+    // with a watched range as well
+    ck_assert_int_eq(bus_watch_add(&watch, 0x100, 0x100, watch_a, NULL), ERR_NONE);
+    bits[0] = 0;
+    bus_watch_record(&watch, 0x100);
+    ck_assert_uint_eq(bits[0], 1);
+    ck_assert_int_eq(bus_watch_dispatch(&watch), ERR_NONE);
+    watch_log[watch_len] = '\0';
+    ck_assert_int_eq(strcmp(watch_log, "a"), 0);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
 
 Suite* bus_test_suite()
 {
@@ -230,6 +554,14 @@ Suite* bus_test_suite()
     tcase_add_test(tc3, bus_write_err);
     tcase_add_test(tc3, bus_write_exec);
 
+    tcase_add_test(tc3, bus_pages_err);
+    tcase_add_test(tc3, bus_pages_exec);
+    tcase_add_test(tc3, bus_pages_detach_exec);
+    tcase_add_test(tc3, bus_watch_err);
+    tcase_add_test(tc3, bus_watch_exec);
+    tcase_add_test(tc3, bus_watch_lazy_exec);
+    tcase_add_test(tc3, bus_watch_dirty_exec);
+
     return s;
 }
 
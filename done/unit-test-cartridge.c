@@ -20,6 +20,7 @@
 #include "cartridge.h"
 #include "cpu.h"
 #include "bus.h"
+#include "gameboy.h" // GB_CYCLES_PER_S
 
 #define FIBONACCI_ROM "tests/data/fibonacci.gb"
 
@@ -130,6 +131,496 @@ START_TEST(cartridge_plug_exec)
 }
 END_TEST
 
+// ======================================================================
+// Banked cartridges, written to a temporary file: the first byte of each
+// ROM bank is its number (modulo 256), and the byte after it its msb
+
+static void write_rom(const char* path, data_t type, data_t ram_code, size_t nb_banks)
+{
+    FILE* f = fopen(path, "wb");
+    ck_assert_ptr_nonnull(f);
+    for (size_t bank = 0; bank < nb_banks; ++bank) {
+        data_t b[BANK_ROM0_SIZE] = {0};
+        b[0] = (data_t)(bank & 0xFF);
+        b[1] = (data_t)(bank >> 8);
+        if (bank == 0) {
+            b[CARTRIDGE_TYPE_ADDR] = type;
+            b[CARTRIDGE_RAM_SIZE_ADDR] = ram_code;
+        }
+        ck_assert_int_eq(fwrite(b, 1, sizeof(b), f), sizeof(b));
+    }
+    fclose(f);
+}
+
+// Same as a write of the cpu, followed by the listeners
+static void cpu_write(cartridge_t* ct, cpu_t* cpu, addr_t addr, data_t data)
+{
+    if (!bus_pages_trap(cpu->pages, addr, data)) {
+        *bus_lookup(*cpu->bus, cpu->pages, addr) = data;
+    }
+    ck_assert_err_none(cartridge_bus_listener(ct, cpu));
+}
+
+static data_t cpu_read(const cpu_t* cpu, addr_t addr)
+{
+    return *bus_lookup(*cpu->bus, cpu->pages, addr);
+}
+
+#define ROM_PATH_FMT "/tmp/unit-test-cartridge-%d.gb"
+#define SAV_PATH_FMT "/tmp/unit-test-cartridge-%d.sav"
+
+#define SETUP_CARTRIDGE(type, ram_code, nb_banks) \
+    SETUP_CARTRIDGE_WITH(cartridge_init, type, ram_code, nb_banks)
+
+#define SETUP_CARTRIDGE_WITH(init, type, ram_code, nb_banks) \
+    char rom[64], sav[64]; \
+    snprintf(rom, sizeof(rom), ROM_PATH_FMT, (int)getpid()); \
+    snprintf(sav, sizeof(sav), SAV_PATH_FMT, (int)getpid()); \
+    unlink(sav); \
+    write_rom(rom, type, ram_code, nb_banks); \
+    cartridge_t ct = {0}; \
+    static bus_t bus = {0}; \
+    static bus_pages_t pages = {0}; \
+    cpu_t cpu = {0}; \
+    cpu.bus = &bus; \
+    cpu.pages = &pages; \
+    ck_assert_err_none(init(&ct, rom)); \
+    ck_assert_err_none(cartridge_plug(&ct, bus)); \
+    ck_assert_err_none(bus_pages_update(&pages, bus, 0, BUS_SIZE - 1)); \
+    ck_assert_err_none(cartridge_protect(&ct, &pages))
+
+#define TEARDOWN_CARTRIDGE() \
+    cartridge_free(&ct); \
+    memset(bus, 0, sizeof(bus)); \
+    memset(&pages, 0, sizeof(pages)); \
+    unlink(rom); \
+    unlink(sav)
+
+START_TEST(cartridge_shared_rom_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    char copy[64], other[64];
+    snprintf(copy, sizeof(copy), ROM_PATH_FMT, (int)getpid());
+    snprintf(other, sizeof(other), "/tmp/unit-test-cartridge-other-%d.gb", (int)getpid());
+
+    // A copy of the ROM, with another name
+    FILE* in = fopen(FIBONACCI_ROM, "rb");
+    FILE* out = fopen(copy, "wb");
+    ck_assert_ptr_nonnull(in);
+    ck_assert_ptr_nonnull(out);
+    int byte;
+    while ((byte = fgetc(in)) != EOF) {
+        fputc(byte, out);
+    }
+    fclose(in);
+    fclose(out);
+    write_rom(other, 0x00, 0, 2);
+
+    cartridge_t a = {0}, b = {0}, c = {0}, d = {0};
+    ck_assert_err_none(cartridge_init(&a, FIBONACCI_ROM));
+    ck_assert_err_none(cartridge_init(&b, FIBONACCI_ROM));
+    ck_assert_err_none(cartridge_init(&c, copy));
+    ck_assert_err_none(cartridge_init(&d, other));
+
+    // Same content, same mapping
+    ck_assert_ptr_eq(a.c.mem, b.c.mem);
+    ck_assert_ptr_eq(a.c.mem, c.c.mem);
+    ck_assert_ptr_ne(a.c.mem, d.c.mem);
+    ck_assert_ptr_eq(a.rom0.mem->memory, c.rom0.mem->memory);
+
+    // Released with the last cartridge only
+    const data_t first = a.c.mem->memory[0x100];
+    cartridge_free(&a);
+    cartridge_free(&c);
+    ck_assert_ptr_null(a.c.mem);
+    ck_assert_int_eq(b.c.mem->memory[0x100], first);
+    ck_assert_int_eq(b.rom0.mem->memory[0x100], first);
+    cartridge_free(&b);
+    cartridge_free(&d);
+
+    unlink(copy);
+    unlink(other);
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_type_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    char rom[64];
+    snprintf(rom, sizeof(rom), ROM_PATH_FMT, (int)getpid());
+    cartridge_t ct = {0};
+
+    // MBC2, not supported
+    write_rom(rom, 0x05, 0, 4);
+    ck_assert_int_eq(cartridge_init(&ct, rom), ERR_NOT_IMPLEMENTED);
+    ck_assert_ptr_null(ct.c.mem);
+
+    // Unknown RAM size
+    write_rom(rom, 0x02, 0x07, 4);
+    ck_assert_int_eq(cartridge_init(&ct, rom), ERR_NOT_IMPLEMENTED);
+
+    // Shorter than two banks
+    FILE* f = fopen(rom, "wb");
+    ck_assert_ptr_nonnull(f);
+    fclose(f);
+    ck_assert_int_eq(cartridge_init(&ct, rom), ERR_IO);
+
+    unlink(rom);
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_rom_id_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    char rom[64];
+    snprintf(rom, sizeof(rom), ROM_PATH_FMT, (int)getpid());
+    cartridge_t ct = {0};
+    cartridge_t same = {0};
+    ck_assert_int_eq(cartridge_rom_id(NULL), 0);
+
+    write_rom(rom, 0x01, 0, 8);
+    ck_assert_err_none(cartridge_init(&ct, rom));
+    const uint64_t id = cartridge_rom_id(&ct);
+    ck_assert_err_none(cartridge_init(&same, "./tests/data/blargg_roms/01-special.gb"));
+    ck_assert_int_ne(cartridge_rom_id(&same), id);
+    cartridge_free(&same);
+
+    // The same header, but another revision
+    FILE* f = fopen(rom, "r+b");
+    ck_assert_ptr_nonnull(f);
+    ck_assert_int_eq(fseek(f, 5 * BANK_ROM0_SIZE + 0x123, SEEK_SET), 0);
+    ck_assert_int_eq(fputc(0x42, f), 0x42);
+    fclose(f);
+    ck_assert_err_none(cartridge_init(&same, rom));
+    ck_assert_int_ne(cartridge_rom_id(&same), id);
+    cartridge_free(&same);
+
+    // Fewer banks
+    write_rom(rom, 0x01, 0, 4);
+    ck_assert_err_none(cartridge_init(&same, rom));
+    ck_assert_int_ne(cartridge_rom_id(&same), id);
+    cartridge_free(&same);
+
+    // The same content, even from another file
+    write_rom(rom, 0x01, 0, 8);
+    ck_assert_err_none(cartridge_init(&same, rom));
+    ck_assert_int_eq(cartridge_rom_id(&same), id);
+    cartridge_free(&same);
+
+    cartridge_free(&ct);
+    unlink(rom);
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_no_mbc_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    SETUP_CARTRIDGE(0x00, 0, 2);
+
+    // The ROM cannot be written
+    cpu_write(&ct, &cpu, 0x0000, 0x55);
+    cpu_write(&ct, &cpu, 0x2000, 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, 0x0000), 0);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 1);
+    ck_assert_int_eq(pages.trap.pending, 0);
+    ck_assert_ptr_null(ct.ram.mem);
+
+    TEARDOWN_CARTRIDGE();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_mbc1_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    // MBC1 + RAM, 32 KiB of RAM, 2 MiB of ROM
+    SETUP_CARTRIDGE(0x02, 0x03, 128);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 1);
+
+    // ROM banks are switched without copying the ROM
+    cpu_write(&ct, &cpu, 0x2000, 0x05);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 5);
+    ck_assert_ptr_eq(bus_lookup(bus, &pages, BANK_ROM1_START), &ct.c.mem->memory[5 * BANK_ROM1_SIZE]);
+    cpu_write(&ct, &cpu, 0x3FFF, 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 1);
+    cpu_write(&ct, &cpu, 0x2000, 0x20 | 0x03); // only 5 bits
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 3);
+    cpu_write(&ct, &cpu, 0x4000, 0x02);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 0x43);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM0_START), 0);
+
+    // The bus_t table follows once synced
+    ck_assert_err_none(bus_pages_sync(&pages, bus));
+    ck_assert_int_eq(*bus[BANK_ROM1_START], 0x43);
+
+    // Second mode: the high bits also select the first ROM bank and the RAM bank
+    cpu_write(&ct, &cpu, 0x6000, 0x01);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM0_START), 0x40);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM0_START + 1), 0);
+
+    // Disabled RAM is not written
+    cpu_write(&ct, &cpu, BANK_RAM_START, 0x12);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 0);
+    cpu_write(&ct, &cpu, 0x0000, 0x0A);
+    cpu_write(&ct, &cpu, BANK_RAM_START, 0x12);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 0x12);
+    ck_assert_int_eq(ct.save.memory[2 * BANK_RAM_SIZE], 0x12);
+    cpu_write(&ct, &cpu, 0x4000, 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 0);
+    cpu_write(&ct, &cpu, BANK_RAM_END, 0x34);
+    ck_assert_int_eq(ct.save.memory[BANK_RAM_SIZE - 1], 0x34);
+    cpu_write(&ct, &cpu, 0x0000, 0x00);
+    cpu_write(&ct, &cpu, BANK_RAM_END, 0x56);
+    ck_assert_int_eq(ct.save.memory[BANK_RAM_SIZE - 1], 0x34);
+
+    // Replugging (at the end of the boot ROM) keeps the banks
+    ck_assert_err_none(cartridge_plug(&ct, bus));
+    ck_assert_int_eq(*bus[BANK_ROM1_START], 3);
+
+    // No battery, no save file
+    ck_assert_int_eq(access(sav, F_OK), -1);
+
+    TEARDOWN_CARTRIDGE();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_mbc5_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    // MBC5 + RAM + BATTERY, 128 KiB of RAM, 4.1 MiB of ROM
+    SETUP_CARTRIDGE_WITH(cartridge_init_with_save, 0x1B, 0x04, 0x104);
+
+    // Bank 0 can be mapped on the second window, and there are 9 bits
+    cpu_write(&ct, &cpu, 0x2000, 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 0);
+    cpu_write(&ct, &cpu, 0x3000, 0x01);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START + 1), 0x01);
+    cpu_write(&ct, &cpu, 0x2000, 0x03);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 0x03);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START + 1), 0x01);
+
+    // Battery backed RAM is written to the save file
+    cpu_write(&ct, &cpu, 0x0000, 0x0A);
+    cpu_write(&ct, &cpu, 0x4000, 0x0F);
+    cpu_write(&ct, &cpu, BANK_RAM_START + 1, 0x77);
+
+    // Free without removing the save file
+    cartridge_free(&ct);
+    memset(bus, 0, sizeof(bus));
+    memset(&pages, 0, sizeof(pages));
+
+    FILE* f = fopen(sav, "rb");
+    ck_assert_ptr_nonnull(f);
+    data_t b = 0;
+    ck_assert_int_eq(fseek(f, 15 * BANK_RAM_SIZE + 1, SEEK_SET), 0);
+    ck_assert_int_eq(fread(&b, 1, 1, f), 1);
+    ck_assert_int_eq(b, 0x77);
+    fclose(f);
+
+    // and found again
+    ck_assert_err_none(cartridge_init_with_save(&ct, rom));
+    ck_assert_int_eq(ct.save.memory[15 * BANK_RAM_SIZE + 1], 0x77);
+    cartridge_free(&ct);
+
+    // but not by a cartridge with private RAM
+    ck_assert_err_none(cartridge_init(&ct, rom));
+    ck_assert_int_eq(ct.battery, 0);
+    ck_assert_int_eq(ct.save.memory[15 * BANK_RAM_SIZE + 1], 0);
+
+    TEARDOWN_CARTRIDGE();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_state_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    // MBC1 + RAM, 32 KiB of RAM, 256 KiB of ROM
+    SETUP_CARTRIDGE(0x02, 0x03, 16);
+    const size_t size = cartridge_state_size(&ct);
+    ck_assert_int_eq(cartridge_state_size(NULL), 0);
+    ck_assert_int_gt(size, ct.save.size);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(state);
+    ck_assert_int_eq(cartridge_save_state(NULL, state), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(cartridge_save_state(&ct, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(cartridge_load_state(&ct, NULL, state), ERR_BAD_PARAMETER);
+
+    cpu_write(&ct, &cpu, 0x2000, 0x03);
+    cpu_write(&ct, &cpu, 0x0000, 0x0A);
+    cpu_write(&ct, &cpu, 0x6000, 0x01);
+    cpu_write(&ct, &cpu, 0x4000, 0x02);
+    cpu_write(&ct, &cpu, BANK_RAM_START, 0x44);
+    ck_assert_err_none(cartridge_save_state(&ct, state));
+
+    cpu_write(&ct, &cpu, 0x2000, 0x05);
+    cpu_write(&ct, &cpu, BANK_RAM_START, 0x55);
+    cpu_write(&ct, &cpu, 0x4000, 0x01);
+    cpu_write(&ct, &cpu, 0x0000, 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 5);
+
+    // Banks and RAM are back
+    ck_assert_err_none(cartridge_load_state(&ct, &cpu, state));
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 3);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 0x44);
+    cpu_write(&ct, &cpu, BANK_RAM_START, 0x66);
+    ck_assert_int_eq(ct.save.memory[2 * BANK_RAM_SIZE], 0x66);
+
+    // Not a state of this ROM
+    state[0] ^= 0xFF;
+    ck_assert_int_eq(cartridge_load_state(&ct, &cpu, state), ERR_BAD_PARAMETER);
+
+    free(state);
+    TEARDOWN_CARTRIDGE();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_mbc3_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    // MBC3 + TIMER + RAM + BATTERY, 32 KiB of RAM
+    SETUP_CARTRIDGE(0x10, 0x03, 0x80);
+    ck_assert_ptr_nonnull(ct.rtc);
+
+    cpu_write(&ct, &cpu, 0x2000, 0x7F);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 0x7F);
+    cpu_write(&ct, &cpu, 0x2000, 0x00);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_ROM1_START), 0x01);
+
+    cpu_write(&ct, &cpu, 0x0000, 0x0A);
+    cpu_write(&ct, &cpu, 0x4000, 0x03);
+    cpu_write(&ct, &cpu, BANK_RAM_START, 0x33);
+    ck_assert_int_eq(ct.save.memory[3 * BANK_RAM_SIZE], 0x33);
+
+    // The clock has run for 1 day, 1 hour, 1 minute and 1 second
+    ct.rtc->base -= 24 * 3600 + 3600 + 60 + 1;
+    cpu_write(&ct, &cpu, 0x6000, 0x00);
+    cpu_write(&ct, &cpu, 0x6000, 0x01);
+    const data_t expected[RTC_NB_REGS] = {1, 1, 1, 1, 0};
+    for (data_t reg = 0; reg < RTC_NB_REGS; ++reg) {
+        cpu_write(&ct, &cpu, 0x4000, (data_t)(RTC_REG_FIRST + reg));
+        ck_assert_int_le(cpu_read(&cpu, BANK_RAM_START) - expected[reg], reg == RTC_S ? 2 : 0);
+        ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_END), cpu_read(&cpu, BANK_RAM_START));
+    }
+
+    // The latched values do not move
+    ct.rtc->base -= 3600;
+    cpu_write(&ct, &cpu, 0x4000, RTC_REG_FIRST + RTC_H);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 1);
+
+    // Halt the clock and set the days: writes go to the clock, not to the RAM
+    cpu_write(&ct, &cpu, 0x4000, RTC_REG_FIRST + RTC_DH);
+    cpu_write(&ct, &cpu, BANK_RAM_START, RTC_DH_HALT | RTC_DH_DAY_MSB);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), RTC_DH_HALT | RTC_DH_DAY_MSB);
+    ck_assert_int_eq(ct.save.memory[3 * BANK_RAM_SIZE], 0x33);
+    ct.rtc->base -= 3600; // no effect when halted
+    cpu_write(&ct, &cpu, 0x6000, 0x00);
+    cpu_write(&ct, &cpu, 0x6000, 0x01);
+    cpu_write(&ct, &cpu, 0x4000, RTC_REG_FIRST + RTC_H);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 2);
+    cpu_write(&ct, &cpu, 0x4000, RTC_REG_FIRST + RTC_DL);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 1);
+
+    // Back to the RAM
+    cpu_write(&ct, &cpu, 0x4000, 0x03);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 0x33);
+
+    // Battery, but private RAM: no save file
+    ck_assert_int_eq(ct.battery, 0);
+    ck_assert_int_eq(access(sav, F_OK), -1);
+
+    TEARDOWN_CARTRIDGE();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cartridge_mbc3_cycles_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    // MBC3 + TIMER + RAM + BATTERY, private RAM
+    SETUP_CARTRIDGE(0x10, 0x03, 0x80);
+    uint64_t cycles = 5 * GB_CYCLES_PER_S;
+    cartridge_count_cycles(NULL, &cycles);
+    cartridge_count_cycles(&ct, NULL);
+    ck_assert_ptr_eq(ct.cycles, NULL);
+    cartridge_count_cycles(&ct, &cycles);
+    ck_assert_ptr_eq(ct.cycles, &cycles);
+
+    // The clock restarts at 0, then follows the cycles whatever the host time
+    cycles += (uint64_t)(24 * 3600 + 3600 + 60 + 1) * GB_CYCLES_PER_S + GB_CYCLES_PER_S - 1;
+    cpu_write(&ct, &cpu, 0x0000, 0x0A);
+    cpu_write(&ct, &cpu, 0x6000, 0x00);
+    cpu_write(&ct, &cpu, 0x6000, 0x01);
+    const data_t expected[RTC_NB_REGS] = {1, 1, 1, 1, 0};
+    for (data_t reg = 0; reg < RTC_NB_REGS; ++reg) {
+        cpu_write(&ct, &cpu, 0x4000, (data_t)(RTC_REG_FIRST + reg));
+        ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), expected[reg]);
+    }
+
+    // Setting a register keeps counting from the new value
+    cpu_write(&ct, &cpu, 0x4000, RTC_REG_FIRST + RTC_M);
+    cpu_write(&ct, &cpu, BANK_RAM_START, 30);
+    cycles += 60 * GB_CYCLES_PER_S;
+    cpu_write(&ct, &cpu, 0x6000, 0x00);
+    cpu_write(&ct, &cpu, 0x6000, 0x01);
+    ck_assert_int_eq(cpu_read(&cpu, BANK_RAM_START), 31);
+
+    TEARDOWN_CARTRIDGE();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
 
 Suite* cartridge_test_suite()
 {
@@ -149,6 +640,17 @@ Suite* cartridge_test_suite()
     tcase_add_test(tc1, cartridge_plug_err);
     tcase_add_test(tc1, cartridge_plug_exec);
 
+    Add_Case(s, tc2, "Cartridge Banking Tests");
+    tcase_add_test(tc2, cartridge_type_err);
+    tcase_add_test(tc2, cartridge_shared_rom_exec);
+    tcase_add_test(tc2, cartridge_rom_id_exec);
+    tcase_add_test(tc2, cartridge_no_mbc_exec);
+    tcase_add_test(tc2, cartridge_mbc1_exec);
+    tcase_add_test(tc2, cartridge_mbc3_exec);
+    tcase_add_test(tc2, cartridge_mbc3_cycles_exec);
+    tcase_add_test(tc2, cartridge_state_exec);
+    tcase_add_test(tc2, cartridge_mbc5_exec);
+
     return s;
 }
 
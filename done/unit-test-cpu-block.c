@@ -0,0 +1,465 @@
+/**
+ * @file unit-test-cpu-block.c
+ * @brief Unit test code for the block translator: a block must leave the
+ *        CPU in the same state as cpu_cycle run for the same number of cycles
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+// for thread-safe randomization
+#include <time.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tests.h"
+#include "error.h"
+#include "util.h"
+#include "cpu.h"
+#include "cpu-decode.h"
+#include "cpu-block.h"
+#include "gameboy.h" // WORK_RAM_START
+
+#define NB_TRIALS 20000
+
+// Both CPUs run on their own copy of the same 64 KiB memory
+static bus_t ref_bus;
+static bus_t blk_bus;
+
+#define INIT \
+    cpu_t ref; \
+    cpu_t blk; \
+    component_t ref_mem = {NULL, 0, 0}; \
+    component_t blk_mem = {NULL, 0, 0}; \
+    block_cache_t* cache = NULL; \
+    do { \
+        ck_assert_err_none(cpu_init(&ref)); \
+        ck_assert_err_none(cpu_init(&blk)); \
+        ck_assert_err_none(cpu_enable_decode_cache(&blk)); \
+        ck_assert_err_none(block_cache_create(&cache)); \
+        ck_assert_err_none(component_create(&ref_mem, BUS_SIZE)); \
+        ck_assert_err_none(component_create(&blk_mem, BUS_SIZE)); \
+        ck_assert_err_none(bus_forced_plug(ref_bus, &ref_mem, 0, BUS_SIZE - 1, 0)); \
+        ck_assert_err_none(bus_forced_plug(blk_bus, &blk_mem, 0, BUS_SIZE - 1, 0)); \
+        ref.bus = &ref_bus; \
+        blk.bus = &blk_bus; \
+    } while (0)
+
+#define FINISH \
+    do { \
+        block_cache_free(&cache); \
+        component_free(&ref_mem); \
+        component_free(&blk_mem); \
+        cpu_free(&ref); \
+        cpu_free(&blk); \
+    } while (0)
+
+/**
+ * @brief Gives both CPUs the same registers (random ones if random is set)
+ *        and the same memory, with PC at pc
+ */
+static void same_state(cpu_t *ref, cpu_t *blk, component_t *ref_mem, component_t *blk_mem,
+                       int random, addr_t pc)
+{
+    if (random)
+    {
+        for (size_t i = 0; i < BUS_SIZE; ++i)
+        {
+            blk_mem->mem->memory[i] = (data_t)rand();
+        }
+        blk->AF = (uint16_t)(rand() & 0xFFF0);
+        blk->BC = (uint16_t)rand();
+        blk->DE = (uint16_t)rand();
+        blk->HL = (uint16_t)rand();
+        blk->SP = (uint16_t)rand();
+        blk->IME = (bit_t)(rand() & 1);
+    }
+    blk->PC = pc;
+    blk->IE = 0;
+    blk->IF = 0;
+    blk->HALT = 0;
+    blk->idle_time = 0;
+    decode_cache_flush(blk->decode_cache);
+
+    memcpy(ref_mem->mem->memory, blk_mem->mem->memory, BUS_SIZE);
+    ref->AF = blk->AF;
+    ref->BC = blk->BC;
+    ref->DE = blk->DE;
+    ref->HL = blk->HL;
+    ref->SP = blk->SP;
+    ref->PC = blk->PC;
+    ref->IME = blk->IME;
+    ref->IE = blk->IE;
+    ref->IF = blk->IF;
+    ref->HALT = blk->HALT;
+    ref->idle_time = blk->idle_time;
+}
+
+/**
+ * @brief Runs the block at PC, then
+ *        cpu_cycle on the reference for the same number of cycles, and
+ *        compares both CPUs
+ *
+ * @return number of instructions executed by the block (0 if none)
+ */
+static int run_and_compare(cpu_t *ref, cpu_t *blk, component_t *ref_mem, component_t *blk_mem,
+                           block_cache_t *cache, uint64_t budget)
+{
+    uint16_t last_at = 0;
+    uint8_t last_cycles = 0;
+    ck_assert_err_none(block_run(cache, blk, budget, &last_at, &last_cycles));
+    if (last_cycles == 0)
+    {
+        ck_assert_int_eq(blk->PC, ref->PC);
+        return 0;
+    }
+    ck_assert_uint_lt(last_at, budget);
+    blk->idle_time = (uint8_t)(last_cycles - 1);
+
+    for (unsigned i = 0; i <= last_at; ++i)
+    {
+        ck_assert_err_none(cpu_cycle(ref));
+    }
+
+    ck_assert_msg(ref->AF == blk->AF && ref->BC == blk->BC && ref->DE == blk->DE && ref->HL == blk->HL,
+                  "registers differ (block at %04" PRIX16 ")", ref->PC);
+    ck_assert_msg(ref->PC == blk->PC && ref->SP == blk->SP, "PC or SP differ");
+    ck_assert_msg(ref->idle_time == blk->idle_time, "idle_time differ (%u vs %u)", ref->idle_time, blk->idle_time);
+    ck_assert_msg(memcmp(ref_mem->mem->memory, blk_mem->mem->memory, BUS_SIZE) == 0, "memories differ");
+    return 1;
+}
+
+START_TEST(block_run_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    cpu_t cpu;
+    zero_init_var(cpu);
+    block_cache_t* cache = NULL;
+    uint16_t at = 0;
+    uint8_t cycles = 0;
+
+    ck_assert_bad_param(block_cache_create(NULL));
+    ck_assert_err_none(block_cache_create(&cache));
+    ck_assert_bad_param(block_run(NULL, &cpu, 100, &at, &cycles));
+    ck_assert_bad_param(block_run(cache, NULL, 100, &at, &cycles));
+    // no bus, no decode cache
+    ck_assert_bad_param(block_run(cache, &cpu, 100, &at, &cycles));
+    ck_assert_ptr_eq(block_cache_lookup(cache, &cpu, 0), NULL);
+    ck_assert_int_eq(block_length(NULL), 0);
+
+    block_cache_free(&cache);
+    ck_assert_ptr_eq(cache, NULL);
+    block_cache_free(NULL);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(block_run_random)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    int ran = 0;
+    for (int trial = 0; trial < NB_TRIALS; ++trial)
+    {
+        // Random code anywhere it may be cached, random data everywhere:
+        // exercises the I/O, ROM and self-modifying code exits as well
+        addr_t pc = (addr_t)rand();
+        while (!decode_cacheable(pc))
+        {
+            pc = (addr_t)rand();
+        }
+        same_state(&ref, &blk, &ref_mem, &blk_mem, 1, pc);
+        ran += run_and_compare(&ref, &blk, &ref_mem, &blk_mem, cache, UINT64_MAX);
+    }
+    ck_assert_int_gt(ran, NB_TRIALS / 2);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(block_run_loop)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    // LD A, 5 ; CP 5 ; JR NZ, -6 ; LD B, 1 ; LD C, 2 ; INC (HL) ; XOR A ; JR Z, -14
+    const data_t code[] = { 0x3E, 0x05, 0xFE, 0x05, 0x20, 0xFA, 0x06, 0x01, 0x0E, 0x02, 0x34, 0xAF, 0x28, 0xF2 };
+    memset(blk_mem.mem->memory, 0, BUS_SIZE);
+    memcpy(&blk_mem.mem->memory[WORK_RAM_START], code, sizeof(code));
+    blk.HL = WORK_RAM_START + 0x100;
+    blk.SP = WORK_RAM_END;
+    same_state(&ref, &blk, &ref_mem, &blk_mem, 0, WORK_RAM_START);
+
+    // The comparison does not depend on constants: one block up to JR Z
+    ck_assert_int_eq(run_and_compare(&ref, &blk, &ref_mem, &blk_mem, cache, UINT64_MAX), 1);
+    block_t* b = block_cache_lookup(cache, &blk, WORK_RAM_START);
+    ck_assert_ptr_ne(b, NULL);
+    ck_assert_int_eq(block_length(b), 8);
+    ck_assert_int_eq(blk.PC, WORK_RAM_START);
+
+    // Second run from the cache
+    blk.idle_time = 0;
+    while (ref.idle_time != 0)
+    {
+        ck_assert_err_none(cpu_cycle(&ref));
+    }
+    ck_assert_int_eq(run_and_compare(&ref, &blk, &ref_mem, &blk_mem, cache, UINT64_MAX), 1);
+    ck_assert_ptr_eq(block_cache_lookup(cache, &blk, WORK_RAM_START), b);
+
+    // Not enough cycles before the next event
+    blk.idle_time = 0;
+    while (ref.idle_time != 0)
+    {
+        ck_assert_err_none(cpu_cycle(&ref));
+    }
+    ck_assert_int_eq(run_and_compare(&ref, &blk, &ref_mem, &blk_mem, cache, 10), 0);
+
+    // Writing to its code invalidates the block
+    ck_assert_err_none(bus_write(blk_bus, WORK_RAM_START + 1, 0x06));
+    decode_cache_invalidate(blk.decode_cache, WORK_RAM_START + 1);
+    ck_assert_ptr_eq(block_cache_lookup(cache, &blk, WORK_RAM_START), NULL);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(block_run_self_modifying)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    // LD HL, pc + 7 ; LD (HL), 0x3C (INC A) ; NOP (patched) ; JR -9
+    const addr_t pc = WORK_RAM_START;
+    const data_t code[] = { 0x21, lsb8(pc + 7), msb8(pc + 7), 0x36, 0x3C, 0x00, 0x00, 0x00, 0x18, 0xF6 };
+    memset(blk_mem.mem->memory, 0, BUS_SIZE);
+    memcpy(&blk_mem.mem->memory[pc], code, sizeof(code));
+    same_state(&ref, &blk, &ref_mem, &blk_mem, 0, pc);
+
+    // The block stops right after its code has been modified
+    ck_assert_int_eq(run_and_compare(&ref, &blk, &ref_mem, &blk_mem, cache, UINT64_MAX), 1);
+    ck_assert_int_eq(blk.PC, pc + 5);
+    ck_assert_ptr_eq(block_cache_lookup(cache, &blk, pc), NULL);
+
+    // and the patched instruction is run by the next block
+    blk.idle_time = 0;
+    while (ref.idle_time != 0)
+    {
+        ck_assert_err_none(cpu_cycle(&ref));
+    }
+    ck_assert_int_eq(run_and_compare(&ref, &blk, &ref_mem, &blk_mem, cache, UINT64_MAX), 1);
+    ck_assert_int_eq(blk.A, 1);
+    ck_assert_int_eq(blk.PC, pc);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(block_run_interrupts_halt)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    uint16_t at = 0;
+    uint8_t cycles = 0;
+
+    memset(blk_mem.mem->memory, 0, BUS_SIZE);
+    same_state(&ref, &blk, &ref_mem, &blk_mem, 0, WORK_RAM_START);
+
+    // An interrupt to serve
+    blk.IME = 1;
+    blk.IE = 0x01;
+    blk.IF = 0x01;
+    ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+    ck_assert_int_eq(cycles, 0);
+
+    // Halted
+    blk.IME = 0;
+    blk.HALT = 1;
+    ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+    ck_assert_int_eq(cycles, 0);
+
+    // HALT, EI, DI and RETI are left to cpu_cycle
+    blk.HALT = 0;
+    const data_t controls[] = { 0x76, 0xFB, 0xF3, 0xD9, 0x10 };
+    for (size_t i = 0; i < sizeof(controls); ++i)
+    {
+        blk_mem.mem->memory[WORK_RAM_START] = controls[i];
+        decode_cache_flush(blk.decode_cache);
+        ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+        ck_assert_int_eq(cycles, 0);
+        ck_assert_int_eq(blk.PC, WORK_RAM_START);
+        ck_assert_ptr_ne(block_cache_lookup(cache, &blk, WORK_RAM_START), NULL);
+        ck_assert_int_eq(block_length(block_cache_lookup(cache, &blk, WORK_RAM_START)), 0);
+    }
+
+    // I/O registers as well
+    const data_t io[] = { 0xE0, 0x44 }; // LDH (0x44), A
+    memcpy(&blk_mem.mem->memory[WORK_RAM_START], io, sizeof(io));
+    decode_cache_flush(blk.decode_cache);
+    ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+    ck_assert_int_eq(cycles, 0);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(block_run_budget)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    uint16_t at = 0;
+    uint8_t cycles = 0;
+
+    // Only NOPs: every block is as long as a block can be
+    memset(blk_mem.mem->memory, 0, BUS_SIZE);
+    same_state(&ref, &blk, &ref_mem, &blk_mem, 0, WORK_RAM_START);
+
+    // Refused for the budget: its instructions are left to cpu_cycle
+    ck_assert_err_none(block_run(cache, &blk, 1, &at, &cycles));
+    ck_assert_int_eq(cycles, 0);
+    ck_assert_int_eq(blk.PC, WORK_RAM_START);
+    ck_assert_ptr_ne(block_cache_lookup(cache, &blk, WORK_RAM_START), NULL);
+
+    // and no block is translated at their addresses
+    for (addr_t pc = WORK_RAM_START + 1; pc < WORK_RAM_START + BLOCK_MAX_INSTR; ++pc)
+    {
+        blk.PC = pc;
+        ck_assert_err_none(block_run(cache, &blk, 1, &at, &cycles));
+        ck_assert_int_eq(cycles, 0);
+        ck_assert_ptr_eq(block_cache_lookup(cache, &blk, pc), NULL);
+    }
+
+    // Past its end, blocks are translated again
+    blk.PC = WORK_RAM_START + BLOCK_MAX_INSTR;
+    ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+    ck_assert_int_eq(blk.PC, WORK_RAM_START + 2 * BLOCK_MAX_INSTR);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(block_cache_conflict_full)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    uint16_t at = 0;
+    uint8_t cycles = 0;
+
+    // Only NOPs: every block is as long as a block can be
+    memset(blk_mem.mem->memory, 0, BUS_SIZE);
+    same_state(&ref, &blk, &ref_mem, &blk_mem, 0, WORK_RAM_START);
+
+    // A set holds the last BLOCK_CACHE_WAYS blocks translated in it
+    for (addr_t way = 0; way <= BLOCK_CACHE_WAYS; ++way)
+    {
+        blk.PC = (addr_t)(WORK_RAM_START + way * BLOCK_CACHE_SETS);
+        blk.idle_time = 0;
+        ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+        ck_assert_int_eq(blk.PC, WORK_RAM_START + way * BLOCK_CACHE_SETS + BLOCK_MAX_INSTR);
+    }
+    ck_assert_ptr_eq(block_cache_lookup(cache, &blk, WORK_RAM_START), NULL);
+    for (addr_t way = 1; way <= BLOCK_CACHE_WAYS; ++way)
+    {
+        ck_assert_ptr_ne(block_cache_lookup(cache, &blk, (addr_t)(WORK_RAM_START + way * BLOCK_CACHE_SETS)), NULL);
+    }
+
+    // The code ring overflows: only the oldest blocks are dropped
+    const addr_t oldest = WORK_RAM_START + BLOCK_CACHE_SETS;
+    addr_t pc = WORK_RAM_START;
+    while (block_cache_lookup(cache, &blk, oldest) != NULL && pc < WORK_RAM_END - BLOCK_MAX_INSTR)
+    {
+        ++pc;
+        blk.PC = pc;
+        blk.idle_time = 0;
+        ck_assert_err_none(block_run(cache, &blk, UINT64_MAX, &at, &cycles));
+        ck_assert_int_eq(blk.PC, pc + BLOCK_MAX_INSTR);
+    }
+    ck_assert_ptr_eq(block_cache_lookup(cache, &blk, oldest), NULL);
+    ck_assert_ptr_ne(block_cache_lookup(cache, &blk, (addr_t)(oldest + BLOCK_CACHE_SETS)), NULL);
+    ck_assert_int_eq(block_length(block_cache_lookup(cache, &blk, pc)), BLOCK_MAX_INSTR);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+
+// ======================================================================
+Suite* cpu_block_test_suite()
+{
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+    srand(time(NULL) ^ getpid() ^ pthread_self());
+#pragma GCC diagnostic pop
+
+    Suite* s = suite_create("cpu-block.c Tests");
+
+    Add_Case(s, tc1, "Block Translator Tests");
+    tcase_add_test(tc1, block_run_err);
+    tcase_add_test(tc1, block_run_random);
+    tcase_add_test(tc1, block_run_loop);
+    tcase_add_test(tc1, block_run_self_modifying);
+    tcase_add_test(tc1, block_run_interrupts_halt);
+    tcase_add_test(tc1, block_run_budget);
+    tcase_add_test(tc1, block_cache_conflict_full);
+
+    return s;
+}
+
+TEST_SUITE(cpu_block_test_suite)
@@ -0,0 +1,271 @@
+/**
+ * @file unit-test-cpu-decode.c
+ * @brief Unit test code for the decode cache and related functions
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+// for thread-safe randomization
+#include <time.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "tests.h"
+#include "util.h"
+#include "error.h"
+#include "cpu.h"
+#include "cpu-storage.h"
+#include "cpu-decode.h"
+#include "gameboy.h" // WORK_RAM_START
+
+#define INIT \
+    decode_cache_t* cache = NULL; \
+    ck_assert_err_none(decode_cache_create(&cache))
+
+#define FINISH \
+    decode_cache_free(&cache); \
+    ck_assert_ptr_eq(cache, NULL)
+
+START_TEST(decode_cache_create_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    ck_assert_bad_param(decode_cache_create(NULL));
+    ck_assert_ptr_eq(decode_cache_lookup(NULL, 0), NULL);
+    ck_assert_ptr_eq(decode_cache_slot(NULL, 0), NULL);
+
+    // must not crash
+    decode_cache_invalidate(NULL, 0);
+    decode_cache_flush(NULL);
+    decode_cache_set_bank(NULL, 1);
+    decode_cache_free(NULL);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(decode_cache_lookup_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START), NULL);
+
+    decoded_instr_t* di = decode_cache_slot(cache, WORK_RAM_START);
+    ck_assert_ptr_ne(di, NULL);
+    di->valid = 1;
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START), di);
+
+    // OAM and registers are written behind the CPU's back
+    ck_assert_ptr_eq(decode_cache_slot(cache, GRAPH_RAM_START), NULL);
+    ck_assert_ptr_eq(decode_cache_slot(cache, REGISTERS_START), NULL);
+    ck_assert_ptr_eq(decode_cache_slot(cache, REG_IE), NULL);
+    ck_assert_ptr_ne(decode_cache_slot(cache, HIGH_RAM_START), NULL);
+
+    decode_cache_flush(cache);
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START), NULL);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(decode_cache_invalidate_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    for (addr_t a = WORK_RAM_START; a < WORK_RAM_START + 4; ++a)
+    {
+        decode_cache_slot(cache, a)->valid = 1;
+    }
+
+    // Every instruction which may contain the written byte is dropped
+    decode_cache_invalidate(cache, WORK_RAM_START + 2);
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START), NULL);
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START + 1), NULL);
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START + 2), NULL);
+    ck_assert_ptr_ne(decode_cache_lookup(cache, WORK_RAM_START + 3), NULL);
+
+    // Writing through the echo also modifies the work RAM
+    decode_cache_invalidate(cache, ECHO_RAM_START + 3);
+    ck_assert_ptr_eq(decode_cache_lookup(cache, WORK_RAM_START + 3), NULL);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(decode_cache_bank_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    // not BANK_ROM0_START, which shares the slot of BANK_ROM1_START
+    decode_cache_slot(cache, BANK_ROM0_START + 1)->valid = 1;
+    decode_cache_slot(cache, BANK_ROM1_START)->valid = 1;
+
+    decode_cache_set_bank(cache, 2);
+    ck_assert_ptr_ne(decode_cache_lookup(cache, BANK_ROM0_START + 1), NULL);
+    ck_assert_ptr_eq(decode_cache_lookup(cache, BANK_ROM1_START), NULL);
+
+    decode_cache_set_bank(cache, 0);
+    ck_assert_ptr_ne(decode_cache_lookup(cache, BANK_ROM1_START), NULL);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(decode_cache_conflict_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+
+    // Both share a slot until the cache grows
+    const addr_t a = WORK_RAM_START;
+    const addr_t b = WORK_RAM_START + DECODE_MIN_SLOTS;
+
+    decode_cache_slot(cache, a)->valid = 1;
+    decode_cache_slot(cache, b)->valid = 1;
+    ck_assert_ptr_eq(decode_cache_lookup(cache, a), NULL);
+    ck_assert_ptr_ne(decode_cache_lookup(cache, b), NULL);
+
+    // Invalidating one does not drop the other
+    decode_cache_invalidate(cache, a);
+    ck_assert_ptr_ne(decode_cache_lookup(cache, b), NULL);
+
+    for (int i = 0; i < 2 * DECODE_MIN_SLOTS; ++i)
+    {
+        decode_cache_slot(cache, i % 2 ? b : a)->valid = 1;
+    }
+    decode_cache_slot(cache, a)->valid = 1;
+    decode_cache_slot(cache, b)->valid = 1;
+    ck_assert_ptr_ne(decode_cache_lookup(cache, a), NULL);
+    ck_assert_ptr_ne(decode_cache_lookup(cache, b), NULL);
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(decode_cache_self_modifying_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    cpu_t cpu;
+    zero_init_var(cpu);
+    bus_t bus = {0};
+    component_t wram = {NULL, 0, 0};
+
+    ck_assert_err_none(cpu_init(&cpu));
+    ck_assert_err_none(cpu_enable_decode_cache(&cpu));
+    ck_assert_err_none(cpu_plug(&cpu, &bus));
+    ck_assert_err_none(component_create(&wram, MEM_SIZE(WORK_RAM)));
+    ck_assert_err_none(bus_plug(bus, &wram, WORK_RAM_START, WORK_RAM_END));
+
+    // LD A, 0x12 ; JP WORK_RAM_START
+    const data_t code[] = { 0x3E, 0x12, 0xC3, lsb8(WORK_RAM_START), msb8(WORK_RAM_START) };
+    for (size_t i = 0; i < sizeof(code); ++i)
+    {
+        ck_assert_err_none(cpu_write_at_idx(&cpu, (addr_t)(WORK_RAM_START + i), code[i]));
+    }
+    cpu.PC = WORK_RAM_START;
+
+    ck_assert_err_none(cpu_cycle(&cpu));
+    ck_assert_int_eq(cpu.A, 0x12);
+#ifndef CPU_THREADED
+    // The threaded interpreter does not go through the decode cache
+    ck_assert_ptr_ne(decode_cache_lookup(cpu.decode_cache, WORK_RAM_START), NULL);
+#endif
+    while (cpu.PC != WORK_RAM_START)
+    {
+        ck_assert_err_none(cpu_cycle(&cpu));
+    }
+
+    // Patch the immediate operand of the cached instruction
+    ck_assert_err_none(cpu_write_at_idx(&cpu, WORK_RAM_START + 1, 0x34));
+#ifndef CPU_THREADED
+    ck_assert_ptr_eq(decode_cache_lookup(cpu.decode_cache, WORK_RAM_START), NULL);
+#endif
+    while (cpu.idle_time != 0)
+    {
+        ck_assert_err_none(cpu_cycle(&cpu));
+    }
+    ck_assert_err_none(cpu_cycle(&cpu));
+    ck_assert_int_eq(cpu.A, 0x34);
+
+    bus_unplug(bus, &wram);
+    component_free(&wram);
+    cpu_free(&cpu);
+    ck_assert_ptr_eq(cpu.decode_cache, NULL);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+
+// ======================================================================
+Suite* cpu_decode_test_suite()
+{
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+    srand(time(NULL) ^ getpid() ^ pthread_self());
+#pragma GCC diagnostic pop
+
+    Suite* s = suite_create("cpu-decode.c Tests");
+
+    Add_Case(s, tc1, "Decode Cache Tests");
+    tcase_add_test(tc1, decode_cache_create_err);
+    tcase_add_test(tc1, decode_cache_lookup_exec);
+    tcase_add_test(tc1, decode_cache_invalidate_exec);
+    tcase_add_test(tc1, decode_cache_bank_exec);
+    tcase_add_test(tc1, decode_cache_conflict_exec);
+
+    Add_Case(s, tc2, "Self-Modifying Code Tests");
+    tcase_add_test(tc2, decode_cache_self_modifying_exec);
+
+    return s;
+}
+
+TEST_SUITE(cpu_decode_test_suite)
@@ -0,0 +1,219 @@
+/**
+ * @file unit-test-cpu-threaded.c
+ * @brief Unit test code for the threaded interpreter: every opcode must
+ *        behave exactly as with cpu_dispatch
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+// for thread-safe randomization
+#include <time.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "tests.h"
+#include "error.h"
+#include "util.h"
+#include "opcode.h"
+#include "cpu.h"
+#include "cpu-threaded.h"
+
+#include "cpu.c" // NOTICE: include cpu.c for testing static functions
+
+#define NB_TRIALS 32
+
+// Both CPUs run on their own copy of the same random 64 KiB memory
+static bus_t ref_bus;
+static bus_t thr_bus;
+static data_t content[BUS_SIZE];
+
+#define INIT \
+    cpu_t ref; \
+    cpu_t thr; \
+    component_t ref_mem = {NULL, 0, 0}; \
+    component_t thr_mem = {NULL, 0, 0}; \
+    do { \
+        ck_assert_err_none(cpu_init(&ref)); \
+        ck_assert_err_none(cpu_init(&thr)); \
+        ck_assert_err_none(component_create(&ref_mem, BUS_SIZE)); \
+        ck_assert_err_none(component_create(&thr_mem, BUS_SIZE)); \
+        ck_assert_err_none(bus_forced_plug(ref_bus, &ref_mem, 0, BUS_SIZE - 1, 0)); \
+        ck_assert_err_none(bus_forced_plug(thr_bus, &thr_mem, 0, BUS_SIZE - 1, 0)); \
+        ref.bus = &ref_bus; \
+        thr.bus = &thr_bus; \
+    } while (0)
+
+#define FINISH \
+    do { \
+        component_free(&ref_mem); \
+        component_free(&thr_mem); \
+        cpu_free(&ref); \
+        cpu_free(&thr); \
+    } while (0)
+
+/**
+ * @brief Gives both CPUs (and their memories) the same random state,
+ *        with the given instruction at PC
+ */
+static void random_state(cpu_t *ref, cpu_t *thr, component_t *ref_mem, component_t *thr_mem,
+                         opcode_kind kind, opcode_t op)
+{
+    for (size_t i = 0; i < BUS_SIZE; ++i)
+    {
+        content[i] = (data_t)rand();
+    }
+
+    ref->AF = (uint16_t)(rand() & 0xFFF0);
+    ref->BC = (uint16_t)rand();
+    ref->DE = (uint16_t)rand();
+    ref->HL = (uint16_t)rand();
+    ref->SP = (uint16_t)rand();
+    ref->PC = (uint16_t)(rand() % (BUS_SIZE - 3));
+    ref->IME = (bit_t)(rand() & 1);
+    ref->HALT = 0;
+    ref->idle_time = 0;
+    ref->write_listener = 0;
+
+    if (kind == PREFIXED)
+    {
+        content[ref->PC] = PREFIXED;
+        content[ref->PC + 1] = op;
+    }
+    else
+    {
+        content[ref->PC] = op;
+    }
+
+    memcpy(ref_mem->mem->memory, content, BUS_SIZE);
+    memcpy(thr_mem->mem->memory, content, BUS_SIZE);
+
+    thr->AF = ref->AF;
+    thr->BC = ref->BC;
+    thr->DE = ref->DE;
+    thr->HL = ref->HL;
+    thr->SP = ref->SP;
+    thr->PC = ref->PC;
+    thr->IME = ref->IME;
+    thr->HALT = ref->HALT;
+    thr->idle_time = ref->idle_time;
+    thr->write_listener = ref->write_listener;
+}
+
+/**
+ * @brief Runs one instruction on both CPUs and compares their states
+ */
+static void compare_on(const instruction_t *table, opcode_kind kind)
+{
+    INIT;
+
+    for (int op = 0; op < 256; ++op)
+    {
+        const instruction_t *lu = &table[op];
+        if (lu->family == UNKN || (kind == DIRECT && op == PREFIXED))
+        {
+            continue;
+        }
+
+        for (int trial = 0; trial < NB_TRIALS; ++trial)
+        {
+            random_state(&ref, &thr, &ref_mem, &thr_mem, kind, (opcode_t)op);
+
+            ck_assert_err_none(cpu_dispatch(lu, &ref));
+            ck_assert_err_none(cpu_step_threaded(&thr));
+
+            ck_assert_msg(ref.AF == thr.AF && ref.BC == thr.BC && ref.DE == thr.DE && ref.HL == thr.HL,
+                          "opcode %02X (%s): registers differ", op, kind == DIRECT ? "direct" : "prefixed");
+            ck_assert_msg(ref.PC == thr.PC && ref.SP == thr.SP,
+                          "opcode %02X (%s): PC or SP differ", op, kind == DIRECT ? "direct" : "prefixed");
+            ck_assert_msg(ref.IME == thr.IME && ref.HALT == thr.HALT && ref.idle_time == thr.idle_time,
+                          "opcode %02X (%s): IME, HALT or idle_time differ", op, kind == DIRECT ? "direct" : "prefixed");
+            ck_assert_msg(ref.write_listener == thr.write_listener,
+                          "opcode %02X (%s): write_listener differ", op, kind == DIRECT ? "direct" : "prefixed");
+            ck_assert_msg(memcmp(ref_mem.mem->memory, thr_mem.mem->memory, BUS_SIZE) == 0,
+                          "opcode %02X (%s): memories differ", op, kind == DIRECT ? "direct" : "prefixed");
+        }
+    }
+
+    FINISH;
+}
+
+START_TEST(cpu_step_threaded_direct)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    compare_on(instruction_direct, DIRECT);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cpu_step_threaded_prefixed)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    compare_on(instruction_prefixed, PREFIXED);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(cpu_step_threaded_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    random_state(&ref, &thr, &ref_mem, &thr_mem, DIRECT, 0xD3);
+    ck_assert_int_eq(cpu_step_threaded(&thr), ERR_INSTR);
+
+    // LD (HL), A on an unmapped address
+    random_state(&ref, &thr, &ref_mem, &thr_mem, DIRECT, 0x77);
+    thr_bus[thr.HL] = NULL;
+    ck_assert_bad_param(cpu_step_threaded(&thr));
+
+    FINISH;
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+
+// ======================================================================
+Suite* cpu_threaded_test_suite()
+{
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+    srand(time(NULL) ^ getpid() ^ pthread_self());
+#pragma GCC diagnostic pop
+
+    Suite* s = suite_create("cpu-threaded.c Tests");
+
+    Add_Case(s, tc1, "Threaded Interpreter Tests");
+    tcase_add_test(tc1, cpu_step_threaded_direct);
+    tcase_add_test(tc1, cpu_step_threaded_prefixed);
+    tcase_add_test(tc1, cpu_step_threaded_err);
+
+    return s;
+}
+
+TEST_SUITE(cpu_threaded_test_suite)
@@ -490,6 +490,124 @@ START_TEST(test_cpu_sp_exec)
 }
 END_TEST
 
+START_TEST(test_cpu_watch)
+{
+    // ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    size_t size = 0x100;
+    add_bus(cpu, size);
+    static bus_watch_t watch;
+    zero_init_var(watch);
+
+    ck_assert_int_eq(cpu_use_watch(NULL, &watch), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(cpu_use_watch(&cpu, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(cpu_use_watch(&cpu, &watch), ERR_NONE);
+    ck_assert_int_eq(bus_watch_add(&watch, 0x10, 0x1F, (bus_watch_fn)1, NULL), ERR_NONE);
+
+    // Unwatched writes are not queued
+    ck_assert_int_eq(cpu_write_at_idx(&cpu, 0x20, 1), ERR_NONE);
+    ck_assert_int_eq(watch.nb_written, 0);
+
+    // Both bytes of a push are queued
+    cpu.SP = 0x20;
+    ck_assert_int_eq(cpu_SP_push(&cpu, 0xBEEF), ERR_NONE);
+    ck_assert_int_eq(watch.nb_written, 2);
+    ck_assert_int_eq(watch.written[0], 0x1E);
+    ck_assert_int_eq(watch.written[1], 0x1F);
+
+    // The queue is emptied by each cycle
+    ck_assert_int_eq(cpu_write_at_idx(&cpu, 0x10, 1), ERR_NONE);
+    ck_assert_int_eq(watch.nb_written, 3);
+    cpu.idle_time = 1;
+    ck_assert_int_eq(cpu_cycle(&cpu), ERR_NONE);
+    ck_assert_int_eq(watch.nb_written, 0);
+
+    finish();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+// 8-bit arithmetic and logic opcodes, and some others reading or writing F
+static const opcode_t lazy_opcodes[] = {
+    0x04, 0x05, 0x0C, 0x0D, 0x14, 0x15, 0x1C, 0x1D,
+    0x24, 0x25, 0x2C, 0x2D, 0x34, 0x35, 0x3C, 0x3D,
+    0xC6, 0xCE, 0xD6, 0xDE, 0xE6, 0xEE, 0xF6, 0xFE,
+    0x07, 0x17, 0x1F, 0x27, 0x2F, 0x37, 0x3F, 0x09
+};
+
+START_TEST(test_cpu_lazy_flags)
+{
+    // ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    add_bus(cpu, BUS_SIZE);
+    cpu_t lazy;
+    zero_init_var(lazy);
+    bus_t lazy_bus = {0};
+    component_t lazy_c = {NULL, 0, 0};
+    ck_assert_int_eq(component_create(&lazy_c, BUS_SIZE), ERR_NONE);
+    ck_assert_int_eq(cpu_init(&lazy), ERR_NONE);
+    ck_assert_int_eq(cpu_plug(&lazy, &lazy_bus), ERR_NONE);
+    ck_assert_int_eq(bus_forced_plug(lazy_bus, &lazy_c, 0, BUS_SIZE - 1, 0), ERR_NONE);
+
+    ck_assert_int_eq(cpu_enable_lazy_flags(NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(cpu_enable_lazy_flags(&lazy), ERR_NONE);
+
+    for (int trial = 0; trial < 2000; ++trial) {
+        FILL_REG(cpu, (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand(),
+                 (uint8_t)rand(), (uint8_t)(rand() & 0xF0), (uint8_t)rand(), (uint8_t)rand());
+        lazy.AF = cpu.AF;
+        lazy.BC = cpu.BC;
+        lazy.DE = cpu.DE;
+        lazy.HL = cpu.HL;
+
+        // a sequence of instructions, so that pending flags are read and overwritten
+        const int length = 1 + rand() % 8;
+        for (int k = 0; k < length; ++k) {
+            const opcode_t op = rand() % 2 ? (opcode_t)(0x80 + rand() % 0x40) :
+                                lazy_opcodes[(size_t)rand() % (sizeof(lazy_opcodes) / sizeof(*lazy_opcodes))];
+            cpu.PC = lazy.PC = (addr_t)rand();
+            const data_t imm = (data_t)rand();
+            const data_t at_hl = (data_t)rand();
+            CPU_BUS_V_AT(cpu, (addr_t)(cpu.PC + 1)) = imm;
+            CPU_BUS_V_AT(lazy, (addr_t)(lazy.PC + 1)) = imm;
+            CPU_BUS_V_AT(cpu, cpu.HL) = at_hl;
+            CPU_BUS_V_AT(lazy, lazy.HL) = at_hl;
+            // as done by cpu_dispatch before each instruction
+            cpu.alu.value = lazy.alu.value = 0;
+            cpu.alu.flags = lazy.alu.flags = 0;
+
+            ck_assert_int_eq(cpu_dispatch_alu(&instruction_direct[op], &cpu), ERR_NONE);
+            ck_assert_int_eq(cpu_dispatch_alu(&instruction_direct[op], &lazy), ERR_NONE);
+
+            ck_assert_msg(cpu_flags_get(&lazy) == cpu.F, "F differs after opcode %02X (%02X vs %02X)",
+                          op, cpu_flags_get(&lazy), cpu.F);
+            ck_assert_msg(cpu.A == lazy.A && cpu.BC == lazy.BC && cpu.DE == lazy.DE && cpu.HL == lazy.HL,
+                          "registers differ after opcode %02X", op);
+            ck_assert_int_eq(cpu.PC, lazy.PC);
+            ck_assert_int_eq(CPU_BUS_V_AT(cpu, cpu.HL), CPU_BUS_V_AT(lazy, lazy.HL));
+        }
+
+        cpu_flags_sync(&lazy);
+        ck_assert_int_eq(lazy.lazy.op, LAZY_NONE);
+        ck_assert_int_eq(lazy.AF, cpu.AF);
+    }
+
+    component_free(&lazy_c);
+    cpu_free(&lazy);
+    finish();
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
 
 START_TEST(test_cpu_cycle_err)
 {
@@ -567,11 +685,15 @@ Suite* cpu_test_suite()
     tcase_add_test(tc4, test_cpu_bus_after_op_macro);
     tcase_add_test(tc4, test_cpu_sp_exec);
     tcase_add_test(tc4, test_cpu_sp_exec);
+    tcase_add_test(tc4, test_cpu_watch);
 
     Add_Case(s, tc5, "Cpu Cycle Tests");
     tcase_add_test(tc5, test_cpu_cycle_err);
     tcase_add_test(tc5, test_cpu_cycle_exec);
 
+    Add_Case(s, tc6, "Cpu Lazy Flags Tests");
+    tcase_add_test(tc6, test_cpu_lazy_flags);
+
     return s;
 }
 
@@ -16,6 +16,7 @@
 #include <check.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <string.h>
 
 #include "tests.h"
 #include "bus.h"
@@ -23,6 +24,7 @@
 #include "component.h"
 #include "error.h"
 #include "gameboy.h"
+#include "tests-gameboy.h"
 #include "cpu-storage.h"
 
 #define INIT \
@@ -48,6 +50,285 @@ START_TEST(gameboy_create_err)
 }
 END_TEST
 
+START_TEST(gameboy_shared_roms_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* a = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* b = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(a);
+    ck_assert_ptr_nonnull(b);
+    memset(a, 0, sizeof(gameboy_t));
+    memset(b, 0, sizeof(gameboy_t));
+    ck_assert_int_eq(gameboy_create(a, "./tests/data/fibonacci.gb"), ERR_NONE);
+    ck_assert_int_eq(gameboy_create(b, "./tests/data/fibonacci.gb"), ERR_NONE);
+
+    // Only the RAM belongs to each gameboy
+    ck_assert_ptr_eq(a->bootrom.mem, b->bootrom.mem);
+    ck_assert_ptr_eq(a->cartridge.c.mem, b->cartridge.c.mem);
+    ck_assert_ptr_eq(bus_lookup(NULL, &a->pages, BOOT_ROM_START), bus_lookup(NULL, &b->pages, BOOT_ROM_START));
+    ck_assert_ptr_ne(bus_lookup(NULL, &a->pages, WORK_RAM_START), bus_lookup(NULL, &b->pages, WORK_RAM_START));
+    ck_assert_int_eq(*bus_lookup(NULL, &a->pages, BOOT_ROM_END), 0);
+
+    gameboy_free(a);
+    ck_assert_ptr_null(a->bootrom.mem);
+    ck_assert_int_eq(gameboy_run_until(b, 100000), ERR_NONE);
+    gameboy_free(b);
+    free(a);
+    free(b);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(gameboy_clone_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    const char* rom = "./tests/data/blargg_roms/01-special.gb";
+    const uint64_t cycles = 2000000;
+    gameboy_t* model = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* copy = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* fresh = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(model);
+    ck_assert_ptr_nonnull(copy);
+    ck_assert_ptr_nonnull(fresh);
+    memset(model, 0, sizeof(gameboy_t));
+    memset(fresh, 0, sizeof(gameboy_t));
+
+    ck_assert_int_eq(gameboy_clone(copy, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_clone(copy, model), ERR_BAD_PARAMETER);
+
+    ck_assert_int_eq(gameboy_create(model, rom), ERR_NONE);
+    ck_assert_int_eq(gameboy_set_serial(model, serial_ignore, NULL), ERR_NONE);
+    ck_assert_int_eq(gameboy_clone(copy, model), ERR_NONE);
+
+    // The copy only shares the ROMs with its model
+    ck_assert_ptr_eq(copy->cartridge.c.mem, model->cartridge.c.mem);
+    ck_assert_ptr_eq(copy->cpu.pages, &copy->pages);
+    ck_assert_ptr_eq(copy->screen.cpu, &copy->cpu);
+    ck_assert_ptr_eq(bus_lookup(NULL, &copy->pages, WORK_RAM_START), copy->ram.work);
+    ck_assert_ptr_eq(bus_lookup(NULL, &copy->pages, REG_LCDC), &copy->ram.registers[REG_LCDC - REGISTERS_START]);
+    ck_assert_ptr_eq(bus_lookup(NULL, &copy->pages, REG_IE), &copy->cpu.IE);
+    gameboy_free(model);
+    free(model);
+
+    // and runs like a gameboy created from the same ROM
+    ck_assert_int_eq(gameboy_create(fresh, rom), ERR_NONE);
+    ck_assert_int_eq(gameboy_set_serial(fresh, serial_ignore, NULL), ERR_NONE);
+    ck_assert_int_eq(gameboy_run_until(copy, cycles), ERR_NONE);
+    ck_assert_int_eq(gameboy_run_until(fresh, cycles), ERR_NONE);
+    ck_assert_int_eq(copy->cpu.PC, fresh->cpu.PC);
+    ck_assert_int_eq(copy->cpu.AF, fresh->cpu.AF);
+    ck_assert_int_eq(memcmp(&copy->ram, &fresh->ram, sizeof(gameboy_ram_t)), 0);
+    ck_assert_int_eq(memcmp(&copy->screen.frame, &fresh->screen.frame, sizeof(framebuffer_t)), 0);
+
+    gameboy_free(copy);
+    gameboy_free(fresh);
+    free(copy);
+    free(fresh);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(gameboy_state_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* a = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* b = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(a);
+    ck_assert_ptr_nonnull(b);
+    memset(a, 0, sizeof(gameboy_t));
+    memset(b, 0, sizeof(gameboy_t));
+    uint8_t small[16] = { 0 };
+    ck_assert_int_eq(gameboy_state_size(NULL), 0);
+    ck_assert_int_eq(gameboy_load_state(a, small, sizeof(small)), ERR_BAD_PARAMETER);
+
+    ck_assert_int_eq(gameboy_create(a, "./tests/data/fibonacci.gb"), ERR_NONE);
+    ck_assert_int_eq(gameboy_create(b, "./tests/data/blargg_roms/01-special.gb"), ERR_NONE);
+    const size_t size = gameboy_state_size(a);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(state);
+
+    ck_assert_int_eq(gameboy_save_state(NULL, state, size), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_save_state(a, NULL, size), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_save_state(a, state, size - 1), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_save_state(a, state, size), ERR_NONE);
+
+    ck_assert_int_eq(gameboy_load_state(NULL, state, size), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_load_state(a, NULL, size), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_load_state(a, small, sizeof(small)), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_load_state(a, state, size - 1), ERR_BAD_PARAMETER);
+    // of another ROM
+    ck_assert_int_eq(gameboy_load_state(b, state, size), ERR_BAD_PARAMETER);
+    // of another version
+    state[4] ^= 0xFF;
+    ck_assert_int_eq(gameboy_load_state(a, state, size), ERR_BAD_PARAMETER);
+
+    free(state);
+    gameboy_free(a);
+    gameboy_free(b);
+    free(a);
+    free(b);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(gameboy_state_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    const char* rom = "./tests/data/blargg_roms/01-special.gb";
+    gameboy_t* a = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* b = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(a);
+    ck_assert_ptr_nonnull(b);
+    memset(a, 0, sizeof(gameboy_t));
+    memset(b, 0, sizeof(gameboy_t));
+    ck_assert_int_eq(gameboy_create(a, rom), ERR_NONE);
+    ck_assert_int_eq(gameboy_create(b, rom), ERR_NONE);
+    ck_assert_int_eq(gameboy_set_serial(a, serial_ignore, NULL), ERR_NONE);
+    ck_assert_int_eq(gameboy_set_serial(b, serial_ignore, NULL), ERR_NONE);
+
+    const size_t size = gameboy_state_size(a);
+    uint8_t* start = malloc(size);
+    uint8_t* end = malloc(size);
+    uint8_t* again = malloc(size);
+    ck_assert_ptr_nonnull(start);
+    ck_assert_ptr_nonnull(end);
+    ck_assert_ptr_nonnull(again);
+
+    ck_assert_int_eq(gameboy_run_until(a, 1000000), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(a, start, size), ERR_NONE);
+    ck_assert_int_eq(gameboy_run_until(a, 3000000), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(a, end, size), ERR_NONE);
+
+    // Going back runs the same way, on the same gameboy or on another one
+    ck_assert_int_eq(gameboy_load_state(a, start, size), ERR_NONE);
+    ck_assert_int_eq(a->cycles, 1000000);
+    ck_assert_int_eq(gameboy_save_state(a, again, size), ERR_NONE);
+    ck_assert_int_eq(memcmp(start, again, size), 0);
+    ck_assert_int_eq(gameboy_run_until(a, 3000000), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(a, again, size), ERR_NONE);
+    ck_assert_int_eq(memcmp(end, again, size), 0);
+
+    ck_assert_int_eq(gameboy_load_state(b, start, size), ERR_NONE);
+    ck_assert_ptr_eq(b->screen.cpu, &b->cpu);
+    ck_assert_int_eq(gameboy_run_until(b, 3000000), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(b, again, size), ERR_NONE);
+    ck_assert_int_eq(memcmp(end, again, size), 0);
+
+    free(start);
+    free(end);
+    free(again);
+    gameboy_free(a);
+    gameboy_free(b);
+    free(a);
+    free(b);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(gameboy_state_fresh_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    const char* rom = "./tests/data/blargg_roms/01-special.gb";
+    gameboy_t* a = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    gameboy_t* b = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(a);
+    ck_assert_ptr_nonnull(b);
+    memset(a, 0x00, sizeof(gameboy_t));
+    memset(b, 0xA5, sizeof(gameboy_t));
+    ck_assert_int_eq(gameboy_create(a, rom), ERR_NONE);
+    ck_assert_int_eq(gameboy_create(b, rom), ERR_NONE);
+
+    // Every byte of the state is written: buffers filled differently end up equal
+    const size_t size = gameboy_state_size(a);
+    uint8_t* state_a = malloc(size);
+    uint8_t* state_b = malloc(size);
+    ck_assert_ptr_nonnull(state_a);
+    ck_assert_ptr_nonnull(state_b);
+    memset(state_a, 0x00, size);
+    memset(state_b, 0xFF, size);
+    ck_assert_int_eq(gameboy_save_state(a, state_a, size), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(b, state_b, size), ERR_NONE);
+    ck_assert_int_eq(memcmp(state_a, state_b, size), 0);
+
+    free(state_a);
+    free(state_b);
+    gameboy_free(a);
+    gameboy_free(b);
+    free(a);
+    free(b);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+static char serial_log[8];
+static size_t serial_len = 0;
+
+static int serial_receive(void* arg, data_t byte)
+{
+    ck_assert_ptr_eq(arg, serial_log);
+    serial_log[serial_len++] = (char) byte;
+    return ERR_NONE;
+}
+
+START_TEST(gameboy_set_serial_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    serial_len = 0;
+    ck_assert_int_eq(gameboy_create(&g, "./tests/data/fibonacci.gb"), ERR_NONE);
+
+    ck_assert_int_eq(gameboy_set_serial(NULL, serial_receive, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_set_serial(&g, NULL, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(gameboy_set_serial(&g, serial_receive, serial_log), ERR_NONE);
+
+    ck_assert_int_eq(cpu_write_at_idx(&g.cpu, BLARGG_REG, 'o'), ERR_NONE);
+    ck_assert_int_eq(bus_watch_dispatch(&g.watch), ERR_NONE);
+    ck_assert_int_eq(cpu_write_at_idx(&g.cpu, BLARGG_REG, 'k'), ERR_NONE);
+    ck_assert_int_eq(bus_watch_dispatch(&g.watch), ERR_NONE);
+    ck_assert_int_eq(serial_len, 2);
+    ck_assert_int_eq(memcmp(serial_log, "ok", 2), 0);
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
 Suite* bus_test_suite()
 {
 
@@ -62,6 +343,12 @@ Suite* bus_test_suite()
     Add_Case(s, tc2, "gameboy tests");
 
     tcase_add_test(tc2, gameboy_create_err);
+    tcase_add_test(tc2, gameboy_set_serial_exec);
+    tcase_add_test(tc2, gameboy_shared_roms_exec);
+    tcase_add_test(tc2, gameboy_clone_exec);
+    tcase_add_test(tc2, gameboy_state_err);
+    tcase_add_test(tc2, gameboy_state_exec);
+    tcase_add_test(tc2, gameboy_state_fresh_exec);
 
     return s;
 }
@@ -0,0 +1,212 @@
+/**
+ * @file unit-test-handoff.c
+ * @brief Unit test code for the handoff of frames and key events between threads
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdlib.h>
+#include <check.h>
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "tests.h"
+#include "error.h"
+#include "handoff.h"
+
+#define NB_FRAMES 2000
+#define NB_EVENTS 20000
+
+// A frame whose pixels all are the low byte of its number, its number in the first 4 pixels
+static void fill_frame(framebuffer_t* fb, uint32_t n)
+{
+    memset(fb->pixels, (int) (n & 0xFF), sizeof(fb->pixels));
+    memcpy(fb->pixels[0], &n, sizeof(n));
+}
+
+static uint32_t frame_number(const framebuffer_t* fb)
+{
+    uint32_t n;
+    memcpy(&n, fb->pixels[0], sizeof(n));
+    return n;
+}
+
+// Whether the frame is whole, not partly written by the producer
+static int frame_whole(const framebuffer_t* fb)
+{
+    const uint8_t byte = (uint8_t) frame_number(fb);
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y) {
+        for (size_t x = y == 0 ? sizeof(uint32_t) : 0; x < FRAMEBUFFER_WIDTH; ++x) {
+            if (fb->pixels[y][x] != byte) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static key_event_t event_of(size_t i)
+{
+    const key_event_t event = { (gb_key_t) (i % NB_GB_KEYS), (i / NB_GB_KEYS) % 2 == 0 };
+    return event;
+}
+
+static frame_slot_t slot;
+static key_queue_t queue;
+
+static void* produce(void* arg)
+{
+    (void) arg;
+    size_t pushed = 0;
+    for (uint32_t n = 1; n <= NB_FRAMES || pushed < NB_EVENTS; ++n) {
+        if (n <= NB_FRAMES) {
+            fill_frame(frame_slot_back(&slot), n);
+            frame_slot_publish(&slot);
+        }
+        while (pushed < NB_EVENTS && key_queue_push(&queue, event_of(pushed))) {
+            ++pushed;
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+START_TEST(frame_slot_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    bool fresh = true;
+    ck_assert_int_eq(frame_slot_init(NULL), ERR_BAD_PARAMETER);
+    ck_assert_ptr_null(frame_slot_back(NULL));
+    ck_assert_ptr_null(frame_slot_latest(NULL, &fresh));
+    frame_slot_publish(NULL);
+
+    ck_assert_int_eq(frame_slot_init(&slot), ERR_NONE);
+    const framebuffer_t* front = frame_slot_latest(&slot, &fresh);
+    ck_assert(!fresh);
+    ck_assert_int_eq(frame_number(front), 0);
+
+    // The latest frame, and no other one, whatever the calls in between
+    fill_frame(frame_slot_back(&slot), 1);
+    frame_slot_publish(&slot);
+    front = frame_slot_latest(&slot, &fresh);
+    ck_assert(fresh);
+    ck_assert_int_eq(frame_number(front), 1);
+    ck_assert_ptr_ne(frame_slot_back(&slot), front);
+
+    fill_frame(frame_slot_back(&slot), 2);
+    frame_slot_publish(&slot);
+    fill_frame(frame_slot_back(&slot), 3);
+    frame_slot_publish(&slot);
+    ck_assert_ptr_ne(frame_slot_back(&slot), front);
+    front = frame_slot_latest(&slot, &fresh);
+    ck_assert(fresh);
+    ck_assert_int_eq(frame_number(front), 3);
+    front = frame_slot_latest(&slot, &fresh);
+    ck_assert(!fresh);
+    ck_assert_int_eq(frame_number(front), 3);
+    ck_assert(frame_whole(front));
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(key_queue_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    key_event_t event;
+    ck_assert_int_eq(key_queue_init(NULL), ERR_BAD_PARAMETER);
+    ck_assert(!key_queue_push(NULL, event_of(0)));
+    ck_assert(!key_queue_pop(NULL, &event));
+
+    ck_assert_int_eq(key_queue_init(&queue), ERR_NONE);
+    ck_assert(!key_queue_pop(&queue, &event));
+    ck_assert(!key_queue_pop(&queue, NULL));
+
+    // Full, then emptied in order, twice to wrap around
+    for (size_t round = 0; round < 2; ++round) {
+        for (size_t i = 0; i < KEY_QUEUE_SIZE; ++i) {
+            ck_assert(key_queue_push(&queue, event_of(i + round)));
+        }
+        ck_assert(!key_queue_push(&queue, event_of(0)));
+        for (size_t i = 0; i < KEY_QUEUE_SIZE; ++i) {
+            ck_assert(key_queue_pop(&queue, &event));
+            ck_assert_int_eq(event.key, event_of(i + round).key);
+            ck_assert_int_eq(event.pressed, event_of(i + round).pressed);
+        }
+        ck_assert(!key_queue_pop(&queue, &event));
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(handoff_threads_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    ck_assert_int_eq(frame_slot_init(&slot), ERR_NONE);
+    ck_assert_int_eq(key_queue_init(&queue), ERR_NONE);
+
+    pthread_t producer;
+    ck_assert_int_eq(pthread_create(&producer, NULL, produce, NULL), 0);
+
+    // Whole frames, newer and newer; all the events, in order
+    uint32_t last = 0;
+    size_t popped = 0;
+    while (last < NB_FRAMES || popped < NB_EVENTS) {
+        bool fresh = false;
+        const framebuffer_t* front = frame_slot_latest(&slot, &fresh);
+        const uint32_t n = frame_number(front);
+        ck_assert(fresh ? n > last : n == last);
+        if (fresh) {
+            ck_assert(frame_whole(front));
+        }
+        last = n;
+
+        key_event_t event;
+        while (key_queue_pop(&queue, &event)) {
+            ck_assert_int_eq(event.key, event_of(popped).key);
+            ck_assert_int_eq(event.pressed, event_of(popped).pressed);
+            ++popped;
+        }
+        if (!fresh) {
+            sched_yield();
+        }
+    }
+    ck_assert_int_eq(pthread_join(producer, NULL), 0);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+Suite* handoff_test_suite()
+{
+    Suite* s = suite_create("handoff.c Tests");
+
+    Add_Case(s, tc1, "handoff tests");
+
+    tcase_add_test(tc1, frame_slot_exec);
+    tcase_add_test(tc1, key_queue_exec);
+    tcase_add_test(tc1, handoff_threads_exec);
+
+    return s;
+}
+
+TEST_SUITE(handoff_test_suite)
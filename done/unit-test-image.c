@@ -0,0 +1,314 @@
+/**
+ * @file unit-test-image.c
+ * @brief Unit test code for the image lines written in place and for the arenas
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+// for thread-safe randomization
+#include <time.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "tests.h"
+#include "error.h"
+#include "bit_vector.h"
+#include "image.h"
+
+// ======================================================================
+// Heap allocations, counted through the linker (see -Wl,--wrap in the Makefile)
+
+static size_t heap_allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t nmemb, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    ++heap_allocations;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t nmemb, size_t size)
+{
+    ++heap_allocations;
+    return __real_calloc(nmemb, size);
+}
+
+// ======================================================================
+#define LINE_SIZE 160
+#define BG_SIZE 256
+#define LINES 144
+
+static void random_line(image_line_t* line)
+{
+    const size_t words = (line->msb->size + IMAGE_LINE_WORD_BITS - 1) / IMAGE_LINE_WORD_BITS;
+    for (size_t i = 0; i < words; ++i) {
+        ck_assert_err_none(image_line_set_word(line, i, (uint32_t) rand() ^ ((uint32_t) rand() << 16),
+                                               (uint32_t) rand() ^ ((uint32_t) rand() << 16)));
+        line->opacity->content[i] = (uint32_t) rand() ^ ((uint32_t) rand() << 16);
+    }
+}
+
+#define line_match_line(l1, l2) \
+    do { \
+        ck_assert_uint_eq((l1).msb->size, (l2).msb->size); \
+        for (size_t k = 0; k < (l1).msb->size; ++k) { \
+            ck_assert_int_eq(bit_vector_get((l1).msb, k), bit_vector_get((l2).msb, k)); \
+            ck_assert_int_eq(bit_vector_get((l1).lsb, k), bit_vector_get((l2).lsb, k)); \
+            ck_assert_int_eq(bit_vector_get((l1).opacity, k), bit_vector_get((l2).opacity, k)); \
+        } \
+    } while(0)
+
+START_TEST(image_line_to_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    image_line_t l1, l2, out;
+    zero_init_var(out);
+    ck_assert_err_none(image_line_create(&l1, LINE_SIZE));
+    ck_assert_err_none(image_line_create(&l2, BG_SIZE));
+
+    ck_assert_bad_param(image_line_create_in(NULL, LINE_SIZE, NULL));
+    ck_assert_bad_param(image_line_shift_to(NULL, l1, 1));
+    ck_assert_bad_param(image_line_shift_to(&out, l1, 1));
+    ck_assert_bad_param(image_line_shift_to(&l2, l1, 1));
+    ck_assert_bad_param(image_line_shift_to(&l1, l1, 1));
+    ck_assert_bad_param(image_line_extract_wrap_ext_to(&l1, l1, 1));
+    ck_assert_bad_param(image_line_map_colors_to(&l2, l1, DEFAULT_PALETTE));
+    ck_assert_bad_param(image_line_below_to(&l1, l1, l2));
+    ck_assert_bad_param(image_line_below_with_opacity_to(&l1, l1, l1, NULL));
+    ck_assert_bad_param(image_line_below_with_opacity_to(&l1, l1, l1, l2.opacity));
+    ck_assert_bad_param(image_line_join_to(&l1, l1, l2, 1));
+    ck_assert_bad_param(image_line_join_to(&l1, l1, l1, -1));
+    ck_assert_bad_param(image_line_join_to(&l1, l1, l1, LINE_SIZE));
+
+    image_line_free(&l1);
+    image_line_free(&l2);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(image_line_to_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    for (int t = 0; t < 50; ++t) {
+        image_line_t bg, line, other, expected, out;
+        ck_assert_err_none(image_line_create(&bg, BG_SIZE));
+        ck_assert_err_none(image_line_create(&line, LINE_SIZE));
+        ck_assert_err_none(image_line_create(&other, LINE_SIZE));
+        ck_assert_err_none(image_line_create(&out, LINE_SIZE));
+        random_line(&bg);
+        random_line(&line);
+        random_line(&other);
+        const int64_t index = rand() % (2 * BG_SIZE) - BG_SIZE;
+        const palette_t palette = (palette_t) rand();
+        const int64_t start = rand() % LINE_SIZE;
+
+        ck_assert_err_none(image_line_extract_wrap_ext(&expected, bg, index, LINE_SIZE));
+        ck_assert_err_none(image_line_extract_wrap_ext_to(&out, bg, index));
+        line_match_line(out, expected);
+        image_line_free(&expected);
+
+        ck_assert_err_none(image_line_shift(&expected, line, index));
+        ck_assert_err_none(image_line_shift_to(&out, line, index));
+        line_match_line(out, expected);
+        image_line_free(&expected);
+
+        // In place
+        ck_assert_err_none(image_line_map_colors(&expected, line, palette));
+        ck_assert_err_none(image_line_map_colors_to(&line, line, palette));
+        line_match_line(line, expected);
+        image_line_free(&expected);
+
+        ck_assert_err_none(image_line_below(&expected, line, other));
+        ck_assert_err_none(image_line_below_to(&other, line, other));
+        line_match_line(other, expected);
+        image_line_free(&expected);
+
+        ck_assert_err_none(image_line_below_with_opacity(&expected, line, other, out.opacity));
+        ck_assert_err_none(image_line_below_with_opacity_to(&line, line, other, out.opacity));
+        line_match_line(line, expected);
+        image_line_free(&expected);
+
+        ck_assert_err_none(image_line_join(&expected, line, other, start));
+        ck_assert_err_none(image_line_join_to(&other, line, other, start));
+        line_match_line(other, expected);
+        image_line_free(&expected);
+
+        image_line_free(&bg);
+        image_line_free(&line);
+        image_line_free(&other);
+        image_line_free(&out);
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(bit_vector_arena_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    bit_vector_arena_t arena;
+    ck_assert_ptr_null(bit_vector_arena_init(NULL, 0));
+    ck_assert_ptr_nonnull(bit_vector_arena_init(&arena, 64));
+    ck_assert_uint_eq(arena.allocations, 1);
+    ck_assert_ptr_null(bit_vector_arena_create(NULL, 1, 0));
+    ck_assert_ptr_null(bit_vector_arena_create(&arena, 0, 0));
+
+    bit_vector_t* ones = bit_vector_arena_create(&arena, 40, 1);
+    ck_assert_ptr_nonnull(ones);
+    ck_assert_uint_eq(ones->size, 40);
+    ck_assert_int_eq(ones->content[0], UINT32_MAX);
+    ck_assert_int_eq(ones->content[1], 0xFF);
+
+    // Grows past its capacity, then merges its chunks on reset
+    for (int i = 0; i < 100; ++i) {
+        bit_vector_t* pbv = bit_vector_arena_create(&arena, LINE_SIZE, 0);
+        ck_assert_ptr_nonnull(pbv);
+        ck_assert_int_eq(pbv->content[LINE_SIZE / IMAGE_LINE_WORD_BITS - 1], 0);
+        pbv->content[0] = 0xdeadb055;
+    }
+    ck_assert_int_eq(ones->content[0], UINT32_MAX);
+    ck_assert(arena.allocations > 1);
+
+    bit_vector_arena_reset(&arena);
+    const size_t allocations = arena.allocations;
+    for (int r = 0; r < 3; ++r) {
+        ck_assert_ptr_nonnull(bit_vector_arena_create(&arena, 40, 1));
+        for (int i = 0; i < 100; ++i) {
+            ck_assert_ptr_nonnull(bit_vector_arena_create(&arena, LINE_SIZE, 0));
+        }
+        bit_vector_arena_reset(&arena);
+        ck_assert_uint_eq(arena.allocations, allocations);
+    }
+
+    bit_vector_arena_free(&arena);
+    ck_assert_ptr_null(arena.chunks);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+/**
+ * @brief Composes a frame the way a line-based renderer would: background
+ *        scrolled and mapped, window joined over it, sprites over both.
+ *        With an arena, lines are drawn from it and it is reset at VBLANK.
+ * @return number of heap allocations during the frame
+ */
+static size_t compose_frame(image_line_t bg, image_line_t sprites, bit_vector_arena_t* arena)
+{
+    const size_t before = heap_allocations;
+    for (int64_t y = 0; y < LINES; ++y) {
+        image_line_t line, window, result;
+        if (arena == NULL) {
+            image_line_t mapped, shifted;
+            ck_assert_err_none(image_line_extract_wrap_ext(&line, bg, y + 3, LINE_SIZE));
+            ck_assert_err_none(image_line_map_colors(&mapped, line, 0x1B));
+            ck_assert_err_none(image_line_shift(&shifted, mapped, y % 7));
+            ck_assert_err_none(image_line_join(&window, mapped, shifted, 80));
+            ck_assert_err_none(image_line_below(&result, window, sprites));
+            image_line_free(&mapped);
+            image_line_free(&shifted);
+            image_line_free(&line);
+            image_line_free(&window);
+            image_line_free(&result);
+        } else {
+            // nothing to free: the lines belong to the arena
+            ck_assert_err_none(image_line_create_in(&line, LINE_SIZE, arena));
+            ck_assert_err_none(image_line_create_in(&window, LINE_SIZE, arena));
+            ck_assert_err_none(image_line_create_in(&result, LINE_SIZE, arena));
+            ck_assert_err_none(image_line_extract_wrap_ext_to(&line, bg, y + 3));
+            ck_assert_err_none(image_line_map_colors_to(&line, line, 0x1B));
+            ck_assert_err_none(image_line_shift_to(&window, line, y % 7));
+            ck_assert_err_none(image_line_join_to(&window, line, window, 80));
+            ck_assert_err_none(image_line_below_to(&result, window, sprites));
+        }
+    }
+    // VBLANK
+    bit_vector_arena_reset(arena);
+    return heap_allocations - before;
+}
+
+START_TEST(image_line_frame_allocations)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    image_line_t bg, sprites;
+    ck_assert_err_none(image_line_create(&bg, BG_SIZE));
+    ck_assert_err_none(image_line_create(&sprites, LINE_SIZE));
+    random_line(&bg);
+    random_line(&sprites);
+
+    bit_vector_arena_t arena;
+    ck_assert_ptr_nonnull(bit_vector_arena_init(&arena, 0));
+
+    size_t allocs[2][3] = { { 0 } };
+    for (int frame = 0; frame < 3; ++frame) {
+        allocs[0][frame] = compose_frame(bg, sprites, NULL);
+        allocs[1][frame] = compose_frame(bg, sprites, &arena);
+    }
+    printf("heap allocations per frame: %zu allocating lines, %zu then %zu, %zu in place with an arena\n",
+           allocs[0][2], allocs[1][0], allocs[1][1], allocs[1][2]);
+
+    ck_assert(allocs[0][2] > 0);
+    ck_assert_uint_eq(allocs[1][1], 0);
+    ck_assert_uint_eq(allocs[1][2], 0);
+
+    bit_vector_arena_free(&arena);
+    image_line_free(&bg);
+    image_line_free(&sprites);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+
+// ======================================================================
+Suite* image_test_suite()
+{
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+    srand(time(NULL) ^ getpid() ^ pthread_self());
+#pragma GCC diagnostic pop
+
+    Suite* s = suite_create("image.c Tests");
+
+    Add_Case(s, tc1, "Image Tests");
+    tcase_add_test(tc1, image_line_to_err);
+    tcase_add_test(tc1, image_line_to_exec);
+    tcase_add_test(tc1, bit_vector_arena_exec);
+    tcase_add_test(tc1, image_line_frame_allocations);
+
+    return s;
+}
+
+TEST_SUITE(image_test_suite)
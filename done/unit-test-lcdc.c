@@ -0,0 +1,600 @@
+/**
+ * @file unit-test-lcdc.c
+ * @brief Unit test code for the LCD controller and related functions
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+// for thread-safe randomization
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "tests.h"
+#include "bus.h"
+#include "cpu.h"
+#include "cpu-storage.h"
+#include "gameboy.h"
+#include "lcdc.h"
+#include "framebuffer.h"
+
+#define ROM "tests/data/fibonacci.gb"
+
+#define INIT \
+    gameboy_t g; \
+    zero_init_var(g); \
+    ck_assert_err_none(gameboy_create(&g, ROM))
+
+#define REG(addr) (*bus_lookup(NULL, &g.pages, addr))
+
+#define START 10
+
+START_TEST(lcdc_init_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    lcdc_t lcd;
+    zero_init_var(lcd);
+    ck_assert_bad_param(lcdc_init(NULL));
+    ck_assert_bad_param(lcdc_plug(NULL, NULL));
+    ck_assert_bad_param(lcdc_cycle(NULL, 0));
+    ck_assert_bad_param(lcdc_bus_listener(NULL, REG_LCDC));
+    ck_assert_bad_param(lcdc_cycle(&lcd, 0));
+    lcdc_free(NULL);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(lcdc_timing_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    lcdc_t *lcd = &g.screen;
+    REG(REG_LYC) = 5;
+    REG(REG_STAT) = 1 << STAT_REG_INT_LYC_BIT;
+    REG(REG_LCDC) = LCDC_REG_LCD_STATUS_MASK;
+    ck_assert_err_none(lcdc_bus_listener(lcd, REG_LCDC));
+
+    for (uint64_t c = START; c <= START + FRAME_TOTAL_CYCLES; ++c) {
+        ck_assert_err_none(lcdc_cycle(lcd, c));
+        const uint64_t t = c - START;
+        const uint64_t ly = (t % FRAME_TOTAL_CYCLES) / LINE_TOTAL_CYCLES;
+        const uint64_t x = t % LINE_TOTAL_CYCLES;
+        ck_assert_int_eq(REG(REG_LY), ly);
+
+        data_t mode = 1;
+        if (ly < LCD_HEIGHT) {
+            mode = x < LINE_MODE_3_START_CYCLE ? 2 : x < LINE_MODE_0_START_CYCLE ? 3 : 0;
+        }
+        ck_assert_int_eq(REG(REG_STAT) & STAT_REG_MODE_MASK, mode);
+        ck_assert_int_eq(bit_get(REG(REG_STAT), STAT_REG_LYC_EQ_LY_BIT), ly == 5);
+
+        // LCD_STAT is requested on line 5, VBLANK at the start of line 144
+        ck_assert_int_eq(bit_get(g.cpu.IF, LCD_STAT), ly >= 5 || t >= FRAME_TOTAL_CYCLES);
+        ck_assert_int_eq(bit_get(g.cpu.IF, VBLANK), ly >= LCD_HEIGHT || t >= FRAME_TOTAL_CYCLES);
+        ck_assert(lcd->next_cycle > c);
+    }
+
+    // Switched off: back to line 0 until switched on again
+    REG(REG_LCDC) = 0;
+    ck_assert_err_none(lcdc_bus_listener(lcd, REG_LCDC));
+    ck_assert_int_eq(REG(REG_LY), 0);
+    ck_assert(lcd->next_cycle == (uint64_t) -1);
+    ck_assert_err_none(lcdc_cycle(lcd, START + 2 * FRAME_TOTAL_CYCLES));
+    ck_assert(lcd->next_cycle == (uint64_t) -1);
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+/**
+ * @brief Runs a whole frame of the controller of a gameboy, switching it on
+ *        (or the next frame if it is already on)
+ */
+static void run_frame(gameboy_t *gb)
+{
+    const uint64_t start = gb->screen.next_cycle == (uint64_t)-1 ? START : gb->screen.next_cycle;
+    *bus_lookup(NULL, &gb->pages, REG_LCDC) |= LCDC_REG_LCD_STATUS_MASK;
+    for (uint64_t c = start; c < start + FRAME_TOTAL_CYCLES; ++c) {
+        ck_assert_err_none(lcdc_cycle(&gb->screen, c));
+    }
+}
+
+static uint8_t pixel(gameboy_t *gb, size_t x, size_t y)
+{
+    const uint8_t *line = framebuffer_line(&gb->screen.frame, y);
+    ck_assert_ptr_nonnull(line);
+    return line[x];
+}
+
+START_TEST(lcdc_background_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    // Tile 1: colors 1 on the left half, 2 on the right one
+    for (addr_t a = 0; a < TILE_SIZE; a += 2) {
+        REG(TILE_SRC_ADDR_LOW + TILE_SIZE + a) = 0xF0;
+        REG(TILE_SRC_ADDR_LOW + TILE_SIZE + a + 1) = 0x0F;
+    }
+    for (addr_t a = TILE_ADDR_BASE_LOW; a < TILE_ADDR_BASE_HIGH; ++a) {
+        REG(a) = 1;
+    }
+    REG(REG_SCX) = 2;
+    REG(REG_BGP) = 0x1B; // colors reversed
+    REG(REG_LCDC) = LCDC_REG_BG_MASK | LCDC_REG_TILE_SOURCE_MASK;
+    run_frame(&g);
+
+    for (size_t y = 0; y < LCD_HEIGHT; y += 13) {
+        for (size_t x = 0; x < LCD_WIDTH; ++x) {
+            const uint8_t color = ((x + 2) % 8) < 4 ? 1 : 2;
+            ck_assert_int_eq(pixel(&g, x, y), 3 - color);
+        }
+    }
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(lcdc_sprites_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    // Tile 1 is color 1, tile 2 is color 3
+    for (addr_t a = 0; a < TILE_SIZE; ++a) {
+        REG(TILE_SRC_ADDR_LOW + TILE_SIZE + a) = (a % 2) ? 0 : 0xFF;
+        REG(TILE_SRC_ADDR_LOW + 2 * TILE_SIZE + a) = 0xFF;
+    }
+    // Background of color 0 on the left half of the screen, 1 on the other one
+    for (addr_t a = TILE_ADDR_BASE_LOW; a < TILE_ADDR_BASE_HIGH; ++a) {
+        REG(a) = (a % TILE_LINE_SIZE) < VISIBLE_LINE_SIZE / 2 ? 0 : 1;
+    }
+    REG(REG_BGP) = DEFAULT_PALETTE;
+    REG(REG_OBP0) = DEFAULT_PALETTE;
+    REG(REG_OBP1) = 0x00;
+
+    // A sprite in front of the background, one behind it, one with OBP1
+    const data_t oam[][4] = {
+        { 16 + 0, 8 + 76, 2, 0x00 },
+        { 16 + 20, 8 + 76, 2, 0x80 },
+        { 16 + 40, 8 + 100, 2, 0x10 },
+    };
+    for (size_t i = 0; i < sizeof(oam) / sizeof(oam[0]); ++i) {
+        for (size_t j = 0; j < 4; ++j) {
+            REG(0xFE00 + 4 * i + j) = oam[i][j];
+        }
+    }
+    REG(REG_LCDC) = LCDC_REG_BG_MASK | LCDC_REG_OBJ_MASK | LCDC_REG_TILE_SOURCE_MASK;
+    run_frame(&g);
+
+    // In front: pixels 76 to 83 of lines 0 to 7, over both halves
+    for (size_t x = 72; x < 88; ++x) {
+        const uint8_t bg = x < 80 ? 0 : 1;
+        ck_assert_int_eq(pixel(&g, x, 3), x >= 76 && x < 84 ? 3 : bg);
+        // Behind: only over the color 0 of the background
+        ck_assert_int_eq(pixel(&g, x, 23), x >= 76 && x < 80 ? 3 : bg);
+    }
+    // OBP1 maps everything to color 0
+    for (size_t x = 96; x < 112; ++x) {
+        ck_assert_int_eq(pixel(&g, x, 43), x >= 100 && x < 108 ? 0 : 1);
+    }
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(lcdc_tile_cache_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    // Tile 1 in color 1, tile 2 in color 3
+    for (addr_t a = 0; a < TILE_SIZE; a += 2) {
+        REG(TILE_SRC_ADDR_LOW + TILE_SIZE + a) = 0xFF;
+        REG(TILE_SRC_ADDR_LOW + 2 * TILE_SIZE + a) = 0xFF;
+        REG(TILE_SRC_ADDR_LOW + 2 * TILE_SIZE + a + 1) = 0xFF;
+    }
+    for (addr_t a = TILE_ADDR_BASE_LOW; a < TILE_ADDR_BASE_HIGH; ++a) {
+        REG(a) = 1;
+    }
+    REG(TILE_ADDR_BASE_LOW + 1) = 2;
+    REG(REG_BGP) = 0xE4;
+    REG(REG_LCDC) = LCDC_REG_BG_MASK | LCDC_REG_TILE_SOURCE_MASK;
+    run_frame(&g);
+    ck_assert_int_eq(pixel(&g, 0, 0), 1);
+    ck_assert_int_eq(pixel(&g, 8, 0), 3);
+    for (size_t i = 0; i < TILE_COUNT / 64; ++i) {
+        ck_assert_uint_eq(g.screen.tiles_dirty[i], i == 0 ? ~UINT64_C(6) : UINT64_MAX);
+    }
+
+    // the cpu writes mark the tiles...
+    ck_assert_err_none(cpu_write_at_idx(&g.cpu, TILE_SRC_ADDR_LOW + TILE_SIZE + 1, 0xFF));
+    ck_assert_uint_eq(g.screen.tiles_dirty[0] & 6, 2);
+    // ...the others have to be notified
+    REG(TILE_SRC_ADDR_LOW + 2 * TILE_SIZE + 3) = 0x00;
+    ck_assert_err_none(lcdc_bus_listener(&g.screen, TILE_SRC_ADDR_LOW + 2 * TILE_SIZE + 3));
+    ck_assert_uint_eq(g.screen.tiles_dirty[0] & 6, 6);
+    // (not being a tile, a map write marks nothing)
+    ck_assert_err_none(lcdc_bus_listener(&g.screen, TILE_ADDR_BASE_LOW));
+    ck_assert_uint_eq(g.screen.tiles_dirty[0] & 6, 6);
+
+    run_frame(&g);
+    for (size_t x = 0; x < 8; ++x) {
+        ck_assert_int_eq(pixel(&g, x, 0), 3);
+        ck_assert_int_eq(pixel(&g, x + 8, 0), 3);
+        ck_assert_int_eq(pixel(&g, x, 1), 1);
+        ck_assert_int_eq(pixel(&g, x + 8, 1), 1);
+        ck_assert_int_eq(pixel(&g, x + 8, 2), 3);
+    }
+    ck_assert_uint_eq(g.screen.tiles_dirty[0] & 6, 0);
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(lcdc_palettes_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    // Tile 1 in color 1
+    for (addr_t a = 0; a < TILE_SIZE; a += 2) {
+        REG(TILE_SRC_ADDR_LOW + TILE_SIZE + a) = 0xFF;
+    }
+    for (addr_t a = TILE_ADDR_BASE_LOW; a < TILE_ADDR_BASE_HIGH; ++a) {
+        REG(a) = 1;
+    }
+    REG(REG_BGP) = 0xE4;
+    REG(REG_LCDC) = LCDC_REG_BG_MASK | LCDC_REG_TILE_SOURCE_MASK;
+    run_frame(&g);
+    ck_assert_int_eq(pixel(&g, 0, 0), 1);
+
+    // the palettes are updated when written
+    REG(REG_BGP) = 0x1B;
+    REG(REG_OBP0) = 0x39;
+    REG(REG_OBP1) = 0xC6;
+    ck_assert_err_none(lcdc_bus_listener(&g.screen, REG_BGP));
+    ck_assert_err_none(lcdc_bus_listener(&g.screen, REG_OBP0));
+    ck_assert_err_none(lcdc_bus_listener(&g.screen, REG_OBP1));
+    const uint8_t palettes[FRAMEBUFFER_INDICES] = {3, 2, 1, 0, 1, 2, 3, 0, 0, 0, 0, 0, 2, 1, 0, 3};
+    ck_assert_int_eq(memcmp(g.screen.palettes, palettes, sizeof(palettes)), 0);
+
+    run_frame(&g);
+    for (size_t y = 0; y < LCD_HEIGHT; y += 11) {
+        for (size_t x = 0; x < LCD_WIDTH; ++x) {
+            ck_assert_int_eq(pixel(&g, x, y), 2);
+        }
+    }
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(lcdc_dma_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    for (addr_t i = 0; i < 0xA0; ++i) {
+        REG(0xC100 + i) = (data_t) (rand() % 0x100);
+    }
+    REG(REG_DMA) = 0xC1;
+    ck_assert_err_none(lcdc_bus_listener(&g.screen, REG_DMA));
+
+    // One byte per cycle
+    for (addr_t i = 0; i < 0xA0; ++i) {
+        ck_assert_err_none(lcdc_cycle(&g.screen, START + i));
+        ck_assert_int_eq(REG(0xFE00 + i), REG(0xC100 + i));
+    }
+    ck_assert_int_gt(g.screen.DMA_to, 0xFE9F);
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(framebuffer_line_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    framebuffer_t fb;
+    zero_init_var(fb);
+    uint32_t msb[FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS] = { 0 };
+    uint32_t lsb[FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS] = { 0 };
+
+    ck_assert_bad_param(framebuffer_set_line(NULL, 0, msb, lsb));
+    ck_assert_bad_param(framebuffer_set_line(&fb, 0, NULL, lsb));
+    ck_assert_bad_param(framebuffer_set_line(&fb, 0, msb, NULL));
+    ck_assert_bad_param(framebuffer_set_line(&fb, FRAMEBUFFER_HEIGHT, msb, lsb));
+    ck_assert_ptr_null(framebuffer_line(NULL, 0));
+    ck_assert_ptr_null(framebuffer_line(&fb, FRAMEBUFFER_HEIGHT));
+
+    for (size_t i = 0; i < FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS; ++i) {
+        msb[i] = (uint32_t) rand();
+        lsb[i] = (uint32_t) rand();
+    }
+    ck_assert_err_none(framebuffer_set_line(&fb, 7, msb, lsb));
+
+    const uint8_t *line = framebuffer_line(&fb, 7);
+    ck_assert_ptr_nonnull(line);
+    for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x) {
+        const uint8_t color = (uint8_t) (((msb[x / 32] >> (x % 32)) & 1) << 1
+                                         | ((lsb[x / 32] >> (x % 32)) & 1));
+        ck_assert_int_eq(line[x], color);
+        ck_assert_int_eq(framebuffer_line(&fb, 6)[x], 0);
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(framebuffer_indices_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    framebuffer_t fb;
+    zero_init_var(fb);
+    uint32_t planes[FRAMEBUFFER_INDEX_BITS][FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS];
+    const uint32_t *const p[FRAMEBUFFER_INDEX_BITS] = {planes[0], planes[1], planes[2], planes[3]};
+    uint8_t table[FRAMEBUFFER_INDICES];
+    uint32_t msb[FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS];
+    uint32_t lsb[FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS];
+
+    ck_assert_bad_param(framebuffer_set_indices(NULL, 0, p, 1));
+    ck_assert_bad_param(framebuffer_set_indices(&fb, 0, NULL, 1));
+    ck_assert_bad_param(framebuffer_set_indices(&fb, 0, p, FRAMEBUFFER_INDEX_BITS + 1));
+    ck_assert_bad_param(framebuffer_set_indices(&fb, FRAMEBUFFER_HEIGHT, p, 1));
+    ck_assert_bad_param(framebuffer_map_line(NULL, 0, table));
+    ck_assert_bad_param(framebuffer_map_line(&fb, 0, NULL));
+    ck_assert_bad_param(framebuffer_map_line(&fb, FRAMEBUFFER_HEIGHT, table));
+    ck_assert_bad_param(framebuffer_get_line(NULL, 0, msb, lsb));
+    ck_assert_bad_param(framebuffer_get_line(&fb, 0, NULL, lsb));
+    ck_assert_bad_param(framebuffer_get_line(&fb, 0, msb, NULL));
+    ck_assert_bad_param(framebuffer_get_line(&fb, FRAMEBUFFER_HEIGHT, msb, lsb));
+
+    for (size_t k = 0; k < FRAMEBUFFER_INDEX_BITS; ++k) {
+        for (size_t i = 0; i < FRAMEBUFFER_WIDTH / IMAGE_LINE_WORD_BITS; ++i) {
+            planes[k][i] = (uint32_t) rand();
+        }
+    }
+    for (size_t i = 0; i < FRAMEBUFFER_INDICES; ++i) {
+        table[i] = (uint8_t) (rand() % 4);
+    }
+    ck_assert_err_none(framebuffer_set_indices(&fb, 5, p, FRAMEBUFFER_INDEX_BITS));
+    ck_assert_err_none(framebuffer_set_indices(&fb, 6, p, 3));
+    ck_assert_err_none(framebuffer_map_line(&fb, 6, table));
+
+    for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x) {
+        uint8_t index = 0;
+        for (size_t k = 0; k < FRAMEBUFFER_INDEX_BITS; ++k) {
+            index |= (uint8_t) (((planes[k][x / 32] >> (x % 32)) & 1) << k);
+        }
+        ck_assert_int_eq(framebuffer_line(&fb, 5)[x], index);
+        ck_assert_int_eq(framebuffer_line(&fb, 6)[x], table[index & 0x7]);
+    }
+
+    // back to bit planes
+    ck_assert_err_none(framebuffer_set_line(&fb, 7, planes[1], planes[0]));
+    ck_assert_err_none(framebuffer_get_line(&fb, 7, msb, lsb));
+    ck_assert_int_eq(memcmp(msb, planes[1], sizeof(msb)), 0);
+    ck_assert_int_eq(memcmp(lsb, planes[0], sizeof(lsb)), 0);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(framebuffer_map_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    framebuffer_t fb;
+    zero_init_var(fb);
+    uint8_t table[FRAMEBUFFER_INDICES];
+    uint8_t before[FRAMEBUFFER_WIDTH];
+
+    for (size_t i = 0; i < FRAMEBUFFER_INDICES; ++i) {
+        table[i] = (uint8_t) rand();
+    }
+
+    // Every line against the scalar loop, whatever the SIMD path taken,
+    // with the bits above the indices set too
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y) {
+        for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x) {
+            fb.pixels[y][x] = (uint8_t) rand();
+        }
+        memcpy(before, fb.pixels[y], sizeof(before));
+        ck_assert_err_none(framebuffer_map_line(&fb, y, table));
+        for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x) {
+            ck_assert_int_eq(framebuffer_line(&fb, y)[x], table[before[x] & (FRAMEBUFFER_INDICES - 1)]);
+        }
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(framebuffer_blit_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    framebuffer_t fb;
+    for (size_t y = 0; y < FRAMEBUFFER_HEIGHT; ++y) {
+        for (size_t x = 0; x < FRAMEBUFFER_WIDTH; ++x) {
+            fb.pixels[y][x] = (uint8_t) (rand() % 4);
+        }
+    }
+
+    // Some padding after each row, which must stay as it is
+    const size_t pad = 5;
+    const size_t max_stride = 3 * FRAMEBUFFER_WIDTH * FRAMEBUFFER_MAX_SCALE + pad;
+    uint8_t* rgb = malloc(max_stride * FRAMEBUFFER_HEIGHT * FRAMEBUFFER_MAX_SCALE);
+    ck_assert_ptr_nonnull(rgb);
+
+    ck_assert_bad_param(framebuffer_blit_rgb(NULL, rgb, max_stride, 1));
+    ck_assert_bad_param(framebuffer_blit_rgb(&fb, NULL, max_stride, 1));
+    ck_assert_bad_param(framebuffer_blit_rgb(&fb, rgb, max_stride, 0));
+    ck_assert_bad_param(framebuffer_blit_rgb(&fb, rgb, max_stride, FRAMEBUFFER_MAX_SCALE + 1));
+    ck_assert_bad_param(framebuffer_blit_rgb(&fb, rgb, 3 * FRAMEBUFFER_WIDTH * 2 - 1, 2));
+
+    for (size_t scale = 1; scale <= FRAMEBUFFER_MAX_SCALE; ++scale) {
+        const size_t row = 3 * FRAMEBUFFER_WIDTH * scale;
+        const size_t stride = row + pad;
+        memset(rgb, 0x5A, stride * FRAMEBUFFER_HEIGHT * scale);
+        ck_assert_err_none(framebuffer_blit_rgb(&fb, rgb, stride, scale));
+        for (size_t y = 0; y < FRAMEBUFFER_HEIGHT * scale; ++y) {
+            const uint8_t* line = rgb + y * stride;
+            for (size_t x = 0; x < FRAMEBUFFER_WIDTH * scale; ++x) {
+                const uint8_t grey = (uint8_t) (255 - 85 * fb.pixels[y / scale][x / scale]);
+                ck_assert_int_eq(line[3 * x], grey);
+                ck_assert_int_eq(line[3 * x + 1], grey);
+                ck_assert_int_eq(line[3 * x + 2], grey);
+            }
+            for (size_t i = row; i < stride; ++i) {
+                ck_assert_int_eq(line[i], 0x5A);
+            }
+        }
+    }
+    free(rgb);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(lcdc_enable_display_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    ck_assert_bad_param(lcdc_enable_display(NULL));
+
+    INIT;
+    ck_assert_ptr_null(g.screen.display.content);
+    for (addr_t a = TILE_SRC_ADDR_LOW; a < TILE_ADDR_BASE_HIGH; ++a) {
+        REG(a) = (data_t) (rand() % 0x100);
+    }
+    REG(REG_BGP) = DEFAULT_PALETTE;
+    REG(REG_LCDC) = LCDC_REG_BG_MASK;
+    run_frame(&g);
+
+    // The display starts as a copy of the frame buffer, then follows it
+    for (int i = 0; i < 2; ++i) {
+        ck_assert_err_none(lcdc_enable_display(&g.screen));
+        ck_assert_int_eq(g.screen.display.height, LCD_HEIGHT);
+        for (size_t y = 0; y < LCD_HEIGHT; ++y) {
+            for (size_t x = 0; x < LCD_WIDTH; ++x) {
+                uint8_t p = 0;
+                ck_assert_err_none(image_get_pixel(&p, &g.screen.display, x, y));
+                ck_assert_int_eq(p, pixel(&g, x, y));
+            }
+        }
+        REG(REG_SCX) = 3;
+        REG(REG_SCY) = 5;
+        run_frame(&g);
+    }
+
+    gameboy_free(&g);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+
+// ======================================================================
+Suite* lcdc_test_suite()
+{
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+    srand(time(NULL) ^ getpid() ^ pthread_self());
+#pragma GCC diagnostic pop
+
+    Suite* s = suite_create("lcdc.c Tests");
+
+    Add_Case(s, tc1, "LCDC Tests");
+    tcase_add_test(tc1, lcdc_init_err);
+    tcase_add_test(tc1, lcdc_timing_exec);
+    tcase_add_test(tc1, lcdc_background_exec);
+    tcase_add_test(tc1, lcdc_sprites_exec);
+    tcase_add_test(tc1, lcdc_dma_exec);
+    tcase_add_test(tc1, lcdc_tile_cache_exec);
+    tcase_add_test(tc1, lcdc_palettes_exec);
+    tcase_add_test(tc1, framebuffer_line_exec);
+    tcase_add_test(tc1, framebuffer_indices_exec);
+    tcase_add_test(tc1, framebuffer_map_exec);
+    tcase_add_test(tc1, framebuffer_blit_exec);
+    tcase_add_test(tc1, lcdc_enable_display_exec);
+
+    return s;
+}
+
+TEST_SUITE(lcdc_test_suite)
@@ -0,0 +1,307 @@
+/**
+ * @file unit-test-movie.c
+ * @brief Unit test code for the input movies
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tests.h"
+#include "error.h"
+#include "gameboy.h"
+#include "tests-gameboy.h"
+#include "framebuffer.h"
+#include "movie.h"
+#include "rewind.h"
+
+#define ROM "./tests/data/blargg_roms/01-special.gb"
+#define OTHER_ROM "./tests/data/fibonacci.gb"
+
+// A temporary file, removed by the caller
+static void temp_file(char* path, size_t size)
+{
+    snprintf(path, size, "/tmp/unit-test-movie-XXXXXX");
+    const int fd = mkstemp(path);
+    ck_assert_int_ge(fd, 0);
+    close(fd);
+}
+
+static void write_file(const char* path, const void* data, size_t size)
+{
+    FILE* file = fopen(path, "wb");
+    ck_assert_ptr_nonnull(file);
+    ck_assert_int_eq(fwrite(data, 1, size, file), size);
+    fclose(file);
+}
+
+START_TEST(movie_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* gb = new_gameboy(ROM);
+    gameboy_t* other = new_gameboy(OTHER_ROM);
+    char path[64];
+    temp_file(path, sizeof(path));
+    movie_t movie;
+
+    ck_assert_int_eq(movie_create(NULL, gb), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_create(&movie, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_create(&movie, gb), ERR_NONE);
+    ck_assert_int_eq(movie_record(NULL, gb, A_KEY, true), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_record(&movie, NULL, A_KEY, true), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_record(&movie, gb, NB_GB_KEYS, true), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_record(&movie, other, A_KEY, true), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_rewind(NULL, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_save(&movie, gb, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_save(&movie, other, path), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_save(&movie, gb, "/nonexistent/dir/movie.gbm"), ERR_IO);
+    ck_assert_int_eq(movie_play_until(&movie, other, 100), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_play_until(NULL, gb, 100), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_play_until(&movie, NULL, 100), ERR_BAD_PARAMETER);
+    movie_free(&movie);
+    movie_free(NULL);
+
+    ck_assert_int_eq(movie_load(NULL, path), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_load(&movie, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(movie_load(&movie, "/nonexistent/dir/movie.gbm"), ERR_IO);
+
+    // Not a movie, another version, truncated
+    write_file(path, "GBMV", 4);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_IO);
+    uint8_t data[64];
+    memset(data, 0, sizeof(data));
+    memcpy(data, "GBMV", 4);
+    data[4] = MOVIE_VERSION + 1;
+    write_file(path, data, 32);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_IO);
+    data[4] = MOVIE_VERSION;
+    data[16] = 100; // length
+    data[24] = 3;   // events
+    data[32] = 10;
+    data[33] = A_KEY;
+    write_file(path, data, 35);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_IO);
+    write_file(path, data, 32);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_IO);
+
+    // An event after the end, or of no key
+    data[24] = 1;
+    data[32] = 101;
+    write_file(path, data, 34);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_IO);
+    data[32] = 100;
+    data[33] = NB_GB_KEYS;
+    write_file(path, data, 34);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_IO);
+    data[33] = A_KEY | 0x80;
+    write_file(path, data, 34);
+    ck_assert_int_eq(movie_load(&movie, path), ERR_NONE);
+    ck_assert_int_eq(movie.count, 1);
+    ck_assert_int_eq(movie.events[0].cycle, 100);
+    ck_assert_int_eq(movie.events[0].key, A_KEY);
+    ck_assert(movie.events[0].pressed);
+    movie_free(&movie);
+
+    remove(path);
+    delete_gameboy(gb);
+    delete_gameboy(other);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(movie_record_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* gb = new_gameboy(ROM);
+    const size_t size = gameboy_state_size(gb);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(state);
+    movie_t movie;
+    ck_assert_int_eq(movie_create(&movie, gb), ERR_NONE);
+
+    ck_assert_int_eq(gameboy_run_until(gb, 1000), ERR_NONE);
+    ck_assert_int_eq(movie_record(&movie, gb, START_KEY, true), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(gb, state, size), ERR_NONE);
+    ck_assert_int_eq(movie_record(&movie, gb, START_KEY, false), ERR_NONE);
+    ck_assert_int_eq(gameboy_run_until(gb, 5000), ERR_NONE);
+    ck_assert_int_eq(movie_record(&movie, gb, A_KEY, true), ERR_NONE);
+    ck_assert_int_eq(movie.count, 3);
+    ck_assert_int_eq(movie.length, gb->cycles);
+
+    // Going back drops the events after the state restored
+    ck_assert_int_eq(gameboy_load_state(gb, state, size), ERR_NONE);
+    ck_assert_int_eq(gameboy_run_until(gb, 3000), ERR_NONE);
+    ck_assert_int_eq(movie_record(&movie, gb, B_KEY, true), ERR_NONE);
+    ck_assert_int_eq(movie.count, 3);
+    ck_assert_int_eq(movie.events[1].key, START_KEY);
+    ck_assert_int_eq(movie.events[2].key, B_KEY);
+    ck_assert_int_eq(movie.events[2].cycle, gb->cycles);
+
+    free(state);
+    movie_free(&movie);
+    delete_gameboy(gb);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(movie_play_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* recorded = new_gameboy(ROM);
+    gameboy_t* played = new_gameboy(ROM);
+    const size_t size = gameboy_state_size(recorded);
+    uint8_t* expected = malloc(size);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(expected);
+    ck_assert_ptr_nonnull(state);
+    char path[64];
+    temp_file(path, sizeof(path));
+
+    // Recorded as gbsimulator does: runs of uneven lengths (as the time
+    // between two images), events between them
+    movie_t movie;
+    ck_assert_int_eq(movie_create(&movie, recorded), ERR_NONE);
+    uint64_t cycle = 0;
+    for (size_t i = 0; i < 200; ++i) {
+        cycle += 15000 + (i * 7919) % 5000;
+        ck_assert_int_eq(gameboy_run_until(recorded, cycle), ERR_NONE);
+        if (i % 3 == 0) {
+            const gb_key_t key = (gb_key_t) (i % NB_GB_KEYS);
+            const bool pressed = i % 2 == 0;
+            ck_assert_int_eq(movie_record(&movie, recorded, key, pressed), ERR_NONE);
+            ck_assert_int_eq(pressed ? joypad_key_pressed(&recorded->pad, key)
+                             : joypad_key_released(&recorded->pad, key), ERR_NONE);
+        }
+    }
+    ck_assert_int_eq(gameboy_save_state(recorded, expected, size), ERR_NONE);
+    ck_assert_int_eq(movie_save(&movie, recorded, path), ERR_NONE);
+    const size_t count = movie.count;
+    movie_free(&movie);
+
+    // Played at once: same state, same frame
+    ck_assert_int_eq(movie_load(&movie, path), ERR_NONE);
+    ck_assert_int_eq(movie.count, count);
+    ck_assert_int_eq(movie.length, recorded->cycles);
+    ck_assert_int_eq(movie_play_until(&movie, played, movie.length), ERR_NONE);
+    ck_assert_int_eq(movie.next, count);
+    ck_assert_int_eq(gameboy_save_state(played, state, size), ERR_NONE);
+    ck_assert_int_eq(memcmp(state, expected, size), 0);
+    ck_assert(framebuffer_hash(&played->screen.frame) == framebuffer_hash(&recorded->screen.frame));
+    movie_free(&movie);
+
+    remove(path);
+    free(expected);
+    free(state);
+    delete_gameboy(recorded);
+    delete_gameboy(played);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(movie_rewind_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* recorded = new_gameboy(ROM);
+    gameboy_t* played = new_gameboy(ROM);
+    const size_t size = gameboy_state_size(recorded);
+    uint8_t* expected = malloc(size);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(expected);
+    ck_assert_ptr_nonnull(state);
+    char path[64];
+    temp_file(path, sizeof(path));
+    rewind_t rw;
+    ck_assert_int_eq(rewind_create(&rw, recorded, 16 * size, 32, 4), ERR_NONE);
+
+    // Recorded as gbsimulator does: a state per frame, events between them
+    movie_t movie;
+    ck_assert_int_eq(movie_create(&movie, recorded), ERR_NONE);
+    uint64_t cycle = 0;
+    for (size_t i = 0; i < 20; ++i) {
+        cycle += 17556;
+        ck_assert_int_eq(gameboy_run_until(recorded, cycle), ERR_NONE);
+        ck_assert_int_eq(rewind_push(&rw, recorded), ERR_NONE);
+        // Every key pressed, then released, then pressed again
+        const gb_key_t key = (gb_key_t) (i % NB_GB_KEYS);
+        const bool pressed = (i / NB_GB_KEYS) % 2 == 0;
+        ck_assert_int_eq(movie_record(&movie, recorded, key, pressed), ERR_NONE);
+        ck_assert_int_eq(pressed ? joypad_key_pressed(&recorded->pad, key)
+                         : joypad_key_released(&recorded->pad, key), ERR_NONE);
+    }
+    const size_t count = movie.count;
+
+    // Back 10 frames: the events after the state restored are dropped
+    ck_assert_int_eq(rewind_back(&rw, recorded, 10), ERR_NONE);
+    ck_assert_uint_lt(recorded->cycles, cycle);
+    ck_assert_int_eq(movie_rewind(&movie, recorded->cycles), ERR_NONE);
+    ck_assert_uint_lt(movie.count, count);
+    ck_assert_uint_lt(movie.events[movie.count - 1].cycle, recorded->cycles);
+
+    // and are not played anymore when the run goes past them without input
+    ck_assert_int_eq(gameboy_run_until(recorded, cycle + 10 * 17556), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(recorded, expected, size), ERR_NONE);
+    ck_assert_int_eq(movie_save(&movie, recorded, path), ERR_NONE);
+    movie_free(&movie);
+
+    ck_assert_int_eq(movie_load(&movie, path), ERR_NONE);
+    ck_assert_int_eq(movie_play_until(&movie, played, movie.length), ERR_NONE);
+    ck_assert_int_eq(gameboy_save_state(played, state, size), ERR_NONE);
+    ck_assert_int_eq(memcmp(state, expected, size), 0);
+    ck_assert(framebuffer_hash(&played->screen.frame) == framebuffer_hash(&recorded->screen.frame));
+    movie_free(&movie);
+
+    remove(path);
+    rewind_free(&rw);
+    free(expected);
+    free(state);
+    delete_gameboy(recorded);
+    delete_gameboy(played);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+Suite* movie_test_suite()
+{
+    Suite* s = suite_create("movie.c Tests");
+
+    Add_Case(s, tc1, "movie tests");
+
+    tcase_add_test(tc1, movie_err);
+    tcase_add_test(tc1, movie_record_exec);
+    tcase_add_test(tc1, movie_play_exec);
+    tcase_add_test(tc1, movie_rewind_exec);
+
+    return s;
+}
+
+TEST_SUITE(movie_test_suite)
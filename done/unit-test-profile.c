@@ -0,0 +1,297 @@
+/**
+ * @file unit-test-profile.c
+ * @brief Unit test code for the execution profile of the CPU
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tests.h"
+#include "error.h"
+#include "gameboy.h"
+#include "tests-gameboy.h"
+#include "profile.h"
+
+#define ROM "./tests/data/blargg_roms/01-special.gb"
+
+// Writes the report or the collapsed stacks of a profile into a string, freed by the caller
+static char* write_to_string(const profile_t* profile, int collapsed)
+{
+    char* text = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&text, &size);
+    ck_assert_ptr_nonnull(out);
+    ck_assert_err_none(collapsed ? profile_write_collapsed(profile, out) : profile_write_report(profile, out, 3));
+    fclose(out);
+    return text;
+}
+
+static const profile_pc_t* find_pc(const profile_t* profile, uint16_t bank, addr_t pc)
+{
+    const uint32_t key = ((uint32_t) bank << 16) | pc;
+    for (size_t i = 0; i < profile->pcs_capacity; ++i) {
+        if (profile->pcs[i].key == key) {
+            return &profile->pcs[i];
+        }
+    }
+    return NULL;
+}
+
+START_TEST(profile_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    profile_t profile;
+    ck_assert_bad_param(profile_create(NULL));
+    ck_assert_err_none(profile_create(&profile));
+
+    ck_assert_bad_param(profile_instr(NULL, 0, 0x100, 0x00, 4));
+    ck_assert_bad_param(profile_instr(&profile, 0, 0x100, 2 * PROFILE_NB_OPCODES, 4));
+    ck_assert_bad_param(profile_call(NULL, 0, 0x200, 0xDFFE));
+    ck_assert_bad_param(profile_interrupt(NULL, 0x40, 0xDFFE, 6));
+    profile_return(NULL, 0xDFFE);
+    ck_assert_bad_param(profile_write_report(NULL, stdout, 0));
+    ck_assert_bad_param(profile_write_report(&profile, NULL, 0));
+    ck_assert_bad_param(profile_write_collapsed(NULL, stdout));
+    ck_assert_bad_param(profile_write_collapsed(&profile, NULL));
+    ck_assert_int_eq(profile.instructions, 0);
+
+    profile_free(&profile);
+    profile_free(NULL);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(profile_count_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    profile_t profile;
+    ck_assert_err_none(profile_create(&profile));
+
+    // More (bank, PC) than the table first holds
+    for (uint16_t bank = 0; bank < 4; ++bank) {
+        for (addr_t pc = 0x4000; pc < 0x5000; ++pc) {
+            ck_assert_err_none(profile_instr(&profile, bank, pc, 0x00, 4));
+        }
+    }
+    ck_assert_err_none(profile_instr(&profile, 1, 0x4321, PROFILE_CB | 0x7C, 8));
+    ck_assert_err_none(profile_instr(&profile, 1, 0x4321, PROFILE_CB | 0x7C, 8));
+    ck_assert_err_none(profile_instr(&profile, 2, 0x4321, 0xC3, 16));
+
+    ck_assert_int_eq(profile.instructions, 4 * 0x1000 + 3);
+    ck_assert_int_eq(profile.cycles, 4 * 4 * 0x1000 + 32);
+    ck_assert_int_eq(profile.nb_pcs, 4 * 0x1000);
+    ck_assert_int_gt(profile.pcs_capacity, 2 * profile.nb_pcs);
+    ck_assert_int_eq(profile.opcodes[0x00].count, 4 * 0x1000);
+    ck_assert_int_eq(profile.opcodes[PROFILE_CB | 0x7C].count, 2);
+    ck_assert_int_eq(profile.opcodes[PROFILE_CB | 0x7C].cycles, 16);
+    ck_assert_int_eq(profile.opcodes[0xC3].cycles, 16);
+
+    const profile_pc_t* pc = find_pc(&profile, 1, 0x4321);
+    ck_assert_ptr_nonnull(pc);
+    ck_assert_int_eq(pc->opcode, PROFILE_CB | 0x7C);
+    ck_assert_int_eq(pc->counter.count, 3);
+    ck_assert_int_eq(pc->counter.cycles, 20);
+    pc = find_pc(&profile, 3, 0x4FFF);
+    ck_assert_ptr_nonnull(pc);
+    ck_assert_int_eq(pc->counter.count, 1);
+    ck_assert_ptr_null(find_pc(&profile, 4, 0x4000));
+
+    // Sorted by cycles, the top 3 (bank, PC) only
+    char* report = write_to_string(&profile, 0);
+    ck_assert_ptr_nonnull(strstr(report, "instructions 16387 cycles 65568\n"));
+    ck_assert_ptr_nonnull(strstr(report, "== 3 opcodes, by cycles"));
+    ck_assert_ptr_nonnull(strstr(report, "== 3 of 16384 (bank, PC), by cycles"));
+    const char* const top = strstr(report, "001:4321 CB 7C ");
+    const char* const second = strstr(report, "002:4321 C3    ");
+    ck_assert_ptr_nonnull(top);
+    ck_assert_ptr_nonnull(second);
+    ck_assert(top < second);
+    ck_assert_ptr_null(strstr(report, "000:4FFF"));
+    free(report);
+
+    profile_free(&profile);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(profile_stack_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    profile_t profile;
+    ck_assert_err_none(profile_create(&profile));
+
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0100, 0xCD, 24));
+    ck_assert_err_none(profile_call(&profile, 0, 0x0200, 0xDFFE));
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0200, 0x00, 4));
+
+    // An interrupt, in the function, and its return
+    ck_assert_err_none(profile_interrupt(&profile, 0x40, 0xDFFC, 6));
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0040, 0xD9, 16));
+    profile_return(&profile, 0xDFFC);
+    ck_assert_int_eq(profile.depth, 1);
+
+    // Two calls deeper, then SP reset: back outside of any call
+    ck_assert_err_none(profile_call(&profile, 1, 0x4000, 0xDFFC));
+    ck_assert_err_none(profile_instr(&profile, 1, 0x4000, 0xCD, 24));
+    ck_assert_err_none(profile_call(&profile, 1, 0x5000, 0xDFFA));
+    ck_assert_err_none(profile_instr(&profile, 1, 0x5000, 0x00, 4));
+    profile_return(&profile, 0xDFFE);
+    ck_assert_int_eq(profile.depth, 0);
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0103, 0x00, 4));
+
+    // A return at the top, and one of an address pushed by PUSH, pop nothing
+    profile_return(&profile, 0xDFF0);
+    ck_assert_int_eq(profile.depth, 0);
+    ck_assert_err_none(profile_call(&profile, 0, 0x0300, 0xDFFE));
+    profile_return(&profile, 0xDFFC);
+    ck_assert_int_eq(profile.depth, 1);
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0300, 0xC9, 16));
+    profile_return(&profile, 0xDFFE);
+
+    // Same stack, same node
+    const size_t nb_nodes = profile.nb_nodes;
+    ck_assert_err_none(profile_call(&profile, 0, 0x0200, 0xDFFE));
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0200, 0x00, 4));
+    profile_return(&profile, 0xDFFE);
+    ck_assert_int_eq(profile.nb_nodes, nb_nodes);
+
+    char* collapsed = write_to_string(&profile, 1);
+    ck_assert_str_eq(collapsed,
+                     "root 28\n"
+                     "root;000:0200 8\n"
+                     "root;000:0200;int_vblank 22\n"
+                     "root;000:0200;001:4000 24\n"
+                     "root;000:0200;001:4000;001:5000 4\n"
+                     "root;000:0300 16\n");
+    free(collapsed);
+
+    // Calls deeper than kept are counted in the deepest frame
+    for (uint16_t i = 0; i < PROFILE_MAX_DEPTH + 10; ++i) {
+        ck_assert_err_none(profile_call(&profile, 0, 0x0400, (uint16_t) (0xDFFE - 2 * i)));
+    }
+    ck_assert_int_eq(profile.depth, PROFILE_MAX_DEPTH);
+    ck_assert_err_none(profile_instr(&profile, 0, 0x0400, 0x00, 4));
+    ck_assert_int_eq(profile.nodes[profile.stack[PROFILE_MAX_DEPTH - 1].node].cycles, 4);
+    profile_return(&profile, 0xDFFE);
+    ck_assert_int_eq(profile.depth, 0);
+
+    profile_free(&profile);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+#ifdef CPU_PROFILE
+START_TEST(profile_gameboy_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* profiled = new_gameboy(ROM);
+    gameboy_t* plain = new_gameboy(ROM);
+    profile_t profile;
+    ck_assert_err_none(profile_create(&profile));
+    ck_assert_bad_param(cpu_use_profile(NULL, &profile));
+    ck_assert_err_none(cpu_use_profile(&profiled->cpu, &profile));
+
+    const uint64_t cycles = 2 * GB_CYCLES_PER_S;
+    ck_assert_err_none(gameboy_run_until(profiled, cycles));
+    ck_assert_err_none(gameboy_run_until(plain, cycles));
+
+    // Profiled, the emulation is the same
+    const size_t size = gameboy_state_size(plain);
+    uint8_t* expected = malloc(size);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(expected);
+    ck_assert_ptr_nonnull(state);
+    memset(expected, 0x00, size);
+    memset(state, 0xFF, size);
+    ck_assert_err_none(gameboy_save_state(plain, expected, size));
+    ck_assert_err_none(gameboy_save_state(profiled, state, size));
+    ck_assert_int_eq(memcmp(state, expected, size), 0);
+
+    // Every cycle counted once per table, in calls and interrupts
+    ck_assert_int_gt(profile.instructions, 0);
+    ck_assert_int_le(profile.cycles, profiled->cycles + profiled->cpu.idle_time);
+    uint64_t instructions = 0, by_opcode = 0, by_pc = 0, by_stack = 0;
+    for (size_t i = 0; i < 2 * PROFILE_NB_OPCODES; ++i) {
+        instructions += profile.opcodes[i].count;
+        by_opcode += profile.opcodes[i].cycles;
+    }
+    for (size_t i = 0; i < profile.pcs_capacity; ++i) {
+        if (profile.pcs[i].key != PROFILE_FREE) {
+            by_pc += profile.pcs[i].counter.cycles;
+        }
+    }
+    for (size_t i = 0; i < profile.nb_nodes; ++i) {
+        by_stack += profile.nodes[i].cycles;
+    }
+    ck_assert_int_eq(instructions, profile.instructions);
+    ck_assert_int_eq(by_pc, by_opcode);
+    ck_assert_int_eq(by_stack, profile.cycles);
+    ck_assert_int_le(by_opcode, profile.cycles);
+    ck_assert_int_gt(profile.nb_nodes, 1);
+
+    // The profile is not part of the state, nor of a copy
+    ck_assert_err_none(gameboy_load_state(profiled, expected, size));
+    ck_assert_ptr_eq(profiled->cpu.profile, &profile);
+    gameboy_t* copy = aligned_alloc(_Alignof(gameboy_t), sizeof(gameboy_t));
+    ck_assert_ptr_nonnull(copy);
+    ck_assert_err_none(gameboy_clone(copy, profiled));
+    ck_assert_ptr_null(copy->cpu.profile);
+
+    free(expected);
+    free(state);
+    delete_gameboy(copy);
+    delete_gameboy(profiled);
+    delete_gameboy(plain);
+    profile_free(&profile);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+#endif
+
+Suite* profile_test_suite()
+{
+    Suite* s = suite_create("profile.c Tests");
+
+    Add_Case(s, tc1, "profile tests");
+
+    tcase_add_test(tc1, profile_err);
+    tcase_add_test(tc1, profile_count_exec);
+    tcase_add_test(tc1, profile_stack_exec);
+#ifdef CPU_PROFILE
+    tcase_add_test(tc1, profile_gameboy_exec);
+#endif
+
+    return s;
+}
+
+TEST_SUITE(profile_test_suite)
@@ -0,0 +1,163 @@
+/**
+ * @file unit-test-rewind.c
+ * @brief Unit test code for the rewind history of a gameboy
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+#include <stdlib.h>
+#include <check.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "tests.h"
+#include "error.h"
+#include "gameboy.h"
+#include "tests-gameboy.h"
+#include "rewind.h"
+
+#define ROM "./tests/data/blargg_roms/01-special.gb"
+#define FRAME_CYCLES 17556
+#define NB_FRAMES 200
+
+START_TEST(rewind_create_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* gb = new_gameboy(ROM);
+    const size_t size = gameboy_state_size(gb);
+    rewind_t rw;
+
+    ck_assert_int_eq(rewind_create(NULL, gb, 4 * size, 16, 4), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_create(&rw, NULL, 4 * size, 16, 4), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_create(&rw, gb, size, 16, 4), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_create(&rw, gb, 4 * size, 1, 4), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_create(&rw, gb, 4 * size, 16, 0), ERR_BAD_PARAMETER);
+    rewind_free(&rw);
+    rewind_free(NULL);
+
+    // The ring buffer cannot be allocated: nothing is left allocated
+    ck_assert_int_eq(rewind_create(&rw, gb, SIZE_MAX, 16, 4), ERR_MEM);
+    ck_assert_ptr_null(rw.ring);
+    ck_assert_ptr_null(rw.records);
+    ck_assert_ptr_null(rw.current);
+    ck_assert_ptr_null(rw.work);
+
+    ck_assert_int_eq(rewind_create(&rw, gb, 4 * size, 16, 4), ERR_NONE);
+    ck_assert_int_eq(rewind_push(NULL, gb), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_push(&rw, NULL), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_seek(&rw, gb, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_back(&rw, gb, 1), ERR_BAD_PARAMETER);
+
+    ck_assert_int_eq(rewind_push(&rw, gb), ERR_NONE);
+    ck_assert_int_eq(rw.count, 1);
+    ck_assert(rw.records[rw.first].keyframe);
+    ck_assert_int_eq(rewind_seek(NULL, gb, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_seek(&rw, NULL, 0), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_seek(&rw, gb, 1), ERR_BAD_PARAMETER);
+    ck_assert_int_eq(rewind_seek(&rw, gb, 0), ERR_NONE);
+
+    rewind_free(&rw);
+    rewind_free(&rw);
+    ck_assert_int_eq(rewind_push(&rw, gb), ERR_BAD_PARAMETER);
+    delete_gameboy(gb);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+START_TEST(rewind_seek_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    gameboy_t* gb = new_gameboy(ROM);
+    const size_t size = gameboy_state_size(gb);
+    uint8_t* states = malloc(NB_FRAMES * size);
+    uint8_t* state = malloc(size);
+    ck_assert_ptr_nonnull(states);
+    ck_assert_ptr_nonnull(state);
+
+    // Dropping the oldest records, as there are too many of them, or as
+    // they do not fit in the ring buffer
+    rewind_t histories[2];
+    ck_assert_int_eq(rewind_create(&histories[0], gb, 8 * size, 64, 16), ERR_NONE);
+    ck_assert_int_eq(rewind_create(&histories[1], gb, 4 * size, 1000, 4), ERR_NONE);
+    for (size_t f = 0; f < NB_FRAMES; ++f) {
+        ck_assert_int_eq(gameboy_run_until(gb, (f + 1) * FRAME_CYCLES), ERR_NONE);
+        ck_assert_int_eq(gameboy_save_state(gb, states + f * size, size), ERR_NONE);
+        for (size_t h = 0; h < 2; ++h) {
+            ck_assert_int_eq(rewind_push(&histories[h], gb), ERR_NONE);
+            ck_assert(histories[h].records[histories[h].first].keyframe);
+        }
+        ck_assert_int_le(histories[0].count, 64);
+    }
+    ck_assert_int_lt(histories[1].count, NB_FRAMES);
+
+    for (size_t h = 0; h < 2; ++h) {
+        rewind_t* rw = &histories[h];
+        ck_assert_int_gt(rw->count, 16);
+        ck_assert_int_eq(rw->cursor, rw->count);
+
+        // Any record, from any other one: backwards, forwards, from a keyframe
+        const size_t oldest = NB_FRAMES - rw->count;
+        const size_t order[] = { rw->count - 1, rw->count - 2, 0, rw->count / 2, rw->count / 2 + 1, 1,
+                                 rw->count - 1, 3, rw->count / 3, rw->count / 3 - 5, rw->count - 1
+                               };
+        for (size_t k = 0; k < sizeof(order) / sizeof(order[0]); ++k) {
+            const size_t i = order[k];
+            ck_assert_int_eq(rewind_seek(rw, gb, i), ERR_NONE);
+            ck_assert_int_eq(gb->cycles, (oldest + i + 1) * FRAME_CYCLES);
+            ck_assert_int_eq(gameboy_save_state(gb, state, size), ERR_NONE);
+            ck_assert_int_eq(memcmp(state, states + (oldest + i) * size, size), 0);
+        }
+
+        // Back then ahead again: the records after the current one are dropped
+        const size_t count = rw->count;
+        ck_assert_int_eq(rewind_back(rw, gb, 10), ERR_NONE);
+        ck_assert_int_eq(rw->cursor, count - 10);
+        ck_assert_int_eq(gameboy_run_until(gb, gb->cycles + FRAME_CYCLES), ERR_NONE);
+        ck_assert_int_eq(rewind_push(rw, gb), ERR_NONE);
+        ck_assert_int_eq(rw->count, count - 9);
+        ck_assert_int_eq(rewind_back(rw, gb, 1), ERR_NONE);
+        ck_assert_int_eq(gameboy_save_state(gb, state, size), ERR_NONE);
+        ck_assert_int_eq(memcmp(state, states + (NB_FRAMES - 11) * size, size), 0);
+
+        // Back further than the oldest record
+        ck_assert_int_eq(rewind_back(rw, gb, 10 * NB_FRAMES), ERR_NONE);
+        ck_assert_int_eq(rw->cursor, 1);
+        ck_assert_int_eq(gameboy_save_state(gb, state, size), ERR_NONE);
+        ck_assert_int_eq(memcmp(state, states + oldest * size, size), 0);
+
+        rewind_free(rw);
+    }
+
+    free(states);
+    free(state);
+    delete_gameboy(gb);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+}
+END_TEST
+
+Suite* rewind_test_suite()
+{
+    Suite* s = suite_create("rewind.c Tests");
+
+    Add_Case(s, tc1, "rewind tests");
+
+    tcase_add_test(tc1, rewind_create_err);
+    tcase_add_test(tc1, rewind_seek_exec);
+
+    return s;
+}
+
+TEST_SUITE(rewind_test_suite)
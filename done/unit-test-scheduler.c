@@ -0,0 +1,161 @@
+/**
+ * @file unit-test-scheduler.c
+ * @brief Unit test code for scheduler and related functions
+ *
+ * @author Joseph Abboud & Zad Abi Fadel
+ * @date 2020
+ */
+
+// for thread-safe randomization
+#include <time.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <check.h>
+#include <inttypes.h>
+
+#include "util.h"
+#include "tests.h"
+#include "scheduler.h"
+
+#define INIT \
+    scheduler_t sched; \
+    zero_init_var(sched)
+
+START_TEST(scheduler_init_err)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    ck_assert_bad_param(scheduler_init(NULL));
+    ck_assert_bad_param(scheduler_set(NULL, SCHED_CPU, 0));
+    ck_assert_err_none(scheduler_init(&sched));
+    ck_assert_bad_param(scheduler_set(&sched, SCHED_NB_EVENTS, 0));
+    ck_assert(scheduler_next(NULL) == SCHED_NEVER);
+    ck_assert(scheduler_get(NULL, SCHED_CPU) == SCHED_NEVER);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+
+}
+END_TEST
+
+START_TEST(scheduler_init_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    ck_assert_err_none(scheduler_init(&sched));
+    ck_assert(scheduler_next(&sched) == SCHED_NEVER);
+
+    for (sched_event_t e = SCHED_CPU; e < SCHED_NB_EVENTS; ++e) {
+        ck_assert(scheduler_get(&sched, e) == SCHED_NEVER);
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+
+}
+END_TEST
+
+START_TEST(scheduler_set_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    ck_assert_err_none(scheduler_init(&sched));
+
+    ck_assert_err_none(scheduler_set(&sched, SCHED_TIMER, 100));
+    ck_assert_err_none(scheduler_set(&sched, SCHED_LCDC, 20));
+    ck_assert_err_none(scheduler_set(&sched, SCHED_CPU, 55));
+    ck_assert(scheduler_next(&sched) == 20);
+    ck_assert(scheduler_get(&sched, SCHED_TIMER) == 100);
+    ck_assert(scheduler_get(&sched, SCHED_CPU) == 55);
+
+    // moving the earliest event later
+    ck_assert_err_none(scheduler_set(&sched, SCHED_LCDC, 200));
+    ck_assert(scheduler_next(&sched) == 55);
+
+    // cancelling events
+    ck_assert_err_none(scheduler_set(&sched, SCHED_CPU, SCHED_NEVER));
+    ck_assert(scheduler_next(&sched) == 100);
+    ck_assert_err_none(scheduler_set(&sched, SCHED_TIMER, SCHED_NEVER));
+    ck_assert_err_none(scheduler_set(&sched, SCHED_LCDC, SCHED_NEVER));
+    ck_assert(scheduler_next(&sched) == SCHED_NEVER);
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+
+}
+END_TEST
+
+#define RANDOM_ROUNDS 1000
+
+START_TEST(scheduler_set_random)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    INIT;
+    ck_assert_err_none(scheduler_init(&sched));
+
+    uint64_t expected[SCHED_NB_EVENTS];
+    for (size_t i = 0; i < SCHED_NB_EVENTS; ++i) {
+        expected[i] = SCHED_NEVER;
+    }
+
+    for (size_t round = 0; round < RANDOM_ROUNDS; ++round) {
+        sched_event_t e = (sched_event_t) (rand() % SCHED_NB_EVENTS);
+        expected[e] = (uint64_t) (rand() % 1000);
+        ck_assert_err_none(scheduler_set(&sched, e, expected[e]));
+
+        uint64_t min = SCHED_NEVER;
+        for (size_t i = 0; i < SCHED_NB_EVENTS; ++i) {
+            ck_assert(scheduler_get(&sched, (sched_event_t) i) == expected[i]);
+            if (expected[i] < min) min = expected[i];
+        }
+        ck_assert(scheduler_next(&sched) == min);
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+
+}
+END_TEST
+
+
+// ======================================================================
+Suite* scheduler_test_suite()
+{
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#pragma GCC diagnostic ignored "-Wconversion"
+    srand(time(NULL) ^ getpid() ^ pthread_self());
+#pragma GCC diagnostic pop
+
+    Suite* s = suite_create("scheduler.c Tests");
+
+    Add_Case(s, tc1, "Scheduler Tests");
+    tcase_add_test(tc1, scheduler_init_err);
+    tcase_add_test(tc1, scheduler_init_exec);
+    tcase_add_test(tc1, scheduler_set_exec);
+    tcase_add_test(tc1, scheduler_set_random);
+
+    return s;
+}
+
+TEST_SUITE(scheduler_test_suite)
@@ -174,6 +174,128 @@ START_TEST(timer_listener_exec)
 }
 END_TEST
 
+#define SKIP_ROUNDS 200
+
+START_TEST(timer_skip_cycles_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    for (data_t tac = 0; tac < 8; ++tac) {
+        INIT;
+        ck_assert_err_none(timer_init(&timer, &cpu));
+        INIT_BUS;
+        *bus[REG_TAC] = tac;
+
+        gbtimer_t ref_timer = timer;
+        cpu_t ref_cpu = cpu;
+        bus_t ref_bus;
+        zero_init_var(ref_bus);
+        data_t ref_regs[TIMER_SIZE] = {0, 0, 0, tac};
+        for (addr_t a = TIMER_START; a <= TIMER_END; ++a) {
+            ref_bus[a] = &ref_regs[a - TIMER_START];
+        }
+        ref_cpu.bus = &ref_bus;
+        ref_timer.cpu = &ref_cpu;
+
+        uint64_t now = 0;
+        for (size_t round = 0; round < SKIP_ROUNDS; ++round) {
+            const uint64_t next = timer_next_event(&timer, now);
+            if (bit_get(tac, 2) == 0) {
+                ck_assert(next == SCHED_NEVER);
+                break;
+            }
+            ck_assert(next >= now);
+
+            // skipping until the event must be the same as cycling
+            ck_assert_err_none(timer_skip_cycles(&timer, next - now));
+            for (uint64_t c = now; c < next; ++c) {
+                ck_assert_err_none(timer_cycle(&ref_timer));
+            }
+            ck_assert_int_eq(timer.counter, ref_timer.counter);
+            ck_assert_int_eq(*bus[REG_DIV], *ref_bus[REG_DIV]);
+            ck_assert_int_eq(*bus[REG_TIMA], *ref_bus[REG_TIMA]);
+
+            // the event itself increments TIMA
+            const data_t tima = *bus[REG_TIMA];
+            ck_assert_err_none(timer_cycle(&timer));
+            ck_assert_err_none(timer_cycle(&ref_timer));
+            ck_assert_int_eq(*bus[REG_TIMA], (data_t)(tima + 1));
+            now = next + 1;
+        }
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+
+}
+END_TEST
+
+#define SYNC_ROUNDS 2000
+
+START_TEST(timer_sync_exec)
+{
+// ------------------------------------------------------------
+#ifdef WITH_PRINT
+    printf("=== %s:\n", __func__);
+#endif
+    for (data_t tac = 0; tac < 8; ++tac) {
+        INIT;
+        ck_assert_err_none(timer_init(&timer, &cpu));
+        INIT_BUS;
+        *bus[REG_TAC] = tac;
+        *bus[REG_TMA] = (data_t)(0xF0 + tac);
+
+        gbtimer_t ref_timer = timer;
+        cpu_t ref_cpu = cpu;
+        bus_t ref_bus;
+        zero_init_var(ref_bus);
+        data_t ref_regs[TIMER_SIZE] = {0, 0, (data_t)(0xF0 + tac), tac};
+        for (addr_t a = TIMER_START; a <= TIMER_END; ++a) {
+            ref_bus[a] = &ref_regs[a - TIMER_START];
+        }
+        ref_cpu.bus = &ref_bus;
+        ref_timer.cpu = &ref_cpu;
+
+        for (size_t round = 0; round < SYNC_ROUNDS; ++round) {
+            const uint64_t overflow = timer_next_overflow(&timer);
+            if (bit_get(tac, 2) == 0) {
+                ck_assert(overflow == SCHED_NEVER);
+            } else {
+                ck_assert(overflow > timer.cycle);
+            }
+
+            // synchronizing at once must be the same as cycling
+            const uint64_t cycle = timer.cycle + (uint64_t)(rand() % 300);
+            ck_assert_err_none(timer_sync(&timer, cycle));
+            for (uint64_t c = ref_timer.cycle; c < cycle; ++c) {
+                ck_assert_err_none(timer_cycle(&ref_timer));
+                // the interrupt is requested during the predicted cycle
+                ck_assert_int_eq(ref_cpu.IF != 0, c + 1 >= overflow);
+            }
+            ck_assert(timer.cycle == cycle);
+            ck_assert_int_eq(timer.counter, ref_timer.counter);
+            ck_assert_int_eq(*bus[REG_DIV], *ref_bus[REG_DIV]);
+            ck_assert_int_eq(*bus[REG_TIMA], *ref_bus[REG_TIMA]);
+            ck_assert_int_eq(cpu.IF, ref_cpu.IF);
+            cpu.IF = 0;
+            ref_cpu.IF = 0;
+
+            // the past is not run again
+            ck_assert_err_none(timer_sync(&timer, cycle / 2));
+            ck_assert(timer.cycle == cycle);
+        }
+    }
+
+#ifdef WITH_PRINT
+    printf("=== END of %s\n", __func__);
+#endif
+
+}
+END_TEST
+
 
 // ======================================================================
 Suite* timer_test_suite()
@@ -195,6 +317,8 @@ Suite* timer_test_suite()
     tcase_add_test(tc1, timer_cycle_exec);
     tcase_add_test(tc1, timer_listener_err);
     tcase_add_test(tc1, timer_listener_exec);
+    tcase_add_test(tc1, timer_skip_cycles_exec);
+    tcase_add_test(tc1, timer_sync_exec);
 
     return s;
 }